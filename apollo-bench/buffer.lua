@@ -0,0 +1,48 @@
+-- Run time of serializing records with a table of fragments and
+-- 'table.concat' against a reused 'buffer', with plain and formatted
+-- writes.
+-- Usage: lua buffer.lua [n]
+
+local buffer = require "buffer"
+
+local N = tonumber(arg and arg[1]) or 200000
+local clock = os.clock
+
+local rec = { id = 12345, name = "widget", price = 9.75, tags = { "a", "bb", "ccc" } }
+local buf = buffer.new()
+local lines = {}
+
+local cases = {
+    { "concat", function()
+        local t = { "{id=", rec.id, ",name=", rec.name, ",price=", rec.price, ",tags={" }
+        for i = 1, #rec.tags do t[#t + 1] = rec.tags[i]; t[#t + 1] = "," end
+        t[#t + 1] = "}}"
+        return table.concat(t)
+    end },
+    { "buffer", function()
+        buf:put("{id=", rec.id, ",name=", rec.name, ",price=", rec.price, ",tags={")
+        for i = 1, #rec.tags do buf:put(rec.tags[i], ",") end
+        return buf:put("}}"):get()
+    end },
+    { "format", function(i)  -- 100 lines per chunk
+        lines[#lines + 1] = string.format("%d;%s;%.2f\n", i, rec.name, rec.price)
+        if i % 100 == 0 then
+            local s = table.concat(lines)
+            lines = {}
+            return s
+        end
+    end },
+    { "putf", function(i)
+        buf:putf("%d;%s;%.2f\n", i, rec.name, rec.price)
+        if i % 100 == 0 then return buf:get() end
+    end },
+}
+
+for _, case in ipairs(cases) do
+    local f = case[2]
+    collectgarbage()
+    local t = clock()
+    for i = 1, N do f(i) end
+    t = clock() - t
+    print(string.format("%-8s %8.3f s", case[1], t))
+end
@@ -0,0 +1,55 @@
+-- Startup cost of requiring many precompiled modules from separate files
+-- versus a bundle. Usage: lua bundle.lua [modules]   (needs luac next to lua)
+
+local N = tonumber(arg and arg[1]) or 300
+local clock = os.clock
+
+local progname
+do
+    local i = 0
+    while arg[i] do i = i - 1 end
+    progname = arg[i + 1]
+end
+local luac = progname:gsub("lua([^/\\]*)$", "luac%1")
+
+local dir = os.tmpname()
+os.remove(dir)
+assert(os.execute('mkdir "' .. dir .. '"'))
+local inputs = {}
+for i = 1, N do
+    local src = string.format("%s/m%d.lua", dir, i)
+    local f = assert(io.open(src, "w"))
+    f:write("local M = {}\n")
+    for k = 1, 20 do
+        f:write("function M.f", k, "(x) return x * ", k, " + ", i, " end\n")
+    end
+    f:write("return M\n")
+    f:close()
+    assert(os.execute(string.format('"%s" -o "%s/m%d.luac" "%s"', luac, dir, i, src)))
+    inputs[i] = string.format('m%d="%s"', i, src)
+end
+local bundle = dir .. "/all.lbundle"
+assert(os.execute(string.format('"%s" --bundle -o "%s" %s', luac, bundle, table.concat(inputs, " "))))
+
+local function bench(name, setup)
+    local saved = package.path
+    local t = clock()
+    setup()
+    for i = 1, N do assert(require("m" .. i).f1(1) == 1 + i) end
+    t = clock() - t
+    for i = 1, N do package.loaded["m" .. i] = nil end
+    package.path = saved
+    print(string.format("%-26s %8.3f ms  %7.1f us/module", name, t * 1e3, t * 1e6 / N))
+end
+
+-- a realistic path with a few misses before the module directory
+local path = "./?.lua;./?/init.lua;/usr/local/share/lua/5.3/?.lua;" .. dir .. "/?.luac"
+bench("separate .luac files", function() package.path = path end)
+bench("bundle", function() assert(package.addbundle(bundle) == N) end)
+
+for i = 1, N do
+    os.remove(string.format("%s/m%d.lua", dir, i))
+    os.remove(string.format("%s/m%d.luac", dir, i))
+end
+os.remove(bundle)
+os.remove(dir)
@@ -0,0 +1,48 @@
+-- Startup time of the stand-alone interpreter on a large script, with and
+-- without the compiled-chunk cache. Usage: lua cache.lua [functions] [runs]
+
+local N = tonumber(arg and arg[1]) or 5000
+local RUNS = tonumber(arg and arg[2]) or 10
+local now = require "sched".now  -- monotonic wall clock
+
+local progname
+do
+    local i = 0
+    while arg[i] do i = i - 1 end
+    progname = arg[i + 1]
+end
+
+local script = os.tmpname()
+do
+    local f = assert(io.open(script, "w"))
+    f:write("local F = {}\n")
+    for i = 1, N do
+        f:write("F[", i, "] = function(a, b)\n",
+                "  local s = 0\n",
+                "  for k = a, b do s = s + k * ", i, " end\n",
+                "  return s\n",
+                "end\n")
+    end
+    f:close()
+end
+local dir = os.tmpname()
+os.remove(dir)
+assert(os.execute('mkdir "' .. dir .. '"'))
+
+local function bench(name, env)
+    local cmd = string.format('%s "%s" "%s"', env, progname, script)
+    assert(os.execute(cmd))  -- warm up (and fill the cache)
+    local t = now()
+    for _ = 1, RUNS do assert(os.execute(cmd)) end
+    t = now() - t
+    print(string.format("%-16s %8.2f ms/run", name, t * 1e3 / RUNS))
+end
+
+bench("no cache", "LUA_CACHEDIR=")
+bench("cache", string.format('LUA_CACHEDIR="%s"', dir))
+
+local p = io.popen('ls "' .. dir .. '"')
+for name in p:lines() do os.remove(dir .. "/" .. name) end
+p:close()
+os.remove(dir)
+os.remove(script)
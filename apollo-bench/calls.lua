@@ -0,0 +1,45 @@
+-- Micro-benchmarks for protected calls and coroutine switches.
+-- Usage: lua calls.lua [iterations]
+
+local N = tonumber(arg and arg[1]) or 2000000
+local clock = os.clock
+
+local function bench(name, n, f)
+    collectgarbage()
+    local t = clock()
+    f(n)
+    t = clock() - t
+    print(string.format("%-28s %8.3f s  %7.1f ns/op", name, t, t * 1e9 / n))
+end
+
+local function nop() end
+local function fail() error("x", 0) end
+
+bench("pcall(f)", N, function(n)
+    local pcall = pcall
+    for _ = 1, n do pcall(nop) end
+end)
+
+bench("pcall(f) with error", N // 10, function(n)
+    local pcall = pcall
+    for _ = 1, n do pcall(fail) end
+end)
+
+bench("nested pcall(pcall, f)", N, function(n)
+    local pcall = pcall
+    for _ = 1, n do pcall(pcall, nop) end
+end)
+
+bench("resume/yield ping-pong", N, function(n)
+    local yield = coroutine.yield
+    local co = coroutine.wrap(function() while true do yield() end end)
+    for _ = 1, n do co() end
+end)
+
+bench("pcall inside coroutine", N, function(n)
+    local pcall = pcall
+    local co = coroutine.wrap(function()
+        for _ = 1, n do pcall(nop) end
+    end)
+    co()
+end)
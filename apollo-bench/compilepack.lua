@@ -0,0 +1,53 @@
+-- Run time of encoding and decoding arrays of binary records with
+-- 'string.pack'/'string.unpack' against a compiled layout, record by
+-- record and with 'packmany'/'unpackmany'.
+-- Usage: lua compilepack.lua [n]
+
+local N = tonumber(arg and arg[1]) or 200
+local clock = os.clock
+
+local fmt = "<I4 I2 B B f f f"  -- 20-byte record
+local lay = string.compilepack(fmt)
+local recs = {}
+for i = 1, 1000 do recs[i] = { i, i % 65536, i % 256, 7, i * 0.5, -i * 0.25, 1.0 } end
+local frame = lay:packmany(recs)
+local unpack = table.unpack
+
+local cases = {
+    { "pack", function()
+        local parts = {}
+        for i = 1, #recs do parts[i] = string.pack(fmt, unpack(recs[i])) end
+        return table.concat(parts)
+    end },
+    { "packmany", function() return lay:packmany(recs) end },
+    { "unpack", function()
+        local t, pos = {}, 1
+        for i = 1, #recs do
+            local r = { string.unpack(fmt, frame, pos) }
+            pos = r[8]
+            r[8] = nil
+            t[i] = r
+        end
+        return t
+    end },
+    { "layout", function()
+        local t, pos = {}, 1
+        for i = 1, #recs do
+            local r = { lay:unpack(frame, pos) }
+            pos = r[8]
+            r[8] = nil
+            t[i] = r
+        end
+        return t
+    end },
+    { "unpackmany", function() return lay:unpackmany(frame) end },
+}
+
+for _, case in ipairs(cases) do
+    local f = case[2]
+    collectgarbage()
+    local t = clock()
+    for i = 1, N do f(i) end
+    t = clock() - t
+    print(string.format("%-10s %8.3f s", case[1], t))
+end
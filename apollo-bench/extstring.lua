@@ -0,0 +1,27 @@
+-- Run time of receiving large strings from a channel, which no longer
+-- copies them into the receiving state. Compare with an older build to
+-- see the gain.
+-- Usage: lua extstring.lua [n]
+
+local threads = require "threads"
+
+local N = tonumber(arg and arg[1]) or 2000
+local clock = os.clock
+
+local cases = {
+    { "4 KB", string.rep("x", 4096) },
+    { "64 KB", string.rep("x", 65536) },
+    { "1 MB", string.rep("x", 1048576) },
+}
+
+for _, case in ipairs(cases) do
+    local s, ch = case[2], threads.channel(1)
+    collectgarbage()
+    local t = clock()
+    for _ = 1, N do
+        ch:send(s)
+        ch:recv()
+    end
+    t = clock() - t
+    print(string.format("%-8s %8.3f s", case[1], t))
+end
@@ -0,0 +1,32 @@
+-- Run time of a loop full of constant guards, written with literals
+-- (folded at compile time) and with the same values passed in as
+-- arguments (tested at run time). Usage: lua fold.lua [n]
+
+local N = tonumber(arg and arg[1]) or 5000000
+local clock = os.clock
+
+local template = [[
+local n, DEBUG, LEVEL, MODE, SEP = ...
+local s = 0
+for i = 1, n do
+    if $DEBUG then s = s + 1000 end
+    if $LEVEL > 2 then s = s - 1 end
+    if $MODE == "release" then s = s + i % 3 else s = s - 1 end
+    while $DEBUG do s = 0 end
+    s = s + #($SEP .. ":")
+end
+return s
+]]
+
+local literals = { DEBUG = "false", LEVEL = "1", MODE = '"release"', SEP = '","' }
+local variables = { DEBUG = "DEBUG", LEVEL = "LEVEL", MODE = "MODE", SEP = "SEP" }
+
+for _, case in ipairs({ { "variables", variables }, { "literals", literals } }) do
+    local src = template:gsub("%$(%u+)", case[2])
+    local f = assert(load(src, "=bench"))
+    local t = clock()
+    local s = f(N, false, 1, "release", ",")
+    t = clock() - t
+    print(string.format("%-9s %8.3f s  %6d bytes of bytecode  (result %d)",
+                        case[1], t, #string.dump(f, true), s))
+end
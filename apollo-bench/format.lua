@@ -0,0 +1,23 @@
+-- Run time of string.format calls typical of logging and serialization.
+-- Compare with an older build to see the gain. Usage: lua format.lua [n]
+
+local N = tonumber(arg and arg[1]) or 1000000
+local clock = os.clock
+local format = string.format
+
+local cases = {
+    { "log line", function(i) return format("[%s] user=%d id=%x took %.2fms", "INFO", i, i * 31, i / 7) end },
+    { "integers", function(i) return format("%d,%d,%d", i, -i, i * 1000003) end },
+    { "strings", function(i) return format("%s=%s", "key", "value") end },
+    { "floats", function(i) return format("%.3f %f", i / 3, i * 0.25) end },
+    { "quoted", function(i) return format("%q", "name") end },
+    { "padded", function(i) return format("%5d|%-8s|%8.3f", i, "x", i / 3) end },
+}
+
+for _, case in ipairs(cases) do
+    local f = case[2]
+    local t = clock()
+    for i = 1, N do f(i) end
+    t = clock() - t
+    print(string.format("%-10s %8.3f s", case[1], t))
+end
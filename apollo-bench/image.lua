@@ -0,0 +1,57 @@
+-- Load time of a large chunk as source, binary chunk and bytecode image.
+-- Usage: lua image.lua [functions]   (needs luac next to lua)
+
+local N = tonumber(arg and arg[1]) or 2000
+local clock = os.clock
+
+local progname
+do
+    local i = 0
+    while arg[i] do i = i - 1 end
+    progname = arg[i + 1]
+end
+local luac = progname:gsub("lua([^/\\]*)$", "luac%1")
+
+local src, bin, img = os.tmpname(), os.tmpname(), os.tmpname()
+do
+    local f = assert(io.open(src, "w"))
+    f:write("local F = {}\n")
+    for i = 1, N do
+        f:write("F[", i, "] = function(a, b)\n",
+                "  local s = 0\n",
+                "  for k = a, b do s = s + k * ", i, " end\n",
+                "  return s\n",
+                "end\n")
+    end
+    f:write("return F[1](1, 10)\n")
+    f:close()
+end
+assert(os.execute(string.format('"%s" -o "%s" "%s"', luac, bin, src)))
+assert(os.execute(string.format('"%s" -m -o "%s" "%s"', luac, img, src)))
+
+local function size(name)
+    local f = assert(io.open(name, "rb"))
+    local n = f:seek("end")
+    f:close()
+    return n
+end
+
+local function bench(name, file, reps)
+    collectgarbage(); collectgarbage()
+    local before = collectgarbage("count")
+    local keep = {}
+    local t = clock()
+    for i = 1, reps do keep[i] = assert(loadfile(file)) end
+    t = clock() - t
+    collectgarbage(); collectgarbage()
+    local kb = (collectgarbage("count") - before) / reps
+    print(string.format("%-14s %8d bytes  %8.3f ms/load  %8.1f KB/instance",
+                        name, size(file), t * 1e3 / reps, kb))
+    assert(keep[1]() == 55)
+end
+
+bench("source", src, 20)
+bench("binary chunk", bin, 20)
+bench("image", img, 20)
+
+os.remove(src); os.remove(bin); os.remove(img)
@@ -0,0 +1,42 @@
+-- Load time and memory of a large generated module whose functions are
+-- mostly never called, compiled eagerly ("t") and lazily ("tl").
+-- Usage: lua lazy.lua [functions] [loads]
+
+local NF = tonumber(arg and arg[1]) or 2000
+local N = tonumber(arg and arg[2]) or 50
+local clock = os.clock
+
+local lines = { "local M = {}" }
+for i = 1, NF do
+    lines[#lines + 1] = string.format([[
+function M.f%d(a, b)
+    local t = { a, b, %d }
+    for i = 1, #t do
+        if t[i] > a then a = a + t[i] * b else a = a - b end
+    end
+    return a
+end]], i, i)
+end
+lines[#lines + 1] = "return M"
+local src = table.concat(lines, "\n")
+
+local function bench(mode)
+    collectgarbage()
+    collectgarbage()
+    local m = collectgarbage("count")
+    local t = clock()
+    local M
+    for _ = 1, N do M = load(src, "=module", mode)() end
+    t = clock() - t
+    collectgarbage()
+    m = collectgarbage("count") - m
+    local c = clock()
+    for i = 1, NF, 100 do M["f" .. i](1, 2) end  -- first calls compile
+    c = clock() - c
+    print(string.format("mode %-3s %8.3f ms/load  %8.1f KB  first calls %7.3f ms",
+                        mode, t * 1e3 / N, m, c * 1e3))
+end
+
+print(string.format("%d functions, %d KB of source", NF, #src // 1024))
+bench("t")
+bench("tl")
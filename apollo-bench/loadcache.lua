@@ -0,0 +1,30 @@
+-- Repeated 'load' of the same generated sources, with and without the
+-- load cache. Usage: lua loadcache.lua [loads]
+
+local N = tonumber(arg and arg[1]) or 20000
+local clock = os.clock
+
+local sources = {}
+for i = 1, 16 do
+    local lines = { "local a, b = ..." }
+    for k = 1, 40 do lines[#lines + 1] = string.format("a = a * %d + b - %d", k + i, k) end
+    lines[#lines + 1] = "return a"
+    sources[i] = table.concat(lines, "\n")
+end
+
+local function bench(name, capacity)
+    collectgarbage("loadcache", capacity)
+    collectgarbage()
+    local t = clock()
+    for i = 1, N do
+        local f = load(sources[i % #sources + 1])
+        f(1, 2)
+    end
+    t = clock() - t
+    print(string.format("%-22s %8.3f s  %7.2f us/load", name, t, t * 1e6 / N))
+end
+
+bench("load", 0)
+bench("load with cache", 32)
+print(string.format("hits %d  misses %d  evictions %d  entries %d", collectgarbage("loadstats")))
+collectgarbage("loadcache", 0)
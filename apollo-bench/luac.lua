@@ -0,0 +1,44 @@
+-- Wall time of luac compiling many files with one thread and with one
+-- thread per core. Usage: lua luac.lua [files]   (needs luac next to lua)
+
+local N = tonumber(arg and arg[1]) or 400
+local now = require "sched".now  -- monotonic wall clock
+
+local progname
+do
+    local i = 0
+    while arg[i] do i = i - 1 end
+    progname = arg[i + 1]
+end
+local luac = progname:gsub("lua([^/\\]*)$", "luac%1")
+
+local dir = os.tmpname()
+os.remove(dir)
+assert(os.execute('mkdir "' .. dir .. '"'))
+local inputs = {}
+for i = 1, N do
+    inputs[i] = string.format("%s/m%d.lua", dir, i)
+    local f = assert(io.open(inputs[i], "w"))
+    f:write("local M = {}\n")
+    for k = 1, 100 do
+        f:write("function M.f", k, "(a, b)\n",
+                "    local t = { a, b, ", k, ", '", i, "' }\n",
+                "    for i = 1, #t - 1 do if t[i] > a then a = a + t[i] * b else a = a - b end end\n",
+                "    return a\nend\n")
+    end
+    f:write("return M\n")
+    f:close()
+end
+local files = '"' .. table.concat(inputs, '" "') .. '"'
+
+local function bench(name, opts)
+    local out = dir .. "/out.luac"
+    local t = now()
+    assert(os.execute(string.format('"%s" %s -o "%s" %s', luac, opts, out, files)))
+    t = now() - t
+    print(string.format("%-22s %8.3f s", name, t))
+end
+
+bench("luac -j 1", "-j 1")
+bench("luac (one per core)", "")
+os.execute('rm -r "' .. dir .. '"')
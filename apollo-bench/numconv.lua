@@ -0,0 +1,31 @@
+-- Run time of float <-> string conversions ('tostring', '..' and
+-- 'tonumber'). Compare with an older build to see the gain.
+-- Usage: lua numconv.lua [n]
+
+local N = tonumber(arg and arg[1]) or 1000000
+local clock = os.clock
+
+local floats, strings = {}, {}
+math.randomseed(1)
+for i = 1, 1000 do
+    floats[i] = math.random(1, 10^6) / 100  -- prices, measurements
+    strings[i] = tostring(floats[i])
+end
+local long = {}
+for i = 1, 1000 do long[i] = string.format("%.17g", math.random()) end
+
+local cases = {
+    { "tostring", function(i) return tostring(floats[i % 1000 + 1]) end },
+    { "concat", function(i) return "v=" .. floats[i % 1000 + 1] * 1.5 end },
+    { "tostring 1/3", function(i) return tostring(i / 3) end },
+    { "tonumber", function(i) return tonumber(strings[i % 1000 + 1]) end },
+    { "tonumber long", function(i) return tonumber(long[i % 1000 + 1]) end },
+}
+
+for _, case in ipairs(cases) do
+    local f = case[2]
+    local t = clock()
+    for i = 1, N do f(i) end
+    t = clock() - t
+    print(string.format("%-14s %8.3f s", case[1], t))
+end
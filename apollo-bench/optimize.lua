@@ -0,0 +1,30 @@
+-- Run time of loops full of 'continue' and branches compiled without
+-- and with the optimization pass. Usage: lua optimize.lua [n]
+
+local N = tonumber(arg and arg[1]) or 3000000
+local clock = os.clock
+
+local src = [[
+local n = ...
+local s = 0
+for i = 1, n do
+    if i % 3 == 0 then continue end
+    local j = i % 7
+    while j > 0 do
+        j = j - 1
+        if j % 2 == 0 then continue end
+        s = s + j
+    end
+    if i % 5 == 0 then s = s + 1 else s = s - 1 end
+end
+return s
+]]
+
+for _, mode in ipairs({ "t", "to", "tO" }) do
+    local f = assert(load(src, "=bench", mode))
+    local t = clock()
+    local s = f(N)
+    t = clock() - t
+    print(string.format("mode %-3s %8.3f s  %6d bytes of bytecode  (result %d)",
+                        mode, t, #string.dump(f, true), s))
+end
@@ -0,0 +1,31 @@
+-- Run time of typical pattern searches over a generated log. Compare
+-- with a build without compiled patterns to see the gain.
+-- Usage: lua pattern.lua [lines]
+
+local N = tonumber(arg and arg[1]) or 20000
+local clock = os.clock
+
+local lines = {}
+for i = 1, N do
+    lines[i] = string.format("2024-01-%02d 12:%02d:%02d [%s] request %d from 10.0.%d.%d took %dms",
+                             i % 28 + 1, i % 60, i * 7 % 60, i % 10 == 0 and "ERROR" or "INFO",
+                             i, i % 256, i * 3 % 256, i % 1000)
+end
+local log = table.concat(lines, "\n")
+
+local cases = {
+    { "find literal", function() local n, i = 0, 1 while true do i = log:find("ERROR", i, true) if not i then return n end n, i = n + 1, i + 1 end end },
+    { "find prefix", function() local n, i = 0, 1 while true do i = log:find("%[ERROR%]", i) if not i then return n end n, i = n + 1, i + 1 end end },
+    { "gmatch fields", function() local n = 0 for d, lvl, ms in log:gmatch("(%d+%-%d+%-%d+) [%d:]+ %[(%u+)%][^\n]- took (%d+)ms") do n = n + 1 end return n end },
+    { "gmatch words", function() local n = 0 for w in log:gmatch("%a+") do n = n + 1 end return n end },
+    { "gsub ips", function() return select(2, log:gsub("10%.0%.%d+%.%d+", "x")) end },
+    { "match lines", function() local n = 0 for _, l in ipairs(lines) do if l:match("^%d+%-%d+%-%d+ [%d:]+ %[ERROR%]") then n = n + 1 end end return n end },
+}
+
+for _, case in ipairs(cases) do
+    local t = clock()
+    local r
+    for _ = 1, 5 do r = case[2]() end
+    t = clock() - t
+    print(string.format("%-14s %8.3f s  (%d results)", case[1], t, r))
+end
@@ -0,0 +1,38 @@
+-- Run time of functions that build large strings in a 'luaL_Buffer'
+-- ('table.concat', 'string.rep', 'string.gsub', 'string.format' and
+-- 'io.read("a")'). Compare with an older build to see the gain.
+-- Usage: lua pushresult.lua [n]
+
+local N = tonumber(arg and arg[1]) or 200
+local clock = os.clock
+
+local parts = {}
+for i = 1, 100000 do parts[i] = string.format("%08d\n", i) end
+local text = table.concat(parts)  -- ~900 KB
+local name = os.tmpname()
+local f = assert(io.open(name, "wb"))
+f:write(text)
+f:close()
+
+local cases = {
+    { "concat", function() return table.concat(parts) end },
+    { "rep", function() return string.rep("abcdefgh", 100000, ",") end },
+    { "gsub", function() return (text:gsub("\n", ";")) end },
+    { "format", function() return string.format("%s|%s", text, text) end },
+    { "read all", function()
+        local f = assert(io.open(name, "rb"))
+        local s = f:read("a")
+        f:close()
+        return s
+    end },
+}
+
+for _, case in ipairs(cases) do
+    local f = case[2]
+    collectgarbage()
+    local t = clock()
+    for i = 1, N do f(i) end
+    t = clock() - t
+    print(string.format("%-8s %8.3f s", case[1], t))
+end
+os.remove(name)
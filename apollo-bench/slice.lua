@@ -0,0 +1,46 @@
+-- Run time of taking long substrings of a large buffer
+-- ('string.sub', captures and 'string.unpack'). Compare with an older
+-- build to see the gain.
+-- Usage: lua slice.lua [n]
+
+local N = tonumber(arg and arg[1]) or 200000
+local clock = os.clock
+
+local records = {}
+math.randomseed(1)
+for i = 1, 2000 do
+    records[i] = string.format("%06d:%s\n", i, string.rep(string.char(97 + i % 26), math.random(200, 2000)))
+end
+local buffer = table.concat(records)  -- ~2 MB
+local starts, pos = {}, 1
+for i = 1, #records do starts[i], pos = pos, pos + #records[i] end
+local packed = {}
+for i = 1, 100 do packed[i] = string.pack("s4", records[i]) end
+packed = table.concat(packed)
+
+local cases = {
+    { "sub", function(i)
+        local p = i % 1000000 + 1
+        return buffer:sub(p, p + 999)
+    end },
+    { "match", function(i)
+        return buffer:match("^%d+:(%a+)\n", starts[i % 2000 + 1])
+    end },
+    { "gmatch", function(i)
+        if i % 2000 == 0 then
+            for id, body in buffer:gmatch("(%d+):(%a+)") do end
+        end
+    end },
+    { "unpack", function(i)
+        return string.unpack("s4", packed, 1)
+    end },
+}
+
+for _, case in ipairs(cases) do
+    local f = case[2]
+    collectgarbage()
+    local t = clock()
+    for i = 1, N do f(i) end
+    t = clock() - t
+    print(string.format("%-8s %8.3f s", case[1], t))
+end
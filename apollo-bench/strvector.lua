@@ -0,0 +1,38 @@
+-- Run time of plain searches and byte transforms on large strings.
+-- Compare with a build configured with -DLUA_NOVECTOR (or an older
+-- build) to see the gain. Usage: lua strvector.lua [megabytes]
+
+local MB = tonumber(arg and arg[1]) or 8
+local clock = os.clock
+
+local text = ("The quick brown fox jumps over the lazy dog. "):rep(MB * 2^20 // 45)
+local rep = ("a"):rep(MB * 2^20) .. "b"
+
+local cases = {
+    { "find text", function() return text:find("lazy cat", 1, true) end },
+    { "find repetitive", function() return rep:find("aaaaaaaaaaaaaaab", 1, true) end },
+    { "find no first", function() return rep:find("xyz", 1, true) end },
+    { "lower", function() return #text:lower() end },
+    { "upper", function() return #text:upper() end },
+    { "reverse", function() return #text:reverse() end },
+    { "rep short", function() return #("ab"):rep(MB * 2^19) end },
+    { "rep sep", function() return #("ab"):rep(MB * 2^18, ", ") end },
+}
+
+for _, case in ipairs(cases) do
+    local t = clock()
+    for _ = 1, 10 do case[2]() end
+    t = clock() - t
+    print(string.format("%-16s %8.3f s", case[1], t))
+end
+
+-- mid-size strings, where per-call overhead matters
+for _, size in ipairs({ 128, 150, 256, 512, 1024 }) do
+    local s = text:sub(1, size)
+    for _, name in ipairs({ "lower", "upper" }) do
+        local f = string[name]
+        local t = clock()
+        for _ = 1, MB * 2^17 // 8 do f(s) end
+        print(string.format("%-16s %8.3f s", name .. " " .. size, clock() - t))
+    end
+end
@@ -0,0 +1,44 @@
+-- Scaling of a CPU-bound batch job across worker threads.
+-- Usage: lua threads.lua [jobs]
+
+local threads = require "threads"
+local now = require "sched".now  -- monotonic wall clock
+
+local JOBS = tonumber(arg and arg[1]) or 64
+
+local function work(n)
+    local s = 0
+    for i = 1, n do s = s + (i * i) % 7 end
+    return s
+end
+
+local function run(nworkers)
+    local jobs, results = threads.channel(JOBS), threads.channel(JOBS)
+    local workers = {}
+    for i = 1, nworkers do
+        workers[i] = threads.spawn(function(jobs, results, work)
+            while true do
+                local n, ok = jobs:recv()
+                if not ok then break end
+                results:send(work(n))
+            end
+        end, jobs, results, work)
+    end
+    for _ = 1, JOBS do jobs:send(1000000) end
+    jobs:close()
+    local total = 0
+    for _ = 1, JOBS do total = total + results:recv() end
+    for i = 1, nworkers do workers[i]:join() end
+    return total
+end
+
+local base
+local n = 1
+while n <= threads.cores() do
+    local t = now()
+    local total = run(n)
+    t = now() - t
+    base = base or t
+    print(string.format("%3d worker(s)  %8.3f s  speedup %5.2fx  (total %d)", n, t, base / t, total))
+    n = n * 2
+end
@@ -0,0 +1,32 @@
+-- Run time of 'utf8.len' and random access through 'utf8.offset' on
+-- large UTF-8 texts. Compare with an older build to see the gain.
+-- Usage: lua utf8.lua [n]
+
+local N = tonumber(arg and arg[1]) or 200
+local clock = os.clock
+
+local latin = string.rep("Der schnelle braune Fuchs springt \xC3\xBCber den faulen Hund. ", 4000)
+local cjk = string.rep("\xE6\x95\x8F\xE6\x8D\xB7\xE7\x9A\x84\xE6\xA3\x95\xE8\x89\xB2\xE7\x8B\x90\xE7\x8B\xB8 fox. ", 8000)
+local nlatin, ncjk = utf8.len(latin), utf8.len(cjk)
+
+local cases = {
+    { "len latin", function() return utf8.len(latin) end },
+    { "len cjk", function() return utf8.len(cjk) end },
+    { "offset latin", function(i)
+        for k = 1, 100 do utf8.offset(latin, (i * 7919 + k * 104729) % nlatin + 1) end
+    end },
+    { "offset cjk", function(i)
+        for k = 1, 100 do utf8.offset(cjk, (i * 7919 + k * 104729) % ncjk + 1) end
+    end },
+    { "offset back", function(i)
+        for k = 1, 100 do utf8.offset(cjk, -((i * 7919 + k * 104729) % ncjk + 1)) end
+    end },
+}
+
+for _, case in ipairs(cases) do
+    local f = case[2]
+    local t = clock()
+    for i = 1, N do f(i) end
+    t = clock() - t
+    print(string.format("%-13s %8.3f s", case[1], t))
+end
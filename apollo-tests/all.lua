@@ -159,6 +159,31 @@ dofile('agoto.lua')
 dofile('glua.lua')
 dofile('continue.lua')
 dofile('compound.lua')
+dofile('compactstack.lua')
+dofile('sched.lua')
+dofile('pcall.lua')
+dofile('threads.lua')
+dofile('shared.lua')
+dofile('freeze.lua')
+dofile('image.lua')
+dofile('bundle.lua')
+dofile('cache.lua')
+dofile('loadcache.lua')
+dofile('lazy.lua')
+dofile('luac.lua')
+dofile('optimize.lua')
+dofile('fold.lua')
+dofile('const.lua')
+dofile('pattern.lua')
+dofile('strvector.lua')
+dofile('format.lua')
+dofile('numconv.lua')
+dofile('slice.lua')
+dofile('extstring.lua')
+dofile('buffer.lua')
+dofile('pushresult.lua')
+dofile('utf8fast.lua')
+dofile('compilepack.lua')
 
 dofile('db.lua')
 assert(dofile('calls.lua') == deep and deep)
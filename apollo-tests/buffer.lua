@@ -0,0 +1,62 @@
+local buffer = require "buffer"
+
+-- appending and reading back
+do
+    local b = buffer.new()
+    assert(#b == 0 and b:tostring() == "" and b:get() == "", "Failed empty buffer test")
+    assert(b:put("abc", 12, "", 1.5):put("\0z") == b, "Failed put chaining test")
+    assert(#b == 10 and tostring(b) == "abc121.5\0z", "Failed put test")
+    local t = setmetatable({}, { __tostring = function() return "<t>" end })
+    b:put(t, buffer.new():put("xy"))
+    assert(b:tostring() == "abc121.5\0z<t>xy", "Failed put object test")
+    assert(not pcall(b.put, b, {}) and not pcall(b.put, b, nil), "Failed put type test")
+    assert(b:get(3) == "abc" and b:get(2) == "12" and #b == 10, "Failed get test")
+    local x, y, z = b:get(3, 2, nil)
+    assert(x == "1.5" and y == "\0z" and z == "<t>xy" and #b == 0, "Failed multiple get test")
+    assert(b:put("hello"):get(100) == "hello" and b:get(1) == "", "Failed short get test")
+    assert(b:put("abcdef"):skip(2):get() == "cdef", "Failed skip test")
+    assert(b:put("abc"):skip(10):tostring() == "", "Failed long skip test")
+    assert(b:put("abc"):reset():put("d"):get() == "d", "Failed reset test")
+    assert(not pcall(b.get, b, -1) and not pcall(b.skip, b, -1), "Failed negative length test")
+    b:put("abc"):free()
+    assert(#b == 0 and b:put("again"):get() == "again", "Failed free test")
+    b:put(b:put("ab"))
+    assert(b:get() == "abab", "Failed self put test")
+end
+
+-- formatted and packed writes
+do
+    local b = buffer.new(16)
+    b:putf("%d:%s;", 42, "x"):putf("%5.1f", 2.25)
+    assert(b:get() == "42:x;  2.2", "Failed putf test")
+    b:pack("<i4s1", 7, "hi"):pack("z", "end")
+    local s = b:get()
+    assert(s == string.pack("<i4s1z", 7, "hi", "end"), "Failed pack test")
+    assert(not pcall(b.putf, b, "%d", "x") and #b == 0, "Failed putf error test")
+    assert(not pcall(b.pack, b) and not pcall(b.putf, b), "Failed missing format test")
+end
+
+-- large contents, interleaved reads and reuse
+do
+    local b = buffer.new()
+    local parts = {}
+    for i = 1, 10000 do
+        parts[i] = string.format("%d,", i)
+        b:put(i, ",")
+    end
+    local all = table.concat(parts)
+    assert(#b == #all and b:tostring() == all, "Failed large buffer test")
+    local got = {}
+    for i = 1, 10000 do
+        b:put("tail", i)
+        got[#got + 1] = b:get(#parts[i])
+    end
+    assert(table.concat(got) == all, "Failed queue test")
+    for i = 1, 100 do
+        b:reset()
+        for j = 1, 100 do b:put(j) end
+        assert(#b == 192, "Failed reuse test")
+    end
+end
+
+print("OK")
@@ -0,0 +1,68 @@
+-- module bundles need 'luac' next to the interpreter
+local progname
+do
+    local i = 0
+    while arg[i] do i = i - 1 end
+    progname = arg[i + 1]
+end
+local luac = progname:gsub("lua([^/\\]*)$", "luac%1")
+if not io.open(luac) then
+    print("luac not found; skipping bundle tests")
+    return
+end
+
+local function write(name, s)
+    local f = assert(io.open(name, "w"))
+    f:write(s)
+    f:close()
+    return name
+end
+
+local util = write(os.tmpname(), "local name = ...\nreturn { name = name, add = function(a, b) return a + b end }\n")
+local main = write(os.tmpname(), "local u = require 'bt.util'\nreturn { twice = function(x) return u.add(x, x) end }\n")
+local broken = write(os.tmpname(), "error('bundled failure')\n")
+local out = os.tmpname()
+assert(os.execute(string.format('"%s" --bundle -o "%s" bt.util="%s" bt="%s" bt.broken="%s"',
+                                luac, out, util, main, broken)), "Failed luac bundle test")
+
+local loaded = 0
+do
+    local h = assert(io.open(out, "rb"))
+    assert(h:read(7) == "\27LuaBnd", "Failed bundle signature test")
+    h:close()
+    assert(package.addbundle(out) == 3, "Failed addbundle test")
+    local bt = require "bt"
+    assert(bt.twice(21) == 42, "Failed bundled require test")
+    assert(package.loaded["bt.util"].name == "bt.util", "Failed bundled module name test")
+    local ok, err = pcall(require, "bt.broken")
+    assert(not ok and err:find("bundled failure"), "Failed bundled error test")
+    ok, err = pcall(require, "bt.none")
+    assert(not ok and err:find("no field package.preload['bt.none']", 1, true), "Failed bundle miss test")
+    assert(type(package.preload.bt) == "function" and #package.searchers == 4, "Failed bundle searchers test")
+    package.loaded.bt, package.loaded["bt.util"] = nil, nil
+end
+
+-- the first bundle providing a module wins
+do
+    write(util, "return 'other'\n")
+    local other = os.tmpname()
+    assert(os.execute(string.format('"%s" --bundle -o "%s" bt.util="%s"', luac, other, util)))
+    assert(package.addbundle(other) == 1, "Failed second bundle test")
+    assert(require("bt.util").name == "bt.util", "Failed bundle order test")
+    package.loaded["bt.util"] = nil
+    os.remove(other)
+end
+
+do
+    local f, err = package.addbundle(util)
+    assert(f == nil and err:find("bad bundle"), "Failed bad bundle test")
+    assert(package.addbundle(out .. ".none") == nil, "Failed missing bundle test")
+    local log = os.tmpname()
+    assert(not os.execute(string.format('"%s" --bundle -o "%s" a="%s" a="%s" 2> "%s"',
+                                        luac, out, util, main, log)), "Failed duplicate module test")
+    os.remove(log)
+end
+
+os.remove(util); os.remove(main); os.remove(broken); os.remove(out)
+
+print("OK")
@@ -0,0 +1,80 @@
+-- compiled-chunk cache of the stand-alone interpreter (LUA_CACHEDIR)
+local progname
+do
+    local i = 0
+    while arg[i] do i = i - 1 end
+    progname = arg[i + 1]
+end
+
+local dir = os.tmpname()
+os.remove(dir)
+assert(os.execute('mkdir "' .. dir .. '"'), "Failed cache directory test")
+local script, out = os.tmpname(), os.tmpname()
+
+local function write(s)
+    local f = assert(io.open(script, "w"))
+    f:write(s)
+    f:close()
+end
+
+local function run()
+    assert(os.execute(string.format('LUA_CACHEDIR="%s" "%s" "%s" > "%s"', dir, progname, script, out)))
+    local f = assert(io.open(out))
+    local s = f:read("a")
+    f:close()
+    return s
+end
+
+local function entries()
+    local p = assert(io.popen('ls "' .. dir .. '"'))
+    local t = {}
+    for name in p:lines() do t[#t + 1] = name end
+    p:close()
+    return t
+end
+
+write("#!/usr/bin/env lua\nlocal t = {}\nfor i = 1, 3 do t[i] = i * 2 end\nprint(table.concat(t, ','))\n")
+assert(run() == "2,4,6\n", "Failed cache miss test")
+local files = entries()
+assert(#files == 1 and files[1]:find("%.luac$"), "Failed cache store test")
+assert(run() == "2,4,6\n" and #entries() == 1, "Failed cache hit test")
+
+-- changed source gets a new entry
+write("print('changed')\n")
+assert(run() == "changed\n" and #entries() == 2, "Failed cache invalidation test")
+
+-- corrupted entries are ignored and replaced
+do
+    local name = dir .. "/" .. files[1]
+    local f = assert(io.open(name, "r+b"))
+    f:seek("set", 40)
+    f:write("garbage")
+    f:close()
+    write("#!/usr/bin/env lua\nlocal t = {}\nfor i = 1, 3 do t[i] = i * 2 end\nprint(table.concat(t, ','))\n")
+    assert(run() == "2,4,6\n", "Failed corrupted cache test")
+    assert(run() == "2,4,6\n" and #entries() == 2, "Failed cache repair test")
+end
+
+-- syntax errors are reported and not cached
+write("x = = 1\n")
+assert(not os.execute(string.format('LUA_CACHEDIR="%s" "%s" "%s" 2> "%s"', dir, progname, script, out)),
+       "Failed cached syntax error test")
+assert(#entries() == 2, "Failed cached syntax error test")
+
+-- loads that do not accept binary chunks bypass the cache
+do
+    local mod = os.tmpname()
+    local f = assert(io.open(mod, "w"))
+    f:write("return 7\n")
+    f:close()
+    write(string.format("print(loadfile(%q, 't')())\n", mod))
+    assert(run() == "7\n" and #entries() == 3, "Failed text-only cache test")
+    write(string.format("print(loadfile(%q, 'bt')())\n", mod))
+    assert(run() == "7\n" and #entries() == 5, "Failed binary-allowed cache test")
+    os.remove(mod)
+end
+
+for _, name in ipairs(entries()) do os.remove(dir .. "/" .. name) end
+os.remove(dir); os.remove(script); os.remove(out)
+
+print("OK")
@@ -0,0 +1,61 @@
+local old = collectgarbage("compactstack")
+assert(old == false, "compact stacks should be off by default")
+
+local function parked(n)
+    local cos = {}
+    collectgarbage(); collectgarbage()
+    local before = collectgarbage("count")
+    for i = 1, n do
+        local co = coroutine.create(function(a) return coroutine.yield(a + 1) end)
+        assert(select(2, coroutine.resume(co, i)) == i + 1)
+        cos[i] = co
+    end
+    collectgarbage(); collectgarbage()
+    return (collectgarbage("count") - before) / n, cos
+end
+
+local normal, keep = parked(1000)
+assert(collectgarbage("compactstack", true) == false)
+assert(collectgarbage("compactstack") == true, "Failed to enable compact stacks")
+local compact, cos = parked(1000)
+assert(compact < normal, "Compact coroutines should use less memory: " .. compact .. " vs " .. normal)
+
+for i = 1, #cos do
+    local ok, v = coroutine.resume(cos[i], "done")
+    assert(ok and v == "done" and coroutine.status(cos[i]) == "dead")
+end
+
+do
+    local function deep(n)
+        if n == 0 then
+            coroutine.yield("bottom")
+            return 0
+        end
+        return 1 + deep(n - 1)
+    end
+
+    local co = coroutine.wrap(function() return deep(500) end)
+    assert(co() == "bottom", "Failed deep yield test")
+    assert(co() == 500, "Failed deep resume test")
+end
+
+do
+    local co = coroutine.wrap(function(...)
+        local t = { ... }
+        while true do
+            t = { coroutine.yield(table.unpack(t)) }
+        end
+    end)
+    for n = 1, 200, 37 do
+        local args = {}
+        for i = 1, n do args[i] = i end
+        local res = { co(table.unpack(args)) }
+        assert(#res == n and res[n] == n, "Failed multiple value yield test")
+    end
+end
+
+keep = nil
+collectgarbage("compactstack", old)
+assert(collectgarbage("compactstack") == false)
+
+print("OK")
@@ -0,0 +1,126 @@
+local formats = { "<i4 d s2 z", ">!8 b h Xi8 j B c3", "=I3 i7 f !4 T x n", "i16 I16 J", " < c0 s1 ", "" }
+local values = {
+    { -5, 2.5, "hello", "zed" },
+    { -128, 1000, math.mininteger, 255, "abc" },
+    { 70000, -3, 0.5, 42, -1.25 },
+    { -1, 2, -3 },
+    { "", "x" },
+    {},
+}
+
+-- layouts produce and read the same bytes as the format
+do
+    for k, fmt in ipairs(formats) do
+        local lay = string.compilepack(fmt)
+        local v = values[k]
+        local s = lay:pack(table.unpack(v))
+        assert(s == string.pack(fmt, table.unpack(v)), "Failed layout pack test")
+        local r = table.pack(lay:unpack(s))
+        local e = table.pack(string.unpack(fmt, s))
+        assert(r.n == e.n and r.n == #v + 1 and r[r.n] == #s + 1, "Failed layout unpack count test")
+        for i = 1, r.n do
+            assert(r[i] == e[i] and math.type(r[i]) == math.type(e[i]), "Failed layout unpack test")
+        end
+        local r2 = table.pack(lay:unpack("????????" .. s, 9))
+        assert(r2[r2.n] == #s + 9, "Failed layout position test")
+    end
+    local lay = string.compilepack("!8 i4 d")
+    assert(lay:size() == string.packsize("!8 i4 d") and lay:size() == 16, "Failed layout size test")
+    assert(not pcall(lay.size, string.compilepack("i4 z")), "Failed variable size test")
+    assert(tostring(lay):find("string.layout", 1, true), "Failed layout name test")
+end
+
+-- the same errors as string.pack and string.unpack
+do
+    for _, fmt in ipairs({ "i17", "c", "Xc4", "!3 i3", "y" }) do
+        local ok, e = pcall(string.compilepack, fmt)
+        local ok2, e2 = pcall(string.packsize, fmt)
+        assert(not ok and not ok2, "Failed invalid layout test")
+        assert(e:gsub("'[%w.]+'", "") == e2:gsub("'[%w.]+'", ""), "Failed invalid layout message test")
+    end
+    local lay = string.compilepack("i1 s1 z")
+    assert(not pcall(lay.pack, lay, 128, "", ""), "Failed overflow test")
+    assert(not pcall(lay.pack, lay, 1, string.rep("x", 256), ""), "Failed length test")
+    assert(not pcall(lay.pack, lay, 1, "", "a\0b"), "Failed zeros test")
+    assert(select(2, pcall(lay.pack, lay, 1.5)):find("integer representation"), "Failed float test")
+    assert(not pcall(lay.pack, lay, 1, "x"), "Failed missing value test")
+    assert(not pcall(lay.unpack, lay, "\1\5abc"), "Failed short data test")
+    assert(not pcall(lay.unpack, lay, "\1\0\0", 5), "Failed bad position test")
+    assert(not pcall(lay.pack, {}) and not pcall(string.compilepack), "Failed self test")
+end
+
+-- arrays of records
+do
+    local lay = string.compilepack("<I2 f s1")
+    local recs = {}
+    for i = 1, 1000 do recs[i] = { i, i / 4, tostring(i) } end
+    local s = lay:packmany(recs)
+    local parts = {}
+    for i = 1, 1000 do parts[i] = lay:pack(table.unpack(recs[i])) end
+    assert(s == table.concat(parts), "Failed packmany test")
+    local t, pos = lay:unpackmany(s)
+    assert(#t == 1000 and pos == #s + 1, "Failed unpackmany test")
+    for i = 1, 1000 do
+        assert(#t[i] == 3 and t[i][1] == i and t[i][2] == i / 4 and t[i][3] == tostring(i), "Failed record test")
+    end
+    t, pos = lay:unpackmany(s, #parts[1] + 1, 10)
+    assert(#t == 10 and t[1][1] == 2 and t[10][1] == 11, "Failed unpackmany count test")
+    assert(lay:unpackmany(s, pos, 1)[1][1] == 12, "Failed unpackmany position test")
+    assert(#lay:unpackmany(s, -1, 0) == 0 and #lay:unpackmany("") == 0, "Failed empty unpackmany test")
+    assert(not pcall(lay.unpackmany, lay, s .. "x"), "Failed partial record test")
+    assert(not pcall(lay.unpackmany, lay, s, 1, 1001), "Failed short records test")
+    assert(not pcall(lay.unpackmany, lay, s, 1, -1), "Failed negative count test")
+    assert(lay:packmany(recs, 3, 4) == parts[3] .. parts[4] and lay:packmany(recs, 5, 4) == "", "Failed packmany range test")
+    local ok, e = pcall(lay.packmany, lay, { { 1, 2, "x" }, { 1, "y", "x" } })
+    assert(not ok and e:find("field #2 in record #2", 1, true), "Failed packmany field error test")
+    ok, e = pcall(lay.packmany, lay, { { 1, 2, "x" }, 5 })
+    assert(not ok and e:find("record #2", 1, true), "Failed packmany record error test")
+    ok, e = pcall(lay.packmany, lay, { { 70000, 2, "x" } })
+    assert(not ok and e:find("unsigned overflow", 1, true), "Failed packmany overflow test")
+end
+
+-- single-value layouts use bare values, alignment counts from the start
+do
+    local lay = string.compilepack("!8 b d")
+    local vals = {}
+    for i = 1, 100 do vals[i] = { i, i * 0.5 } end
+    local s = lay:packmany(vals)
+    assert(#s == 1600 and s == string.pack(string.rep("!8 b d", 100), table.unpack((function()
+        local flat = {}
+        for i = 1, 100 do flat[#flat + 1] = i; flat[#flat + 1] = i * 0.5 end
+        return flat
+    end)())), "Failed aligned packmany test")
+    local d = string.compilepack("<d")
+    local nums = {}
+    for i = 1, 500 do nums[i] = i * 1.5 end
+    local t = d:unpackmany(d:packmany(nums))
+    assert(#t == 500 and t[1] == 1.5 and t[500] == 750.0, "Failed bare value test")
+    local z = string.compilepack("z")
+    assert(table.concat(z:unpackmany(z:packmany({ "a", "bc", "", "d" })), ",") == "a,bc,,d", "Failed bare string test")
+    local e = string.compilepack("c0")
+    assert(#e:unpackmany("abc", 1, 5) == 5 and not pcall(e.unpackmany, e, "abc"), "Failed empty record test")
+    assert(#string.compilepack("x"):unpackmany("abc")[1] == 0, "Failed no value test")
+    local big = string.compilepack("<s4")
+    local long = string.rep("y", 1000)
+    local r = big:unpackmany(big:packmany({ long, long .. "z" }))
+    assert(r[1] == long and r[2] == long .. "z", "Failed long string test")
+end
+
+-- long records of variable size do not preallocate for tiny records
+do
+    local long = string.rep("v", 4 * 1024 * 1024)
+    for _, fmt in ipairs({ "<s4", "z" }) do
+        local lay = string.compilepack(fmt)
+        local data = lay:pack(long)
+        collectgarbage()
+        local before = collectgarbage("count")
+        local t = lay:unpackmany(data)
+        local growth = (collectgarbage("count") - before) * 1024
+        assert(#t == 1 and t[1] == long, "Failed long record test")
+        assert(growth < 2 * #long, "Failed long record memory test")
+    end
+    local lay = string.compilepack("z")
+    assert(#lay:unpackmany(string.rep("a\0", 100)) == 100, "Failed many variable records test")
+end
+
+print("OK")
@@ -0,0 +1,88 @@
+local debug = require "debug"
+
+-- compile-time constants
+do
+    local MAX <const> = 100
+    local NAME <const> = "apo" .. "llo"
+    local HALF <const> = MAX / 2
+    local NOTHING <const> = nil
+    local function f()
+        local s = 0
+        for i = 1, MAX do s = s + i end
+        return s, NAME, #NAME, HALF, NOTHING
+    end
+    local s, name, len, half, nothing = f()
+    assert(s == 5050 and name == "apollo" and len == 6, "Failed constant value test")
+    assert(half == 50.0 and math.type(half) == "float" and nothing == nil, "Failed constant type test")
+    assert(debug.getinfo(f, "u").nups == 0, "Failed constant upvalue test")
+end
+
+-- constants take no register and are not in debug information
+do
+    local f = assert(load("local A <const> = 1; local b = A + 1; return require('debug').getlocal(1, 1)"))
+    local name, value = f()
+    assert(name == "b" and value == 2, "Failed constant register test")
+end
+
+-- scoping
+do
+    local X <const> = 1
+    do
+        local X = 2
+        assert(X == 2, "Failed local shadowing test")
+    end
+    local Y = X + 1
+    local X = Y
+    assert(X == 2, "Failed constant shadowing test")
+    local a, b <const> = 10, 20
+    assert(a == 10 and b == 20, "Failed multiple declaration test")
+end
+
+-- '<const>' locals with run-time values are read-only locals
+do
+    local t <const> = {}
+    t.x = 1
+    assert(t.x == 1, "Failed read-only table test")
+    local f = function() return t end
+    assert(f() == t, "Failed read-only upvalue test")
+end
+
+-- constant guards drop dead code
+do
+    local f, active
+    f = assert(load([[
+local DEBUG <const> = false
+local x = 0
+if DEBUG then
+    x = 1
+end
+return x
+]], "=const"))
+    active = debug.getinfo(f, "L").activelines
+    assert(f() == 0 and not active[4], "Failed constant guard test")
+end
+
+-- assignments are compile errors
+for _, src in ipairs({
+    "local c <const> = 1; c = 2",
+    "local c <const> = {}; c = 2",
+    "local c <const> = 1; c += 1",
+    "local c <const> = 1; c++",
+    "local c <const> = 1; function c() end",
+    "local c <const> = {}; return function() return function() c = 1 end end",
+    "local a, c <const> = 1, {}; a, c = 2, 3",
+}) do
+    local f, err = load(src)
+    assert(f == nil and err:find("attempt to assign to const variable 'c'"), "Failed assignment check test")
+end
+assert(select(2, load("local c <close> = 1")):find("unknown attribute 'close'"), "Failed attribute check test")
+
+-- lazy functions that see constants are compiled at once
+do
+    local f = assert(load("local K <const> = 7; local t <const> = {}; return function() return K end, function() return t end", "=lazy", "tl"))
+    local g, h = f()
+    assert(g() == 7 and type(h()) == "table", "Failed lazy constant test")
+    assert(not load("local t <const> = {}; return function() t = 1 end", "=lazy", "tl"), "Failed lazy read-only test")
+end
+
+print("OK")
@@ -125,7 +125,7 @@ if nil then
 else
   a=2
 end
-]], {2,5,6})
+]], {5,6})   -- dead 'then' part is dropped with its test
 
 test([[a=1
 repeat
@@ -0,0 +1,65 @@
+local threads = require "threads"
+
+local line = "alpha beta gamma 42\n"
+local text = string.rep(line, 5000)  -- 100 KB
+
+-- large strings received from a thread use the message bytes
+do
+    local s, small, n = threads.spawn(function(t)
+        return t, t:sub(1, 5), #t
+    end, text):join()
+    assert(s == text and #s == n and small == "alpha", "Failed external value test")
+    assert(s:sub(21, 25) == "alpha" and s:byte(-1) == 10, "Failed external sub test")
+    assert(s:find("gamma 42\nalpha", 1, true) == 12 and s:match("(%a+) (%d+)") == "gamma", "Failed external search test")
+    assert(select(2, s:gsub("beta", "")) == 5000 and s:upper() == text:upper(), "Failed external lstrlib test")
+    assert(s .. "!" == text .. "!" and s < text .. "!" and s >= text, "Failed external comparison test")
+    local t = { [text] = 1 }
+    assert(t[s] == 1 and string.format("%s", s) == text, "Failed external key test")
+    assert(string.unpack("s4", string.pack("s4", s)) == text, "Failed external pack test")
+    assert(load("return " .. string.format("%q", s))() == text, "Failed external quote test")
+end
+
+-- borrowed bytes count as memory of the receiving state
+do
+    local ch = threads.channel(1)
+    ch:send(string.rep("x", 1000000))
+    collectgarbage()
+    local before = collectgarbage("count")
+    local s = ch:recv()
+    assert(#s == 1000000 and s:sub(-3) == "xxx", "Failed external receive test")
+    assert(collectgarbage("count") - before > 976, "Failed external memory test")
+    s = nil
+    collectgarbage()
+    assert(collectgarbage("count") - before < 100, "Failed external release test")
+end
+
+-- strings outlive each other and the message they came in
+do
+    local ch = threads.channel(8)
+    local t = threads.spawn(function(ch, s)
+        for i = 1, 100 do
+            ch:send({ s .. i, i, s:rep(2) .. i })
+        end
+        ch:close()
+    end, ch, text:sub(1, 2000))
+    local kept, slices = {}, {}
+    while true do
+        local m = ch:recv()
+        if m == nil then break end
+        kept[m[2]] = m[1]
+        slices[m[2]] = m[3]:sub(3001, 3500)
+    end
+    t:join()
+    collectgarbage()
+    for i = 1, 100 do
+        assert(kept[i] == text:sub(1, 2000) .. i, "Failed external lifetime test")
+        assert(slices[i] == text:sub(1001, 1500), "Failed external slice test")
+    end
+    kept = nil
+    collectgarbage()
+    for i = 1, 100 do
+        assert(slices[i] == text:sub(1001, 1500), "Failed orphan external slice test")
+    end
+end
+
+print("OK")
@@ -0,0 +1,93 @@
+local debug = require "debug"
+
+-- constant expressions give the same values as at run time
+do
+    local one, s = 1, "ab"
+    assert((1 == 1.0) == (one == 1.0) and (1 < 1.5) == (one < 1.5), "Failed numeric comparison test")
+    assert((2 >= 3) == false and (3 > 2) == true and (2 <= 2) == true, "Failed order test")
+    assert(("ab" == "ab") == (s == "ab") and ("ab" != "ba") == true, "Failed string equality test")
+    assert((nil == false) == false and (true ~= true) == false, "Failed nil/boolean test")
+    assert((`apollo` == `apollo`) == true and (`apollo` == `other`) == false, "Failed hash literal test")
+    assert(math.type(#"hello") == "integer" and #"hello" == 5 and #"" == 0, "Failed length test")
+    assert("a" .. "b" .. "c" == "abc", "Failed concatenation test")
+    assert(1 .. "" == one .. "" and 2.5 .. "x" == "2.5x" and 1e100 .. "" == 1e100 .. s:sub(3), "Failed number concatenation test")
+    assert("x" .. 2^63 == "x" .. (2^63 + one - 1), "Failed float concatenation test")
+    assert(s .. "c" .. "d" == "abcd" and "c" .. "d" .. s == "cdab", "Failed mixed concatenation test")
+    assert(#("ab" .. "cd") == 4 and not ("a" == "b") and !(1 < 2) == false, "Failed combined folding test")
+end
+
+-- order comparisons of strings, mixed types and concatenations of floats are not folded
+do
+    assert(("a" < "b") == true, "Failed string order test")
+    assert(not pcall(load("return 1 < 'x'")), "Failed invalid comparison test")
+    -- floats are converted with the run-time locale's decimal point
+    assert(string.dump(load("return 1 .. 'x'")):find("1x", 1, true), "Failed integer concatenation folding test")
+    assert(not string.dump(load("return 2.5 .. 'x'")):find("2.5x", 1, true), "Failed float concatenation folding test")
+end
+
+local function lines(src, mode)
+    local f = assert(load(src, "=fold", mode))
+    return f, debug.getinfo(f, "L").activelines
+end
+
+-- dead branches leave no code
+for _, mode in ipairs({ "t", "to", "tO", "tl" }) do
+    local f, active = lines([[
+local x = 0
+if false then
+    x = 1
+elseif nil then
+    x = 2
+end
+while false do
+    x = x + 3
+end
+if 1 < 2 then
+    x = x + 10
+elseif x then
+    x = 100
+else
+    x = 1000
+end
+return x
+]], mode)
+    assert(f() == 10, "Failed dead branch result test")
+    for l = 2, 8 do assert(not active[l], "Failed dead branch test") end
+    for l = 12, 15 do assert(not active[l], "Failed dead else test") end
+end
+
+-- dead branches that jump out of themselves are kept
+do
+    local f = assert(load([[
+local n = 0
+for i = 1, 3 do
+    if false then break end
+    if nil then goto skip end
+    while false do continue end
+    n = n + i
+    ::skip::
+end
+if true then n = n + 1 else goto out end
+::out::
+return n
+]], "=fold"))
+    assert(f() == 7, "Failed escaping goto test")
+end
+
+-- functions and locals of dead code disappear, later ones still work
+do
+    local f = assert(load([[
+local a = 1
+if false then
+    local dead = function() return a end
+    a = dead()
+end
+local b = 2
+local g = function() return a + b end
+return g(), require("debug").getlocal(1, 2)
+]], "=fold"))
+    local r, name, v = f()
+    assert(r == 3 and name == "b" and v == 2, "Failed dead function test")
+end
+
+print("OK")
@@ -0,0 +1,45 @@
+-- direct conversions agree with the C library
+do
+    local f = string.format
+    assert(f("%d %i %d", 0, -7, math.mininteger) == "0 -7 " .. tostring(math.mininteger), "Failed integer test")
+    assert(f("%d", 3.0) == "3" and not pcall(f, "%d", 3.5), "Failed integer conversion test")
+    assert(f("%x %X %x", 255, 48879, -1) == "ff BEEF ffffffffffffffff", "Failed hexadecimal test")
+    assert(f("%s|%s|%s", "a\0b", 12, nil) == "a\0b|12|nil", "Failed string test")
+    assert(f("%q", "a\nb\"\0") == '"a\\\nb\\"\\0"' and f("%q", 7) == "7", "Failed quote test")
+    for _, x in ipairs({ 0, -0.0, 0.5, -0.001, 1.005, 2.675, 0.125, 99.995, 123456.789, 1e15, 2^53, 1e300, 1/0, -1/0, 1e-7 }) do
+        for p = 0, 17 do
+            local ref = f("%5." .. p .. "f", x):gsub("^%s+", "")  -- width avoids the direct path
+            assert(f("%." .. p .. "f", x) == ref, "Failed fixed float test")
+        end
+        assert(f("%f", x) == f("%1f", x):gsub("^%s+", ""), "Failed default precision test")
+    end
+    assert(f("%.3f", 0/0):find("nan") and f("%.2f", -0.0) == "-0.00", "Failed special float test")
+end
+
+-- other conversions and literal text
+do
+    local f = string.format
+    assert(f("100%% of %5.1f%%", 99.44) == "100% of  99.4%", "Failed literal text test")
+    assert(f("%-5s|%5s|%.2s", "ab", "cd", "xyz") == "ab   |   cd|xy", "Failed modified string test")
+    assert(f("%c%c", 72, 105) == "Hi" and f("%05d|%+d|%o", 42, 5, 8) == "00042|+5|10", "Failed flags test")
+    assert(f("%g %e", 1e20, 1.5) == "1e+20 1.500000e+00", "Failed exponent test")
+    assert(f("") == "" and f("plain") == "plain" and f("%%") == "%", "Failed text only test")
+end
+
+-- errors are the same with and without a cached format
+do
+    for _ = 1, 2 do
+        local ok, err = pcall(string.format, "%d %d", 1)
+        assert(not ok and err:find("bad argument #3 to '[%w.]*format' %(no value%)"), "Failed missing argument test")
+        ok, err = pcall(string.format, "%d %y", "x")
+        assert(not ok and err:find("number expected, got string"), "Failed argument order test")
+        ok, err = pcall(string.format, "%d %y", 1, 2)
+        assert(not ok and err:find("invalid option '%%y' to '[%w.]*format'"), "Failed invalid option test")
+        ok, err = pcall(string.format, "%123d", 1)
+        assert(not ok and err:find("invalid format %(width or precision too long%)"), "Failed long width test")
+        assert(not pcall(string.format, "%10s", "a\0b"), "Failed zeros test")
+        assert(not pcall(string.format, "abc%"), "Failed trailing percent test")
+    end
+end
+
+print("OK")
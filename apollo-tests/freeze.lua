@@ -0,0 +1,54 @@
+local function fails(f, ...)
+    local ok, err = pcall(f, ...)
+    return not ok and err:find("frozen table") ~= nil
+end
+
+do
+    local mt = { __index = { default = 1 } }
+    local cfg = setmetatable({ name = "items", list = { 1, 2, 3 }, [{ "key" }] = true }, mt)
+    assert(table.freeze(cfg) == cfg, "Failed freeze return test")
+    assert(table.isfrozen(cfg) and table.isfrozen(cfg.list), "Failed deep freeze test")
+    assert(table.isfrozen(mt) and table.isfrozen(mt.__index), "Failed metatable freeze test")
+    for k in pairs(cfg) do
+        if type(k) == "table" then assert(table.isfrozen(k), "Failed key freeze test") end
+    end
+    assert(not table.isfrozen({}) and not table.isfrozen(1), "Failed isfrozen test")
+
+    assert(cfg.name == "items" and cfg.default == 1 and #cfg.list == 3, "Failed frozen read test")
+    assert(fails(function() cfg.name = "x" end), "Failed existing field test")
+    assert(fails(function() cfg.new = 1 end), "Failed new field test")
+    assert(fails(function() cfg.list[1] = 0 end), "Failed nested field test")
+    assert(fails(function() cfg.name = cfg.name end), "Failed same value test")
+    assert(fails(rawset, cfg, "name", 1), "Failed rawset test")
+    assert(fails(setmetatable, cfg, nil), "Failed setmetatable test")
+    assert(fails(table.insert, cfg.list, 4), "Failed table.insert test")
+    assert(fails(table.remove, cfg.list), "Failed table.remove test")
+    assert(fails(table.sort, table.freeze({ 3, 1, 2 })), "Failed table.sort test")
+    local ok, err = pcall(function() cfg.list[2] = 0 end)
+    assert(err:find("field 'list'"), "Failed frozen error message test: " .. err)
+    assert(cfg.list[1] == 1 and cfg.name == "items" and rawget(cfg, "new") == nil, "Failed frozen contents test")
+
+    -- compound assignment goes through the same checks
+    local t = table.freeze({ n = 1 })
+    assert(fails(function() t.n += 1 end), "Failed compound assignment test")
+    assert(t.n == 1, "Failed compound assignment test")
+end
+
+-- cycles and shared subtables are frozen once
+do
+    local a, b = {}, {}
+    a.b, b.a, a.self = b, a, a
+    table.freeze(a)
+    assert(table.isfrozen(b), "Failed cycle freeze test")
+end
+
+-- frozen tables keep their state when copied to a worker
+if threads then
+    local t = table.freeze({ x = 1, sub = { y = 2 } })
+    local frozen, sub, plain = threads.spawn(function(t, p)
+        return table.isfrozen(t), table.isfrozen(t.sub), table.isfrozen(p)
+    end, t, { 1 }):join()
+    assert(frozen and sub and not plain, "Failed frozen transfer test")
+end
+
+print("OK")
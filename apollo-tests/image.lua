@@ -0,0 +1,74 @@
+-- bytecode images need 'luac' next to the interpreter
+local progname
+do
+    local i = 0
+    while arg[i] do i = i - 1 end
+    progname = arg[i + 1]
+end
+local luac = progname:gsub("lua([^/\\]*)$", "luac%1")
+if not io.open(luac) then
+    print("luac not found; skipping image tests")
+    return
+end
+
+local src, img, plain = os.tmpname(), os.tmpname(), os.tmpname()
+local stripped, bad = os.tmpname(), os.tmpname()
+local function compile(opts, out)
+    assert(os.execute(string.format('"%s" %s -o "%s" "%s"', luac, opts, out, src)), "Failed luac test")
+end
+
+do
+    local f = assert(io.open(src, "w"))
+    f:write("local n = ...\n",
+            "local function fib(k) if k < 2 then return k end return fib(k - 1) + fib(k - 2) end\n",
+            "local function check(v) if v < 0 then error('neg') end return v end\n",
+            "return fib(n), check, function(s) return s .. '!' end\n")
+    f:close()
+end
+compile("-m", img)
+compile("", plain)
+
+do
+    local h = assert(io.open(img, "rb"))
+    local sig = h:read(7)
+    h:close()
+    assert(sig == "\27LuaImg", "Failed image signature test")
+    local f = assert(loadfile(img))
+    local v, check, bang = f(20)
+    assert(v == 6765 and bang("x") == "x!", "Failed image load test")
+    assert(v == loadfile(plain)(20), "Failed image equivalence test")
+    local ok, err = pcall(check, -1)
+    assert(not ok and err:find(":3: neg$"), "Failed image line info test")
+    assert(loadfile(img) ~= f and loadfile(img)(10) == 55, "Failed image reload test")
+end
+
+-- functions keep the image alive after the loader is gone
+do
+    local _, check = loadfile(img)(1)
+    collectgarbage(); collectgarbage()
+    assert(check(3) == 3, "Failed image lifetime test")
+end
+
+do
+    compile("-m -s", stripped)
+    local _, check = assert(loadfile(stripped))(1)
+    local ok, err = pcall(check, -1)
+    assert(not ok and err == "neg", "Failed stripped image test")
+    assert(select(2, loadfile(stripped, "t")):find("mode is 't'"), "Failed image mode test")
+end
+
+do
+    local h = assert(io.open(img, "rb"))
+    local data = h:read("a")
+    h:close()
+    h = assert(io.open(bad, "wb"))
+    h:write(data:sub(1, 64))
+    h:close()
+    local f, err = loadfile(bad)
+    assert(f == nil and err:find("bad bytecode image"), "Failed truncated image test")
+end
+
+os.remove(src); os.remove(img); os.remove(plain)
+os.remove(stripped); os.remove(bad)
+
+print("OK")
@@ -0,0 +1,113 @@
+local src = [[
+local up = 10
+local M = { k = 3 }
+function M.add(a, b) return a + b + up end
+function M:scale(x) return self.k * x end
+local function fact(n) if n <= 1 then return 1 end return n * fact(n - 1) end
+M.fact = fact
+function M.counter()
+    local n = 0
+    return function() n = n + 1; up = up + 1; return n, up end
+end
+function M.fail()
+    local t = nil
+    return t.x
+end
+function M.bad() return 1 + end
+function M.loops(n)
+    local s = 0
+    for i = 1, n do
+        while false do end
+        repeat s = s + i until true
+        if i % 2 == 0 then s = s + 1 elseif i > 100 then break else s = s - 1 end
+    end
+    do local up = 0; s = s + up end
+    return s
+end
+return M
+]]
+
+-- lazy functions behave like eagerly compiled ones
+do
+    local M = assert(load(src, "=lazy", "tl"))()
+    assert(M.add(1, 2) == 13, "Failed upvalue test")
+    assert(M:scale(4) == 12, "Failed method test")
+    assert(M.fact(10) == 3628800, "Failed recursion test")
+    local c = M.counter()
+    local n, up = c()
+    assert(n == 1 and up == 11 and select(2, c()) == 12, "Failed nested closure test")
+    assert(M.add(0, 0) == 12, "Failed shared upvalue test")
+    assert(M.loops(10) == 55, "Failed block test")
+    local _, err = pcall(M.fail)
+    assert(err:find("^lazy:13: attempt to index a nil value %(local 't'%)"), "Failed line number test")
+end
+
+-- syntax errors in a body are raised when it is called
+do
+    assert(load(src, "=eager", "t") == nil, "Failed eager syntax error test")
+    local M = assert(load(src, "=lazy", "tl"))()
+    for _ = 1, 2 do
+        local ok, err = pcall(M.bad)
+        assert(not ok and err:find("^lazy:15: unexpected symbol near 'end'"), "Failed deferred syntax error test")
+    end
+    assert(not pcall(string.dump, M.bad), "Failed dump syntax error test")
+    assert(M.add(1, 1) == 12, "Failed syntax error isolation test")
+end
+
+-- dumped lazy functions are fully compiled
+do
+    local f = assert(load("local x = ...; return function(y) return function() return x + y end end", "=d", "tl"))
+    local g = load(string.dump(f), "=d", "b")
+    assert(g(1)(2)() == 3, "Failed dump test")
+end
+
+-- modules
+do
+    local name = os.tmpname()
+    local file = assert(io.open(name .. ".lua", "w"))
+    file:write("local M = {}\nfunction M.twice(x) return 2 * x end\nreturn M\n")
+    file:close()
+    local path, lazy = package.path, package.lazy
+    assert(lazy == false, "Failed package.lazy default test")
+    package.path = name .. ".lua"
+    package.lazy = true
+    local M = require("lazymod")
+    package.path, package.lazy = path, lazy
+    package.loaded.lazymod = nil
+    os.remove(name .. ".lua")
+    os.remove(name)
+    assert(M.twice(21) == 42, "Failed lazy module test")
+end
+
+-- names after a local declaration are still resolved when skimming
+do
+    local src = "local y = 0\nlocal function f()\n  local x\n  y = 5\nend\nf()\nreturn y"
+    assert(load(src, "=lz", "tl")() == 5, "Failed name after local test")
+    src = "local function f()\n  local a\n  return type(a)\nend\nreturn f()"
+    assert(load(src, "=lz", "tl")() == "nil", "Failed global after local test")
+    src = "local n = 1\nreturn function()\n  for i = 1, 2 do end\n  local a, b\n  n = n + 1\n  return n\nend"
+    assert(load(src, "=lz", "tl")()() == 2, "Failed name after for test")
+end
+
+-- unused bodies are not compiled
+do
+    local lines = { "local M = {}" }
+    for i = 1, 200 do
+        lines[#lines + 1] = string.format("function M.f%d(a, b) local t = { a, b, %d } for i = 1, #t do a = a + t[i] * b end return a end", i, i)
+    end
+    lines[#lines + 1] = "return M"
+    local big = table.concat(lines, "\n")
+    local function size(mode)
+        collectgarbage()
+        local m = collectgarbage("count")
+        local M = load(big, "=big", mode)()
+        collectgarbage()
+        return collectgarbage("count") - m, M
+    end
+    local eager = size("t")
+    local lazy, M = size("tl")
+    assert(lazy < eager, "Failed memory test")
+    assert(M.f7(1, 2) == 1 + 2 * (1 + 2 + 7), "Failed big module test")
+end
+
+print("OK")
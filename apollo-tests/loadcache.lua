@@ -0,0 +1,72 @@
+local old = collectgarbage("loadcache", 3)
+assert(old == 0 and collectgarbage("loadcache") == 3, "Failed load cache capacity test")
+local h0, m0 = collectgarbage("loadstats")
+
+-- hits give fresh closures with their own upvalues
+do
+    local src = "local n = ... or 0\nreturn function() n = n + 1 return n end"
+    local f1, f2 = load(src), load(src)
+    assert(f1 ~= f2, "Failed fresh closure test")
+    local c1, c2 = f1(10), f2(20)
+    assert(c1() == 11 and c2() == 21 and c1() == 12, "Failed fresh upvalue test")
+    local h, m = collectgarbage("loadstats")
+    assert(h == h0 + 1 and m == m0 + 1, "Failed load cache hit test")
+end
+
+-- name, mode and environment
+do
+    local src = "return x"
+    assert(load(src, "=a", "t", { x = 1 })() == 1, "Failed env test")
+    assert(load(src, "=a", "t", { x = 2 })() == 2, "Failed cached env test")
+    x = "global"
+    assert(load(src, "=a", "t")() == "global", "Failed cached global env test")
+    x = nil
+    local h, m = collectgarbage("loadstats")
+    assert(load(src, "=b")() == nil and load(src, "=b", "bt") ~= nil, "Failed name test")
+    local h2, m2 = collectgarbage("loadstats")
+    assert(h2 == h + 1 and m2 == m + 1, "Failed name and mode key test")
+    local _, err = pcall(load(src .. "+nil", "=c"))
+    assert(err:find("^c:1:"), "Failed cached chunk name test")
+    _, err = pcall(load(src .. "+nil", "=c"))
+    assert(err:find("^c:1:"), "Failed cached chunk name test")
+end
+
+-- least recently used entries are evicted
+do
+    collectgarbage("loadcache", 0)
+    collectgarbage("loadcache", 2)
+    local _, _, e0, n0 = collectgarbage("loadstats")
+    assert(n0 == 0, "Failed load cache clear test")
+    load("return 1"); load("return 2"); load("return 1"); load("return 3")
+    local h, m, e, n = collectgarbage("loadstats")
+    assert(e == e0 + 1 and n == 2, "Failed eviction test")
+    load("return 1")
+    local h2, m2 = collectgarbage("loadstats")
+    assert(h2 == h + 1 and m2 == m, "Failed LRU test")
+    assert(load("x = = 1") == nil and select(4, collectgarbage("loadstats")) == 2, "Failed error not cached test")
+end
+
+-- replaced entries move to the front; eviction order survives churn
+do
+    collectgarbage("loadcache", 0)
+    collectgarbage("loadcache", 3)
+    load("return 1"); load("return 2"); load("return 3")
+    load("return 1", "=other")  -- replaces the oldest entry
+    load("return 4")  -- evicts "return 2"
+    local h, m, e, n = collectgarbage("loadstats")
+    load("return 3"); load("return 1", "=other")
+    local h2, m2 = collectgarbage("loadstats")
+    assert(n == 3 and h2 == h + 2 and m2 == m, "Failed replaced entry test")
+    collectgarbage("loadcache", 100)
+    for i = 1, 1000 do load("return " .. i % 150) end
+    local _, _, _, n2 = collectgarbage("loadstats")
+    assert(n2 == 100, "Failed load cache churn test")
+    local h3 = collectgarbage("loadstats")
+    for i = 901, 1000 do load("return " .. i % 150) end
+    assert(collectgarbage("loadstats") == h3 + 100, "Failed load cache churn order test")
+end
+
+collectgarbage("loadcache", old)
+assert(select(4, collectgarbage("loadstats")) == 0, "Failed load cache disable test")
+
+print("OK")
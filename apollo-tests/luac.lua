@@ -0,0 +1,69 @@
+-- parallel compilation needs 'luac' next to the interpreter
+local progname
+do
+    local i = 0
+    while arg[i] do i = i - 1 end
+    progname = arg[i + 1]
+end
+local luac = progname:gsub("lua([^/\\]*)$", "luac%1")
+if not io.open(luac) then
+    print("luac not found; skipping luac tests")
+    return
+end
+
+local function write(name, s)
+    local f = assert(io.open(name, "w"))
+    f:write(s)
+    f:close()
+    return name
+end
+
+local function read(name)
+    local f = assert(io.open(name, "rb"))
+    local s = f:read("a")
+    f:close()
+    return s
+end
+
+local inputs, names = {}, {}
+for i = 1, 12 do
+    inputs[i] = write(os.tmpname(), string.format("N = (N or 0) + 1\nlocal t = { %d }\nreturn function() return t[1] + N end\n", i))
+    names[i] = '"' .. inputs[i] .. '"'
+end
+local files = table.concat(names, " ")
+local out1, outn = os.tmpname(), os.tmpname()
+
+local function luacout(opts, out)
+    return os.execute(string.format('"%s" %s -o "%s" %s 2>"%s"', luac, opts, out, files, out .. ".err"))
+end
+
+-- output does not depend on the number of threads
+for _, opts in ipairs({ "", "-s", "-m", "--bundle" }) do
+    if opts == "--bundle" then
+        local b = {}
+        for i = 1, #inputs do b[i] = string.format('m%d="%s"', i, inputs[i]) end
+        files = table.concat(b, " ")
+    end
+    assert(luacout("-j 1 " .. opts, out1) and luacout("-j 4 " .. opts, outn), "Failed luac -j test")
+    assert(read(out1) == read(outn), "Failed deterministic output test")
+end
+N = nil
+assert(loadfile(out1) == nil and package.addbundle(out1) == 12, "Failed parallel bundle test")
+assert(require("m12")() == 13 and N == 1, "Failed parallel bundle load test")
+N, package.loaded.m12 = nil, nil
+
+-- the first failing input (in argument order) is reported
+files = table.concat(names, " ")
+write(inputs[5], "x = = 1")
+write(inputs[9], "y = = 1")
+assert(not luacout("-j 4", outn), "Failed luac error test")
+assert(read(outn .. ".err"):find(inputs[5] .. ":1:", 1, true), "Failed luac error order test")
+assert(not os.execute(string.format('"%s" -j 0 -p "%s" 2>"%s"', luac, inputs[1], outn .. ".err")), "Failed -j argument test")
+
+for _, name in ipairs(inputs) do os.remove(name) end
+for _, name in ipairs({ out1, outn }) do
+    os.remove(name)
+    os.remove(name .. ".err")
+end
+
+print("OK")
@@ -0,0 +1,52 @@
+-- float to string: same as "%.14g" (plus ".0" for integral values)
+local function ref(x)
+    local s = string.format("%.14g", x)
+    if s:find("^[-0-9]*$") then s = s .. ".0" end
+    return s
+end
+
+do
+    local values = { 0.0, 1/0, 0/0, 0.1, 0.1 + 0.2, 1/3, 2/3, 0.5, 2.5, 100.0, 1e15, 1e16, 2^53, 2^63, 1e100, 5e-324,
+                     1e-4, 1e-5, 9.99999999999995e-5, 1e-14, 1.25e-5, 3.14159265358979, 99999999999999.5,
+                     123456789012345.0, 123456789012355.0, 999999999999995.0, 0.30000000000000004 }
+    for _, x in ipairs(values) do
+        assert(tostring(x) == ref(x) and tostring(-x) == ref(-x), "Failed float to string test")
+    end
+    assert(tostring(-0.0) == "-0.0" and tostring(1e15) == "1e+15" and tostring(2^63) == "9.2233720368548e+18", "Failed format test")
+    assert(tostring(123456789012345.0) == "1.2345678901234e+14", "Failed tie to even test")
+    assert(tostring(123456789012355.0) == "1.2345678901236e+14", "Failed tie to even upward test")
+    assert(1e-5 .. "" == "1e-05" and 0.0001 .. "" == "0.0001", "Failed exponent threshold test")
+    math.randomseed(42)
+    for _ = 1, 20000 do
+        local x = string.unpack("d", string.pack("i4i4", math.random(0, 2^32 - 1) - 2^31, math.random(0, 2^32 - 1) - 2^31))
+        assert(tostring(x) == ref(x), "Failed random bits test")
+        x = math.random(1, 10^14) * 10.0 ^ math.random(-20, 5)
+        assert(tostring(x) == ref(x), "Failed random decimal test")
+    end
+end
+
+-- string to float: short numerals give the same as long ones read by the C library
+do
+    local pad = ("0"):rep(20)  -- more digits than the fast path takes
+    for _, s in ipairs({ "0.1", "3.14159", "1e22", "1e23", "123456789.123", "9007199254740993.0", "2.5e-10", "1e-22",
+                         ".5", "5.", "-0.0", "1.7976931348623157e308", "4.9e-324", "  7.25  ", "+1.5E+3" }) do
+        local m, e = s:match("^(%s*[-+]?[%d.]*)(.*)$")
+        if not m:find("%.") then m = m .. "." end
+        local v = tonumber(s)
+        assert(v == tonumber(m .. pad .. e) and math.type(v) == "float", "Failed string to float test")
+    end
+    assert(1 / tonumber("-0.0") < 0 and tonumber("0.1") == 0.1 and tonumber("1e5") == 100000.0, "Failed value test")
+    for _, s in ipairs({ "1e", "1e+", ".", "-", "1.5x", "0x1.8p1x", "1..2", "e5", "1 2" }) do
+        assert(tonumber(s) == nil, "Failed invalid numeral test")
+    end
+    assert(tonumber("0x1.8p1") == 3.0 and tonumber("  0b101  ") == 5 and tonumber("1e400") == 1/0, "Failed other numeral test")
+    math.randomseed(7)
+    for _ = 1, 20000 do
+        local x = math.random() * 10 ^ math.random(-30, 30)
+        local s = string.format("%.15g", x)
+        assert(tonumber(s) == tonumber(string.format("%.30g", tonumber(s))), "Failed round trip test")
+        assert(tonumber(tostring(x)) == tonumber(string.format("%.14g", x)), "Failed tostring round trip test")
+    end
+end
+
+print("OK")
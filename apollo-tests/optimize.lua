@@ -0,0 +1,90 @@
+local src = [[
+local n = ...
+local s, t = 0, {}
+for i = 1, n do
+    if i % 3 == 0 then continue end
+    local j = i
+    while j > 0 do
+        j = j - 4
+        if j % 2 == 0 then continue end
+        s = s + 1
+    end
+    if i > 10 then
+        t[#t + 1] = i
+    else
+        t[#t + 1] = -i
+    end
+    goto next
+    s = s + 1000  -- unreachable
+    ::next::
+end
+local a = s; a = #t
+local function f(x)
+    if x then return "yes" else return "no" end
+    return "unreachable constant"
+end
+local ok, err = pcall(function() local z = nil; return z.field end)
+return s, a, table.concat(t, ","), f(true), f(false), err
+]]
+
+-- all levels compute the same results
+local results = {}
+for _, mode in ipairs({ "t", "to", "tO" }) do
+    local r = table.pack(assert(load(src, "=opt", mode))(20))
+    results[#results + 1] = table.concat(r, "|", 1, r.n)
+end
+assert(results[1] == results[2] and results[1] == results[3], "Failed optimized results test")
+assert(results[1]:find("opt:25: attempt to index a nil value", 1, true), "Failed optimized line info test")
+
+-- optimized code is smaller and drops unused constants
+do
+    local d0 = string.dump(load(src, "=opt", "t"))
+    local d1 = string.dump(load(src, "=opt", "to"))
+    local d2 = string.dump(load(src, "=opt", "tO"))
+    assert(#d1 < #d0 and #d2 < #d1, "Failed code size test")
+    assert(d1:find("unreachable constant", 1, true) and not d2:find("unreachable constant", 1, true),
+           "Failed constant compaction test")
+end
+
+-- loops that never exit and jumps to jumps
+do
+    local f = assert(load("local n = 0 while true do n = n + 1 if n == 5 then return n end end", "=loop", "tO"))
+    assert(f() == 5, "Failed infinite loop test")
+    f = assert(load([[
+        local r = {}
+        for i = 1, 3 do
+            for j = 1, 3 do
+                if j == 2 then goto continue end
+                do r[#r + 1] = i * 10 + j end
+                ::continue::
+            end
+        end
+        return table.concat(r, " ")
+    ]], "=nested", "tO"))
+    assert(f() == "11 13 21 23 31 33", "Failed nested jump test")
+end
+
+-- moves are kept when the next instruction can call a metamethod
+do
+    local src = [[
+        local x = 1
+        local function peek() return x end
+        local y = 2
+        local t = setmetatable({}, {__index = function() return peek() end})
+        x = y
+        x = t.k
+        return x
+    ]]
+    for _, mode in ipairs({ "t", "tO" }) do
+        assert(load(src, "=peek", mode)() == 2, "Failed captured move test")
+    end
+end
+
+-- lazy functions use the level of their chunk
+do
+    local f = assert(load("return function() if true then return 1 end return 'lazy dead' end", "=lazy", "tlO"))()
+    assert(f() == 1, "Failed lazy optimization test")
+    assert(not string.dump(f):find("lazy dead", 1, true), "Failed lazy optimization level test")
+end
+
+print("OK")
@@ -0,0 +1,46 @@
+-- compiled patterns give the same results as interpreted ones
+do
+    local s = "key1 = value one; key2=(nested (parens)); key3 = %x"
+    assert(s:find("key2") == 19 and select(2, s:find("key%d+")) == 4, "Failed prefix find test")
+    assert(s:match("(key2)%s*=%s*(%b())") == "key2", "Failed balance test")
+    assert(select(2, s:match("(key2)%s*=%s*(%b())")) == "(nested (parens))", "Failed balance capture test")
+    assert(s:match("%f[%w]%w+$") == "x", "Failed frontier test")
+    assert(s:match("()value") == 8 and s:match("^key%d") == "key1" and not s:match("^value"), "Failed anchor test")
+    assert(("abcabc"):match("(a)(b)c%1%2") == "a", "Failed back reference test")
+    assert(("x = 1, y = 22"):gsub("(%w+) = (%d+)", "%2=%1") == "1=x, 22=y", "Failed gsub test")
+    assert(select(2, ("a.b.c"):gsub("%.", "/")) == 2 and ("a.b.c"):gsub("%.", "/", 1) == "a/b.c", "Failed gsub limit test")
+    assert(("hello"):gsub("", "-") == "-h-e-l-l-o-", "Failed empty match test")
+    assert(("a\0b\0c"):find("\0c", 1) == 4 and ("a\0b"):match("%z") == "\0", "Failed embedded zero test")
+    assert(("caf\233!"):find("[\200-\255]") == 4, "Failed high byte test")
+    local words = {}
+    for k, v in ("a=1, b=2, c=3"):gmatch("(%w+)=(%w+)") do words[#words + 1] = k .. v end
+    assert(table.concat(words) == "a1b2c3", "Failed gmatch test")
+    words = {}
+    for w in ("^a ^b"):gmatch("^%a") do words[#words + 1] = w end
+    assert(table.concat(words) == "^a^b", "Failed gmatch anchor test")
+end
+
+-- malformed patterns raise errors only when the faulty part is reached
+do
+    assert(("abc"):find("x%") == nil, "Failed lazy error test")
+    for _, p in ipairs({ "a%", "a[b", "a%b", "a%fx", "a(", "a)", "%1a" }) do
+        for _ = 1, 2 do
+            assert(not pcall(string.match, "abc", p), "Failed malformed pattern test")
+        end
+    end
+    assert(not pcall(string.find, "a", string.rep("(", 40) .. "a"), "Failed capture limit test")
+end
+
+-- the cache survives many distinct patterns and nested use
+do
+    for i = 1, 1000 do
+        local n = tostring(i)
+        assert(("item" .. n .. ";"):match("item(" .. n .. ");") == n, "Failed cache churn test")
+    end
+    local r = ("one two three"):gsub("%a+", function(w)
+        return (w:gsub("^%a", string.upper):gsub("e", "E"))
+    end)
+    assert(r == "OnE Two ThrEE", "Failed nested pattern test")
+end
+
+print("OK")
@@ -0,0 +1,104 @@
+-- protected calls recovered by unrolling, outside coroutines
+do
+    local function fails(msg) error(msg, 0) end
+
+    local ok, err = pcall(fails, "plain")
+    assert(not ok and err == "plain", "Failed plain pcall test")
+
+    ok, err = pcall(pcall, fails, "nested")
+    assert(ok == true and err == false, "Failed nested pcall test")
+
+    local function chain(n)
+        if n == 0 then error({ depth = "bottom" }) end
+        local ok, e = pcall(chain, n - 1)
+        assert(not ok and e.depth == "bottom")
+        error(e)
+    end
+    ok, err = pcall(chain, 150)
+    assert(not ok and err.depth == "bottom", "Failed deep pcall chain test")
+
+    local a, b, c = select(2, pcall(function() return 1, 2, 3 end))
+    assert(a == 1 and b == 2 and c == 3, "Failed multiple results test")
+end
+
+do
+    local mt = { __index = function(t, k)
+        local ok, err = pcall(error, "inner " .. k, 0)
+        assert(not ok)
+        return err
+    end }
+    local t = setmetatable({}, mt)
+    assert(t.x == "inner x", "Failed pcall inside metamethod test")
+    assert(t.x .. t.y == "inner xinner y")
+    -- metamethod reached from a C function without continuation
+    assert(table.concat(t, ",", 1, 2) == "inner 1,inner 2", "Failed pcall below C frame test")
+end
+
+do
+    local t = { 3, 1, 2 }
+    table.sort(t, function(a, b)
+        local ok = pcall(error, "x")
+        assert(not ok)
+        return a < b
+    end)
+    assert(t[1] == 1 and t[3] == 3, "Failed pcall inside sort test")
+end
+
+do
+    local ok, err = xpcall(function() error("raw", 0) end, function(m) return "handled " .. m end)
+    assert(not ok and err == "handled raw", "Failed xpcall test")
+
+    ok, err = xpcall(function()
+        local ok2, err2 = xpcall(error, function(m) return m .. "!" end, "in", 0)
+        assert(not ok2 and err2 == "in!")
+        error("out", 0)
+    end, function(m) return m .. "?" end)
+    assert(not ok and err == "out?", "Failed nested xpcall test")
+
+    ok, err = xpcall(error, function() error("again") end, "x")
+    assert(not ok, "Failed error in handler test")
+end
+
+do
+    local function overflow() return 1 + overflow() end
+    local ok, err = pcall(overflow)
+    assert(not ok and string.find(err, "overflow"), "Failed stack overflow test")
+    assert(pcall(overflow) == false)
+end
+
+-- yields straight from the resumed Lua code and across C frames
+do
+    local co = coroutine.wrap(coroutine.yield)
+    assert(co(1, 2) == 1, "Failed direct yield test")
+
+    co = coroutine.wrap(function(...)
+        local a = coroutine.yield(...)
+        local b = select(2, pcall(coroutine.yield, a + 1))
+        local c = setmetatable({}, { __add = function(_, v) return coroutine.yield(v) end }) + b
+        for v in coroutine.wrap(function() coroutine.yield(c) end) do
+            return coroutine.yield(v * 2)
+        end
+    end)
+    assert(co(10) == 10)
+    assert(co(20) == 21, "Failed yield across pcall test")
+    assert(co(30) == 30, "Failed yield inside metamethod test")
+    assert(co(40) == 80, "Failed yield inside nested coroutine test")
+    assert(co("done") == "done")
+end
+
+do
+    local co = coroutine.create(function()
+        local ok, err = pcall(function()
+            coroutine.yield(1)
+            error("after yield", 0)
+        end)
+        coroutine.yield(err)
+        return "end"
+    end)
+    assert(select(2, coroutine.resume(co)) == 1)
+    assert(select(2, coroutine.resume(co)) == "after yield", "Failed error after yield test")
+    assert(select(2, coroutine.resume(co)) == "end")
+    assert(coroutine.status(co) == "dead")
+end
+
+print("OK")
@@ -0,0 +1,60 @@
+local parts = {}
+for i = 1, 20000 do parts[i] = string.format("%06d\n", i) end
+
+-- large results of buffer-based functions
+do
+    local text = table.concat(parts)
+    assert(#text == 140000 and text:sub(1, 14) == "000001\n000002\n", "Failed concat result test")
+    assert(text:sub(-7) == "020000\n" and text:find("010000\n", 1, true) == 69994, "Failed concat content test")
+    local r = string.rep("ab", 50000, "-")
+    assert(#r == 149999 and r:sub(1, 5) == "ab-ab" and r:sub(-2) == "ab", "Failed rep result test")
+    local g, n = text:gsub("\n", ";")
+    assert(n == 20000 and #g == #text and not g:find("\n", 1, true), "Failed gsub result test")
+    local f = string.format("[%s][%s]", text, r)
+    assert(#f == #text + #r + 4 and f:sub(2, #text + 1) == text, "Failed format result test")
+    local name = os.tmpname()
+    local h = assert(io.open(name, "wb"))
+    h:write(text)
+    h:close()
+    h = assert(io.open(name, "rb"))
+    local all = h:read("a")
+    h:close()
+    os.remove(name)
+    assert(all == text, "Failed read all test")
+    local t = { [text] = 1 }
+    assert(t[all] == 1 and t[g:gsub(";", "\n")] == 1, "Failed result key test")
+end
+
+-- results of every size survive collection, alone or through slices
+do
+    local results, slices = {}, {}
+    for i = 1, 300 do
+        local s = table.concat(parts, "", 1, i * 50)
+        results[i] = s
+        slices[i] = s:sub(-200)
+    end
+    collectgarbage()
+    for i = 1, 300 do
+        assert(#results[i] == i * 350 and results[i]:sub(-7) == parts[i * 50], "Failed result size test")
+    end
+    results = nil
+    collectgarbage()
+    collectgarbage()
+    for i = 1, 300 do
+        assert(slices[i] == table.concat(parts, "", i * 50 - 28, i * 50):sub(-200), "Failed result slice test")
+    end
+end
+
+-- results count as memory and are released
+do
+    collectgarbage()
+    local before = collectgarbage("count")
+    local s = string.rep("x", 1000000, "")
+    local s2 = s:gsub("x", "y")
+    assert(collectgarbage("count") - before > 1900, "Failed result memory test")
+    s, s2 = nil, nil
+    collectgarbage()
+    assert(collectgarbage("count") - before < 100, "Failed result release test")
+end
+
+print("OK")
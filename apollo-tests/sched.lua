@@ -0,0 +1,122 @@
+local sched = require "sched"
+
+do
+    local count = 0
+    for i = 1, 20000 do
+        sched.spawn(function(n)
+            sched.sleep((n % 10) / 1000)
+            count = count + 1
+        end, i)
+    end
+    assert(sched.run() == 0, "Failed to finish all tasks")
+    assert(count == 20000, "Failed spawn test")
+end
+
+do
+    local order = {}
+    for _, d in ipairs({ 30, 10, 20, 0 }) do
+        sched.spawn(function()
+            sched.sleep(d / 1000)
+            order[#order + 1] = d
+        end)
+    end
+    local start = sched.now()
+    sched.run()
+    assert(table.concat(order, ",") == "0,10,20,30", "Failed sleep order test: " .. table.concat(order, ","))
+    assert(sched.now() - start >= 0.029, "Failed sleep duration test")
+end
+
+do
+    local order = {}
+    sched.spawn(function()
+        for i = 1, 3 do
+            order[#order + 1] = "a" .. i
+            coroutine.yield()
+        end
+    end)
+    sched.spawn(function()
+        for i = 1, 3 do
+            order[#order + 1] = "b" .. i
+            sched.sleep(0)
+        end
+    end)
+    sched.run()
+    assert(table.concat(order) == "a1b1a2b2a3b3", "Failed round robin test")
+end
+
+for _, cap in ipairs({ 0, 1, 4 }) do
+    local ch = sched.channel(cap)
+    local got = {}
+    sched.spawn(function()
+        for i = 1, 10 do assert(ch:send(i)) end
+        ch:close()
+        assert(ch:send(11) == false, "Failed send on closed channel test")
+    end)
+    sched.spawn(function()
+        while true do
+            local v, ok = ch:recv()
+            if not ok then break end
+            got[#got + 1] = v
+        end
+    end)
+    assert(sched.run() == 0)
+    assert(#got == 10 and got[1] == 1 and got[10] == 10, "Failed channel test with capacity " .. cap)
+end
+
+do
+    local ch = sched.channel(2)
+    assert(ch:send("x") and ch:send("y") and #ch == 2, "Failed buffered send outside a task")
+    assert(not pcall(ch.send, ch, "z"), "Blocking outside a task should fail")
+    assert(ch:recv() == "x" and #ch == 1)
+
+    local blocked = sched.channel()
+    sched.spawn(function() blocked:recv() end)
+    assert(sched.run() == 1, "Failed deadlock detection test")
+    blocked:close()
+    assert(sched.run() == 0)
+
+    local lost = sched.channel()
+    for i = 1, 3 do sched.spawn(function() lost:recv() end) end
+    sched.spawn(function() lost:send(1) end)
+    assert(sched.run() == 2, "Failed partial deadlock test")
+    lost = nil  -- the tasks are blocked on a channel nobody can reach
+    collectgarbage()
+    collectgarbage()
+    assert(sched.run() == 0, "Failed collected channel test")
+end
+
+do
+    sched.spawn(function() error("boom") end)
+    local ok, err = pcall(sched.run)
+    assert(not ok and string.find(err, "boom"), "Failed task error test")
+end
+
+if sched.wait then
+    local f = io.popen("sleep 0.05; echo ready")
+    local line
+    sched.spawn(function()
+        assert(sched.wait(f, "r", 0.01) == false, "Failed wait timeout test")
+        assert(sched.wait(f, "r") == true, "Failed wait test")
+        line = f:read("l")
+    end)
+    sched.run()
+    f:close()
+    assert(line == "ready", "Failed pipe test")
+
+    f = io.popen("sleep 0.05; echo ready")
+    local woke = 0
+    for i = 1, 3 do
+        sched.spawn(function()
+            assert(sched.wait(f, "r") == true, "Failed shared wait test")
+            woke = woke + 1
+        end)
+    end
+    sched.spawn(function()
+        assert(sched.wait(f, "r", 0.01) == false and sched.wait(f, "w", 0.01) == false, "Failed shared timeout test")
+    end)
+    assert(sched.run() == 0)
+    f:close()
+    assert(woke == 3, "Failed shared descriptor test")
+end
+
+print("OK")
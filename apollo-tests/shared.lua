@@ -0,0 +1,50 @@
+local threads = require "threads"
+
+local lines = { "local x = ...", "local function inc(v) if v < 0 then error('neg') end return v + 1 end" }
+for i = 1, 2000 do lines[#lines + 1] = "x = x + " .. i % 7 end
+lines[#lines + 1] = "return inc(x), inc"
+local src = table.concat(lines, "\n")
+local f = assert(load(src, "=big"))
+
+local h = threads.share(f)
+do
+    local g = h:load()
+    local x, inc = g(0)
+    assert(x == f(0), "Failed shared load test")
+    local ok, err = pcall(inc, -1)
+    assert(not ok and err == "big:2: neg", "Failed shared line info test")
+    assert(h:load() ~= g, "Failed shared instance test")
+end
+
+-- instances share code and line information
+do
+    local function cost(make)
+        local keep = {}
+        collectgarbage(); collectgarbage()
+        local before = collectgarbage("count")
+        for i = 1, 50 do keep[i] = make() end
+        collectgarbage(); collectgarbage()
+        return collectgarbage("count") - before, keep
+    end
+    local plain = cost(function() return load(src, "=big") end)
+    local shared = cost(function() return h:load() end)
+    assert(shared < plain / 2, "Failed shared memory test")
+end
+
+do
+    local workers = {}
+    for i = 1, 4 do
+        workers[i] = threads.spawn(function(h, n)
+            local x = h:load()(n)
+            return x
+        end, h, i)
+    end
+    for i = 1, 4 do
+        assert(workers[i]:join() == f(i), "Failed shared worker test")
+    end
+    local up = 1
+    assert(not pcall(threads.share, function() return up end), "Failed shared upvalue check")
+    assert(not pcall(threads.share, print), "Failed shared C function check")
+end
+
+print("OK")
@@ -0,0 +1,80 @@
+local pieces = {}
+for i = 1, 1000 do pieces[i] = string.format("%07d;", i) end
+local text = table.concat(pieces)  -- "0000001;0000002;..."
+
+local function copy(s) return (s:upper()) end  -- digits and ';' only
+
+-- substrings behave like any other string
+do
+    local s = text:sub(81, 400)
+    local plain = table.concat(pieces, "", 11, 50)
+    assert(s == plain and #s == 320 and s:byte(1) == 48, "Failed slice value test")
+    assert(s:sub(9, 16) == "0000012;" and s:sub(2, 200) == plain:sub(2, 200), "Failed slice of slice test")
+    assert(s .. "x" == plain .. "x" and "x" .. s:sub(1, 160) == "x" .. plain:sub(1, 160), "Failed slice concatenation test")
+    assert(s < text:sub(89, 400) and not (s > plain) and s <= plain, "Failed slice comparison test")
+    local t = { [plain] = 1 }
+    t[text:sub(1, 200)] = 2
+    assert(t[s] == 1 and t[copy(text:sub(1, 200))] == 2, "Failed slice key test")
+    assert(string.format("%s|", s) == plain .. "|" and tostring(s) == plain, "Failed slice tostring test")
+    assert(s:find("0000020;", 1, true) == 73 and select(2, s:gsub(";", ";")) == 40, "Failed slice search test")
+    assert(text:sub(-160) == table.concat(pieces, "", 981), "Failed negative slice test")
+    assert(text:sub(1, -1) == text and text:sub(0) == text, "Failed whole string test")
+end
+
+-- captures and unpacked fields
+do
+    local body = string.rep("x", 300)
+    local doc = "<a>" .. body .. "</a><b>" .. body:upper() .. "</b>"
+    local tag, inner = doc:match("<(%a)>([^<]*)</%1>")
+    assert(tag == "a" and inner == body, "Failed long capture test")
+    assert(doc:match("<b>.*</b>") == "<b>" .. body:upper() .. "</b>", "Failed whole match test")
+    local n = 0
+    for t, v in doc:gmatch("<(%a)>([^<]*)</%a>") do
+        n = n + 1
+        assert(v:lower() == body, "Failed gmatch capture test")
+    end
+    assert(n == 2, "Failed gmatch count test")
+    local r = doc:gsub("<(%a)>([^<]*)", function(t, v) return "<" .. t .. ">" .. #v end)
+    assert(r == "<a>300</a><b>300</b>", "Failed gsub capture test")
+    local packed = string.pack("s4c200z", body, text:sub(1, 200), body)
+    local a, b, c = string.unpack("s4c200z", packed)
+    assert(a == body and b == text:sub(1, 200) and c == body, "Failed unpack slice test")
+end
+
+-- slices that look like numbers
+do
+    local src = "x" .. string.rep(" ", 150) .. "42" .. string.rep(" ", 10) .. "x"
+    local num = src:sub(2, -2)
+    assert(num + 1 == 43 and num * 1 == 42 and (num | 0) == 42, "Failed slice arithmetic test")
+    assert(tonumber(num) == 42 and tonumber(src:sub(2, 140)) == nil, "Failed slice tonumber test")
+end
+
+-- slices neither copy bytes nor keep their parents alive
+do
+    local big = string.rep("0123456789", 100000)
+    local parts = {}
+    collectgarbage()
+    collectgarbage("stop")
+    local before = collectgarbage("count")
+    for i = 1, 100 do parts[i] = big:sub(i * 1000, i * 1000 + 99999) end
+    local used = collectgarbage("count") - before
+    collectgarbage("restart")
+    assert(used < 100, "Failed slice memory test")
+    local small = { big:sub(501, 1000), big:sub(9001, 10000) }
+    local weak = setmetatable({ big:sub(2001, 2200) }, { __mode = "v" })
+    big, parts = nil, nil
+    collectgarbage()
+    collectgarbage()
+    assert(collectgarbage("count") < before - 500, "Failed parent collection test")
+    assert(small[1] == string.rep("0123456789", 50) and #small[2] == 1000, "Failed orphan slice test")
+    assert(small[2]:sub(1, 200) == string.rep("0123456789", 20), "Failed orphan subslice test")
+    assert(weak[1] == string.rep("0123456789", 20), "Failed weak slice test")
+end
+
+-- a slice can be loaded as a chunk
+do
+    local src = "-- " .. string.rep("-", 200) .. "\nreturn 1 + 2\n" .. string.rep("?", 10)
+    assert(load(src:sub(1, -11))() == 3, "Failed slice chunk test")
+end
+
+print("OK")
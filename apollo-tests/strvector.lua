@@ -0,0 +1,63 @@
+-- reference versions, one byte at a time
+local function ref_find(s, p)
+    for i = 1, #s - #p + 1 do
+        if s:sub(i, i + #p - 1) == p then return i end
+    end
+    return nil
+end
+
+local function ref_reverse(s)
+    local t = {}
+    for i = #s, 1, -1 do t[#t + 1] = s:sub(i, i) end
+    return table.concat(t)
+end
+
+local function ref_map(s, f)
+    local t = {}
+    for i = 1, #s do t[i] = f(s:sub(i, i)) end
+    return table.concat(t)
+end
+
+-- all bytes at every length and offset around the vector width
+do
+    local all = {}
+    for c = 0, 255 do all[#all + 1] = string.char(c) end
+    all = table.concat(all)
+    for len = 0, 300, 7 do
+        for off = 0, 3 do
+            local s = (all .. all):sub(1 + off * 37, off * 37 + len)
+            local lower = ref_map(s, function(c) return (c >= "A" and c <= "Z") and string.char(c:byte() + 32) or c end)
+            local upper = ref_map(s, function(c) return (c >= "a" and c <= "z") and string.char(c:byte() - 32) or c end)
+            assert(s:lower() == lower and s:upper() == upper, "Failed case conversion test")
+            assert(s:reverse() == ref_reverse(s), "Failed reverse test")
+        end
+    end
+end
+
+-- plain search on repetitive data, with matches at every position
+do
+    local hay = ("a"):rep(200) .. "b" .. ("ab"):rep(50) .. "\0c"
+    for _, needle in ipairs({ "a", "ab", "aab", ("a"):rep(17) .. "b", "ba", "bb", "\0c", "c", "abababab\0", ("a"):rep(201) }) do
+        for init = 1, #hay, 13 do
+            local sub = hay:sub(init)
+            assert(sub:find(needle, 1, true) == ref_find(sub, needle), "Failed plain find test")
+        end
+    end
+    for len = 1, 40 do
+        local hay2 = ("x"):rep(len) .. "yz"
+        assert(hay2:find("yz", 1, true) == len + 1 and not hay2:find("zy", 1, true), "Failed find tail test")
+    end
+end
+
+-- repetition with and without separators
+do
+    for n = 0, 20 do
+        local t = {}
+        for i = 1, n do t[i] = "ab" end
+        assert(("ab"):rep(n) == table.concat(t) and ("ab"):rep(n, ", ") == table.concat(t, ", "), "Failed rep test")
+        assert((""):rep(n, "-") == ("-"):rep(n - 1), "Failed empty rep test")
+    end
+    assert(#("x"):rep(100000) == 100000 and ("x"):rep(100000):find("^x+$"), "Failed long rep test")
+end
+
+print("OK")
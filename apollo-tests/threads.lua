@@ -0,0 +1,116 @@
+local threads = require "threads"
+
+assert(threads.cores() >= 1, "Failed cores test")
+
+do
+    local t = threads.spawn(function(a, b, s)
+        return a + b, s:upper(), math.type(a), math.type(b)
+    end, 1, 2.5, "ab\0c")
+    local sum, s, ta, tb = t:join()
+    assert(sum == 3.5 and s == "AB\0C", "Failed spawn test")
+    assert(ta == "integer" and tb == "float", "Failed number subtype test")
+    assert(not pcall(t.join, t), "Failed double join test")
+end
+
+do
+    local data = { 1, 2, { x = true, y = { "deep" } }, name = "t", [2.5] = false }
+    local r = threads.spawn(function(t)
+        t.added = #t
+        return t
+    end, data):join()
+    assert(r[1] == 1 and r[3].x == true and r[3].y[1] == "deep", "Failed table copy test")
+    assert(r.name == "t" and r[2.5] == false and r.added == 3, "Failed table copy test")
+    assert(r ~= data and data.added == nil, "Failed table isolation test")
+end
+
+do
+    local f = threads.spawn(function()
+        return function(x) return x * 2 end
+    end):join()
+    assert(f(21) == 42, "Failed function return test")
+    local n = threads.spawn(function(g) return g(4) end, function(x) return x + x end):join()
+    assert(n == 8, "Failed function argument test")
+end
+
+do
+    local t = threads.spawn(function() error("boom") end)
+    local ok, err = pcall(t.join, t)
+    assert(not ok and err:find("boom"), "Failed error propagation test")
+    t = threads.spawn(function() error({}) end)
+    ok, err = pcall(t.join, t)
+    assert(not ok and err:find("table"), "Failed error object test")
+end
+
+do
+    local up = 1
+    assert(not pcall(threads.spawn, function() return up end), "Failed upvalue check")
+    assert(not pcall(threads.spawn, print), "Failed C function check")
+    local cyc = {}
+    cyc.self = cyc
+    assert(not pcall(threads.spawn, function() end, cyc), "Failed cycle check")
+    assert(not pcall(threads.spawn, function() end, coroutine.create(print)), "Failed type check")
+end
+
+-- worker pool
+do
+    local jobs, results = threads.channel(16), threads.channel(16)
+    local workers = {}
+    for i = 1, 4 do
+        workers[i] = threads.spawn(function(jobs, results)
+            local done = 0
+            while true do
+                local n, ok = jobs:recv()
+                if not ok then break end
+                local s = 0
+                for k = 1, n do s = s + k * k end
+                results:send({ n, s })
+                done = done + 1
+            end
+            return done
+        end, jobs, results)
+    end
+    local producer = threads.spawn(function(jobs)
+        for n = 1, 200 do jobs:send(n) end
+        jobs:close()
+    end, jobs)
+    local total, count = 0, 0
+    for _ = 1, 200 do
+        local r = results:recv()
+        assert(r[2] == r[1] * (r[1] + 1) * (2 * r[1] + 1) // 6, "Failed pool result test")
+        total = total + r[1]
+        count = count + 1
+    end
+    producer:join()
+    local done = 0
+    for i = 1, 4 do done = done + workers[i]:join() end
+    assert(count == 200 and total == 200 * 201 // 2 and done == 200, "Failed worker pool test")
+    assert(#results == 0, "Failed channel length test")
+end
+
+-- unbuffered and closed channels
+do
+    local ch = threads.channel()
+    local t = threads.spawn(function(ch)
+        local got = {}
+        for _ = 1, 3 do got[#got + 1] = ch:recv() end
+        return table.concat(got, ",")
+    end, ch)
+    for i = 1, 3 do assert(ch:send(i), "Failed unbuffered send test") end
+    assert(t:join() == "1,2,3", "Failed unbuffered channel test")
+    ch:close()
+    assert(ch:send(4) == false, "Failed send on closed channel test")
+    local v, ok = ch:recv()
+    assert(v == nil and ok == false, "Failed recv on closed channel test")
+end
+
+-- a channel cannot travel through itself
+do
+    local ch, other = threads.channel(2), threads.channel(1)
+    local ok, err = pcall(ch.send, ch, { 1, { ch } })
+    assert(not ok and err:find("through itself", 1, true) and #ch == 0, "Failed self send test")
+    assert(ch:send(other) and other:send(ch), "Failed channel send test")
+    local c = ch:recv():recv()
+    assert(#other == 0 and c:send(1) and ch:recv() == 1, "Failed received channel test")
+end
+
+print("OK")
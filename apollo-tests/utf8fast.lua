@@ -0,0 +1,72 @@
+-- reference: position of the n-th character from 'i', walking bytes
+local function refoffset(s, n, i)
+    i = i or (n >= 0 and 1 or #s + 1)
+    local p = i
+    local function iscont(q) local b = s:byte(q) return b and b >= 0x80 and b < 0xC0 end
+    if n > 0 then
+        n = n - 1
+        while n > 0 and p <= #s do
+            repeat p = p + 1 until not iscont(p)
+            n = n - 1
+        end
+    else
+        while n < 0 and p > 1 do
+            repeat p = p - 1 until p == 1 or not iscont(p)
+            n = n + 1
+        end
+    end
+    if n == 0 then return p end
+end
+
+local text = string.rep("plain ascii text, ", 300) .. string.rep("\xC3\xA9t\xC3\xA9 \xE4\xB8\xAD\xE6\x96\x87 \xF0\x9F\x98\x80!", 300)
+local nchars = 300 * 18 + 300 * 9
+
+-- length over ASCII runs and multibyte sequences
+do
+    assert(utf8.len(text) == nchars, "Failed long len test")
+    assert(utf8.len(text, 5400) == nchars - 5399 and utf8.len(text, 1, 5400) == 5400, "Failed len range test")
+    local bad = text:sub(1, 5000) .. "\xE4\xB8" .. text:sub(1, 100)
+    local r, pos = utf8.len(bad)
+    assert(r == nil and pos == 5001, "Failed invalid len test")
+    r, pos = utf8.len(text .. "\xC0\x80")
+    assert(r == nil and pos == #text + 1, "Failed overlong len test")
+    assert(utf8.len(string.rep("x", 1000) .. "\xED\xA0\x80") == 1001, "Failed surrogate len test")
+end
+
+-- random access through the character index
+do
+    for k = 1, 3 do  -- first walk, index build and indexed walks
+        for _, n in ipairs({ 1, 200, 5399, 5400, 5401, nchars, nchars + 1, nchars + 2 }) do
+            assert(utf8.offset(text, n) == refoffset(text, n), "Failed forward offset test")
+            assert(utf8.offset(text, -n) == refoffset(text, -n), "Failed backward offset test")
+        end
+        for _, i in ipairs({ 1, 2000, 5401, 5403, #text - 4, #text + 1 }) do
+            for _, n in ipairs({ 300, -300, 1000, -1000, 4000, -8000 }) do
+                local ok, r = pcall(utf8.offset, text, n, i)
+                local ok2, r2 = pcall(refoffset, text, n, i)
+                if text:byte(i) and text:byte(i) >= 0x80 and text:byte(i) < 0xC0 then
+                    assert(not ok, "Failed continuation offset test")
+                else
+                    assert(ok and r == r2, "Failed offset from position test")
+                end
+            end
+        end
+    end
+    local s = "\x80\x80" .. text  -- starts with continuation bytes
+    for k = 1, 3 do
+        assert(utf8.offset(s, -nchars - 1) == refoffset(s, -nchars - 1), "Failed leading continuation test")
+    end
+end
+
+-- many indexed strings
+do
+    local strs = {}
+    for i = 1, 40 do strs[i] = string.rep("\xCE\xB1", 3000 + i) end
+    for k = 1, 3 do
+        for i = 1, 40 do
+            assert(utf8.offset(strs[i], 2500) == 4999 and utf8.offset(strs[i], -500) == #strs[i] - 999, "Failed index cache test")
+        end
+    end
+end
+
+print("OK")
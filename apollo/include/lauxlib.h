@@ -28,6 +28,10 @@
 #define LUA_PRELOAD_TABLE    "_PRELOAD"
 
 
+/* key, in the registry, for the directory of the compiled-chunk cache */
+#define LUA_CACHEDIR_KEY    "_CACHEDIR"
+
+
 typedef struct luaL_Reg {
     const char *name;
     lua_CFunction func;
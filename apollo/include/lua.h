@@ -29,6 +29,21 @@
 /* mark for precompiled code ('<esc>Lua') */
 #define LUA_SIGNATURE    "\x1bLua"
 
+/* version of the binary chunk format (not the official one) */
+#define LUA_BYTECODE_FORMAT    1
+
+/*
+** revision of the code generator; change it whenever the compiler output
+** changes, so that cached binary chunks (see LUA_CACHEDIR) are not reused
+*/
+#define LUA_COMPILER_REVISION    "1"
+
+/* mark for memory-mappable bytecode images (see 'lua_loadimage') */
+#define LUA_IMAGESIGNATURE    "\x1bLuaImg"
+
+/* mark for bundles of precompiled modules (see 'luac --bundle') */
+#define LUA_BUNDLESIGNATURE    "\x1bLuaBnd"
+
 /* option for multiple returns in 'lua_pcall' and 'lua_call' */
 #define LUA_MULTRET    (-1)
 
@@ -187,6 +202,8 @@ LUA_API int (lua_isinteger)(lua_State *L, int idx);
 
 LUA_API int (lua_isuserdata)(lua_State *L, int idx);
 
+LUA_API int (lua_isfrozen)(lua_State *L, int idx);
+
 LUA_API int (lua_type)(lua_State *L, int idx);
 
 LUA_API const char *(lua_typename)(lua_State *L, int tp);
@@ -251,6 +268,12 @@ LUA_API void (lua_pushinteger)(lua_State *L, lua_Integer n);
 
 LUA_API const char *(lua_pushlstring)(lua_State *L, const char *s, size_t len);
 
+LUA_API void (lua_pushsubstring)(lua_State *L, int idx, size_t i, size_t len);
+
+LUA_API const char *(lua_pushexternalstring)(lua_State *L, const char *s,
+                                             size_t len, lua_Alloc falloc,
+                                             void *ud);
+
 LUA_API const char *(lua_pushstring)(lua_State *L, const char *s);
 
 LUA_API const char *(lua_pushvfstring)(lua_State *L, const char *fmt,
@@ -314,6 +337,8 @@ LUA_API int (lua_setmetatable)(lua_State *L, int objindex);
 
 LUA_API void (lua_setuservalue)(lua_State *L, int idx);
 
+LUA_API void (lua_freezetable)(lua_State *L, int idx);
+
 
 /*
 ** 'load' and 'call' functions (load and run Lua code)
@@ -333,6 +358,28 @@ LUA_API int (lua_load)(lua_State *L, lua_Reader reader, void *dt,
 
 LUA_API int (lua_dump)(lua_State *L, lua_Writer writer, void *data, int strip);
 
+LUA_API void (lua_clonefunction)(lua_State *L, int idx);
+
+
+/*
+** shared chunks
+*/
+typedef struct lua_Shared lua_Shared;
+
+LUA_API lua_Shared *(lua_newshared)(lua_State *L);
+
+LUA_API int (lua_loadshared)(lua_State *L, lua_Shared *s);
+
+LUA_API void (lua_retainshared)(lua_Shared *s);
+
+LUA_API void (lua_releaseshared)(lua_Shared *s);
+
+typedef void (*lua_ImageFree)(void *ud, void *image, size_t size);
+
+LUA_API int (lua_loadimage)(lua_State *L, void *image, size_t size,
+                            const char *chunkname, lua_ImageFree ffree,
+                            void *ud);
+
 
 /*
 ** coroutine functions
@@ -362,6 +409,7 @@ LUA_API int (lua_isyieldable)(lua_State *L);
 #define LUA_GCSETPAUSE        6
 #define LUA_GCSETSTEPMUL    7
 #define LUA_GCISRUNNING        9
+#define LUA_GCCOMPACTSTACK    10
 
 LUA_API int (lua_gc)(lua_State *L, int what, int data);
 
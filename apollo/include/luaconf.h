@@ -493,6 +493,7 @@
 
 #define LUA_NUMBER_FRMLEN    ""
 #define LUA_NUMBER_FMT        "%.14g"
+#define LUAI_NUMDIGITS        14  /* precision of LUA_NUMBER_FMT */
 
 #define l_mathop(op)        op
 
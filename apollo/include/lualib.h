@@ -41,6 +41,10 @@ LUAMOD_API int (luaopen_string)(lua_State *L);
 
 LUAMOD_API int (luaopen_utf8)(lua_State *L);
 
+#define LUA_BUFLIBNAME    "buffer"
+
+LUAMOD_API int (luaopen_buffer)(lua_State *L);
+
 #define LUA_BITLIBNAME    "bit32"
 
 LUAMOD_API int (luaopen_bit32)(lua_State *L);
@@ -57,6 +61,14 @@ LUAMOD_API int (luaopen_debug)(lua_State *L);
 
 LUAMOD_API int (luaopen_package)(lua_State *L);
 
+#define LUA_SCHEDLIBNAME    "sched"
+
+LUAMOD_API int (luaopen_sched)(lua_State *L);
+
+#define LUA_THREADLIBNAME    "threads"
+
+LUAMOD_API int (luaopen_threads)(lua_State *L);
+
 
 /* open all previous libraries */
 LUALIB_API void (luaL_openlibs)(lua_State *L);
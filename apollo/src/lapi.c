@@ -282,6 +282,12 @@ LUA_API int lua_isstring(lua_State *L, int idx) {
 }
 
 
+LUA_API int lua_isfrozen(lua_State *L, int idx) {
+    const TValue *o = index2addr(L, idx);
+    return (ttistable(o) && isfrozen(hvalue(o)));
+}
+
+
 LUA_API int lua_isuserdata(lua_State *L, int idx) {
     const TValue *o = index2addr(L, idx);
     return (ttisfulluserdata(o) || ttislightuserdata(o));
@@ -384,6 +390,10 @@ LUA_API const char *lua_tolstring(lua_State *L, int idx, size_t *len) {
         luaC_checkGC(L);
         o = index2addr(L, idx);  /* previous call may reallocate the stack */
         lua_unlock(L);
+    } else if (isslice(tsvalue(o))) {  /* C code needs an ending '\0' */
+        lua_lock(L);
+        luaS_unslice(L, tsvalue(o));
+        lua_unlock(L);
     }
     if (len != NULL)
         *len = vslen(o);
@@ -506,6 +516,50 @@ LUA_API const char *lua_pushlstring(lua_State *L, const char *s, size_t len) {
 }
 
 
+/*
+** Push the 'len' bytes of the string at 'idx' starting at 'i'. Long
+** results may share the bytes of that string (see 'luaS_newslice').
+*/
+LUA_API void lua_pushsubstring(lua_State *L, int idx, size_t i, size_t len) {
+    const TValue *o;
+    TString *ts;
+    lua_lock(L);
+    o = index2addr(L, idx);
+    api_check(L, ttisstring(o), "string expected");
+    ts = tsvalue(o);
+    api_check(L, i <= tsslen(ts) && len <= tsslen(ts) - i,
+              "substring out of bounds");
+    ts = luaS_newslice(L, ts, i, len);
+    setsvalue2s(L, L->top, ts);
+    api_incr_top(L);
+    luaC_checkGC(L);
+    lua_unlock(L);
+}
+
+
+/*
+** Pushes on the stack a string with the 'len' bytes at 's', which must
+** be followed by a '\0'. Long strings keep using that memory instead of
+** copying it; the collector calls 'falloc(ud, s, len + 1, 0)' when it no
+** longer needs it (if 'falloc' is not NULL). Memory errors can only happen
+** before the string takes the block, and there is no collection step
+** afterwards, so callers can hand the block over once this returns.
+*/
+LUA_API const char *lua_pushexternalstring(lua_State *L, const char *s,
+                                           size_t len, lua_Alloc falloc,
+                                           void *ud) {
+    TString *ts;
+    lua_lock(L);
+    api_check(L, s[len] == '\0', "string not ending with zero");
+    luaC_checkGC(L);
+    ts = luaS_newextlstr(L, s, len, falloc, ud);
+    setsvalue2s(L, L->top, ts);
+    api_incr_top(L);
+    lua_unlock(L);
+    return getstr(ts);
+}
+
+
 LUA_API const char *lua_pushstring(lua_State *L, const char *s) {
     lua_lock(L);
     if (s == NULL)
@@ -819,6 +873,8 @@ LUA_API void lua_rawset(lua_State *L, int idx) {
     api_checknelems(L, 2);
     o = index2addr(L, idx);
     api_check(L, ttistable(o), "table expected");
+    if (isfrozen(hvalue(o)))
+        luaG_frozenerror(L, o);
     slot = luaH_set(L, hvalue(o), L->top - 2);
     setobj2t(L, slot, L->top - 1);
     invalidateTMcache(hvalue(o));
@@ -834,6 +890,8 @@ LUA_API void lua_rawseti(lua_State *L, int idx, lua_Integer n) {
     api_checknelems(L, 1);
     o = index2addr(L, idx);
     api_check(L, ttistable(o), "table expected");
+    if (isfrozen(hvalue(o)))
+        luaG_frozenerror(L, o);
     luaH_setint(L, hvalue(o), n, L->top - 1);
     luaC_barrierback(L, hvalue(o), L->top - 1);
     L->top--;
@@ -848,6 +906,8 @@ LUA_API void lua_rawsetp(lua_State *L, int idx, const void *p) {
     api_checknelems(L, 1);
     o = index2addr(L, idx);
     api_check(L, ttistable(o), "table expected");
+    if (isfrozen(hvalue(o)))
+        luaG_frozenerror(L, o);
     setpvalue(&k, cast(void *, p));
     slot = luaH_set(L, hvalue(o), &k);
     setobj2t(L, slot, L->top - 1);
@@ -871,6 +931,8 @@ LUA_API int lua_setmetatable(lua_State *L, int objindex) {
     }
     switch (ttnov(obj)) {
         case LUA_TTABLE: {
+            if (isfrozen(hvalue(obj)))
+                luaG_frozenerror(L, obj);
             hvalue(obj)->metatable = mt;
             if (mt) {
                 luaC_objbarrier(L, gcvalue(obj), mt);
@@ -897,6 +959,21 @@ LUA_API int lua_setmetatable(lua_State *L, int objindex) {
 }
 
 
+/*
+** Make the table at 'idx' read-only: any later attempt to set one of its
+** fields or its metatable raises an error. Only the table itself is
+** frozen; tables it refers to are not.
+*/
+LUA_API void lua_freezetable(lua_State *L, int idx) {
+    StkId o;
+    lua_lock(L);
+    o = index2addr(L, idx);
+    api_check(L, ttistable(o), "table expected");
+    hvalue(o)->flags |= FROZENFLAG;
+    lua_unlock(L);
+}
+
+
 LUA_API void lua_setuservalue(lua_State *L, int idx) {
     StkId o;
     lua_lock(L);
@@ -944,21 +1021,9 @@ LUA_API void lua_callk(lua_State *L, int nargs, int nresults,
 /*
 ** Execute a protected call.
 */
-struct CallS {  /* data to 'f_call' */
-    StkId func;
-    int nresults;
-};
-
-
-static void f_call(lua_State *L, void *ud) {
-    struct CallS *c = cast(struct CallS *, ud);
-    luaD_callnoyield(L, c->func, c->nresults);
-}
-
-
 LUA_API int lua_pcallk(lua_State *L, int nargs, int nresults, int errfunc,
                        lua_KContext ctx, lua_KFunction k) {
-    struct CallS c;
+    StkId cfunc;
     int status;
     ptrdiff_t func;
     lua_lock(L);
@@ -974,21 +1039,22 @@ LUA_API int lua_pcallk(lua_State *L, int nargs, int nresults, int errfunc,
         api_checkstackindex(L, errfunc, o);
         func = savestack(L, o);
     }
-    c.func = L->top - (nargs + 1);  /* function to be called */
-    if (k == NULL || L->nny > 0) {  /* no continuation or no yieldable? */
-        c.nresults = nresults;  /* do a 'conventional' protected call */
-        status = luaD_pcall(L, f_call, &c, savestack(L, c.func), func);
-    } else {  /* prepare continuation (call is already protected by 'resume') */
+    cfunc = L->top - (nargs + 1);  /* function to be called */
+    if (k == NULL || L->nny != L->nnyrec) {  /* no continuation or recover point? */
+        /* do a 'conventional' protected call */
+        status = luaD_pcallrec(L, cfunc, nresults, func);
+    } else {  /* prepare continuation (call is already protected by 'resume'
+               or by an enclosing conventional protected call) */
         CallInfo *ci = L->ci;
         ci->u.c.k = k;  /* save continuation */
         ci->u.c.ctx = ctx;  /* save context */
         /* save information for error recovery */
-        ci->extra = savestack(L, c.func);
+        ci->extra = savestack(L, cfunc);
         ci->u.c.old_errfunc = L->errfunc;
         L->errfunc = func;
         setoah(ci->callstatus, L->allowhook);  /* save value of 'allowhook' */
         ci->callstatus |= CIST_YPCALL;  /* function can do error recovery */
-        luaD_call(L, c.func, nresults);  /* do the call */
+        luaD_call(L, cfunc, nresults);  /* do the call */
         ci->callstatus &= ~CIST_YPCALL;
         L->errfunc = ci->u.c.old_errfunc;
         status = LUA_OK;  /* if it is here, there were no errors */
@@ -999,6 +1065,22 @@ LUA_API int lua_pcallk(lua_State *L, int nargs, int nresults, int errfunc,
 }
 
 
+/*
+** set global table as 1st upvalue (may be LUA_ENV) of the newly loaded
+** function on the top of the stack
+*/
+static void setglobalenv(lua_State *L) {
+    LClosure *f = clLvalue(L->top - 1);  /* get newly created function */
+    if (f->nupvalues >= 1) {  /* does it have an upvalue? */
+        /* get global table from registry */
+        Table *reg = hvalue(&G(L)->l_registry);
+        const TValue *gt = luaH_getint(reg, LUA_RIDX_GLOBALS);
+        setobj(L, f->upvals[0]->v, gt);
+        luaC_upvalbarrier(L, f->upvals[0]);
+    }
+}
+
+
 LUA_API int lua_load(lua_State *L, lua_Reader reader, void *data,
                      const char *chunkname, const char *mode) {
     ZIO z;
@@ -1006,18 +1088,9 @@ LUA_API int lua_load(lua_State *L, lua_Reader reader, void *data,
     lua_lock(L);
     if (!chunkname) chunkname = "?";
     luaZ_init(L, &z, reader, data);
-    status = luaD_protectedparser(L, &z, chunkname, mode);
-    if (status == LUA_OK) {  /* no errors? */
-        LClosure *f = clLvalue(L->top - 1);  /* get newly created function */
-        if (f->nupvalues >= 1) {  /* does it have an upvalue? */
-            /* get global table from registry */
-            Table *reg = hvalue(&G(L)->l_registry);
-            const TValue *gt = luaH_getint(reg, LUA_RIDX_GLOBALS);
-            /* set global table as 1st upvalue of 'f' (may be LUA_ENV) */
-            setobj(L, f->upvals[0]->v, gt);
-            luaC_upvalbarrier(L, f->upvals[0]);
-        }
-    }
+    status = luaD_protectedparser(L, &z, chunkname, mode, NULL);
+    if (status == LUA_OK)  /* no errors? */
+        setglobalenv(L);
     lua_unlock(L);
     return status;
 }
@@ -1029,8 +1102,10 @@ LUA_API int lua_dump(lua_State *L, lua_Writer writer, void *data, int strip) {
     lua_lock(L);
     api_checknelems(L, 1);
     o = L->top - 1;
-    if (isLfunction(o))
+    if (isLfunction(o)) {
+        luaD_compileall(L, getproto(o));  /* dump needs all the code */
         status = luaU_dump(L, getproto(o), writer, data, strip);
+    }
     else
         status = 1;
     lua_unlock(L);
@@ -1038,6 +1113,192 @@ LUA_API int lua_dump(lua_State *L, lua_Writer writer, void *data, int strip) {
 }
 
 
+/*
+** Push a new closure for the prototype of the Lua function at 'idx', as
+** if it had been loaded again: its upvalues are fresh and the first one
+** is the global table.
+*/
+LUA_API void lua_clonefunction(lua_State *L, int idx) {
+    LClosure *cl, *ncl;
+    TValue *o;
+    lua_lock(L);
+    o = index2addr(L, idx);
+    api_check(L, ttisLclosure(o), "Lua function expected");
+    cl = clLvalue(o);
+    ncl = luaF_newLclosure(L, cl->nupvalues);
+    ncl->p = cl->p;  /* does not need barrier because closure is white */
+    setclLvalue(L, L->top, ncl);
+    api_incr_top(L);
+    luaF_initupvals(L, ncl);
+    setglobalenv(L);
+    luaC_checkGC(L);
+    lua_unlock(L);
+}
+
+
+/*
+** {======================================================
+** Shared chunks
+** =======================================================
+*/
+
+static int writeshared(lua_State *L, const void *b, size_t size, void *ud) {
+    lua_Shared *s = cast(lua_Shared *, ud);
+    UNUSED(L);
+    if (size > s->sizechunk - s->size) {  /* grow the buffer */
+        size_t newsize = s->sizechunk * 2;
+        char *newchunk;
+        if (newsize < s->size + size)
+            newsize = s->size + size + 256;
+        newchunk = cast(char *, (*s->frealloc)(s->ud, s->chunk,
+                                               s->sizechunk, newsize));
+        if (newchunk == NULL)
+            return 1;
+        s->chunk = newchunk;
+        s->sizechunk = newsize;
+    }
+    memcpy(s->chunk + s->size, b, size);
+    s->size += size;
+    return 0;
+}
+
+
+static const char *readshared(lua_State *L, void *ud, size_t *size) {
+    lua_Shared **ps = cast(lua_Shared **, ud);
+    lua_Shared *s = *ps;
+    UNUSED(L);
+    if (s == NULL)
+        return NULL;
+    *ps = NULL;  /* the whole chunk is read at once */
+    *size = s->size;
+    return s->chunk;
+}
+
+
+static int loadshared(lua_State *L, lua_Shared *s) {
+    ZIO z;
+    lua_Shared *rs = s;
+    luaZ_init(L, &z, readshared, &rs);
+    return luaD_protectedparser(L, &z, "=(shared)", "b", s);
+}
+
+
+/*
+** Create a shared chunk from the Lua function on the top of the stack,
+** which is popped. The function is dumped once; its code and line
+** information are then built outside 'L', to be used by every function
+** later loaded from the chunk with 'lua_loadshared', in any state. The
+** returned chunk has one reference, owned by the caller.
+*/
+LUA_API lua_Shared *lua_newshared(lua_State *L) {
+    lua_Shared *s;
+    int status;
+    lua_lock(L);
+    api_checknelems(L, 1);
+    api_check(L, isLfunction(L->top - 1), "Lua function expected");
+    luaD_compileall(L, getproto(L->top - 1));
+    s = luaF_newshared(L);
+    if (luaU_dump(L, getproto(L->top - 1), writeshared, s, 0) != 0) {
+        luaF_releaseshared(s);
+        luaD_throw(L, LUA_ERRMEM);
+    }
+    L->top--;  /* remove function */
+    status = loadshared(L, s);  /* first load builds the shared arrays */
+    if (status != LUA_OK) {
+        luaF_releaseshared(s);
+        luaD_throw(L, status);  /* error message is on the top */
+    }
+    L->top--;  /* remove the function used to build the chunk */
+    lua_unlock(L);
+    return s;
+}
+
+
+/*
+** Push a new Lua function loaded from shared chunk 's', with the global
+** table as its first upvalue. Returns a status code like 'lua_load'.
+*/
+LUA_API int lua_loadshared(lua_State *L, lua_Shared *s) {
+    int status;
+    lua_lock(L);
+    api_check(L, s->nprotos > 0, "shared chunk not built");
+    status = loadshared(L, s);
+    if (status == LUA_OK)
+        setglobalenv(L);
+    lua_unlock(L);
+    return status;
+}
+
+
+struct OpenImage {
+    lua_Shared *s;
+    void *image;
+    size_t size;
+    const char *name;
+    lua_ImageFree ffree;
+    void *ud;
+};
+
+
+static void f_openimage(lua_State *L, void *ud) {
+    struct OpenImage *oi = cast(struct OpenImage *, ud);
+    lua_Shared *s = luaF_newshared(L);
+    s->image = oi->image;  /* from now on the chunk owns the image */
+    s->sizeimage = oi->size;
+    s->ffree = oi->ffree;
+    s->fud = oi->ud;
+    oi->s = s;
+    luaU_openimage(L, s, oi->name);
+}
+
+
+/*
+** Load a bytecode image (see 'luaU_dumpimage') that stays in place,
+** typically in a memory-mapped file: prototypes point to its code and
+** line information instead of copying them. The image is given to Lua,
+** which calls 'ffree' once no function uses it anymore (or right away,
+** on errors). Returns a status code like 'lua_load'.
+*/
+LUA_API int lua_loadimage(lua_State *L, void *image, size_t size,
+                          const char *chunkname, lua_ImageFree ffree,
+                          void *ud) {
+    struct OpenImage oi;
+    int status;
+    lua_lock(L);
+    if (!chunkname) chunkname = "?";
+    oi.s = NULL;
+    oi.image = image;
+    oi.size = size;
+    oi.name = chunkname;
+    oi.ffree = ffree;
+    oi.ud = ud;
+    status = luaD_pcall(L, f_openimage, &oi, savestack(L, L->top), L->errfunc);
+    if (status == LUA_OK) {
+        status = loadshared(L, oi.s);
+        if (status == LUA_OK)
+            setglobalenv(L);
+    }
+    if (oi.s != NULL)
+        luaF_releaseshared(oi.s);  /* new functions keep their own references */
+    else
+        (*ffree)(ud, image, size);
+    lua_unlock(L);
+    return status;
+}
+
+
+LUA_API void lua_retainshared(lua_Shared *s) {
+    luai_atomicinc(s->refs);
+}
+
+
+LUA_API void lua_releaseshared(lua_Shared *s) {
+    luaF_releaseshared(s);
+}
+
+/* }====================================================== */
+
+
 LUA_API int lua_status(lua_State *L) {
     return L->status;
 }
@@ -1107,6 +1368,12 @@ LUA_API int lua_gc(lua_State *L, int what, int data) {
             res = g->gcrunning;
             break;
         }
+        case LUA_GCCOMPACTSTACK: {
+            res = g->compactstack;
+            if (data >= 0)  /* negative 'data' only queries the mode */
+                g->compactstack = cast_byte(data != 0);
+            break;
+        }
         default:
             res = -1;  /* invalid option */
     }
@@ -495,6 +495,30 @@ static void *newbox(lua_State *L, size_t newsize) {
 #define buffonstack(B)    ((B)->b != (B)->initb)
 
 
+/*
+** Trailer written after the '\0' of a result that took over the block
+** of its box, so that 'freeresult' can release the whole block with the
+** allocator that made it.
+*/
+typedef struct BoxTrailer {
+    lua_Alloc allocf;
+    void *ud;
+    size_t bsize;  /* size of the whole block */
+} BoxTrailer;
+
+
+static void *freeresult(void *ud, void *ptr, size_t osize, size_t nsize) {
+    BoxTrailer t;
+    (void) ud; (void) nsize;
+    memcpy(&t, (char *) ptr + osize, sizeof(t));  /* after the '\0' */
+    return (*t.allocf)(t.ud, ptr, t.bsize, 0);
+}
+
+
+/* room kept in a box after the contents, for 'luaL_pushresult' */
+#define RESULTEXTRA    (1 + sizeof(BoxTrailer))
+
+
 /*
 ** returns a pointer to a free area with at least 'sz' bytes
 */
@@ -505,13 +529,14 @@ LUALIB_API char *luaL_prepbuffsize(luaL_Buffer *B, size_t sz) {
         size_t newsize = B->size * 2;  /* double buffer size */
         if (newsize - B->n < sz)  /* not big enough? */
             newsize = B->n + sz;
-        if (newsize < B->n || newsize - B->n < sz)
+        if (newsize < B->n || newsize - B->n < sz ||
+            newsize + RESULTEXTRA < newsize)
             luaL_error(L, "buffer too large");
         /* create larger buffer */
         if (buffonstack(B))
-            newbuff = (char *) resizebox(L, -1, newsize);
+            newbuff = (char *) resizebox(L, -1, newsize + RESULTEXTRA);
         else {  /* no buffer yet */
-            newbuff = (char *) newbox(L, newsize);
+            newbuff = (char *) newbox(L, newsize + RESULTEXTRA);
             memcpy(newbuff, B->b, B->n * sizeof(char));  /* copy original content */
         }
         B->b = newbuff;
@@ -535,12 +560,35 @@ LUALIB_API void luaL_addstring(luaL_Buffer *B, const char *s) {
 }
 
 
+/*
+** A result that outgrew the initial buffer is already in a block from
+** the allocator of the state. If that block fits the result well, it
+** becomes the bytes of an external string instead of being copied.
+** Otherwise the result is copied and the block freed at once, as
+** trimming it would keep most of the memory behind the string anyway
+** (and, with 'malloc', tends to make it map new pages for every result).
+*/
 LUALIB_API void luaL_pushresult(luaL_Buffer *B) {
     lua_State *L = B->L;
-    lua_pushlstring(L, B->b, B->n);
-    if (buffonstack(B)) {
-        resizebox(L, -2, 0);  /* delete old buffer */
-        lua_remove(L, -2);  /* remove its header from the stack */
+    UBox *box = buffonstack(B) ? (UBox *) lua_touserdata(L, -1) : NULL;
+    size_t len = B->n;
+    if (box == NULL || box->bsize - (len + RESULTEXTRA) > box->bsize / 4) {
+        lua_pushlstring(L, B->b, len);
+        if (box != NULL) {
+            resizebox(L, -2, 0);  /* delete old buffer */
+            lua_remove(L, -2);  /* remove its header from the stack */
+        }
+    } else {  /* hand the block over to the string */
+        BoxTrailer t;
+        char *s = (char *) box->box;
+        s[len] = '\0';
+        t.allocf = lua_getallocf(L, &t.ud);
+        t.bsize = box->bsize;
+        memcpy(s + len + 1, &t, sizeof(t));
+        lua_pushexternalstring(L, s, len, freeresult, NULL);
+        box->box = NULL;  /* the string took control of the block */
+        box->bsize = 0;
+        lua_remove(L, -2);  /* remove box from the stack */
     }
 }
 
@@ -693,6 +741,313 @@ static int skipcomment(LoadF *lf, int *cp) {
 }
 
 
+/*
+** {======================================================
+** Bytecode images
+** =======================================================
+*/
+
+/*
+** Bytecode images (luac -m) are loaded in place: on POSIX systems the
+** file is mapped read-only and functions run directly from the mapping;
+** elsewhere it is read into a single block.
+*/
+
+#if !defined(l_mapimage)    /* { */
+
+#if defined(LUA_USE_POSIX)
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void unmapimage(void *ud, void *image, size_t size) {
+    (void) ud;
+    munmap(image, size);
+}
+
+static void *l_mapimage(const char *filename, size_t *size,
+                        lua_ImageFree *ffree) {
+    struct stat st;
+    void *image = NULL;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 &&
+        (off_t) (size_t) st.st_size == st.st_size) {
+        image = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (image == MAP_FAILED) image = NULL;
+        else *size = (size_t) st.st_size;
+    }
+    close(fd);
+    *ffree = unmapimage;
+    return image;
+}
+
+#else                /* }{ */
+
+static void freeimage(void *ud, void *image, size_t size) {
+    (void) ud; (void) size;
+    free(image);
+}
+
+static void *l_mapimage(const char *filename, size_t *size,
+                        lua_ImageFree *ffree) {
+    void *image = NULL;
+    long n;
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL) return NULL;
+    if (fseek(f, 0, SEEK_END) == 0 && (n = ftell(f)) > 0 &&
+        fseek(f, 0, SEEK_SET) == 0 && (image = malloc((size_t) n)) != NULL) {
+        if (fread(image, 1, (size_t) n, f) != (size_t) n) {
+            free(image);
+            image = NULL;
+        } else *size = (size_t) n;
+    }
+    fclose(f);
+    *ffree = freeimage;
+    return image;
+}
+
+#endif                /* } */
+
+#endif                /* } */
+
+
+/* check whether file 'f' starts with an image signature */
+static int isimage(FILE *f) {
+    char sig[sizeof(LUA_IMAGESIGNATURE) - 1];
+    size_t n = fread(sig, 1, sizeof(sig), f);
+    return (n == sizeof(sig) && memcmp(sig, LUA_IMAGESIGNATURE, n) == 0);
+}
+
+
+static int loadimage(lua_State *L, const char *filename, const char *mode,
+                     int fnameindex) {
+    size_t size = 0;
+    lua_ImageFree ffree;
+    void *image;
+    int status;
+    if (mode && strchr(mode, 'b') == NULL) {
+        lua_pushfstring(L, "attempt to load a binary chunk (mode is '%s')", mode);
+        lua_remove(L, fnameindex);
+        return LUA_ERRSYNTAX;
+    }
+    image = l_mapimage(filename, &size, &ffree);
+    if (image == NULL) return errfile(L, "map", fnameindex);
+    status = lua_loadimage(L, image, size, lua_tostring(L, -1), ffree, NULL);
+    lua_remove(L, fnameindex);
+    return status;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Compiled-chunk cache
+** =======================================================
+*/
+
+/*
+** When registry[LUA_CACHEDIR_KEY] names a directory, source files loaded
+** by 'luaL_loadfilex' are compiled once and their binary chunks kept in
+** that directory, in files named after a hash of the source text (as seen
+** by the parser), the chunk name and the compiler configuration (release,
+** bytecode format and LUA_COMPILER_REVISION). Each cache file holds a
+** header with a second hash and the source size, to reject collisions,
+** followed by the binary chunk. Cache files are
+** written to a temporary name and then renamed, so concurrent processes
+** never see partial files. Loads whose mode does not allow binary chunks
+** bypass the cache. Any problem with the cache just falls back to
+** compiling the source.
+*/
+
+#define CACHESIGNATURE    "\x1bLuaCch"
+
+#define cachestr_(x)    #x
+#define cachestr(x)    cachestr_(x)
+
+/* everything that changes the output of the compiler */
+#define CACHECONFIG    LUA_RELEASE " " LUA_SIGNATURE \
+                       " format " cachestr(LUA_BYTECODE_FORMAT) \
+                       " compiler " LUA_COMPILER_REVISION
+
+
+typedef struct CacheKey {
+    unsigned long long h1, h2;
+    size_t size;  /* size of the source text */
+} CacheKey;
+
+
+static void hashcache(CacheKey *k, const char *s, size_t l) {
+    size_t i;
+    for (i = 0; i < l; i++) {  /* FNV-1a and a multiplicative hash */
+        unsigned char c = (unsigned char) s[i];
+        k->h1 = (k->h1 ^ c) * 0x100000001b3ULL;
+        k->h2 = (k->h2 + c + 1) * 0x9e3779b97f4a7c15ULL;
+        k->h2 ^= k->h2 >> 29;
+    }
+}
+
+
+static void makekey(CacheKey *k, const char *src, size_t l,
+                    const char *chunkname, const char *mode) {
+    k->h1 = 0xcbf29ce484222325ULL;
+    k->h2 = (unsigned long long) (sizeof(lua_Integer) * 16 + sizeof(lua_Number));
+    hashcache(k, CACHECONFIG, sizeof(CACHECONFIG));
+    hashcache(k, mode, strlen(mode) + 1);
+    hashcache(k, chunkname, strlen(chunkname) + 1);
+    hashcache(k, src, l);
+    k->size = l;
+}
+
+
+/* try to load the cached chunk for 'k' from file 'cname' */
+static int loadcache(lua_State *L, const char *cname, const CacheKey *k,
+                     const char *chunkname) {
+    char sig[sizeof(CACHESIGNATURE) - 1];
+    CacheKey ck;
+    LoadF lf;
+    int status;
+    lf.f = fopen(cname, "rb");
+    if (lf.f == NULL) return 0;
+    if (fread(sig, 1, sizeof(sig), lf.f) != sizeof(sig) ||
+        memcmp(sig, CACHESIGNATURE, sizeof(sig)) != 0 ||
+        fread(&ck, sizeof(ck), 1, lf.f) != 1 ||
+        ck.h1 != k->h1 || ck.h2 != k->h2 || ck.size != k->size) {
+        fclose(lf.f);
+        return 0;
+    }
+    lf.n = 0;
+    status = lua_load(L, getF, &lf, chunkname, "b");
+    if (ferror(lf.f) && status == LUA_OK) status = LUA_ERRFILE;
+    fclose(lf.f);
+    if (status != LUA_OK) {  /* stale or corrupted cache file */
+        lua_pop(L, 1);
+        return 0;
+    }
+    return 1;
+}
+
+
+/*
+** 'opencachetmp' creates a temporary file next to cache file 'cname',
+** with a name unique across processes, and pushes that name. It returns
+** the open file, or NULL when it cannot create one (systems with neither
+** 'mkstemp' nor a process id do not write to the cache).
+*/
+#if defined(LUA_USE_POSIX)	/* { */
+
+#include <unistd.h>
+
+static FILE *opencachetmp(lua_State *L, const char *cname) {
+    size_t l = strlen(cname);
+    char *b = (char *) lua_newuserdata(L, l + sizeof(".XXXXXX"));
+    FILE *f = NULL;
+    int fd;
+    memcpy(b, cname, l);
+    memcpy(b + l, ".XXXXXX", sizeof(".XXXXXX"));
+    fd = mkstemp(b);
+    if (fd != -1 && (f = fdopen(fd, "wb")) == NULL) {
+        close(fd);
+        remove(b);
+    }
+    lua_pushstring(L, b);
+    lua_remove(L, -2);  /* remove buffer */
+    return f;
+}
+
+#elif defined(_WIN32)	/* }{ */
+
+#include <process.h>
+
+static FILE *opencachetmp(lua_State *L, const char *cname) {
+    const char *tname = lua_pushfstring(L, "%s.%d.tmp", cname, (int) _getpid());
+    return fopen(tname, "wb");
+}
+
+#else	/* }{ */
+
+static FILE *opencachetmp(lua_State *L, const char *cname) {
+    (void) cname;
+    lua_pushliteral(L, "");
+    return NULL;
+}
+
+#endif	/* } */
+
+
+static int writer(lua_State *L, const void *b, size_t size, void *f) {
+    (void) L;
+    return (fwrite(b, 1, size, (FILE *) f) != size);
+}
+
+
+/* store the function on the top of the stack in cache file 'cname' */
+static void storecache(lua_State *L, const char *cname, const CacheKey *k) {
+    FILE *f = opencachetmp(L, cname);
+    const char *tname = lua_tostring(L, -1);
+    int ok;
+    if (f == NULL) {
+        lua_pop(L, 1);
+        return;
+    }
+    lua_pushvalue(L, -2);  /* function to dump */
+    ok = fwrite(CACHESIGNATURE, sizeof(CACHESIGNATURE) - 1, 1, f) == 1 &&
+         fwrite(k, sizeof(*k), 1, f) == 1 &&
+         lua_dump(L, writer, f, 0) == 0;
+    lua_pop(L, 1);
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tname, cname) != 0)
+        remove(tname);
+    lua_pop(L, 1);  /* remove temporary name */
+}
+
+
+/*
+** Load the rest of source file 'lf' (whose first character is 'c')
+** through the cache in directory 'dir', compiling it with 'mode'.
+*/
+static int loadthroughcache(lua_State *L, LoadF *lf, int c, const char *dir,
+                            const char *chunkname, const char *mode) {
+    luaL_Buffer b;
+    CacheKey k;
+    const char *src, *cname;
+    char hex[2 * sizeof(k.h1) + 1];
+    size_t l, n;
+    int i, status;
+    luaL_buffinit(L, &b);
+    luaL_addlstring(&b, lf->buff, lf->n);
+    if (c != EOF) luaL_addchar(&b, c);
+    do {
+        char *p = luaL_prepbuffer(&b);
+        n = fread(p, 1, LUAL_BUFFERSIZE, lf->f);
+        luaL_addsize(&b, n);
+    } while (n == LUAL_BUFFERSIZE);
+    luaL_pushresult(&b);
+    if (ferror(lf->f)) return LUA_ERRFILE;  /* caller reports the error */
+    src = lua_tolstring(L, -1, &l);
+    makekey(&k, src, l, chunkname, mode);
+    for (i = 0; i < 2 * (int) sizeof(k.h1); i++)
+        hex[i] = "0123456789abcdef"[(k.h1 >> (4 * i)) & 0xf];
+    hex[i] = '\0';
+    cname = lua_pushfstring(L, "%s" LUA_DIRSEP "%s.luac", dir, hex);
+    if (loadcache(L, cname, &k, chunkname))
+        status = LUA_OK;
+    else {
+        status = luaL_loadbufferx(L, src, l, chunkname, mode);
+        if (status == LUA_OK)
+            storecache(L, cname, &k);
+    }
+    lua_remove(L, -2);  /* remove cache name */
+    lua_remove(L, -2);  /* remove source */
+    return status;
+}
+
+/* }====================================================== */
+
+
 LUALIB_API int luaL_loadfilex(lua_State *L, const char *filename,
                               const char *mode) {
     LoadF lf;
@@ -712,11 +1067,32 @@ LUALIB_API int luaL_loadfilex(lua_State *L, const char *filename,
     if (c == LUA_SIGNATURE[0] && filename) {  /* binary file? */
         lf.f = freopen(filename, "rb", lf.f);  /* reopen in binary mode */
         if (lf.f == NULL) return errfile(L, "reopen", fnameindex);
+        if (isimage(lf.f)) {  /* bytecode image? */
+            fclose(lf.f);
+            return loadimage(L, filename, mode, fnameindex);
+        }
+        rewind(lf.f);
         skipcomment(&lf, &c);  /* re-read initial portion */
     }
-    if (c != EOF)
-        lf.buff[lf.n++] = c;  /* 'c' is the first character of the stream */
-    status = lua_load(L, getF, &lf, lua_tostring(L, -1), mode);
+    if (c != LUA_SIGNATURE[0] && filename != NULL &&
+        (mode == NULL || (strchr(mode, 't') != NULL &&  /* source file? */
+                          strchr(mode, 'b') != NULL &&  /* binary allowed? */
+                          strchr(mode, 'l') == NULL)))  /* not lazy? */
+        lua_getfield(L, LUA_REGISTRYINDEX, LUA_CACHEDIR_KEY);
+    else
+        lua_pushnil(L);
+    if (lua_type(L, -1) == LUA_TSTRING) {  /* cache enabled? */
+        const char *cmode = (mode == NULL) ? "t" :  /* keep optimization level */
+                            strchr(mode, 'O') ? "tO" : strchr(mode, 'o') ? "to" : "t";
+        status = loadthroughcache(L, &lf, c, lua_tostring(L, -1),
+                                  lua_tostring(L, fnameindex), cmode);
+    }
+    else {
+        if (c != EOF)
+            lf.buff[lf.n++] = c;  /* 'c' is the first character of the stream */
+        status = lua_load(L, getF, &lf, lua_tostring(L, fnameindex), mode);
+    }
+    lua_remove(L, fnameindex + 1);  /* remove cache directory */
     readstatus = ferror(lf.f);
     if (filename) fclose(lf.f);  /* close file (even in case of errors) */
     if (readstatus) {
@@ -171,16 +171,31 @@ static int luaB_rawset(lua_State *L) {
 }
 
 
+static int loadcacheopt(lua_State *L, int stats);
+
+/* options handled by the load cache rather than by 'lua_gc' */
+#define GCLOADCACHE    (-1)
+#define GCLOADSTATS    (-2)
+
 static int luaB_collectgarbage(lua_State *L) {
     static const char *const opts[] = {"stop", "restart", "collect",
                                        "count", "step", "setpause", "setstepmul",
-                                       "isrunning", NULL};
+                                       "isrunning", "compactstack",
+                                       "loadcache", "loadstats", NULL};
     static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
                                   LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-                                  LUA_GCISRUNNING};
+                                  LUA_GCISRUNNING, LUA_GCCOMPACTSTACK,
+                                  GCLOADCACHE, GCLOADSTATS};
     int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
-    int ex = (int) luaL_optinteger(L, 2, 0);
-    int res = lua_gc(L, o, ex);
+    int ex;
+    int res;
+    if (o == GCLOADCACHE || o == GCLOADSTATS)
+        return loadcacheopt(L, o == GCLOADSTATS);
+    if (o == LUA_GCCOMPACTSTACK)  /* boolean argument; absent means query */
+        ex = lua_isnoneornil(L, 2) ? -1 : lua_toboolean(L, 2);
+    else
+        ex = (int) luaL_optinteger(L, 2, 0);
+    res = lua_gc(L, o, ex);
     switch (o) {
         case LUA_GCCOUNT: {
             int b = lua_gc(L, LUA_GCCOUNTB, 0);
@@ -188,7 +203,8 @@ static int luaB_collectgarbage(lua_State *L) {
             return 1;
         }
         case LUA_GCSTEP:
-        case LUA_GCISRUNNING: {
+        case LUA_GCISRUNNING:
+        case LUA_GCCOMPACTSTACK: {
             lua_pushboolean(L, res);
             return 1;
         }
@@ -330,6 +346,202 @@ static const char *generic_reader(lua_State *L, void *ud, size_t *size) {
 }
 
 
+/*
+** {======================================================
+** Load cache
+** =======================================================
+*/
+
+/*
+** When enabled (collectgarbage("loadcache", n)), 'load' keeps the
+** functions compiled from its last 'n' distinct source strings, in a
+** table indexed by the source. Each entry records the chunk name (false
+** for the default one), the mode and its source; loading the same source
+** again with the same name and mode just creates a new closure for the
+** cached prototype. Entries are also linked in a circular list in order
+** of use, with the cache table itself as the list head, so both moving
+** an entry to the front and evicting the least recently used one, when
+** the cache is full, take constant time.
+*/
+
+typedef struct LoadCache {
+    lua_Integer capacity;  /* maximum number of entries; 0 disables it */
+    lua_Integer count;  /* number of entries */
+    lua_Integer hits, misses, evictions;
+} LoadCache;
+
+
+/* unique key for the cache in the registry */
+static const int LOADCACHE = 0;
+
+/* fields of cache entries (and list links of the cache table) */
+#define CE_FUNC    1
+#define CE_NAME    2
+#define CE_MODE    3
+#define CE_KEY     4
+#define CE_PREV    5  /* next less recently used (or the head) */
+#define CE_NEXT    6  /* next more recently used (or the head) */
+
+
+/* push the cache table and return the cache (creating them if needed) */
+static LoadCache *getloadcache(lua_State *L) {
+    LoadCache *lc;
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, &LOADCACHE) == LUA_TNIL) {
+        lua_pop(L, 1);
+        lc = (LoadCache *) lua_newuserdata(L, sizeof(LoadCache));
+        memset(lc, 0, sizeof(LoadCache));
+        lua_newtable(L);
+        lua_pushvalue(L, -1);  /* empty list */
+        lua_rawseti(L, -2, CE_PREV);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, -2, CE_NEXT);
+        lua_setuservalue(L, -2);
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &LOADCACHE);
+    }
+    lc = (LoadCache *) lua_touserdata(L, -1);
+    lua_getuservalue(L, -1);
+    lua_remove(L, -2);
+    return lc;
+}
+
+
+/* remove entry 'e' from the list of uses */
+static void unlinkentry(lua_State *L, int e) {
+    e = lua_absindex(L, e);
+    lua_rawgeti(L, e, CE_PREV);
+    lua_rawgeti(L, e, CE_NEXT);
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, -3, CE_NEXT);  /* prev.next = next */
+    lua_pushvalue(L, -2);
+    lua_rawseti(L, -2, CE_PREV);  /* next.prev = prev */
+    lua_pop(L, 2);
+}
+
+
+/* insert entry 'e' as the most recently used one of cache 'cache' */
+static void linkentry(lua_State *L, int cache, int e) {
+    e = lua_absindex(L, e);
+    lua_rawgeti(L, cache, CE_NEXT);  /* current most recent (or head) */
+    lua_pushvalue(L, e);
+    lua_rawseti(L, -2, CE_PREV);
+    lua_rawseti(L, e, CE_NEXT);
+    lua_pushvalue(L, cache);
+    lua_rawseti(L, e, CE_PREV);
+    lua_pushvalue(L, e);
+    lua_rawseti(L, cache, CE_NEXT);
+}
+
+
+/* evict least recently used entries from cache table 'cache' */
+static void trimloadcache(lua_State *L, LoadCache *lc, int cache,
+                          lua_Integer max) {
+    while (lc->count > max) {
+        lua_rawgeti(L, cache, CE_PREV);  /* least recently used entry */
+        unlinkentry(L, -1);
+        lua_rawgeti(L, -1, CE_KEY);
+        lua_pushnil(L);
+        lua_rawset(L, cache);
+        lua_pop(L, 1);
+        lc->count--;
+        lc->evictions++;
+    }
+}
+
+
+/* check whether the entry on the top was loaded with the same name and mode */
+static int sameentry(lua_State *L, int named, const char *mode) {
+    int same;
+    lua_rawgeti(L, -1, CE_NAME);
+    same = named ? lua_rawequal(L, -1, 2) : !lua_toboolean(L, -1);
+    lua_rawgeti(L, -2, CE_MODE);
+    same = same && strcmp(lua_tostring(L, -1), mode) == 0;
+    lua_pop(L, 2);
+    return same;
+}
+
+
+/*
+** Load string 's' (the first argument) through the cache at the top of
+** the stack; leave the result of the load on the top.
+*/
+static int cachedload(lua_State *L, LoadCache *lc, const char *s, size_t l,
+                      const char *chunkname, const char *mode) {
+    int named = !lua_isnoneornil(L, 2);
+    int cache = lua_gettop(L);
+    int status;
+    lua_pushvalue(L, 1);
+    if (lua_rawget(L, cache) == LUA_TTABLE && sameentry(L, named, mode)) {
+        unlinkentry(L, -1);  /* move it to the front */
+        linkentry(L, cache, -1);
+        lua_rawgeti(L, -1, CE_FUNC);
+        lua_clonefunction(L, -1);
+        lc->hits++;
+        lua_replace(L, cache);
+        lua_settop(L, cache);
+        return LUA_OK;
+    }
+    lua_settop(L, cache);
+    lc->misses++;
+    status = luaL_loadbufferx(L, s, l, chunkname, mode);
+    if (status == LUA_OK) {
+        lua_pushvalue(L, 1);
+        if (lua_rawget(L, cache) == LUA_TNIL)  /* new entry? */
+            lc->count++;
+        else  /* replace entry with another name or mode */
+            unlinkentry(L, -1);
+        lua_pop(L, 1);
+        lua_createtable(L, 6, 0);
+        lua_pushvalue(L, -2);
+        lua_rawseti(L, -2, CE_FUNC);
+        if (named) lua_pushvalue(L, 2);
+        else lua_pushboolean(L, 0);
+        lua_rawseti(L, -2, CE_NAME);
+        lua_pushstring(L, mode);
+        lua_rawseti(L, -2, CE_MODE);
+        lua_pushvalue(L, 1);
+        lua_rawseti(L, -2, CE_KEY);
+        linkentry(L, cache, -1);
+        lua_pushvalue(L, 1);  /* key */
+        lua_insert(L, -2);
+        lua_rawset(L, cache);
+        trimloadcache(L, lc, cache, lc->capacity);
+        /* the cached function keeps its upvalues; return a fresh closure */
+        lua_clonefunction(L, -1);
+        lua_remove(L, -2);
+    }
+    lua_remove(L, cache);
+    return status;
+}
+
+
+/* collectgarbage("loadcache" [, n]) and collectgarbage("loadstats") */
+static int loadcacheopt(lua_State *L, int stats) {
+    lua_Integer n = -1;  /* new capacity; -1 only queries it */
+    LoadCache *lc;
+    if (!lua_isnoneornil(L, 2)) {
+        n = luaL_checkinteger(L, 2);
+        luaL_argcheck(L, n >= 0, 2, "negative capacity");
+    }
+    lc = getloadcache(L);
+    if (stats) {
+        lua_pushinteger(L, lc->hits);
+        lua_pushinteger(L, lc->misses);
+        lua_pushinteger(L, lc->evictions);
+        lua_pushinteger(L, lc->count);
+        return 4;
+    }
+    lua_pushinteger(L, lc->capacity);  /* previous capacity */
+    if (n >= 0) {  /* set a new capacity? */
+        trimloadcache(L, lc, lua_absindex(L, -2), n);
+        lc->capacity = n;
+    }
+    return 1;
+}
+
+/* }====================================================== */
+
+
 static int luaB_load(lua_State *L) {
     int status;
     size_t l;
@@ -338,7 +550,15 @@ static int luaB_load(lua_State *L) {
     int env = (!lua_isnone(L, 4) ? 4 : 0);  /* 'env' index or 0 if no 'env' */
     if (s != NULL) {  /* loading a string? */
         const char *chunkname = luaL_optstring(L, 2, s);
-        status = luaL_loadbufferx(L, s, l, chunkname, mode);
+        LoadCache *lc;
+        lua_settop(L, 4);  /* cache goes above all arguments */
+        lc = getloadcache(L);
+        if (lc->capacity > 0)
+            status = cachedload(L, lc, s, l, chunkname, mode);
+        else {
+            lua_pop(L, 1);
+            status = luaL_loadbufferx(L, s, l, chunkname, mode);
+        }
     } else {  /* loading from a reader function */
         const char *chunkname = luaL_optstring(L, 2, "=(load)");
         luaL_checktype(L, 1, LUA_TFUNCTION);
@@ -0,0 +1,301 @@
+/*
+** String Buffer Library
+** See Copyright Notice in lua.h
+*/
+
+#define lbuflib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+#define BUFFER_HANDLE    "buffer.buffer"
+
+/* smallest storage allocated for a buffer */
+#define BUFFER_MINSIZE    64
+
+#define MAX_SIZET    ((size_t)(~(size_t)0))
+
+
+/*
+** A buffer is a byte queue: writes append at 'w' and reads consume from
+** 'r'. The storage comes from the allocator of the state and is kept by
+** 'reset' and by reads that empty the buffer, so a buffer reused across
+** iterations stops allocating once it is large enough.
+*/
+typedef struct Buffer {
+    char *b;  /* storage (NULL if none) */
+    size_t size;  /* size of the storage */
+    size_t r;  /* read position */
+    size_t w;  /* write position (end of the contents) */
+} Buffer;
+
+
+#define checkbuffer(L)    ((Buffer *)luaL_checkudata(L, 1, BUFFER_HANDLE))
+
+#define buflen(buf)    ((buf)->w - (buf)->r)
+
+/* start of the contents (storage may be NULL when empty) */
+#define bufstart(buf)    ((buf)->b != NULL ? (buf)->b + (buf)->r : "")
+
+
+static void *bufalloc(lua_State *L, void *p, size_t osize, size_t nsize) {
+    void *ud;
+    lua_Alloc allocf = lua_getallocf(L, &ud);
+    void *temp = allocf(ud, p, osize, nsize);
+    if (temp == NULL && nsize > 0)
+        luaL_error(L, "not enough memory for buffer allocation");
+    return temp;
+}
+
+
+/*
+** Return a pointer to a free area with at least 'n' bytes after the
+** contents. Consumed bytes are reclaimed by moving the contents down,
+** but only when there are at least as many of them as there are bytes
+** to move, so that appends stay amortized O(1); otherwise the storage
+** doubles.
+*/
+static char *prepbuffer(lua_State *L, Buffer *buf, size_t n) {
+    if (buf->size - buf->w < n) {  /* not enough space? */
+        size_t len = buflen(buf);
+        if (buf->r >= len && buf->size - len >= n)
+            memmove(buf->b, buf->b + buf->r, len);
+        else {
+            size_t newsize = (buf->size < BUFFER_MINSIZE / 2)
+                             ? BUFFER_MINSIZE : buf->size * 2;
+            if (n > MAX_SIZET - len)
+                luaL_error(L, "buffer too large");
+            if (newsize < buf->size || newsize - len < n)
+                newsize = len + n;
+            if (buf->r == 0)  /* contents at the start? */
+                buf->b = (char *) bufalloc(L, buf->b, buf->size, newsize);
+            else {  /* copy only the contents */
+                char *newb = (char *) bufalloc(L, NULL, 0, newsize);
+                memcpy(newb, buf->b + buf->r, len);
+                bufalloc(L, buf->b, buf->size, 0);
+                buf->b = newb;
+            }
+            buf->size = newsize;
+        }
+        buf->r = 0;
+        buf->w = len;
+    }
+    return buf->b + buf->w;
+}
+
+
+static void addbytes(lua_State *L, Buffer *buf, const char *s, size_t l) {
+    if (l > 0) {  /* avoid 'memcpy' when 's' can be NULL */
+        char *p = prepbuffer(L, buf, l);
+        memcpy(p, s, l);
+        buf->w += l;
+    }
+}
+
+
+/* drop the first 'n' bytes of the contents */
+static void consume(Buffer *buf, size_t n) {
+    buf->r += n;
+    if (buf->r == buf->w)  /* empty? start again from the beginning */
+        buf->r = buf->w = 0;
+}
+
+
+/* append the result of calling upvalue 'f' with the arguments 2... */
+static void addcall(lua_State *L, Buffer *buf, int f) {
+    int n = lua_gettop(L) - 1;
+    size_t l;
+    const char *s;
+    lua_pushvalue(L, lua_upvalueindex(f));
+    lua_rotate(L, 2, 1);  /* put function before its arguments */
+    lua_call(L, n, 1);
+    s = lua_tolstring(L, -1, &l);
+    addbytes(L, buf, s, l);
+    lua_settop(L, 1);
+}
+
+
+static int buf_new(lua_State *L) {
+    lua_Integer size = luaL_optinteger(L, 1, 0);
+    Buffer *buf;
+    luaL_argcheck(L, size >= 0, 1, "negative size");
+    buf = (Buffer *) lua_newuserdata(L, sizeof(Buffer));
+    buf->b = NULL;
+    buf->size = buf->r = buf->w = 0;
+    luaL_setmetatable(L, BUFFER_HANDLE);
+    if (size > 0)
+        prepbuffer(L, buf, (size_t) size);
+    return 1;
+}
+
+
+static int buf_put(lua_State *L) {
+    Buffer *buf = checkbuffer(L);
+    int top = lua_gettop(L);
+    int i;
+    for (i = 2; i <= top; i++) {
+        size_t l;
+        const char *s;
+        Buffer *other = (Buffer *) luaL_testudata(L, i, BUFFER_HANDLE);
+        if (lua_type(L, i) == LUA_TSTRING || lua_type(L, i) == LUA_TNUMBER) {
+            s = lua_tolstring(L, i, &l);
+            addbytes(L, buf, s, l);
+        } else if (other != NULL) {
+            l = buflen(other);
+            if (l > 0) {
+                char *p = prepbuffer(L, buf, l);  /* may move 'other' bytes */
+                memcpy(p, other->b + other->r, l);
+                buf->w += l;
+            }
+        } else if (luaL_callmeta(L, i, "__tostring")) {
+            if (!lua_isstring(L, -1))
+                luaL_error(L, "'__tostring' must return a string");
+            s = lua_tolstring(L, -1, &l);
+            addbytes(L, buf, s, l);
+            lua_pop(L, 1);
+        } else
+            luaL_argerror(L, i, lua_pushfstring(L, "string expected, got %s",
+                                                luaL_typename(L, i)));
+    }
+    lua_settop(L, 1);
+    return 1;
+}
+
+
+static int buf_putf(lua_State *L) {
+    Buffer *buf = checkbuffer(L);
+    luaL_checkstring(L, 2);
+    addcall(L, buf, 1);
+    return 1;
+}
+
+
+static int buf_pack(lua_State *L) {
+    Buffer *buf = checkbuffer(L);
+    luaL_checkstring(L, 2);
+    addcall(L, buf, 2);
+    return 1;
+}
+
+
+/*
+** Remove and return bytes from the start of the buffer: all of them
+** without arguments, or one string per argument with at most that many
+** bytes ('nil' takes the rest).
+*/
+static int buf_get(lua_State *L) {
+    Buffer *buf = checkbuffer(L);
+    int n = lua_gettop(L) - 1;
+    int i;
+    if (n == 0) {
+        lua_pushnil(L);
+        n = 1;
+    }
+    luaL_checkstack(L, n, "too many results");
+    for (i = 2; i <= n + 1; i++) {
+        size_t len = buflen(buf);
+        if (!lua_isnil(L, i)) {
+            lua_Integer l = luaL_checkinteger(L, i);
+            luaL_argcheck(L, l >= 0, i, "negative length");
+            if ((lua_Unsigned) l < len)
+                len = (size_t) l;
+        }
+        lua_pushlstring(L, bufstart(buf), len);
+        consume(buf, len);
+    }
+    return n;
+}
+
+
+static int buf_skip(lua_State *L) {
+    Buffer *buf = checkbuffer(L);
+    lua_Integer n = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, n >= 0, 2, "negative length");
+    consume(buf, ((lua_Unsigned) n < buflen(buf)) ? (size_t) n : buflen(buf));
+    lua_settop(L, 1);
+    return 1;
+}
+
+
+static int buf_reset(lua_State *L) {
+    Buffer *buf = checkbuffer(L);
+    buf->r = buf->w = 0;
+    lua_settop(L, 1);
+    return 1;
+}
+
+
+static int buf_free(lua_State *L) {
+    Buffer *buf = checkbuffer(L);
+    bufalloc(L, buf->b, buf->size, 0);
+    buf->b = NULL;
+    buf->size = buf->r = buf->w = 0;
+    return 0;
+}
+
+
+static int buf_tostring(lua_State *L) {
+    Buffer *buf = checkbuffer(L);
+    lua_pushlstring(L, bufstart(buf), buflen(buf));
+    return 1;
+}
+
+
+static int buf_len(lua_State *L) {
+    Buffer *buf = checkbuffer(L);
+    lua_pushinteger(L, (lua_Integer) buflen(buf));
+    return 1;
+}
+
+
+static const luaL_Reg buf_funcs[] = {
+        {"new", buf_new},
+        {NULL, NULL}
+};
+
+
+static const luaL_Reg buf_meth[] = {
+        {"put",      buf_put},
+        {"putf",     buf_putf},
+        {"pack",     buf_pack},
+        {"get",      buf_get},
+        {"skip",     buf_skip},
+        {"reset",    buf_reset},
+        {"free",     buf_free},
+        {"tostring", buf_tostring},
+        {NULL, NULL}
+};
+
+
+/*
+** 'putf' and 'pack' call 'string.format' and 'string.pack', which are
+** the upvalues of the methods.
+*/
+LUAMOD_API int luaopen_buffer(lua_State *L) {
+    luaL_newlib(L, buf_funcs);
+    luaL_newmetatable(L, BUFFER_HANDLE);
+    lua_newtable(L);  /* method table */
+    luaL_requiref(L, LUA_STRLIBNAME, luaopen_string, 0);
+    lua_getfield(L, -1, "format");
+    lua_getfield(L, -2, "pack");
+    lua_remove(L, -3);  /* remove string library */
+    luaL_setfuncs(L, buf_meth, 2);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, buf_tostring);
+    lua_setfield(L, -2, "__tostring");
+    lua_pushcfunction(L, buf_len);
+    lua_setfield(L, -2, "__len");
+    lua_pushcfunction(L, buf_free);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+    return 1;
+}
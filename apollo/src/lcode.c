@@ -36,6 +36,13 @@
 #define hasjumps(e)    ((e)->t != (e)->f)
 
 
+/*
+** values whose concatenation can be folded: floats are converted with
+** the locale's decimal point, which is only known at run time
+*/
+#define isconcatable(o)    (ttisstring(o) || (cvt2str(o) && ttisinteger(o)))
+
+
 /*
 ** If expression is a numeric constant, fills 'v' with its value
 ** and returns 1. Otherwise, returns 0.
@@ -56,6 +63,34 @@ static int tonumeral(const expdesc *e, TValue *v) {
 }
 
 
+/*
+** If expression is a constant (nil, boolean, numeral, string constant,
+** or '<const>' local), fills 'v' with its value and returns 1.
+** Otherwise, returns 0.
+*/
+int luaK_exp2const(FuncState *fs, const expdesc *e, TValue *v) {
+    if (hasjumps(e))
+        return 0;  /* not a constant */
+    switch (e->k) {
+        case VCONST:
+            setobj(fs->ls->L, v, &fs->ls->dyd->constvar.arr[e->u.info].k);
+            return 1;
+        case VNIL:
+            setnilvalue(v);
+            return 1;
+        case VFALSE:
+        case VTRUE:
+            setbvalue(v, e->k == VTRUE);
+            return 1;
+        case VK:
+            setobj(fs->ls->L, v, &fs->f->k[e->u.info]);
+            return 1;
+        default:
+            return tonumeral(e, v);
+    }
+}
+
+
 /*
 ** Create a OP_LOADNIL instruction, but try to optimize: if the previous
 ** instruction is also OP_LOADNIL and ranges are compatible, adjust
@@ -548,11 +583,43 @@ void luaK_setoneret(FuncState *fs, expdesc *e) {
 }
 
 
+/*
+** Convert constant 'v' into an expression.
+*/
+static void const2exp(FuncState *fs, const TValue *v, expdesc *e) {
+    switch (ttype(v)) {
+        case LUA_TNUMINT:
+            e->k = VKINT;
+            e->u.ival = ivalue(v);
+            break;
+        case LUA_TNUMFLT:
+            e->k = VKFLT;
+            e->u.nval = fltvalue(v);
+            break;
+        case LUA_TBOOLEAN:
+            e->k = bvalue(v) ? VTRUE : VFALSE;
+            break;
+        case LUA_TNIL:
+            e->k = VNIL;
+            break;
+        default:
+            lua_assert(ttisstring(v));
+            e->k = VK;
+            e->u.info = luaK_stringK(fs, tsvalue(v));
+            break;
+    }
+}
+
+
 /*
 ** Ensure that expression 'e' is not a variable.
 */
 void luaK_dischargevars(FuncState *fs, expdesc *e) {
     switch (e->k) {
+        case VCONST: {  /* replace a '<const>' local by its value */
+            const2exp(fs, &fs->ls->dyd->constvar.arr[e->u.info].k, e);
+            break;
+        }
         case VLOCAL: {  /* already in a register */
             e->k = VNONRELOC;  /* becomes a non-relocatable value */
             break;
@@ -1027,6 +1094,89 @@ static int constfolding(FuncState *fs, int op, expdesc *e1,
 }
 
 
+/*
+** Try to fold a comparison of two constants; return 1 iff successful.
+** (In this case, 'e1' has the final result.) Order comparisons are
+** folded only for numbers, as the order of strings depends on the
+** locale in use when the code runs.
+*/
+static int compfolding(FuncState *fs, BinOpr opr, expdesc *e1,
+                       const expdesc *e2) {
+    lua_State *L = fs->ls->L;
+    TValue v1, v2;
+    int res;
+    if (!luaK_exp2const(fs, e1, &v1) || !luaK_exp2const(fs, e2, &v2))
+        return 0;
+    switch (opr) {
+        case OPR_EQ:
+        case OPR_NE:
+            res = (luaV_rawequalobj(&v1, &v2) == (opr == OPR_EQ));
+            break;
+        default: {
+            if (!ttisnumber(&v1) || !ttisnumber(&v2))
+                return 0;  /* not safe to fold */
+            switch (opr) {
+                case OPR_LT: res = luaV_lessthan(L, &v1, &v2); break;
+                case OPR_LE: res = luaV_lessequal(L, &v1, &v2); break;
+                case OPR_GT: res = luaV_lessthan(L, &v2, &v1); break;
+                default: res = luaV_lessequal(L, &v2, &v1); break;
+            }
+            break;
+        }
+    }
+    e1->k = res ? VTRUE : VFALSE;
+    return 1;
+}
+
+
+/*
+** Try to fold a concatenation of two string or integer constants;
+** return 1 iff successful. 'luaK_infix' already loaded 'e1' into a
+** register, so folding is only possible when the last instruction is
+** that load and no jump goes past it; this instruction is then removed.
+** The result is computed by 'luaV_concat' itself, so integers are
+** converted exactly as they would be at run time.
+*/
+static int concatfolding(FuncState *fs, expdesc *e1, const expdesc *e2) {
+    lua_State *L = fs->ls->L;
+    Instruction *previous;
+    TValue v2;
+    if (e1->k != VNONRELOC || hasjumps(e1) ||
+        e1->u.info != fs->freereg - 1 || fs->pc <= fs->lasttarget ||
+        !luaK_exp2const(fs, e2, &v2) || !isconcatable(&v2))
+        return 0;
+    previous = &fs->f->code[fs->pc - 1];
+    if (GET_OPCODE(*previous) != OP_LOADK ||
+        GETARG_A(*previous) != e1->u.info ||
+        !isconcatable(&fs->f->k[GETARG_Bx(*previous)]))
+        return 0;
+    setobj2s(L, L->top, &fs->f->k[GETARG_Bx(*previous)]);
+    luaD_inctop(L);
+    setobj2s(L, L->top, &v2);
+    luaD_inctop(L);
+    luaV_concat(L, 2);  /* result stays anchored in the stack */
+    freeexp(fs, e1);
+    fs->pc--;  /* remove the load of 'e1' */
+    e1->u.info = luaK_stringK(fs, tsvalue(L->top - 1));
+    e1->k = VK;
+    L->top--;
+    return 1;
+}
+
+
+/*
+** Try to fold the length of a string constant; return 1 iff successful.
+*/
+static int lenfolding(FuncState *fs, expdesc *e) {
+    TValue v;
+    if (e->k != VK || !luaK_exp2const(fs, e, &v) || !ttisstring(&v))
+        return 0;
+    e->k = VKINT;
+    e->u.ival = cast(lua_Integer, tsslen(tsvalue(&v)));
+    return 1;
+}
+
+
 /*
 ** Emit code for unary expressions that "produce values"
 ** (everything but 'not').
@@ -1097,15 +1247,18 @@ static void codecomp(FuncState *fs, BinOpr opr, expdesc *e1, expdesc *e2) {
 */
 void luaK_prefix(FuncState *fs, UnOpr op, expdesc *e, int line) {
     static const expdesc ef = {VKINT, {0}, NO_JUMP, NO_JUMP};
+    luaK_dischargevars(fs, e);
     switch (op) {
         case OPR_MINUS:
         case OPR_BNOT:  /* use 'ef' as fake 2nd operand */
             if (constfolding(fs, op + LUA_OPUNM, e, &ef))
                 break;
-            /* FALLTHROUGH */
-        case OPR_LEN:
             codeunexpval(fs, cast(OpCode, op + OP_UNM), e, line);
             break;
+        case OPR_LEN:
+            if (!lenfolding(fs, e))
+                codeunexpval(fs, OP_LEN, e, line);
+            break;
         case OPR_NOT:
             codenot(fs, e);
             break;
@@ -1120,6 +1273,7 @@ void luaK_prefix(FuncState *fs, UnOpr op, expdesc *e, int line) {
 ** 2nd operand.
 */
 void luaK_infix(FuncState *fs, BinOpr op, expdesc *v) {
+    luaK_dischargevars(fs, v);
     switch (op) {
         case OPR_AND: {
             luaK_goiftrue(fs, v);  /* go ahead only if 'v' is true */
@@ -1166,23 +1320,24 @@ void luaK_infix(FuncState *fs, BinOpr op, expdesc *v) {
 */
 void luaK_posfix(FuncState *fs, BinOpr op,
                  expdesc *e1, expdesc *e2, int line) {
+    luaK_dischargevars(fs, e2);
     switch (op) {
         case OPR_AND: {
             lua_assert(e1->t == NO_JUMP);  /* list closed by 'luK_infix' */
-            luaK_dischargevars(fs, e2);
             luaK_concat(fs, &e2->f, e1->f);
             *e1 = *e2;
             break;
         }
         case OPR_OR: {
             lua_assert(e1->f == NO_JUMP);  /* list closed by 'luK_infix' */
-            luaK_dischargevars(fs, e2);
             luaK_concat(fs, &e2->t, e1->t);
             *e1 = *e2;
             break;
         }
         case OPR_CONCAT: {
             luaK_exp2val(fs, e2);
+            if (concatfolding(fs, e1, e2))
+                break;
             if (e2->k == VRELOCABLE &&
                 GET_OPCODE(getinstruction(fs, e2)) == OP_CONCAT) {
                 lua_assert(e1->u.info == GETARG_B(getinstruction(fs, e2)) - 1);
@@ -1218,7 +1373,8 @@ void luaK_posfix(FuncState *fs, BinOpr op,
         case OPR_NE:
         case OPR_GT:
         case OPR_GE: {
-            codecomp(fs, op, e1, e2);
+            if (!compfolding(fs, op, e1, e2))
+                codecomp(fs, op, e1, e2);
             break;
         }
         default:
@@ -1256,3 +1412,278 @@ void luaK_setlist(FuncState *fs, int base, int nelems, int tostore) {
     fs->freereg = base + 1;  /* free registers with list values */
 }
 
+
+
+/*
+** {======================================================
+** Optimization pass
+** =======================================================
+*/
+
+/*
+** 'luaK_optimize' rewrites the finished code of a function. Level 1
+** threads jumps to jumps (and jumps to returns), and removes unreachable
+** code and jumps to the next instruction; level 2 also removes moves
+** into registers that the next instruction overwrites and unused
+** constants. Removed instructions take their line information with
+** them, and the ranges of local variables follow the code.
+*/
+
+/* destination of jump instruction 'i' at 'pc' */
+#define jumpdest(i, pc)    ((pc) + 1 + GETARG_sBx(i))
+
+
+static int isjump(OpCode op) {
+    return (op == OP_JMP || op == OP_FORPREP || op == OP_FORLOOP ||
+            op == OP_TFORLOOP);
+}
+
+
+/*
+** Check whether instruction 'i' skips or uses the instruction after it,
+** which then must stay in place.
+*/
+static int bindsnext(Instruction i) {
+    OpCode op = GET_OPCODE(i);
+    return (testTMode(op) || op == OP_LOADKX || op == OP_TFORCALL ||
+            (op == OP_LOADBOOL && GETARG_C(i) != 0) ||
+            (op == OP_SETLIST && GETARG_C(i) == 0));
+}
+
+
+/*
+** Make each unconditional jump go directly to the end of its chain of
+** jumps, merging the levels of upvalues they close. A jump to a return
+** becomes a copy of that return (unless the return uses the stack top
+** set by its previous instruction).
+*/
+static void threadjumps(FuncState *fs) {
+    Instruction *code = fs->f->code;
+    int pc;
+    for (pc = 0; pc < fs->pc; pc++) {
+        Instruction *i = &code[pc];
+        int dest, n;
+        if (GET_OPCODE(*i) != OP_JMP)
+            continue;
+        dest = jumpdest(*i, pc);
+        for (n = 0; n < fs->pc && dest != pc && GET_OPCODE(code[dest]) == OP_JMP; n++) {
+            Instruction j = code[dest];
+            int a = GETARG_A(j);
+            int next = jumpdest(j, dest);
+            if (abs(next - (pc + 1)) > MAXARG_sBx)
+                break;
+            if (a != 0 && (GETARG_A(*i) == 0 || a < GETARG_A(*i)))
+                SETARG_A(*i, a);  /* close the lower level */
+            SETARG_sBx(*i, next - (pc + 1));
+            dest = next;
+        }
+        if (GET_OPCODE(code[dest]) == OP_RETURN && GETARG_B(code[dest]) != 0 &&
+            !(pc > 0 && testTMode(GET_OPCODE(code[pc - 1])))) {  /* not conditional? */
+            *i = code[dest];
+            fs->f->lineinfo[pc] = fs->f->lineinfo[dest];
+        }
+    }
+}
+
+
+/*
+** Mark in 'live' the instructions reachable from the function entry;
+** 'stack' is a work list with room for all instructions.
+*/
+static void markreachable(FuncState *fs, int *live, int *stack) {
+    Instruction *code = fs->f->code;
+    int n = 0;
+    int pc;
+    for (pc = 0; pc < fs->pc; pc++) live[pc] = 0;
+    live[0] = 1;
+    stack[n++] = 0;
+    while (n > 0) {
+        Instruction i;
+        int next, dest = -1;
+        pc = stack[--n];
+        i = code[pc];
+        next = pc + 1;
+        switch (GET_OPCODE(i)) {
+            case OP_RETURN:
+                next = -1;
+                break;
+            case OP_JMP:
+            case OP_FORPREP:
+                next = -1;
+                dest = jumpdest(i, pc);
+                break;
+            case OP_FORLOOP:
+            case OP_TFORLOOP:
+                dest = jumpdest(i, pc);
+                break;
+            case OP_LOADBOOL:
+                if (GETARG_C(i) != 0) next = pc + 2;
+                break;
+            default:
+                if (testTMode(GET_OPCODE(i))) dest = pc + 2;
+                break;
+        }
+        if (next >= 0 && next < fs->pc && !live[next]) {
+            live[next] = 1;
+            stack[n++] = next;
+        }
+        if (dest >= 0 && dest < fs->pc && !live[dest]) {
+            live[dest] = 1;
+            stack[n++] = dest;
+        }
+    }
+    for (pc = 0; pc < fs->pc - 1; pc++) {  /* keep what live code depends on */
+        if (live[pc] && bindsnext(code[pc]))
+            live[pc + 1] = 1;
+    }
+}
+
+
+/*
+** Check whether instruction 'i' sets register 'r' without reading it.
+** Only instructions that cannot run other code count: with a metamethod
+** call or a collection step (which may run finalizers) in between, a
+** closure capturing 'r' could see its old value.
+*/
+static int overwrites(Instruction i, int r) {
+    if (GETARG_A(i) != r)
+        return 0;
+    switch (GET_OPCODE(i)) {
+        case OP_LOADK:
+        case OP_LOADNIL:
+        case OP_GETUPVAL:
+            return 1;
+        case OP_LOADBOOL:
+            return (GETARG_C(i) == 0);
+        case OP_MOVE:
+            return (GETARG_B(i) != r);
+        default:
+            return 0;
+    }
+}
+
+
+/*
+** Unmark jumps to the next instruction and, at level 2, moves whose
+** result is overwritten right away.
+*/
+static void removenops(FuncState *fs, int *live, int level) {
+    Instruction *code = fs->f->code;
+    int pc;
+    for (pc = 0; pc < fs->pc - 1; pc++) {
+        Instruction i = code[pc];
+        if (!live[pc] || (pc > 0 && live[pc - 1] && bindsnext(code[pc - 1])))
+            continue;
+        if (GET_OPCODE(i) == OP_JMP)
+            live[pc] = !(GETARG_A(i) == 0 && GETARG_sBx(i) == 0);
+        else if (GET_OPCODE(i) == OP_MOVE && level >= 2)
+            live[pc] = !(GETARG_A(i) == GETARG_B(i) || overwrites(code[pc + 1], GETARG_A(i)));
+    }
+}
+
+
+/*
+** Remove the instructions not marked in 'live', which becomes the map
+** from old to new positions.
+*/
+static void compactcode(FuncState *fs, int *live) {
+    Proto *f = fs->f;
+    int *newpc = live;
+    int pc, n = 0;
+    for (pc = 0; pc < fs->pc; pc++) {
+        int keep = newpc[pc];
+        newpc[pc] = n;
+        n += keep;
+    }
+    newpc[fs->pc] = n;
+    if (n == fs->pc)
+        return;  /* nothing removed */
+    for (pc = 0; pc < fs->pc; pc++) {
+        Instruction i = f->code[pc];
+        if (newpc[pc + 1] == newpc[pc])
+            continue;  /* removed */
+        if (isjump(GET_OPCODE(i)))
+            SETARG_sBx(i, newpc[jumpdest(i, pc)] - newpc[pc] - 1);
+        f->code[newpc[pc]] = i;
+        f->lineinfo[newpc[pc]] = f->lineinfo[pc];
+    }
+    for (pc = 0; pc < fs->nlocvars; pc++) {
+        f->locvars[pc].startpc = newpc[f->locvars[pc].startpc];
+        f->locvars[pc].endpc = newpc[f->locvars[pc].endpc];
+    }
+    fs->pc = n;
+}
+
+
+/*
+** Remove the constants no instruction uses.
+*/
+static void compactk(FuncState *fs) {
+    Proto *f = fs->f;
+    int *newk;
+    int pc, k, n = 0;
+    if (fs->nk == 0)
+        return;
+    newk = luaM_newvector(fs->ls->L, fs->nk, int);
+    for (k = 0; k < fs->nk; k++) newk[k] = 0;
+    for (pc = 0; pc < fs->pc; pc++) {  /* mark used constants */
+        Instruction i = f->code[pc];
+        OpCode op = GET_OPCODE(i);
+        if (op == OP_LOADK)
+            newk[GETARG_Bx(i)] = 1;
+        else if (op == OP_LOADKX)
+            newk[GETARG_Ax(f->code[pc + 1])] = 1;
+        else if (getOpMode(op) == iABC) {
+            if (getBMode(op) == OpArgK && ISK(GETARG_B(i)))
+                newk[INDEXK(GETARG_B(i))] = 1;
+            if (getCMode(op) == OpArgK && ISK(GETARG_C(i)))
+                newk[INDEXK(GETARG_C(i))] = 1;
+        }
+    }
+    for (k = 0; k < fs->nk; k++) {
+        if (newk[k]) {
+            f->k[n] = f->k[k];
+            newk[k] = n++;
+        }
+    }
+    if (n < fs->nk) {
+        for (pc = 0; pc < fs->pc; pc++) {  /* renumber constants */
+            Instruction *i = &f->code[pc];
+            OpCode op = GET_OPCODE(*i);
+            if (op == OP_LOADK)
+                SETARG_Bx(*i, newk[GETARG_Bx(*i)]);
+            else if (op == OP_LOADKX)
+                SETARG_Ax(f->code[pc + 1], newk[GETARG_Ax(f->code[pc + 1])]);
+            else if (getOpMode(op) == iABC) {
+                if (getBMode(op) == OpArgK && ISK(GETARG_B(*i)))
+                    SETARG_B(*i, RKASK(newk[INDEXK(GETARG_B(*i))]));
+                if (getCMode(op) == OpArgK && ISK(GETARG_C(*i)))
+                    SETARG_C(*i, RKASK(newk[INDEXK(GETARG_C(*i))]));
+            }
+        }
+    }
+    luaM_freearray(fs->ls->L, newk, fs->nk);
+    fs->nk = n;
+}
+
+
+/*
+** Optimize the code of a finished function at level 'level' (0 does
+** nothing).
+*/
+void luaK_optimize(FuncState *fs, int level) {
+    int size = fs->pc + 1;
+    int *live;
+    if (level <= 0 || fs->pc == 0)
+        return;
+    threadjumps(fs);
+    live = luaM_newvector(fs->ls->L, 2 * size, int);  /* marks and work list */
+    markreachable(fs, live, live + size);
+    removenops(fs, live, level);
+    compactcode(fs, live);
+    luaM_freearray(fs->ls->L, live, 2 * size);
+    if (level >= 2)
+        compactk(fs);
+}
+
+/* }====================================================== */
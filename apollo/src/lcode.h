@@ -80,6 +80,7 @@ LUAI_FUNC void luaK_exp2nextreg(FuncState *fs, expdesc *e);
 LUAI_FUNC void luaK_exp2val(FuncState *fs, expdesc *e);
 
 LUAI_FUNC int luaK_exp2RK(FuncState *fs, expdesc *e);
+LUAI_FUNC int luaK_exp2const(FuncState *fs, const expdesc *e, TValue *v);
 
 LUAI_FUNC void luaK_self(FuncState *fs, expdesc *e, expdesc *key);
 
@@ -118,5 +119,7 @@ LUAI_FUNC void luaK_posfix(FuncState *fs, BinOpr op, expdesc *v1,
 
 LUAI_FUNC void luaK_setlist(FuncState *fs, int base, int nelems, int tostore);
 
+LUAI_FUNC void luaK_optimize(FuncState *fs, int level);
+
 
 #endif
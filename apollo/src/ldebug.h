@@ -34,6 +34,8 @@ LUAI_FUNC l_noret luaG_tointerror(lua_State *L, const TValue *p1,
 LUAI_FUNC l_noret luaG_ordererror(lua_State *L, const TValue *p1,
                                   const TValue *p2);
 
+LUAI_FUNC l_noret luaG_frozenerror(lua_State *L, const TValue *t);
+
 LUAI_FUNC l_noret luaG_runerror(lua_State *L, const char *fmt, ...);
 
 LUAI_FUNC const char *luaG_addinfo(lua_State *L, const char *msg,
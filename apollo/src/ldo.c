@@ -190,7 +190,7 @@ void luaD_growstack(lua_State *L, int n) {
         luaD_throw(L, LUA_ERRERR);
     else {
         int needed = cast_int(L->top - L->stack) + n + EXTRA_STACK;
-        int newsize = 2 * size;
+        int newsize = G(L)->compactstack ? needed + needed / 4 : 2 * size;
         if (newsize > LUAI_MAXSTACK) newsize = LUAI_MAXSTACK;
         if (newsize < needed) newsize = needed;
         if (newsize > LUAI_MAXSTACK) {  /* stack overflow? */
@@ -213,13 +213,19 @@ static int stackinuse(lua_State *L) {
 }
 
 
+/*
+** In compact-stack mode the slack kept above the part in use is just
+** EXTRA_STACK and every CallInfo past the current one is released, so
+** that a suspended thread holds as little memory as possible.
+*/
 void luaD_shrinkstack(lua_State *L) {
     int inuse = stackinuse(L);
-    int goodsize = inuse + (inuse / 8) + 2 * EXTRA_STACK;
+    int compact = G(L)->compactstack;
+    int goodsize = inuse + (inuse / 8) + (compact ? 1 : 2) * EXTRA_STACK;
     if (goodsize > LUAI_MAXSTACK)
         goodsize = LUAI_MAXSTACK;  /* respect stack limit */
-    if (L->stacksize > LUAI_MAXSTACK)  /* had been handling stack overflow? */
-        luaE_freeCI(L);  /* free all CIs (list grew because of an error) */
+    if (L->stacksize > LUAI_MAXSTACK || compact)  /* overflow or compact? */
+        luaE_freeCI(L);  /* free all CIs not in use */
     else
         luaE_shrinkCI(L);  /* shrink list */
     /* if thread is currently not handling a stack overflow and its
@@ -428,6 +434,8 @@ int luaD_precall(lua_State *L, StkId func, int nresults) {
             lua_unlock(L);
             n = (*f)(L);  /* do the actual call */
             lua_lock(L);
+            if (L->status == LUA_YIELD)  /* yielded without a long jump? */
+                return 1;  /* leave its frame suspended */
             api_checknelems(L, n);
             luaD_poscall(L, ci, L->top - n, n);
             return 1;
@@ -436,7 +444,13 @@ int luaD_precall(lua_State *L, StkId func, int nresults) {
             StkId base;
             Proto *p = clLvalue(func)->p;
             int n = cast_int(L->top - func) - 1;  /* number of real arguments */
-            int fsize = p->maxstacksize;  /* frame size */
+            int fsize;
+            if (p->lazy != NULL) {  /* body not compiled yet? */
+                ptrdiff_t funcr = savestack(L, func);
+                luaD_compilelazy(L, p);
+                func = restorestack(L, funcr);
+            }
+            fsize = p->maxstacksize;  /* frame size */
             checkstackp(L, fsize, func);
             if (p->is_vararg)
                 base = adjust_varargs(L, p, n);
@@ -514,7 +528,7 @@ static void finishCcall(lua_State *L, int status) {
     CallInfo *ci = L->ci;
     int n;
     /* must have a continuation and must be able to call it */
-    lua_assert(ci->u.c.k != NULL && L->nny == 0);
+    lua_assert(ci->u.c.k != NULL && L->nny == L->nnyrec);
     /* error status can only happen in a protected call */
     lua_assert((ci->callstatus & CIST_YPCALL) || status == LUA_YIELD);
     if (ci->callstatus & CIST_YPCALL) {  /* was inside a pcall? */
@@ -527,23 +541,33 @@ static void finishCcall(lua_State *L, int status) {
     lua_unlock(L);
     n = (*ci->u.c.k)(L, status, ci->u.c.ctx);  /* call continuation function */
     lua_lock(L);
+    if (L->status == LUA_YIELD)  /* continuation yielded again? */
+        return;
     api_checknelems(L, n);
     luaD_poscall(L, ci, L->top - n, n);  /* finish 'luaD_precall' */
 }
 
 
+/* data to 'unroll' */
+struct Unroll {
+    CallInfo *limit;  /* frame where the continuation ends */
+    int status;  /* error being recovered from (or LUA_OK) */
+};
+
+
 /*
-** Executes "full continuation" (everything in the stack) of a
-** previously interrupted coroutine until the stack is empty (or another
-** interruption long-jumps out of the loop). If the coroutine is
-** recovering from an error, 'ud' points to the error status, which must
-** be passed to the first continuation function (otherwise the default
-** status is LUA_YIELD).
+** Executes "full continuation" (everything in the stack above 'limit')
+** of a previously interrupted coroutine or recovered protected call
+** until it is done, the coroutine yields again or another interruption
+** long-jumps out of the loop. If recovering from an error, its status
+** must be passed to the first continuation function (otherwise the
+** default status is LUA_YIELD).
 */
 static void unroll(lua_State *L, void *ud) {
-    if (ud != NULL)  /* error status? */
-        finishCcall(L, *(int *) ud);  /* finish 'lua_pcallk' callee */
-    while (L->ci != &L->base_ci) {  /* something in the stack */
+    struct Unroll *u = cast(struct Unroll *, ud);
+    if (errorstatus(u->status))  /* error status? */
+        finishCcall(L, u->status);  /* finish 'lua_pcallk' callee */
+    while (L->ci != u->limit && L->status == LUA_OK) {  /* something left? */
         if (!isLua(L->ci))  /* C function? */
             finishCcall(L, LUA_YIELD);  /* complete its execution */
         else {  /* Lua function */
@@ -556,11 +580,11 @@ static void unroll(lua_State *L, void *ud) {
 
 /*
 ** Try to find a suspended protected call (a "recover point") for the
-** given thread.
+** given thread, above frame 'limit'.
 */
-static CallInfo *findpcall(lua_State *L) {
+static CallInfo *findpcall(lua_State *L, CallInfo *limit) {
     CallInfo *ci;
-    for (ci = L->ci; ci != NULL; ci = ci->previous) {  /* search for a pcall */
+    for (ci = L->ci; ci != limit; ci = ci->previous) {  /* search for a pcall */
         if (ci->callstatus & CIST_YPCALL)
             return ci;
     }
@@ -569,13 +593,14 @@ static CallInfo *findpcall(lua_State *L) {
 
 
 /*
-** Recovers from an error in a coroutine. Finds a recover point (if
-** there is one) and completes the execution of the interrupted
-** 'luaD_pcall'. If there is no recover point, returns zero.
+** Recovers from an error in a coroutine or in a call made by
+** 'luaD_pcallrec'. Finds a recover point above 'limit' (if there is
+** one) and completes the execution of the interrupted 'lua_pcallk'. If
+** there is no recover point, returns zero.
 */
-static int recover(lua_State *L, int status) {
+static int recover(lua_State *L, int status, CallInfo *limit) {
     StkId oldtop;
-    CallInfo *ci = findpcall(L);
+    CallInfo *ci = findpcall(L, limit);
     if (ci == NULL) return 0;  /* no recovery point */
     /* "finish" luaD_pcall */
     oldtop = restorestack(L, ci->extra);
@@ -583,7 +608,7 @@ static int recover(lua_State *L, int status) {
     seterrorobj(L, status, oldtop);
     L->ci = ci;
     L->allowhook = getoah(ci->callstatus);  /* restore original 'allowhook' */
-    L->nny = 0;  /* should be zero to be yieldable */
+    L->nny = L->nnyrec;  /* back to the level of the recover point */
     luaD_shrinkstack(L);
     L->errfunc = ci->u.c.old_errfunc;
     return 1;  /* continue running the coroutine */
@@ -615,6 +640,7 @@ static void resume(lua_State *L, void *ud) {
     int n = *(cast(int*, ud));  /* number of arguments */
     StkId firstArg = L->top - n;  /* first argument */
     CallInfo *ci = L->ci;
+    struct Unroll u;
     if (L->status == LUA_OK) {  /* starting a coroutine? */
         if (!luaD_precall(L, firstArg - 1, LUA_MULTRET))  /* Lua function? */
             luaV_execute(L);  /* call it */
@@ -629,12 +655,16 @@ static void resume(lua_State *L, void *ud) {
                 lua_unlock(L);
                 n = (*ci->u.c.k)(L, LUA_YIELD, ci->u.c.ctx); /* call continuation */
                 lua_lock(L);
+                if (L->status == LUA_YIELD)  /* yielded again? */
+                    return;
                 api_checknelems(L, n);
                 firstArg = L->top - n;  /* yield results come from continuation */
             }
             luaD_poscall(L, ci, firstArg, n);  /* finish 'luaD_precall' */
         }
-        unroll(L, NULL);  /* run continuation */
+        u.limit = &L->base_ci;
+        u.status = LUA_OK;
+        unroll(L, &u);  /* run continuation */
     }
 }
 
@@ -651,6 +681,7 @@ LUA_API int lua_resume(lua_State *L, lua_State *from, int nargs) {
     L->nCcalls = (from) ? from->nCcalls + 1 : 1;
     if (L->nCcalls >= LUAI_MAXCCALLS)
         return resume_error(L, "C stack overflow", nargs);
+    L->nCbase = L->nCcalls;
     luai_userstateresume(L, nargs);
     L->nny = 0;  /* allow yields */
     api_checknelems(L, (L->status == LUA_OK) ? nargs + 1 : nargs);
@@ -658,16 +689,22 @@ LUA_API int lua_resume(lua_State *L, lua_State *from, int nargs) {
     if (status == -1)  /* error calling 'lua_resume'? */
         status = LUA_ERRRUN;
     else {  /* continue running after recoverable errors */
-        while (errorstatus(status) && recover(L, status)) {
-            /* unroll continuation */
-            status = luaD_rawrunprotected(L, unroll, &status);
+        struct Unroll u;
+        u.limit = &L->base_ci;
+        while (errorstatus(status) && recover(L, status, &L->base_ci)) {
+            u.status = status;  /* unroll continuation */
+            status = luaD_rawrunprotected(L, unroll, &u);
         }
         if (errorstatus(status)) {  /* unrecoverable error? */
             L->status = cast_byte(status);  /* mark thread as 'dead' */
             seterrorobj(L, status, L->top);  /* push error message */
             L->ci->top = L->top;
-        } else
-            lua_assert(status == L->status);  /* normal end or yield */
+        } else {  /* normal end or yield (maybe without a long jump) */
+            lua_assert(status == L->status || L->status == LUA_YIELD);
+            status = L->status;
+            if (status == LUA_YIELD && G(L)->compactstack)
+                luaD_shrinkstack(L);  /* park suspended thread compactly */
+        }
     }
     L->nny = oldnny;  /* restore 'nny' */
     L->nCcalls--;
@@ -702,11 +739,15 @@ LUA_API int lua_yieldk(lua_State *L, int nresults, lua_KContext ctx,
         if ((ci->u.c.k = k) != NULL)  /* is there a continuation? */
             ci->u.c.ctx = ctx;  /* save context */
         ci->func = L->top - nresults - 1;  /* protect stack below results */
-        luaD_throw(L, LUA_YIELD);
+        /* other C frames (or a hook) between this one and 'lua_resume'? */
+        if (L->nCcalls != L->nCbase || (ci->callstatus & CIST_HOOKED))
+            luaD_throw(L, LUA_YIELD);  /* they must be long-jumped over */
+        /* else called straight from the resumed Lua code, which checks
+           'L->status' after each C call and returns to 'lua_resume' */
     }
-    lua_assert(ci->callstatus & CIST_HOOKED);  /* must be inside a hook */
+    lua_assert(!isLua(ci) || (ci->callstatus & CIST_HOOKED));
     lua_unlock(L);
-    return 0;  /* return to 'luaD_hook' */
+    return 0;  /* return to 'luaD_hook' or to 'luaD_precall' */
 }
 
 
@@ -733,6 +774,62 @@ int luaD_pcall(lua_State *L, Pfunc func, void *u,
 }
 
 
+/* data to 'f_callrec' */
+struct CallRec {
+    StkId func;
+    int nresults;
+};
+
+
+static void f_callrec(lua_State *L, void *ud) {
+    struct CallRec *c = cast(struct CallRec *, ud);
+    luaD_call(L, c->func, c->nresults);
+}
+
+
+/*
+** Call a function in protected mode, like 'luaD_pcall', but also act as
+** the recover point for 'lua_pcallk's with continuations made inside it
+** (while 'nny' stays at 'nnyrec'). Those do not need a 'setjmp' of
+** their own: an error long-jumps here, 'recover' finds the innermost of
+** them and 'unroll' runs the interrupted frames down to the caller, as
+** 'lua_resume' does for coroutines.
+*/
+int luaD_pcallrec(lua_State *L, StkId func, int nresults, ptrdiff_t ef) {
+    struct CallRec c;
+    struct Unroll u;
+    int status;
+    ptrdiff_t old_top = savestack(L, func);
+    CallInfo *old_ci = L->ci;
+    lu_byte old_allowhooks = L->allowhook;
+    unsigned short old_nny = L->nny;
+    unsigned short old_nnyrec = L->nnyrec;
+    ptrdiff_t old_errfunc = L->errfunc;
+    L->errfunc = ef;
+    L->nnyrec = ++L->nny;  /* no yields; errors recovered at this level */
+    c.func = func;
+    c.nresults = nresults;
+    status = luaD_rawrunprotected(L, f_callrec, &c);
+    u.limit = old_ci;
+    while (errorstatus(status) && recover(L, status, old_ci)) {
+        u.status = status;  /* unroll continuation */
+        status = luaD_rawrunprotected(L, unroll, &u);
+    }
+    if (status != LUA_OK) {  /* an error occurred? */
+        StkId oldtop = restorestack(L, old_top);
+        luaF_close(L, oldtop);  /* close possible pending closures */
+        seterrorobj(L, status, oldtop);
+        L->ci = old_ci;
+        L->allowhook = old_allowhooks;
+        luaD_shrinkstack(L);
+    }
+    L->nny = old_nny;
+    L->nnyrec = old_nnyrec;
+    L->errfunc = old_errfunc;
+    return status;
+}
+
+
 /*
 ** Execute a protected parser.
 */
@@ -742,6 +839,7 @@ struct SParser {  /* data to 'f_parser' */
     Dyndata dyd;  /* dynamic structures used by the parser */
     const char *mode;
     const char *name;
+    lua_Shared *shared;  /* shared chunk being loaded (or NULL) */
 };
 
 
@@ -760,38 +858,100 @@ static void f_parser(lua_State *L, void *ud) {
     int c = zgetc(p->z);  /* read first character */
     if (c == LUA_SIGNATURE[0]) {
         checkmode(L, p->mode, "binary");
-        cl = luaU_undump(L, p->z, p->name);
+        cl = luaU_undump(L, p->z, p->name, p->shared);
     } else {
+        const char *mode = (p->mode != NULL) ? p->mode : "";
+        int optlevel = (strchr(mode, 'O') != NULL) ? 2 : (strchr(mode, 'o') != NULL);
         checkmode(L, p->mode, "text");
-        cl = luaY_parser(L, p->z, &p->buff, &p->dyd, p->name, c);
+        cl = luaY_parser(L, p->z, &p->buff, &p->dyd, p->name, c,
+                         strchr(mode, 'l') != NULL, optlevel);
     }
     lua_assert(cl->nupvalues == cl->p->sizeupvalues);
     luaF_initupvals(L, cl);
 }
 
 
+static void initparser(lua_State *L, struct SParser *p) {
+    UNUSED(L);
+    p->dyd.actvar.arr = NULL;
+    p->dyd.actvar.size = 0;
+    p->dyd.constvar.arr = NULL;
+    p->dyd.constvar.size = 0;
+    p->dyd.gt.arr = NULL;
+    p->dyd.gt.size = 0;
+    p->dyd.label.arr = NULL;
+    p->dyd.label.size = 0;
+    luaZ_initbuffer(L, &p->buff);
+}
+
+
+static void freeparser(lua_State *L, struct SParser *p) {
+    luaZ_freebuffer(L, &p->buff);
+    luaM_freearray(L, p->dyd.actvar.arr, p->dyd.actvar.size);
+    luaM_freearray(L, p->dyd.constvar.arr, p->dyd.constvar.size);
+    luaM_freearray(L, p->dyd.gt.arr, p->dyd.gt.size);
+    luaM_freearray(L, p->dyd.label.arr, p->dyd.label.size);
+}
+
+
 int luaD_protectedparser(lua_State *L, ZIO *z, const char *name,
-                         const char *mode) {
+                         const char *mode, lua_Shared *shared) {
     struct SParser p;
     int status;
     L->nny++;  /* cannot yield during parsing */
     p.z = z;
     p.name = name;
     p.mode = mode;
-    p.dyd.actvar.arr = NULL;
-    p.dyd.actvar.size = 0;
-    p.dyd.gt.arr = NULL;
-    p.dyd.gt.size = 0;
-    p.dyd.label.arr = NULL;
-    p.dyd.label.size = 0;
-    luaZ_initbuffer(L, &p.buff);
+    p.shared = shared;
+    initparser(L, &p);
     status = luaD_pcall(L, f_parser, &p, savestack(L, L->top), L->errfunc);
-    luaZ_freebuffer(L, &p.buff);
-    luaM_freearray(L, p.dyd.actvar.arr, p.dyd.actvar.size);
-    luaM_freearray(L, p.dyd.gt.arr, p.dyd.gt.size);
-    luaM_freearray(L, p.dyd.label.arr, p.dyd.label.size);
+    freeparser(L, &p);
     L->nny--;
     return status;
 }
 
 
+struct SLazy {  /* data to 'f_compilelazy' */
+    struct SParser p;
+    Proto *f;
+};
+
+
+static void f_compilelazy(lua_State *L, void *ud) {
+    struct SLazy *s = cast(struct SLazy *, ud);
+    luaY_compilelazy(L, s->f, &s->p.buff, &s->p.dyd);
+}
+
+
+/*
+** Compile the body of lazy function 'f' (see 'luaY_compilelazy'). Errors
+** (such as syntax errors in the body) are raised in the caller and leave
+** 'f' lazy.
+*/
+void luaD_compilelazy(lua_State *L, Proto *f) {
+    struct SLazy s;
+    TString *src = f->lazy;
+    int status;
+    L->nny++;  /* cannot yield during parsing */
+    s.f = f;
+    initparser(L, &s.p);
+    status = luaD_pcall(L, f_compilelazy, &s, savestack(L, L->top), L->errfunc);
+    freeparser(L, &s.p);
+    L->nny--;
+    if (status != LUA_OK) {
+        f->lazy = src;  /* try again next time */
+        luaD_throw(L, status);
+    }
+}
+
+
+/* compile 'f' and all functions nested in it that are still lazy */
+void luaD_compileall(lua_State *L, Proto *f) {
+    int i;
+    if (f->lazy != NULL)
+        luaD_compilelazy(L, f);
+    for (i = 0; i < f->sizep; i++)
+        luaD_compileall(L, f->p[i]);
+}
+
+
@@ -36,7 +36,11 @@
 typedef void (*Pfunc)(lua_State *L, void *ud);
 
 LUAI_FUNC int luaD_protectedparser(lua_State *L, ZIO *z, const char *name,
-                                   const char *mode);
+                                   const char *mode, lua_Shared *shared);
+
+LUAI_FUNC void luaD_compilelazy(lua_State *L, Proto *f);
+
+LUAI_FUNC void luaD_compileall(lua_State *L, Proto *f);
 
 LUAI_FUNC void luaD_hook(lua_State *L, int event, int line);
 
@@ -49,6 +53,9 @@ LUAI_FUNC void luaD_callnoyield(lua_State *L, StkId func, int nResults);
 LUAI_FUNC int luaD_pcall(lua_State *L, Pfunc func, void *u,
                          ptrdiff_t oldtop, ptrdiff_t ef);
 
+LUAI_FUNC int luaD_pcallrec(lua_State *L, StkId func, int nresults,
+                            ptrdiff_t ef);
+
 LUAI_FUNC int luaD_poscall(lua_State *L, CallInfo *ci, StkId firstResult,
                            int nres);
 
@@ -24,7 +24,9 @@ typedef struct {
     lua_Writer writer;
     void *data;
     int strip;
+    int image;  /* true to leave out code and line information */
     int status;
+    size_t size;  /* number of bytes written */
 } DumpState;
 
 
@@ -42,6 +44,7 @@ static void DumpBlock(const void *b, size_t size, DumpState *D) {
         lua_unlock(D->L);
         D->status = (*D->writer)(D->L, b, size, D->data);
         lua_lock(D->L);
+        D->size += size;
     }
 }
 
@@ -87,9 +90,15 @@ static void DumpString(const TString *s, DumpState *D) {
 }
 
 
+static void DumpSize(size_t x, DumpState *D) {
+    DumpVar(x, D);
+}
+
+
 static void DumpCode(const Proto *f, DumpState *D) {
     DumpInt(f->sizecode, D);
-    DumpVector(f->code, f->sizecode, D);
+    if (!D->image)
+        DumpVector(f->code, f->sizecode, D);
 }
 
 
@@ -148,7 +157,8 @@ static void DumpDebug(const Proto *f, DumpState *D) {
     int i, n;
     n = (D->strip) ? 0 : f->sizelineinfo;
     DumpInt(n, D);
-    DumpVector(f->lineinfo, n, D);
+    if (!D->image)
+        DumpVector(f->lineinfo, n, D);
     n = (D->strip) ? 0 : f->sizelocvars;
     DumpInt(n, D);
     for (i = 0; i < n; i++) {
@@ -164,6 +174,7 @@ static void DumpDebug(const Proto *f, DumpState *D) {
 
 
 static void DumpFunction(const Proto *f, TString *psource, DumpState *D) {
+    lua_assert(f->lazy == NULL);  /* see 'luaD_compileall' */
     if (D->strip || f->source == psource)
         DumpString(NULL, D);  /* no debug info or same source as its parent */
     else
@@ -206,10 +217,127 @@ int luaU_dump(lua_State *L, const Proto *f, lua_Writer w, void *data,
     D.writer = w;
     D.data = data;
     D.strip = strip;
+    D.image = 0;
+    D.status = 0;
+    D.size = 0;
+    DumpHeader(&D);
+    DumpByte(f->sizeupvalues, &D);
+    DumpFunction(f, NULL, &D);
+    return D.status;
+}
+
+
+/*
+** {======================================================
+** Bytecode images
+** =======================================================
+*/
+
+static int countwriter(lua_State *L, const void *b, size_t size, void *ud) {
+    UNUSED(L);
+    UNUSED(b);
+    UNUSED(size);
+    UNUSED(ud);
+    return 0;
+}
+
+
+static int countprotos(const Proto *f) {
+    int i, n = 1;
+    for (i = 0; i < f->sizep; i++)
+        n += countprotos(f->p[i]);
+    return n;
+}
+
+
+#define alignimage(x, a)    (((x) + ((a) - 1)) & ~(size_t)((a) - 1))
+
+/* alignment of each array in an image */
+#define ARRAYALIGN    16
+
+
+static void DumpPadding(size_t to, DumpState *D) {
+    static const char zeros[ARRAYALIGN] = {0};
+    while (D->size < to) {
+        size_t n = to - D->size;
+        DumpBlock(zeros, (n < ARRAYALIGN) ? n : ARRAYALIGN, D);
+        if (D->status != 0)
+            break;
+    }
+}
+
+
+/*
+** Dump the directory entries of 'f' and its nested functions, in the
+** order they are loaded, assigning offsets from 'offset' on; return the
+** offset after their arrays.
+*/
+static size_t DumpDirectory(const Proto *f, size_t offset, DumpState *D) {
+    int i;
+    int sizelineinfo = (D->strip) ? 0 : f->sizelineinfo;
+    size_t lineoffset = alignimage(offset + f->sizecode * sizeof(Instruction),
+                                   ARRAYALIGN);
+    DumpSize(offset, D);
+    DumpSize(lineoffset, D);
+    DumpInt(f->sizecode, D);
+    DumpInt(sizelineinfo, D);
+    offset = alignimage(lineoffset + sizelineinfo * sizeof(int), ARRAYALIGN);
+    for (i = 0; i < f->sizep; i++)
+        offset = DumpDirectory(f->p[i], offset, D);
+    return offset;
+}
+
+
+/* dump the arrays of 'f' and its nested functions, as in 'DumpDirectory' */
+static void DumpArrays(const Proto *f, DumpState *D) {
+    int i;
+    DumpPadding(alignimage(D->size, ARRAYALIGN), D);
+    DumpVector(f->code, f->sizecode, D);
+    DumpPadding(alignimage(D->size, ARRAYALIGN), D);
+    if (!D->strip)
+        DumpVector(f->lineinfo, f->sizelineinfo, D);
+    for (i = 0; i < f->sizep; i++)
+        DumpArrays(f->p[i], D);
+}
+
+
+/*
+** dump Lua function as a bytecode image
+*/
+int luaU_dumpimage(lua_State *L, const Proto *f, lua_Writer w, void *data,
+                   int strip) {
+    DumpState D;
+    int nprotos = countprotos(f);
+    size_t chunkoffset = LUAI_IMAGEHEADER + nprotos * LUAI_IMAGEENTRY;
+    size_t chunksize;
+    D.L = L;
+    D.writer = countwriter;  /* first pass only measures the chunk */
+    D.data = NULL;
+    D.strip = strip;
+    D.image = 1;
     D.status = 0;
+    D.size = 0;
     DumpHeader(&D);
     DumpByte(f->sizeupvalues, &D);
     DumpFunction(f, NULL, &D);
+    chunksize = D.size;
+    D.writer = w;
+    D.data = data;
+    D.size = 0;
+    DumpLiteral(LUA_IMAGESIGNATURE, &D);
+    DumpByte(LUAC_VERSION, &D);
+    DumpSize(nprotos, &D);
+    DumpSize(chunkoffset, &D);
+    DumpSize(chunksize, &D);
+    DumpDirectory(f, alignimage(chunkoffset + chunksize, LUAI_IMAGEALIGN), &D);
+    lua_assert(D.status != 0 || D.size == chunkoffset);
+    DumpHeader(&D);
+    DumpByte(f->sizeupvalues, &D);
+    DumpFunction(f, NULL, &D);
+    DumpPadding(alignimage(D.size, LUAI_IMAGEALIGN), &D);
+    DumpArrays(f, &D);
     return D.status;
 }
 
+/* }====================================================== */
+
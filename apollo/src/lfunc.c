@@ -14,6 +14,7 @@
 
 #include "lua.h"
 
+#include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
 #include "lmem.h"
@@ -104,6 +105,12 @@ Proto *luaF_newproto(lua_State *L) {
     f->sizep = 0;
     f->code = NULL;
     f->cache = NULL;
+    f->shared = NULL;
+    f->lazy = NULL;
+    f->lazypos = 0;
+    f->lazyline = 0;
+    f->lazymethod = 0;
+    f->lazyopt = 0;
     f->sizecode = 0;
     f->lineinfo = NULL;
     f->sizelineinfo = 0;
@@ -122,16 +129,65 @@ Proto *luaF_newproto(lua_State *L) {
 
 
 void luaF_freeproto(lua_State *L, Proto *f) {
-    luaM_freearray(L, f->code, f->sizecode);
+    if (f->shared == NULL) {
+        luaM_freearray(L, f->code, f->sizecode);
+        luaM_freearray(L, f->lineinfo, f->sizelineinfo);
+    } else  /* arrays belong to the shared chunk */
+        luaF_releaseshared(f->shared);
     luaM_freearray(L, f->p, f->sizep);
     luaM_freearray(L, f->k, f->sizek);
-    luaM_freearray(L, f->lineinfo, f->sizelineinfo);
     luaM_freearray(L, f->locvars, f->sizelocvars);
     luaM_freearray(L, f->upvalues, f->sizeupvalues);
     luaM_free(L, f);
 }
 
 
+/*
+** Create an empty shared chunk with one reference. It uses the allocator
+** of 'L', which therefore must outlive every state using the chunk.
+*/
+lua_Shared *luaF_newshared(lua_State *L) {
+    global_State *g = G(L);
+    lua_Shared *s = cast(lua_Shared *,
+                         (*g->frealloc)(g->ud, NULL, 0, sizeof(lua_Shared)));
+    if (s == NULL)
+        luaD_throw(L, LUA_ERRMEM);
+    s->frealloc = g->frealloc;
+    s->ud = g->ud;
+    s->refs = 1;
+    s->nprotos = 0;
+    s->sizeprotos = 0;
+    s->protos = NULL;
+    s->chunk = NULL;
+    s->size = 0;
+    s->sizechunk = 0;
+    s->image = NULL;
+    s->sizeimage = 0;
+    s->ffree = NULL;
+    s->fud = NULL;
+    return s;
+}
+
+
+void luaF_releaseshared(lua_Shared *s) {
+    if (luai_atomicdec(s->refs) == 0) {
+        int i;
+        if (s->image != NULL)  /* chunk and arrays live in the image */
+            (*s->ffree)(s->fud, s->image, s->sizeimage);
+        else {
+            for (i = 0; i < s->sizeprotos; i++) {
+                SharedProto *sp = &s->protos[i];
+                (*s->frealloc)(s->ud, sp->code, sp->sizecode * sizeof(Instruction), 0);
+                (*s->frealloc)(s->ud, sp->lineinfo, sp->sizelineinfo * sizeof(int), 0);
+            }
+            (*s->frealloc)(s->ud, s->chunk, s->sizechunk, 0);
+        }
+        (*s->frealloc)(s->ud, s->protos, s->sizeprotos * sizeof(SharedProto), 0);
+        (*s->frealloc)(s->ud, s, sizeof(lua_Shared), 0);
+    }
+}
+
+
 /*
 ** Look for n-th local variable at line 'line' in function 'func'.
 ** Returns NULL if not found.
@@ -47,6 +47,41 @@ struct UpVal {
 #define upisopen(up)    ((up)->v != &(up)->u.value)
 
 
+/*
+** A shared chunk keeps a binary chunk together with the code and line
+** information of each of its prototypes, allocated once outside any
+** state. Prototypes loaded from it in any state point to these arrays
+** instead of owning copies. When the chunk comes from a bytecode image
+** ('lua_loadimage'), both the binary chunk and the arrays stay inside the
+** image. It is reference counted by its users and by
+** those prototypes, with atomic operations, so that states running in
+** different threads can share it.
+*/
+typedef struct SharedProto {
+    Instruction *code;
+    int *lineinfo;
+    int sizecode;
+    int sizelineinfo;
+} SharedProto;
+
+
+struct lua_Shared {
+    lua_Alloc frealloc;  /* allocator of the creating state */
+    void *ud;
+    l_refcount refs;
+    int nprotos;  /* number of prototypes (0 until the chunk is built) */
+    int sizeprotos;  /* size of 'protos' */
+    SharedProto *protos;  /* arrays of each prototype, in load order */
+    char *chunk;  /* the binary chunk */
+    size_t size;  /* size of the binary chunk */
+    size_t sizechunk;  /* size of 'chunk' */
+    void *image;  /* bytecode image holding chunk and arrays (or NULL) */
+    size_t sizeimage;
+    lua_ImageFree ffree;  /* function to release 'image' */
+    void *fud;  /* auxiliary data to 'ffree' */
+};
+
+
 LUAI_FUNC Proto *luaF_newproto(lua_State *L);
 
 LUAI_FUNC CClosure *luaF_newCclosure(lua_State *L, int nelems);
@@ -61,6 +96,10 @@ LUAI_FUNC void luaF_close(lua_State *L, StkId level);
 
 LUAI_FUNC void luaF_freeproto(lua_State *L, Proto *f);
 
+LUAI_FUNC lua_Shared *luaF_newshared(lua_State *L);
+
+LUAI_FUNC void luaF_releaseshared(lua_Shared *s);
+
 LUAI_FUNC const char *luaF_getlocalname(const Proto *func, int local_number,
                                         int pc);
 
@@ -240,8 +240,13 @@ static void reallymarkobject(global_State *g, GCObject *o) {
             break;
         }
         case LUA_TLNGSTR: {
+            TString *ts = gco2ts(o);
             gray2black(o);
-            g->GCmemtrav += sizelstring(gco2ts(o)->u.lnglen);
+            if (isslice(ts)) {  /* parent is checked at the end of 'atomic' */
+                lngstr(ts)->gclist = g->slices;
+                g->slices = lngstr(ts);
+            }
+            g->GCmemtrav += lngstrmem(ts);
             break;
         }
         case LUA_TUSERDATA: {
@@ -335,6 +340,7 @@ static void remarkupvals(global_State *g) {
 static void restartcollection(global_State *g) {
     g->gray = g->grayagain = NULL;
     g->weak = g->allweak = g->ephemeron = NULL;
+    g->slices = NULL;
     markobject(g, g->mainthread);
     markvalue(g, &g->l_registry);
     markmt(g);
@@ -477,6 +483,7 @@ static int traverseproto(global_State *g, Proto *f) {
     if (f->cache && iswhite(f->cache))
         f->cache = NULL;  /* allow cache to be collected */
     markobjectN(g, f->source);
+    markobjectN(g, f->lazy);
     for (i = 0; i < f->sizek; i++)  /* mark literals */
     markvalue(g, &f->k[i]);
     for (i = 0; i < f->sizeupvalues; i++)  /* mark upvalue names */
@@ -485,10 +492,11 @@ static int traverseproto(global_State *g, Proto *f) {
     markobjectN(g, f->p[i]);
     for (i = 0; i < f->sizelocvars; i++)  /* mark local-variable names */
     markobjectN(g, f->locvars[i].varname);
-    return sizeof(Proto) + sizeof(Instruction) * f->sizecode +
+    return sizeof(Proto) +
+           (f->shared ? 0 : sizeof(Instruction) * f->sizecode +
+                            sizeof(int) * f->sizelineinfo) +
            sizeof(Proto *) * f->sizep +
            sizeof(TValue) * f->sizek +
-           sizeof(int) * f->sizelineinfo +
            sizeof(LocVar) * f->sizelocvars +
            sizeof(Upvaldesc) * f->sizeupvalues;
 }
@@ -671,6 +679,39 @@ static void clearvalues(global_State *g, GCObject *l, GCObject *f) {
 }
 
 
+/*
+** Slices do not mark their parents. Once everything is marked, marked
+** slices whose parent is still white copy their bytes to a block of
+** their own, so that the parent can be collected (a small slice should
+** not keep alive a large string). A slice with at least half the bytes
+** of its parent keeps the parent instead, and so do emergency
+** collections (which cannot allocate) and failed allocations.
+*/
+static void checkslices(global_State *g) {
+    LString *ls;
+    for (ls = g->slices; ls != NULL; ls = ls->gclist) {
+        TString *parent = ls->parent;
+        if (ls->tsv.shrlen == LSTRSLICE && iswhite(parent)) {
+            size_t l = ls->tsv.u.lnglen;
+            char *buff = NULL;
+            if (g->gckind != KGC_EMERGENCY && l < parent->u.lnglen / 2)
+                buff = cast(char *, (*g->frealloc)(g->ud, NULL, 0, l + 1));
+            if (buff == NULL)
+                reallymarkobject(g, obj2gco(parent));  /* keep parent */
+            else {
+                memcpy(buff, ls->contents, l * sizeof(char));
+                buff[l] = '\0';
+                g->GCdebt += l + 1;
+                ls->contents = buff;
+                ls->parent = NULL;
+                ls->tsv.shrlen = LSTRMEM;
+            }
+        }
+    }
+    g->slices = NULL;
+}
+
+
 void luaC_upvdeccount(lua_State *L, UpVal *uv) {
     lua_assert(uv->refcount > 0);
     uv->refcount--;
@@ -717,7 +758,7 @@ static void freeobj(lua_State *L, GCObject *o) {
             luaM_freemem(L, o, sizelstring(gco2ts(o)->shrlen));
             break;
         case LUA_TLNGSTR: {
-            luaM_freemem(L, o, sizelstring(gco2ts(o)->u.lnglen));
+            luaS_freelngstr(L, gco2ts(o));
             break;
         }
         default:
@@ -831,9 +872,12 @@ static void GCTM(lua_State *L, int propagateerrors) {
         g->gcrunning = running;  /* restore state */
         if (status != LUA_OK && propagateerrors) {  /* error while running __gc? */
             if (status == LUA_ERRRUN) {  /* is there an error object? */
-                const char *msg = (ttisstring(L->top - 1))
-                                  ? svalue(L->top - 1)
-                                  : "no message";
+                const char *msg = "no message";
+                if (ttisstring(L->top - 1)) {
+                    if (isslice(tsvalue(L->top - 1)))
+                        luaS_unslice(L, tsvalue(L->top - 1));
+                    msg = svalue(L->top - 1);
+                }
                 luaO_pushfstring(L, "error in __gc metamethod (%s)", msg);
                 status = LUA_ERRGCMM;  /* error in __gc metamethod */
             }
@@ -1025,6 +1069,7 @@ static l_mem atomic(lua_State *L) {
     /* clear values from resurrected weak tables */
     clearvalues(g, g->weak, origweak);
     clearvalues(g, g->allweak, origall);
+    checkslices(g);  /* after all marking (including by 'clearvalues') */
     luaS_clearcache(g);
     g->currentwhite = cast_byte(otherwhite(g));  /* flip current white */
     work += g->GCmemtrav;  /* complete counting */
@@ -43,12 +43,15 @@ static const luaL_Reg loadedlibs[] = {
         {"_G", luaopen_base},
         {LUA_LOADLIBNAME, luaopen_package},
         {LUA_COLIBNAME, luaopen_coroutine},
+        {LUA_SCHEDLIBNAME, luaopen_sched},
+        {LUA_THREADLIBNAME, luaopen_threads},
         {LUA_TABLIBNAME, luaopen_table},
         {LUA_IOLIBNAME, luaopen_io},
         {LUA_OSLIBNAME, luaopen_os},
         {LUA_STRLIBNAME, luaopen_string},
         {LUA_MATHLIBNAME, luaopen_math},
         {LUA_UTF8LIBNAME, luaopen_utf8},
+        {LUA_BUFLIBNAME, luaopen_buffer},
         {LUA_DBLIBNAME, luaopen_debug},
 #if defined(LUA_COMPAT_BITLIB)
         {LUA_BITLIBNAME, luaopen_bit32},
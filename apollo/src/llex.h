@@ -70,6 +70,8 @@ typedef struct LexState {
     struct Dyndata *dyd;  /* dynamic structures used by the parser */
     TString *source;  /* current source name */
     TString *envn;  /* environment variable name */
+    TString *lazysrc;  /* whole source, when compiling lazily (or NULL) */
+    int optlevel;  /* optimization level (see 'luaK_optimize') */
 } LexState;
 
 
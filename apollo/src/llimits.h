@@ -177,6 +177,16 @@ typedef unsigned long Instruction;
 #endif
 
 
+/*
+** Minimum length for a substring of a long string to share the bytes of
+** that string (a slice; see 'luaS_newslice') instead of copying them.
+** (Must be larger than LUAI_MAXSHORTLEN.)
+*/
+#if !defined(LUAI_MINSLICE)
+#define LUAI_MINSLICE    128
+#endif
+
+
 /*
 ** Initial size for the string table (must be power of 2).
 ** The Lua core alone registers ~50 strings (reserved words +
@@ -223,6 +233,36 @@ typedef unsigned long Instruction;
 #endif
 
 
+/*
+** atomic increment and decrement (returning the new value) of counters
+** of type 'l_refcount' in data shared by several states, such as shared
+** chunks. A port without any of these primitives must define the three
+** macros itself; plain '++' and '--' would race between threads.
+*/
+#if !defined(luai_atomicinc)
+#if defined(__GNUC__)
+typedef int l_refcount;
+#define luai_atomicinc(x)    __atomic_add_fetch(&(x), 1, __ATOMIC_RELAXED)
+#define luai_atomicdec(x)    __atomic_sub_fetch(&(x), 1, __ATOMIC_ACQ_REL)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+      !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+typedef atomic_int l_refcount;
+#define luai_atomicinc(x)  \
+    (atomic_fetch_add_explicit(&(x), 1, memory_order_relaxed) + 1)
+#define luai_atomicdec(x)  \
+    (atomic_fetch_sub_explicit(&(x), 1, memory_order_acq_rel) - 1)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+typedef long l_refcount;
+#define luai_atomicinc(x)    _InterlockedIncrement(&(x))
+#define luai_atomicdec(x)    _InterlockedDecrement(&(x))
+#else
+#error "define 'l_refcount', 'luai_atomicinc' and 'luai_atomicdec'"
+#endif
+#endif
+
+
 /*
 ** these macros allow user-specific actions on threads when you defined
 ** LUAI_EXTRASPACE and need to do something extra when a thread is
@@ -14,6 +14,7 @@
 #include "lprefix.h"
 
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -491,10 +492,14 @@ static int checkload(lua_State *L, int stat, const char *filename) {
 
 static int searcher_Lua(lua_State *L) {
     const char *filename;
+    const char *mode;
     const char *name = luaL_checkstring(L, 1);
     filename = findfile(L, name, "path", LUA_LSUBSEP);
     if (filename == NULL) return 1;  /* module not found in this path */
-    return checkload(L, (luaL_loadfile(L, filename) == LUA_OK), filename);
+    lua_getfield(L, lua_upvalueindex(1), "lazy");
+    mode = lua_toboolean(L, -1) ? "btl" : NULL;  /* lazy compilation? */
+    lua_pop(L, 1);
+    return checkload(L, (luaL_loadfilex(L, filename, mode) == LUA_OK), filename);
 }
 
 
@@ -563,6 +568,159 @@ static int searcher_preload(lua_State *L) {
 }
 
 
+/*
+** {======================================================
+** Module bundles
+** =======================================================
+*/
+
+/*
+** A bundle (built by 'luac --bundle') is a file with an index followed
+** by the binary chunks of its modules. 'package.addbundle' reads only
+** the index, into a single userdata, and puts a loader for each module
+** in 'package.preload' (unless that name is already there), so 'require'
+** finds it with one table lookup, before 'package.path', and the loader
+** reads and undumps just its chunk.
+*/
+
+typedef struct BundleEntry {
+    size_t offset;  /* position of the binary chunk in the file */
+    size_t size;  /* size of the binary chunk */
+    const char *path;  /* bundle file */
+} BundleEntry;
+
+
+typedef struct LoadB {
+    FILE *f;
+    size_t left;  /* bytes of the chunk not read yet */
+    char buff[BUFSIZ];
+} LoadB;
+
+
+static const char *getB(lua_State *L, void *ud, size_t *size) {
+    LoadB *lb = (LoadB *) ud;
+    size_t n = (lb->left < sizeof(lb->buff)) ? lb->left : sizeof(lb->buff);
+    (void) L;  /* not used */
+    if (n == 0) return NULL;
+    *size = fread(lb->buff, 1, n, lb->f);
+    lb->left -= *size;
+    if (*size < n) lb->left = 0;  /* truncated file; let 'lua_load' complain */
+    return (*size > 0) ? lb->buff : NULL;
+}
+
+
+static int readsize(FILE *f, size_t *x) {
+    return fread(x, sizeof(size_t), 1, f) == 1;
+}
+
+
+static int badbundle(lua_State *L, FILE *f, const char *path) {
+    fclose(f);
+    lua_pushnil(L);
+    lua_pushfstring(L, "bad bundle '%s'", path);
+    return 2;
+}
+
+
+/*
+** Loader for a bundled module; upvalues are the entries of its bundle
+** and the index of its entry. Offsets were checked against the file
+** size, which 'ftell' gives as a long, so they fit in 'fseek'.
+*/
+static int loader_bundle(lua_State *L) {
+    const char *name = luaL_checkstring(L, 1);
+    const BundleEntry *e = (const BundleEntry *) lua_touserdata(L, lua_upvalueindex(1));
+    LoadB lb;
+    int status;
+    e += lua_tointeger(L, lua_upvalueindex(2));
+    lua_pushfstring(L, "=%s", e->path);
+    lb.f = fopen(e->path, "rb");
+    if (lb.f == NULL || fseek(lb.f, (long) e->offset, SEEK_SET) != 0) {
+        if (lb.f) fclose(lb.f);
+        return luaL_error(L, "error loading module '%s' from bundle '%s':\n\t%s",
+                          name, e->path, "cannot read bundle");
+    }
+    lb.left = e->size;
+    status = lua_load(L, getB, &lb, lua_tostring(L, -1), "b");
+    fclose(lb.f);
+    if (status != LUA_OK)
+        return luaL_error(L, "error loading module '%s' from bundle '%s':\n\t%s",
+                          name, e->path, lua_tostring(L, -1));
+    lua_pushvalue(L, 1);
+    lua_pushstring(L, e->path);
+    lua_call(L, 2, 1);  /* run the module like 'require' would */
+    return 1;
+}
+
+
+static int ll_addbundle(lua_State *L) {
+    const char *path = luaL_checkstring(L, 1);
+    char sig[sizeof(LUA_BUNDLESIGNATURE) - 1];
+    BundleEntry *e;
+    char *p;
+    size_t n, i, filesize;
+    long pos;
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return luaL_fileresult(L, 0, path);
+    if (fread(sig, 1, sizeof(sig), f) != sizeof(sig) ||
+        memcmp(sig, LUA_BUNDLESIGNATURE, sizeof(sig)) != 0 ||
+        getc(f) != (int) sizeof(size_t) || !readsize(f, &n))
+        return badbundle(L, f, path);
+    if (fseek(f, 0, SEEK_END) != 0 || (pos = ftell(f)) < 0) {
+        /* e.g., a file too large for a long offset */
+        int en = errno;
+        fclose(f);
+        errno = en;
+        return luaL_fileresult(L, 0, path);
+    }
+    if (n > (size_t) pos / (3 * sizeof(size_t)))
+        return badbundle(L, f, path);
+    filesize = (size_t) pos;
+    fseek(f, sizeof(sig) + 1 + sizeof(size_t), SEEK_SET);
+    /* entries and path live in one userdata */
+    e = (BundleEntry *) lua_newuserdata(L, n * sizeof(BundleEntry) + strlen(path) + 1);
+    p = (char *) (e + n);
+    strcpy(p, path);
+    lua_createtable(L, (int) n, 0);  /* module names */
+    for (i = 0; i < n; i++) {
+        size_t l;
+        char *name;
+        if (!readsize(f, &l) || l > filesize)
+            return badbundle(L, f, path);
+        name = (char *) lua_newuserdata(L, l);  /* temporary buffer */
+        if (fread(name, 1, l, f) != l ||
+            !readsize(f, &e[i].offset) || !readsize(f, &e[i].size) ||
+            e[i].offset > filesize || e[i].size > filesize - e[i].offset)
+            return badbundle(L, f, path);
+        e[i].path = p;
+        lua_pushlstring(L, name, l);
+        lua_remove(L, -2);  /* remove buffer */
+        lua_rawseti(L, -2, (lua_Integer) i + 1);
+    }
+    fclose(f);
+    /* index is valid; register its modules */
+    lua_getfield(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+    for (i = 0; i < n; i++) {
+        lua_rawgeti(L, -2, (lua_Integer) i + 1);  /* module name */
+        lua_pushvalue(L, -1);
+        if (lua_rawget(L, -3) == LUA_TNIL) {  /* first bundle wins */
+            lua_pop(L, 1);
+            lua_pushvalue(L, -4);  /* entries */
+            lua_pushinteger(L, (lua_Integer) i);
+            lua_pushcclosure(L, loader_bundle, 2);
+            lua_rawset(L, -3);
+        }
+        else
+            lua_pop(L, 2);
+    }
+    lua_pushinteger(L, (lua_Integer) n);
+    return 1;
+}
+
+/* }====================================================== */
+
+
 static void findloader(lua_State *L, const char *name) {
     int i;
     luaL_Buffer msg;  /* to build error message */
@@ -704,6 +862,7 @@ static int ll_seeall (lua_State *L) {
 static const luaL_Reg pk_funcs[] = {
         {"loadlib", ll_loadlib},
         {"searchpath", ll_searchpath},
+        {"addbundle", ll_addbundle},
 #if defined(LUA_COMPAT_MODULE)
         {"seeall", ll_seeall},
 #endif
@@ -767,6 +926,8 @@ LUAMOD_API int luaopen_package(lua_State *L) {
     /* set paths */
     setpath(L, "path", LUA_PATH_VAR, LUA_PATH_DEFAULT);
     setpath(L, "cpath", LUA_CPATH_VAR, LUA_CPATH_DEFAULT);
+    lua_pushboolean(L, 0);
+    lua_setfield(L, -2, "lazy");  /* modules are compiled eagerly */
     /* store config information */
     lua_pushliteral(L, LUA_DIRSEP "\n" LUA_PATH_SEP "\n" LUA_PATH_MARK "\n"
             LUA_EXEC_DIR "\n" LUA_IGMARK "\n");
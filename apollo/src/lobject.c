@@ -10,6 +10,7 @@
 #include "lprefix.h"
 
 
+#include <float.h>
 #include <locale.h>
 #include <math.h>
 #include <stdarg.h>
@@ -339,6 +340,248 @@ static lua_Number lua_strb2number(const char *s, char **endptr) {
 #define L_MAXLENNUM    200
 #endif
 
+
+/*
+** {==================================================================
+** Fast decimal conversions
+** ===================================================================
+*/
+
+/*
+** With 'double' floats and 64-bit integers, the common cases of
+** converting between floats and decimal numerals are done here with
+** exact arithmetic, and the C library is used only for the rest:
+** - 'l_str2dfast' reads numerals with at most 19 significant digits
+**   whose value is an integer below 2^53 times a power of 10 in
+**   [1e-22, 1e22]; both are exact doubles, so one multiplication or
+**   division gives the correctly rounded result (Clinger's fast path).
+** - 'l_num2strfast' writes floats in [1e-14, 2^63) as LUA_NUMBER_FMT
+**   ("%.<LUAI_NUMDIGITS>g") would, rounding the exact binary value with
+**   integer arithmetic (ties to even, as the C library does).
+*/
+#if LUA_FLOAT_TYPE == LUA_FLOAT_DOUBLE && LUA_MAXINTEGER > 2147483647 && \
+    defined(LUAI_NUMDIGITS) && LUAI_NUMDIGITS <= 15 && \
+    defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+
+#define l_fastnum
+
+/* exact powers of 10 as doubles */
+static const double l_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+static const char *l_str2dfast(const char *s, lua_Number *result) {
+    lua_Unsigned w = 0;  /* significant digits */
+    int nd = 0;  /* number of significant digits */
+    int e = 0;  /* decimal exponent */
+    int any = 0;  /* read any digit? */
+    int neg;
+    double r;
+    while (lisspace(cast_uchar(*s))) s++;  /* skip initial spaces */
+    neg = isneg(&s);
+    for (; lisdigit(cast_uchar(*s)); s++) {
+        any = 1;
+        if (w == 0 && *s == '0') continue;  /* leading zero */
+        if (nd++ >= 19) return NULL;  /* too many digits */
+        w = w * 10 + (*s - '0');
+    }
+    if (*s == '.') {
+        for (s++; lisdigit(cast_uchar(*s)); s++) {
+            any = 1;
+            e--;
+            if (w == 0 && *s == '0') continue;  /* leading zero */
+            if (nd++ >= 19) return NULL;  /* too many digits */
+            w = w * 10 + (*s - '0');
+        }
+    }
+    if (!any) return NULL;
+    if (*s == 'e' || *s == 'E') {
+        int exp1 = 0;
+        int neg1;
+        s++;  /* skip 'e' */
+        neg1 = isneg(&s);
+        if (!lisdigit(cast_uchar(*s))) return NULL;
+        for (; lisdigit(cast_uchar(*s)); s++) {
+            if (exp1 < 10000)  /* (larger values are out of range anyway) */
+                exp1 = exp1 * 10 + (*s - '0');
+        }
+        e += neg1 ? -exp1 : exp1;
+    }
+    while (lisspace(cast_uchar(*s))) s++;  /* skip trailing spaces */
+    if (*s != '\0') return NULL;
+    if (w == 0)
+        r = 0.0;
+    else if (w > (cast(lua_Unsigned, 1) << 53) || e < -22 || e > 22)
+        return NULL;  /* not exact; let 'strtod' do it */
+    else if (e < 0)
+        r = cast_num(w) / l_pow10[-e];
+    else
+        r = cast_num(w) * l_pow10[e];
+    *result = neg ? -r : r;
+    return s;
+}
+
+
+/* '*hi:*lo' = 'a' * 'b' */
+static void l_mul64(lua_Unsigned a, lua_Unsigned b,
+                    lua_Unsigned *hi, lua_Unsigned *lo) {
+    lua_Unsigned a0 = a & 0xffffffffu, a1 = a >> 32;
+    lua_Unsigned b0 = b & 0xffffffffu, b1 = b >> 32;
+    lua_Unsigned p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    lua_Unsigned mid = (p00 >> 32) + (p01 & 0xffffffffu) + (p10 & 0xffffffffu);
+    *lo = (mid << 32) | (p00 & 0xffffffffu);
+    *hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+}
+
+
+/* bit 'i' of 'hi:lo' */
+#define bit128(hi,lo,i)  \
+    (((i) < 64 ? (lo) >> (i) : (hi) >> ((i) - 64)) & 1)
+
+
+/* whether the 'i' lowest bits of 'hi:lo' (0 < 'i' < 128) are not all 0 */
+static int l_lowbits(lua_Unsigned hi, lua_Unsigned lo, int i) {
+    if (i < 64)
+        return (lo & ((cast(lua_Unsigned, 1) << i) - 1)) != 0;
+    else if (i == 64)
+        return lo != 0;
+    else
+        return lo != 0 || (hi & ((cast(lua_Unsigned, 1) << (i - 64)) - 1)) != 0;
+}
+
+
+/*
+** Put in '*res' the value of positive 'x' times 10^(LUAI_NUMDIGITS - 1 -
+** 'e10') rounded to an integer (ties to even). Return 2 on success, -1
+** if 'e10' is too small (result has too many digits), +1 if it is too
+** large (too few digits), and 0 if 'x' is out of the range handled here.
+*/
+static int l_scaledigits(double x, int e10, lua_Unsigned *res) {
+    lua_Unsigned low = cast(lua_Unsigned, l_pow10[LUAI_NUMDIGITS - 1]);
+    int k = LUAI_NUMDIGITS - 1 - e10;  /* result is 'x' * 10^k */
+    int q;
+    lua_Unsigned m = cast(lua_Unsigned,
+                          l_mathop(ldexp)(l_mathop(frexp)(x, &q), 53));
+    lua_Unsigned M;
+    int up;  /* round up? */
+    q -= 53;  /* now 'x' == 'm' * 2^'q' */
+    if (k >= 0) {  /* M = m * 5^k * 2^(q + k) */
+        lua_Unsigned hi, lo, p5 = 1;
+        int s = q + k;
+        int i;
+        if (k > 27) return 0;  /* 5^k would not fit in 64 bits */
+        for (i = 0; i < k; i++) p5 *= 5;
+        l_mul64(m, p5, &hi, &lo);
+        if (s >= 0) {  /* an exact integer */
+            if (hi != 0 || s >= 64 || (lo >> (63 - s)) != 0) return -1;
+            M = lo << s;
+            up = 0;
+        } else {  /* shift 'hi:lo' right by 'r' bits, rounding */
+            int r = -s;
+            if (r >= 128) return 1;
+            if (r >= 64)
+                M = hi >> (r - 64);
+            else {
+                if ((hi >> r) != 0) return -1;
+                M = (lo >> r) | (hi << (64 - r));
+            }
+            up = bit128(hi, lo, r - 1) &&
+                 (M & 1 || (r > 1 && l_lowbits(hi, lo, r - 1)));
+        }
+    } else {  /* M = m * 2^q / 10^-k */
+        lua_Unsigned num = m, den, rest;
+        if (-k > 19) return 0;  /* 10^-k would not fit in 64 bits */
+        den = cast(lua_Unsigned, l_pow10[-k]);
+        if (q > 10) return 0;  /* 'x' >= 2^63 */
+        else if (q >= 0) num <<= q;
+        else if ((den >> (64 + q)) != 0) return 0;
+        else den <<= -q;
+        M = num / den;
+        rest = num % den;  /* compare it with 'den' / 2 */
+        up = rest > den - rest || (rest == den - rest && (M & 1));
+    }
+    if (M >= low * 10) return -1;
+    else if (M < low) return 1;
+    *res = M + up;
+    return 2;
+}
+
+
+/*
+** Write float 'n' into 'buff' as LUA_NUMBER_FMT would (with a final
+** '\0') and return its length; return 0 if 'n' is out of the range
+** handled here.
+*/
+static int l_num2strfast(char *buff, lua_Number n) {
+    char digits[LUAI_NUMDIGITS];
+    double x = l_mathop(fabs)(n);
+    lua_Unsigned M;
+    int e10, nd, i, len = 0, res = 0, tries;
+    if (x == 0) {  /* +0 or -0 */
+        if (n < 0 || 1 / n < 0) buff[len++] = '-';
+        buff[len++] = '0';
+        buff[len] = '\0';
+        return len;
+    }
+    if (!(x >= 1e-14 && x < 9.2e18)) return 0;  /* also for inf and NaN */
+    (void) l_mathop(frexp)(x, &e10);
+    e10 = cast_int(l_mathop(floor)((e10 - 1) * 0.30102999566398119521));
+    for (tries = 0; tries < 3; tries++) {  /* adjust exponent estimate */
+        res = l_scaledigits(x, e10, &M);
+        if (res == 2 || res == 0) break;
+        e10 -= res;
+    }
+    if (res != 2) return 0;
+    if (M == cast(lua_Unsigned, l_pow10[LUAI_NUMDIGITS])) {  /* rounded up? */
+        M /= 10;
+        e10++;
+    }
+    for (i = LUAI_NUMDIGITS - 1; i >= 0; i--) {
+        digits[i] = cast(char, '0' + M % 10);
+        M /= 10;
+    }
+    for (nd = LUAI_NUMDIGITS; nd > 1 && digits[nd - 1] == '0'; nd--) {}
+    if (n < 0) buff[len++] = '-';
+    if (e10 < -4 || e10 >= LUAI_NUMDIGITS) {  /* exponent notation */
+        buff[len++] = digits[0];
+        if (nd > 1) {
+            buff[len++] = lua_getlocaledecpoint();
+            memcpy(buff + len, digits + 1, nd - 1);
+            len += nd - 1;
+        }
+        buff[len++] = 'e';
+        buff[len++] = (e10 < 0) ? '-' : '+';
+        if (e10 < 0) e10 = -e10;
+        if (e10 >= 100) buff[len++] = cast(char, '0' + e10 / 100);
+        buff[len++] = cast(char, '0' + e10 / 10 % 10);  /* at least 2 digits */
+        buff[len++] = cast(char, '0' + e10 % 10);
+    } else if (e10 >= 0) {  /* integer part plus decimals */
+        memcpy(buff + len, digits, e10 + 1);
+        len += e10 + 1;
+        if (nd > e10 + 1) {
+            buff[len++] = lua_getlocaledecpoint();
+            memcpy(buff + len, digits + e10 + 1, nd - e10 - 1);
+            len += nd - e10 - 1;
+        }
+    } else {  /* 0.000ddd */
+        buff[len++] = '0';
+        buff[len++] = lua_getlocaledecpoint();
+        for (i = -1; i > e10; i--)
+            buff[len++] = '0';
+        memcpy(buff + len, digits, nd);
+        len += nd;
+    }
+    buff[len] = '\0';
+    return len;
+}
+
+#endif
+
+/* }================================================================== */
+
+
 static const char *l_str2dloc(const char *s, lua_Number *result, int mode) {
     char *endptr;
     if (mode == 'x')
@@ -369,8 +612,14 @@ static const char *l_str2dloc(const char *s, lua_Number *result, int mode) {
 */
 static const char *l_str2d(const char *s, lua_Number *result) {
     const char *endptr;
-    const char *pmode = strpbrk(s, ".xXnNbB");
-    int mode = pmode ? ltolower(cast_uchar(*pmode)) : 0;
+    const char *pmode;
+    int mode;
+#if defined(l_fastnum)
+    if ((endptr = l_str2dfast(s, result)) != NULL)
+        return endptr;
+#endif
+    pmode = strpbrk(s, ".xXnNbB");
+    mode = pmode ? ltolower(cast_uchar(*pmode)) : 0;
     if (mode == 'n')  /* reject 'inf' and 'nan' */
         return NULL;
     endptr = l_str2dloc(s, result, mode);  /* try to convert */
@@ -476,6 +725,9 @@ void luaO_tostring(lua_State *L, StkId obj) {
     if (ttisinteger(obj))
         len = lua_integer2str(buff, sizeof(buff), ivalue(obj));
     else {
+#if defined(l_fastnum)
+        if ((len = l_num2strfast(buff, fltvalue(obj))) == 0)
+#endif
         len = lua_number2str(buff, sizeof(buff), fltvalue(obj));
 #if !defined(LUA_COMPAT_FLOATSTRING)
         if (buff[strspn(buff, "-0123456789")] == '\0') {  /* looks like an int? */
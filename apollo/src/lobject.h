@@ -300,7 +300,7 @@ typedef TValue *StkId;  /* index to stack elements */
 typedef struct TString {
     CommonHeader;
     lu_byte extra;  /* reserved words for short strings; "has hash" for longs */
-    lu_byte shrlen;  /* length for short strings */
+    lu_byte shrlen;  /* length for short strings; kind (LSTR*) for longs */
     unsigned int hash;
     union {
         size_t lnglen;  /* length for long strings */
@@ -319,11 +319,44 @@ typedef union UTString {
 
 
 /*
-** Get the actual string (array of bytes) from a 'TString'.
-** (Access to 'extra' ensures that value is really a 'TString'.)
+** Header for long strings. Their bytes are reached through 'contents',
+** which depends on the kind of the string (kept in 'shrlen'):
+** LSTRREG: bytes follow the header, overlapping 'parent' and the rest;
+** LSTRSLICE: a slice (see 'luaS_newslice'), whose bytes are part of
+** those of the long string 'parent';
+** LSTRMEM: a former slice, with its bytes in a block of its own;
+** LSTREXT: an external string, whose bytes belong to the embedder and
+** are released with 'falloc' (see 'lua_pushexternalstring').
+** Only external strings have the whole header; slices and LSTRMEM
+** strings end before 'falloc'.
 */
+#define LSTRREG      0
+#define LSTRSLICE    1
+#define LSTRMEM      2
+#define LSTREXT      3
+
+typedef struct LString {
+    TString tsv;
+    char *contents;  /* string bytes */
+    struct TString *parent;  /* string owning 'contents' (slices only) */
+    struct LString *gclist;  /* list of marked slices (see 'lgc.c') */
+    lua_Alloc falloc;  /* function to release 'contents' (external only) */
+    void *ud;  /* user data for 'falloc' */
+} LString;
+
+
+/* get the header of a long string */
+#define lngstr(ts)  check_exp((ts)->tt == LUA_TLNGSTR, cast(LString *, (ts)))
+
+/*
+** Get the actual string (array of bytes) from a 'TString'. Only
+** slices are not followed by a '\0'.
+*/
+#define getshrstr(ts)  \
+  check_exp((ts)->tt == LUA_TSHRSTR, cast(char *, (ts)) + sizeof(UTString))
+#define getlngstr(ts)    (lngstr(ts)->contents)
 #define getstr(ts)  \
-  check_exp(sizeof((ts)->extra), cast(char *, (ts)) + sizeof(UTString))
+  ((ts)->tt == LUA_TSHRSTR ? getshrstr(ts) : getlngstr(ts))
 
 
 /* get the actual string (array of bytes) from a Lua value */
@@ -406,6 +439,8 @@ typedef struct Proto {
     lu_byte numparams;  /* number of fixed parameters */
     lu_byte is_vararg;
     lu_byte maxstacksize;  /* number of registers needed by this function */
+    lu_byte lazymethod;  /* lazy function is a method (has 'self')? */
+    lu_byte lazyopt;  /* optimization level for the lazy body */
     int sizeupvalues;  /* size of 'upvalues' */
     int sizek;  /* size of 'k' */
     int sizecode;
@@ -421,6 +456,10 @@ typedef struct Proto {
     LocVar *locvars;  /* information about local variables (debug information) */
     Upvaldesc *upvalues;  /* upvalue information */
     struct LClosure *cache;  /* last-created closure with this prototype */
+    lua_Shared *shared;  /* owner of 'code' and 'lineinfo' (or NULL) */
+    TString *lazy;  /* source text while the body is not compiled (or NULL) */
+    size_t lazypos;  /* position of the parameter list in 'lazy' */
+    int lazyline;  /* line of the parameter list */
     TString *source;  /* used for debug information */
     GCObject *gclist;
 } Proto;
@@ -49,12 +49,25 @@ typedef struct BlockCnt {
     struct BlockCnt *previous;  /* chain */
     int firstlabel;  /* index of first label in this block */
     int firstgoto;  /* index of first pending goto in this block */
+    int firstconst;  /* index of first constant in this block */
     lu_byte nactvar;  /* # active locals outside the block */
     lu_byte upval;  /* true if some variable in the block is an upvalue */
     lu_byte isloop;  /* true if 'block' is a loop */
 } BlockCnt;
 
 
+/*
+** state saved at the start of a statically dead region of code
+*/
+typedef struct DeadCode {
+    int pc;  /* first instruction of the region */
+    int np;  /* number of prototypes before the region */
+    int ngoto;  /* number of pending gotos before the region */
+    short nlocvars;  /* number of local variables before the region */
+    lu_byte nups;  /* number of upvalues before the region */
+} DeadCode;
+
+
 #define FSCOPE_LOOP         0x01   /* Scope is a (breakable) for in loop. */
 #define FSCOPE_FORINLOOP      0x02   /* Scope is a (breakable) for in loop. */
 #define FSCOPE_DOWHILELOOP   0x04   /* Scope is a (breakable) do while in loop. */
@@ -212,7 +225,27 @@ static void new_localvar(LexState *ls, TString *name) {
                MAXVARS, "local variables");
     luaM_growvector(ls->L, dyd->actvar.arr, dyd->actvar.n + 1,
                     dyd->actvar.size, Vardesc, MAX_INT, "local variables");
-    dyd->actvar.arr[dyd->actvar.n++].idx = cast(short, reg);
+    dyd->actvar.arr[dyd->actvar.n].idx = cast(short, reg);
+    dyd->actvar.arr[dyd->actvar.n++].readonly = 0;
+}
+
+
+/*
+** create a compile-time constant for the local variable just declared
+** (and not yet active), which then takes no register
+*/
+static void new_localconst(LexState *ls, const TValue *k) {
+    FuncState *fs = ls->fs;
+    Dyndata *dyd = ls->dyd;
+    Constdesc *c;
+    dyd->actvar.n--;  /* remove the variable... */
+    fs->nlocvars--;  /* ...and its debug information */
+    luaM_growvector(ls->L, dyd->constvar.arr, dyd->constvar.n + 1,
+                    dyd->constvar.size, Constdesc, MAX_INT, "constants");
+    c = &dyd->constvar.arr[dyd->constvar.n++];
+    c->name = fs->f->locvars[fs->nlocvars].varname;
+    setobj(ls->L, &c->k, k);
+    c->nactvar = cast_byte(dyd->actvar.n - fs->firstlocal);  /* after pending ones */
 }
 
 
@@ -224,6 +257,11 @@ static void new_localvarliteral_(LexState *ls, const char *name, size_t sz) {
     new_localvarliteral_(ls, "" v, (sizeof(v)/sizeof(char))-1)
 
 
+static Vardesc *getvardesc(FuncState *fs, int i) {
+    return &fs->ls->dyd->actvar.arr[fs->firstlocal + i];
+}
+
+
 static LocVar *getlocvar(FuncState *fs, int i) {
     int idx = fs->ls->dyd->actvar.arr[fs->firstlocal + i].idx;
     lua_assert(idx < fs->nlocvars);
@@ -283,6 +321,22 @@ static int searchvar(FuncState *fs, TString *n) {
 }
 
 
+/*
+  Look for a constant named 'n' in the current function that was
+  declared after local variable 'v' (or -1), which it then shadows.
+*/
+static int searchconst(FuncState *fs, TString *n, int v) {
+    Dyndata *dyd = fs->ls->dyd;
+    int i;
+    for (i = dyd->constvar.n - 1; i >= fs->firstconst; i--) {
+        Constdesc *c = &dyd->constvar.arr[i];
+        if (eqstr(n, c->name))
+            return (v < c->nactvar) ? i : -1;
+    }
+    return -1;  /* not found */
+}
+
+
 /*
   Mark block where variable at given level was defined
   (to emit close instructions later).
@@ -304,7 +358,10 @@ static void singlevaraux(FuncState *fs, TString *n, expdesc *var, int base) {
         init_exp(var, VVOID, 0);  /* default is global */
     else {
         int v = searchvar(fs, n);  /* look up locals at current level */
-        if (v >= 0) {  /* found? */
+        int c = searchconst(fs, n, v);  /* and constants */
+        if (c >= 0)  /* found a constant? */
+            init_exp(var, VCONST, c);  /* needs no upvalue */
+        else if (v >= 0) {  /* found? */
             init_exp(var, VLOCAL, v);  /* variable is local */
             if (!base)
                 markupval(fs, v);  /* local will be used as an upval */
@@ -312,8 +369,8 @@ static void singlevaraux(FuncState *fs, TString *n, expdesc *var, int base) {
             int idx = searchupvalue(fs, n);  /* try existing upvalues */
             if (idx < 0) {  /* not found? */
                 singlevaraux(fs->prev, n, var, 0);  /* try upper levels */
-                if (var->k == VVOID)  /* not found? */
-                    return;  /* it is a global */
+                if (var->k == VVOID || var->k == VCONST)  /* not found? */
+                    return;  /* it is a global (or a constant) */
                 /* else was LOCAL or UPVAL */
                 idx = newupvalue(fs, n, var);  /* will be a new upvalue */
             }
@@ -331,6 +388,8 @@ static void singlevar(LexState *ls, expdesc *var) {
         expdesc key;
         singlevaraux(fs, ls->envn, var, 1);  /* get environment variable */
         lua_assert(var->k != VVOID);  /* this one must exist */
+        if (var->k == VCONST)  /* '_ENV' is a constant? */
+            luaK_exp2anyreg(fs, var);  /* index it from a register */
         codestring(ls, &key, varname);  /* key is variable name */
         luaK_indexed(fs, var, &key);  /* env[varname] */
     }
@@ -471,6 +530,7 @@ static void enterblock(FuncState *fs, BlockCnt *bl, lu_byte isloop) {
     bl->nactvar = fs->nactvar;
     bl->firstlabel = fs->ls->dyd->label.n;
     bl->firstgoto = fs->ls->dyd->gt.n;
+    bl->firstconst = fs->ls->dyd->constvar.n;
     bl->upval = 0;
     bl->previous = fs->bl;
     fs->bl = bl;
@@ -530,6 +590,7 @@ static void leaveblock(FuncState *fs) {
     lua_assert(bl->nactvar == fs->nactvar);
     fs->freereg = fs->nactvar;  /* free registers */
     ls->dyd->label.n = bl->firstlabel;  /* remove local labels */
+    ls->dyd->constvar.n = bl->firstconst;  /* remove local constants */
     if (bl->previous)  /* inner block? */
         movegotosout(fs, bl);  /* update pending gotos to outer block */
     else if (bl->firstgoto < ls->dyd->gt.n)  /* pending gotos in outer block? */
@@ -537,6 +598,58 @@ static void leaveblock(FuncState *fs) {
 }
 
 
+/*
+** Start a region of code that can never run. Its first instruction
+** jumps over it, in case the region must be kept after all. (It is
+** coded as a plain jump, so that pending jumps to the region are
+** patched to it instead of being joined to its list.)
+*/
+static int enterdead(FuncState *fs, DeadCode *d) {
+    d->pc = fs->pc;
+    d->np = fs->np;
+    d->ngoto = fs->ls->dyd->gt.n;
+    d->nlocvars = fs->nlocvars;
+    d->nups = fs->nups;
+    return luaK_codeAsBx(fs, OP_JMP, 0, NO_JUMP);
+}
+
+
+/*
+** Finish a dead region, dropping its code, functions, variables, and
+** upvalues.
+** Returns 0 if the region must be kept because some 'goto' (or
+** 'break') leaves it. Jumps from before the region were patched to
+** its first instruction, which is now the next one to be coded;
+** pending jumps in 'jpc' all come from inside the region.
+*/
+static int leavedead(FuncState *fs, const DeadCode *d) {
+    if (fs->ls->dyd->gt.n != d->ngoto)
+        return 0;
+    fs->pc = d->pc;
+    fs->lasttarget = d->pc;
+    fs->jpc = NO_JUMP;
+    fs->np = d->np;
+    fs->nlocvars = d->nlocvars;
+    fs->nups = d->nups;
+    return 1;
+}
+
+
+/*
+** Check whether an expression is a constant that is false (nil or
+** false) or true (everything else) no matter when it runs.
+*/
+static int isfalse(const expdesc *e) {
+    return e->t == e->f && (e->k == VNIL || e->k == VFALSE);
+}
+
+
+static int istrue(const expdesc *e) {
+    return e->t == e->f && (e->k == VTRUE || e->k == VK ||
+                            e->k == VKINT || e->k == VKFLT);
+}
+
+
 /*
 ** adds a new prototype into list of prototypes
 */
@@ -585,6 +698,7 @@ static void open_func(LexState *ls, FuncState *fs, BlockCnt *bl) {
     fs->nlocvars = 0;
     fs->nactvar = 0;
     fs->firstlocal = ls->dyd->actvar.n;
+    fs->firstconst = ls->dyd->constvar.n;
     fs->bl = NULL;
     f = fs->f;
     f->source = ls->source;
@@ -598,8 +712,11 @@ static void close_func(LexState *ls) {
     lua_State *L = ls->L;
     FuncState *fs = ls->fs;
     Proto *f = fs->f;
-    luaK_ret(fs, 0, 0);  /* final return */
+    if (f->lazy == NULL)  /* body was compiled? */
+        luaK_ret(fs, 0, 0);  /* final return */
     leaveblock(fs);
+    if (f->lazy == NULL)
+        luaK_optimize(fs, ls->optlevel);
     luaM_reallocvector(L, f->code, f->sizecode, fs->pc, Instruction);
     f->sizecode = fs->pc;
     luaM_reallocvector(L, f->lineinfo, f->sizelineinfo, fs->pc, int);
@@ -831,10 +948,207 @@ static void parlist(LexState *ls) {
 }
 
 
+/*
+** {======================================================
+** Lazy compilation
+** =======================================================
+*/
+
+/*
+** In lazy mode ('l' in the load mode) the parser only skims the body of
+** nested functions, leaving them without code; 'luaD_precall' compiles
+** such a function from the retained source text the first time it is
+** called. Skimming resolves every name used in the body the same way
+** the compiler would, so the function gets all upvalues it may need (and
+** enclosing blocks learn which of their locals are captured) before its
+** closures are created. Names that turn out to be table keys, parameters
+** or inner locals only cost unused upvalues. Functions that can see
+** '<const>' locals are always compiled at once, as those would not be
+** known when compiling the body later.
+*/
+
+/* position of the current character in the source */
+#define lazypos(ls)    (cast(size_t, (ls)->z->p - getstr((ls)->lazysrc)) - 1)
+
+
+/* check whether the current function can see '<const>' locals */
+static int seesconst(LexState *ls) {
+    Dyndata *dyd = ls->dyd;
+    int i;
+    if (dyd->constvar.n > 0)
+        return 1;
+    for (i = 0; i < dyd->actvar.n; i++) {
+        if (dyd->actvar.arr[i].readonly)
+            return 1;
+    }
+    return 0;
+}
+
+
+static void skimbody(LexState *ls) {
+    FuncState *fs = ls->fs;
+    int depth = 0;  /* number of open blocks closed by 'end' */
+    int prev = 0;  /* previous token */
+    int decl = 0;  /* reading names of new locals? */
+    for (;;) {
+        int t = ls->t.token;
+        /* a new local's name follows 'local', 'for', 'local function' or ',' */
+        int newname = decl && (prev == TK_LOCAL || prev == TK_FOR ||
+                               prev == TK_FUNCTION || prev == ',');
+        switch (t) {
+            case TK_FUNCTION:
+            case TK_IF:
+            case TK_DO: {  /* 'while' and 'for' blocks also have a 'do' */
+                depth++;
+                break;
+            }
+            case TK_END: {
+                if (depth-- == 0)
+                    return;
+                break;
+            }
+            case TK_EOS:
+                return;  /* 'check_match' reports the error */
+            case TK_NAME:
+            case TK_GOTO:
+            case TK_CONTINUE: {
+                if (!newname && prev != '.' && prev != ':' && prev != TK_DBCOLON &&
+                    prev != TK_GOTO && prev != TK_CONTINUE) {
+                    expdesc v;
+                    singlevaraux(fs, ls->t.seminfo.ts, &v, 1);
+                    if (v.k == VVOID)  /* global name? */
+                        singlevaraux(fs, ls->envn, &v, 1);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        if (t == TK_LOCAL || t == TK_FOR)
+            decl = 1;
+        else if (!(t == TK_NAME && newname) && t != ',' &&
+                 !(t == TK_FUNCTION && prev == TK_LOCAL))
+            decl = 0;
+        prev = t;
+        luaX_next(ls);
+    }
+}
+
+
+typedef struct LoadLazy {
+    const char *s;
+    size_t size;
+} LoadLazy;
+
+
+static const char *getlazy(lua_State *L, void *ud, size_t *size) {
+    LoadLazy *ll = cast(LoadLazy *, ud);
+    UNUSED(L);
+    if (ll->size == 0) return NULL;
+    *size = ll->size;
+    ll->size = 0;
+    return ll->s;
+}
+
+
+/* read the rest of stream 'z' into a string, starting with 'firstchar' */
+static TString *readsource(lua_State *L, ZIO *z, Mbuffer *buff, int firstchar) {
+    size_t n = 0;
+    if (firstchar == EOZ)  /* empty stream? ('z->n' is not valid anymore) */
+        return luaS_newliteral(L, "");
+    luaZ_resizebuffer(L, buff, LUA_MINBUFFER);
+    luaZ_buffer(buff)[n++] = cast(char, firstchar);
+    for (;;) {
+        size_t m;
+        if (z->n == 0) {  /* no bytes in buffer? */
+            if (luaZ_fill(z) == EOZ)
+                break;
+            z->n++;  /* 'luaZ_fill' consumed first byte; put it back */
+            z->p--;
+        }
+        m = z->n;
+        if (n + m > luaZ_sizebuffer(buff)) {
+            size_t newsize = luaZ_sizebuffer(buff) * 2;
+            if (newsize < n + m) newsize = n + m;
+            luaZ_resizebuffer(L, buff, newsize);
+        }
+        memcpy(luaZ_buffer(buff) + n, z->p, m);
+        n += m;
+        z->p += m;
+        z->n = 0;
+    }
+    return luaS_newlstr(L, luaZ_buffer(buff), n);
+}
+
+
+/*
+** Compile the body of lazy function 'f'. Its upvalues were already
+** collected when it was skimmed.
+*/
+void luaY_compilelazy(lua_State *L, Proto *f, Mbuffer *buff, Dyndata *dyd) {
+    LexState lexstate;
+    FuncState funcstate;
+    BlockCnt bl;
+    LoadLazy ll;
+    ZIO z;
+    TString *src = f->lazy;
+    int nups = f->sizeupvalues;
+    int i;
+    lexstate.h = luaH_new(L);  /* create table for scanner */
+    sethvalue(L, L->top, lexstate.h);  /* anchor it */
+    luaD_inctop(L);
+    setsvalue2s(L, L->top, src);  /* anchor source */
+    luaD_inctop(L);
+    for (i = 0; i < f->sizeupvalues; i++) {  /* scanner must reuse their names */
+        TValue key;
+        setsvalue(L, &key, f->upvalues[i].name);
+        setbvalue(luaH_set(L, lexstate.h, &key), 1);
+    }
+    lexstate.buff = buff;
+    lexstate.dyd = dyd;
+    dyd->actvar.n = dyd->constvar.n = dyd->gt.n = dyd->label.n = 0;
+    ll.s = getstr(src) + f->lazypos;
+    ll.size = tsslen(src) - f->lazypos;
+    luaZ_init(L, &z, getlazy, &ll);
+    luaX_setinput(L, &lexstate, &z, f->source, zgetc(&z));
+    lexstate.linenumber = lexstate.lastline = f->lazyline;
+    lexstate.lazysrc = src;  /* nested functions are lazy too */
+    lexstate.optlevel = f->lazyopt;
+    f->lazy = NULL;
+    funcstate.f = f;
+    open_func(&lexstate, &funcstate, &bl);
+    funcstate.nups = cast_byte(nups);
+    luaX_next(&lexstate);  /* read '(' */
+    checknext(&lexstate, '(');
+    if (f->lazymethod) {
+        new_localvarliteral(&lexstate, "self");  /* create 'self' parameter */
+        adjustlocalvars(&lexstate, 1);
+    }
+    parlist(&lexstate);
+    checknext(&lexstate, ')');
+    statlist(&lexstate);
+    check_match(&lexstate, TK_END, TK_FUNCTION, f->linedefined);
+    if (funcstate.nups != nups) {  /* skimming missed a name? */
+        /* closures already exist with 'nups' upvalues; keep 'f' as is */
+        luaM_reallocvector(L, f->upvalues, f->sizeupvalues, nups, Upvaldesc);
+        f->sizeupvalues = nups;
+        luaX_syntaxerror(&lexstate, "lazy function needs upvalues it was not created with");
+    }
+    close_func(&lexstate);
+    L->top -= 2;  /* remove scanner's table and source */
+}
+
+/* }====================================================== */
+
+
 static void body(LexState *ls, expdesc *e, int ismethod, int line) {
     /* body ->  '(' parlist ')' block END */
     FuncState new_fs;
     BlockCnt bl;
+    int lazy = (ls->lazysrc != NULL && ls->t.token == '(' &&
+                ls->lookahead.token == TK_EOS && !seesconst(ls));
+    size_t pos = lazy ? lazypos(ls) - 1 : 0;  /* position of '(' */
+    int pline = ls->linenumber;
     new_fs.f = addprototype(ls);
     new_fs.f->linedefined = line;
     open_func(ls, &new_fs, &bl);
@@ -845,7 +1159,17 @@ static void body(LexState *ls, expdesc *e, int ismethod, int line) {
     }
     parlist(ls);
     checknext(ls, ')');
-    statlist(ls);
+    if (lazy) {
+        Proto *f = new_fs.f;
+        skimbody(ls);
+        f->lazy = ls->lazysrc;
+        luaC_objbarrier(ls->L, f, f->lazy);
+        f->lazypos = pos;
+        f->lazyline = pline;
+        f->lazymethod = cast_byte(ismethod);
+        f->lazyopt = cast_byte(ls->optlevel);
+    } else
+        statlist(ls);
     new_fs.f->lastlinedefined = ls->linenumber;
     check_match(ls, TK_END, TK_FUNCTION, line);
     codeclosure(ls, e);
@@ -1246,8 +1570,50 @@ static void check_conflict(LexState *ls, struct LHS_assign *lh, expdesc *v) {
 }
 
 
+/*
+** Raise an error if variable described by 'e' is a '<const>' local,
+** or an upvalue that comes from one.
+*/
+static void check_readonly(LexState *ls, expdesc *e) {
+    FuncState *fs = ls->fs;
+    TString *varname = NULL;
+    switch (e->k) {
+        case VCONST:
+            varname = ls->dyd->constvar.arr[e->u.info].name;
+            break;
+        case VLOCAL:
+            if (getvardesc(fs, e->u.info)->readonly)
+                varname = getlocvar(fs, e->u.info)->varname;
+            break;
+        case VUPVAL: {
+            int idx = e->u.info;
+            FuncState *up = fs;
+            while (up->prev != NULL) {  /* find where upvalue comes from */
+                Upvaldesc *uv = &up->f->upvalues[idx];
+                up = up->prev;
+                if (uv->instack) {
+                    if (getvardesc(up, uv->idx)->readonly)
+                        varname = uv->name;
+                    break;
+                }
+                idx = uv->idx;
+            }
+            break;
+        }
+        default:
+            return;  /* other cases cannot be read-only */
+    }
+    if (varname) {
+        const char *msg = luaO_pushfstring(ls->L,
+            "attempt to assign to const variable '%s'", getstr(varname));
+        semerror(ls, msg);
+    }
+}
+
+
 static void assignment(LexState *ls, struct LHS_assign *lh, int nvars) {
     expdesc e;
+    check_readonly(ls, &lh->v);
     check_condition(ls, vkisvar(lh->v.k), "syntax error");
     if (testnext(ls, ',')) {  /* assignment -> ',' suffixedexp assignment */
         struct LHS_assign nv;
@@ -1409,17 +1775,29 @@ static void whilestat(LexState *ls, int line) {
     FuncState *fs = ls->fs;
     int whileinit;
     int condexit;
+    int dead;
+    DeadCode d;
     BlockCnt bl;
+    expdesc v;
     luaX_next(ls);  /* skip WHILE */
     whileinit = luaK_getlabel(fs);
-    condexit = cond(ls);
+    expr(ls, &v);  /* read condition */
+    luaK_dischargevars(fs, &v);  /* constants become their values */
+    dead = isfalse(&v);
+    if (dead)  /* loop never runs? */
+        condexit = enterdead(fs, &d);
+    else {
+        luaK_goiftrue(fs, &v);
+        condexit = v.f;
+    }
     enterblock(fs, &bl, 1);
     checknext(ls, TK_DO);
     block(ls);
     luaK_jumpto(fs, whileinit);
     check_match(ls, TK_END, TK_WHILE, line);
     leaveblock(fs);
-    luaK_patchtohere(fs, condexit);  /* false conditions finish the loop */
+    if (!dead || !leavedead(fs, &d))
+        luaK_patchtohere(fs, condexit);  /* false conditions finish the loop */
 }
 
 
@@ -1552,36 +1930,72 @@ static void forstat(LexState *ls, int line) {
 }
 
 
-static void test_then_block(LexState *ls, int *escapelist) {
+static int test_then_block(LexState *ls, int *escapelist) {
     /* test_then_block -> [IF | ELSEIF] cond THEN block */
     BlockCnt bl;
     FuncState *fs = ls->fs;
     expdesc v;
     int jf;  /* instruction to skip 'then' code (if condition is false) */
+    int taken;  /* true if condition is constant true */
     luaX_next(ls);  /* skip IF or ELSEIF */
     expr(ls, &v);  /* read condition */
     checknext(ls, TK_THEN);
-    if (ls->t.token == TK_GOTO || ls->t.token == TK_BREAK) {
-        luaK_goiffalse(ls->fs, &v);  /* will jump to label if condition is true */
-        enterblock(fs, &bl, 0);  /* must enter block before 'goto' */
-        gotostat(ls, v.t);  /* handle goto/break */
-        while (testnext(ls, ';')) {}  /* skip colons */
-        if (block_follow(ls, 0)) {  /* 'goto' is the entire block? */
-            leaveblock(fs);
-            return;  /* and that is it */
-        } else  /* must skip over 'then' part if condition is false */
-            jf = luaK_jump(fs);
-    } else {  /* regular case (not goto/break) */
-        luaK_goiftrue(ls->fs, &v);  /* skip over block if condition is false */
+    luaK_dischargevars(fs, &v);  /* constants become their values */
+    taken = istrue(&v);
+    if (isfalse(&v)) {  /* 'then' part never runs? */
+        DeadCode d;
+        jf = enterdead(fs, &d);
         enterblock(fs, &bl, 0);
-        jf = v.f;
+        statlist(ls);  /* 'then' part */
+        leaveblock(fs);
+        if (leavedead(fs, &d))
+            return 0;  /* dropped; nothing to skip */
+    } else {
+        if (ls->t.token == TK_GOTO || ls->t.token == TK_BREAK) {
+            luaK_goiffalse(ls->fs, &v);  /* will jump to label if condition is true */
+            enterblock(fs, &bl, 0);  /* must enter block before 'goto' */
+            gotostat(ls, v.t);  /* handle goto/break */
+            while (testnext(ls, ';')) {}  /* skip colons */
+            if (block_follow(ls, 0)) {  /* 'goto' is the entire block? */
+                leaveblock(fs);
+                return taken;  /* and that is it */
+            } else  /* must skip over 'then' part if condition is false */
+                jf = luaK_jump(fs);
+        } else {  /* regular case (not goto/break) */
+            luaK_goiftrue(ls->fs, &v);  /* skip over block if condition is false */
+            enterblock(fs, &bl, 0);
+            jf = v.f;
+        }
+        statlist(ls);  /* 'then' part */
+        leaveblock(fs);
     }
-    statlist(ls);  /* 'then' part */
-    leaveblock(fs);
-    if (ls->t.token == TK_ELSE ||
-        ls->t.token == TK_ELSEIF)  /* followed by 'else'/'elseif'? */
+    if (!taken && (ls->t.token == TK_ELSE ||
+                   ls->t.token == TK_ELSEIF))  /* followed by 'else'/'elseif'? */
         luaK_concat(fs, escapelist, luaK_jump(fs));  /* must jump over it */
     luaK_patchtohere(fs, jf);
+    return taken;
+}
+
+
+static void elsepart(LexState *ls, int *escapelist, int taken) {
+    /* elsepart -> {ELSEIF cond THEN block} [ELSE block] */
+    FuncState *fs = ls->fs;
+    while (!taken && ls->t.token == TK_ELSEIF)
+        taken = test_then_block(ls, escapelist);  /* ELSEIF cond THEN block */
+    if (!taken) {
+        if (testnext(ls, TK_ELSE))
+            block(ls);  /* 'else' part */
+    } else if (ls->t.token == TK_ELSE || ls->t.token == TK_ELSEIF) {
+        /* a previous condition is constant true; the rest never runs */
+        DeadCode d;
+        int deadlist = NO_JUMP;  /* exit list for dead parts */
+        int j = enterdead(fs, &d);
+        elsepart(ls, &deadlist, 0);
+        if (!leavedead(fs, &d)) {  /* dead parts kept? */
+            luaK_concat(fs, escapelist, j);  /* jump over them */
+            luaK_concat(fs, escapelist, deadlist);
+        }
+    }
 }
 
 
@@ -1589,11 +2003,8 @@ static void ifstat(LexState *ls, int line) {
     /* ifstat -> IF cond THEN block {ELSEIF cond THEN block} [ELSE block] END */
     FuncState *fs = ls->fs;
     int escapelist = NO_JUMP;  /* exit list for finished parts */
-    test_then_block(ls, &escapelist);  /* IF cond THEN block */
-    while (ls->t.token == TK_ELSEIF)
-        test_then_block(ls, &escapelist);  /* ELSEIF cond THEN block */
-    if (testnext(ls, TK_ELSE))
-        block(ls);  /* 'else' part */
+    int taken = test_then_block(ls, &escapelist);  /* IF cond THEN block */
+    elsepart(ls, &escapelist, taken);
     check_match(ls, TK_END, TK_IF, line);
     luaK_patchtohere(fs, escapelist);  /* patch escape list to 'if' end */
 }
@@ -1610,13 +2021,32 @@ static void localfunc(LexState *ls) {
 }
 
 
+static int getlocalattribute(LexState *ls) {
+    /* ATTRIB -> ['<' NAME '>'] */
+    if (testnext(ls, '<')) {
+        TString *name = str_checkname(ls);
+        const char *attr = getstr(name);
+        checknext(ls, '>');
+        if (strcmp(attr, "const") != 0)
+            semerror(ls, luaO_pushfstring(ls->L, "unknown attribute '%s'", attr));
+        return 1;
+    }
+    return 0;
+}
+
+
 static void localstat(LexState *ls) {
-    /* stat -> LOCAL NAME {',' NAME} ['=' explist] */
+    /* stat -> LOCAL NAME ATTRIB {',' NAME ATTRIB} ['=' explist] */
+    FuncState *fs = ls->fs;
     int nvars = 0;
     int nexps;
+    int isconst;  /* is the last variable '<const>'? */
     expdesc e;
+    TValue k;
     do {
         new_localvar(ls, str_checkname(ls));
+        isconst = getlocalattribute(ls);
+        getvardesc(fs, fs->nactvar + nvars)->readonly = cast_byte(isconst);
         nvars++;
     } while (testnext(ls, ','));
     if (testnext(ls, '='))
@@ -1625,8 +2055,14 @@ static void localstat(LexState *ls) {
         e.k = VVOID;
         nexps = 0;
     }
-    adjust_assign(ls, nvars, nexps, &e);
-    adjustlocalvars(ls, nvars);
+    if (isconst && nvars == nexps && luaK_exp2const(fs, &e, &k)) {
+        /* last variable is a compile-time constant */
+        new_localconst(ls, &k);
+        adjustlocalvars(ls, nvars - 1);  /* other values are in registers */
+    } else {
+        adjust_assign(ls, nvars, nexps, &e);
+        adjustlocalvars(ls, nvars);
+    }
 }
 
 
@@ -1650,6 +2086,7 @@ static void funcstat(LexState *ls, int line) {
     expdesc v, b;
     luaX_next(ls);  /* skip FUNCTION */
     ismethod = funcname(ls, &v);
+    check_readonly(ls, &v);
     body(ls, &b, ismethod, line);
     luaK_storevar(ls->fs, &v, &b);
     luaK_fixline(ls->fs, line);  /* definition "happens" in the first line */
@@ -1666,9 +2103,11 @@ static void exprstat(LexState *ls) {
         assignment(ls, &v, 1);
     } else if (ls->t.token >= TK_CADD && ls->t.token <= TK_CCONCAT) {
         v.prev = NULL;
+        check_readonly(ls, &v.v);
         compound_assignment(ls, &v.v);
     } else if (ls->t.token == TK_INC) {
         v.prev = NULL;
+        check_readonly(ls, &v.v);
         incremental_assignment(ls, &v.v);
     } else {  /* stat -> func */
         check_condition(ls, v.v.k == VCALL, "syntax error");
@@ -1821,9 +2260,13 @@ static void mainfunc(LexState *ls, FuncState *fs) {
 
 
 LClosure *luaY_parser(lua_State *L, ZIO *z, Mbuffer *buff,
-                      Dyndata *dyd, const char *name, int firstchar) {
+                      Dyndata *dyd, const char *name, int firstchar,
+                      int lazy, int optlevel) {
     LexState lexstate;
     FuncState funcstate;
+    LoadLazy ll;
+    ZIO lz;
+    TString *src = NULL;
     LClosure *cl = luaF_newLclosure(L, 1);  /* create main closure */
     setclLvalue(L, L->top, cl);  /* anchor it (to avoid being collected) */
     luaD_inctop(L);
@@ -1836,13 +2279,26 @@ LClosure *luaY_parser(lua_State *L, ZIO *z, Mbuffer *buff,
     lua_assert(iswhite(funcstate.f));  /* do not need barrier here */
     lexstate.buff = buff;
     lexstate.dyd = dyd;
-    dyd->actvar.n = dyd->gt.n = dyd->label.n = 0;
+    dyd->actvar.n = dyd->constvar.n = dyd->gt.n = dyd->label.n = 0;
+    if (lazy) {  /* keep the source for lazy functions and parse from it */
+        src = readsource(L, z, buff, firstchar);
+        setsvalue2s(L, L->top, src);  /* anchor it */
+        luaD_inctop(L);
+        ll.s = getstr(src);
+        ll.size = tsslen(src);
+        luaZ_init(L, &lz, getlazy, &ll);
+        z = &lz;
+        firstchar = zgetc(z);
+    }
     luaX_setinput(L, &lexstate, z, funcstate.f->source, firstchar);
+    lexstate.lazysrc = src;
+    lexstate.optlevel = optlevel;
     mainfunc(&lexstate, &funcstate);
     lua_assert(!funcstate.prev && funcstate.nups == 1 && !lexstate.fs);
     /* all scopes should be correctly finished */
-    lua_assert(dyd->actvar.n == 0 && dyd->gt.n == 0 && dyd->label.n == 0);
-    L->top--;  /* remove scanner's table */
+    lua_assert(dyd->actvar.n == 0 && dyd->constvar.n == 0 &&
+               dyd->gt.n == 0 && dyd->label.n == 0);
+    L->top -= (lazy) ? 2 : 1;  /* remove scanner's table (and source) */
     return cl;  /* closure is on the stack, too */
 }
 
@@ -44,7 +44,9 @@ typedef enum {
     VRELOCABLE,  /* expression can put result in any register;
                   info = instruction pc */
     VCALL,  /* expression is a function call; info = instruction pc */
-    VVARARG  /* vararg expression; info = instruction pc */
+    VVARARG,  /* vararg expression; info = instruction pc */
+    VCONST  /* compile-time constant local ('<const>');
+             info = index of constant in 'dyd->constvar' */
 } expkind;
 
 
@@ -71,9 +73,18 @@ typedef struct expdesc {
 /* description of active local variable */
 typedef struct Vardesc {
     short idx;  /* variable index in stack */
+    lu_byte readonly;  /* true if variable is '<const>' */
 } Vardesc;
 
 
+/* description of compile-time constant local ('local x <const> = k') */
+typedef struct Constdesc {
+    TString *name;  /* constant name */
+    TValue k;  /* constant value */
+    lu_byte nactvar;  /* number of active locals where it was declared */
+} Constdesc;
+
+
 /* description of pending goto statements and label statements */
 typedef struct Labeldesc {
     TString *name;  /* label identifier */
@@ -98,6 +109,11 @@ typedef struct Dyndata {
         int n;
         int size;
     } actvar;
+    struct {  /* list of active compile-time constants */
+        Constdesc *arr;
+        int n;
+        int size;
+    } constvar;
     Labellist gt;  /* list of pending gotos */
     Labellist label;   /* list of active labels */
 } Dyndata;
@@ -119,6 +135,7 @@ typedef struct FuncState {
     int nk;  /* number of elements in 'k' */
     int np;  /* number of elements in 'p' */
     int firstlocal;  /* index of first local var (in Dyndata array) */
+    int firstconst;  /* index of first constant (in Dyndata array) */
     short nlocvars;  /* number of elements in 'f->locvars' */
     lu_byte nactvar;  /* number of active local variables */
     lu_byte nups;  /* number of upvalues */
@@ -127,7 +144,10 @@ typedef struct FuncState {
 
 
 LUAI_FUNC LClosure *luaY_parser(lua_State *L, ZIO *z, Mbuffer *buff,
-                                Dyndata *dyd, const char *name, int firstchar);
+                                Dyndata *dyd, const char *name, int firstchar,
+                                int lazy, int optlevel);
+LUAI_FUNC void luaY_compilelazy(lua_State *L, Proto *f, Mbuffer *buff,
+                                Dyndata *dyd);
 
 
 #endif
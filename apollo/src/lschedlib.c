@@ -0,0 +1,834 @@
+/*
+** Coroutine Scheduler Library
+** See Copyright Notice in lua.h
+*/
+
+#define lschedlib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** {==================================================================
+** Configuration for clocks and descriptor readiness
+** ===================================================================
+*/
+
+#if !defined(l_schedclock)        /* { */
+
+#if defined(LUA_USE_POSIX)
+
+/* monotonic clock in milliseconds */
+static lua_Integer l_schedclock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (lua_Integer) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void l_schedsleep(int ms) {
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long) (ms % 1000) * 1000000;
+    nanosleep(&ts, NULL);
+}
+
+#elif defined(_WIN32)        /* }{ */
+
+#include <windows.h>
+
+#define l_schedclock()    ((lua_Integer) GetTickCount64())
+#define l_schedsleep(ms)    Sleep((DWORD) (ms))
+
+#else                /* }{ */
+
+/*
+** ISO C only offers processor time and cannot sleep, so waiting for a
+** timer keeps the processor busy
+*/
+#define l_schedclock()  \
+    ((lua_Integer)((double)clock() * 1000.0 / CLOCKS_PER_SEC))
+#define l_schedsleep(ms)    ((void)(ms))
+
+#endif                /* } */
+
+#endif                /* } */
+
+
+/*
+** LUA_USE_EPOLL enables 'sched.wait', which suspends a task until a
+** file descriptor is ready. It needs Linux 'epoll'.
+*/
+#if !defined(LUA_USE_EPOLL) && defined(LUA_USE_POSIX) && defined(__linux__)
+#define LUA_USE_EPOLL
+#endif
+
+#if defined(LUA_USE_EPOLL)
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
+/* }================================================================== */
+
+
+/* number of slots in the timer wheel (one per millisecond; power of 2) */
+#define SCHED_WHEELSIZE        256
+
+/* maximum number of descriptor events handled per poll */
+#define SCHED_MAXEVENTS        64
+
+#define wheelslot(t)    ((int)((t) & (SCHED_WHEELSIZE - 1)))
+
+#define SCHED_CHANNEL    "sched.channel"
+
+
+/* task states */
+#define TS_READY    0  /* in the run queue */
+#define TS_RUNNING    1  /* being resumed by the scheduler */
+#define TS_BLOCKED    2  /* waiting for a timer, a descriptor or a channel */
+
+
+typedef struct Task {
+    lua_State *co;
+    struct Task *next;  /* link in the run queue or in a channel queue */
+    struct Task *tprev, *tnext;  /* links in a timer-wheel slot */
+    lua_Integer deadline;  /* wake-up time while in the timer wheel */
+    int state;
+    int nargs;  /* number of values on 'co' to pass to the next resume */
+    int timed;  /* true iff the task is in the timer wheel */
+    int fd;  /* descriptor being waited on (-1 if none) */
+    unsigned events;  /* events waited for on 'fd' */
+    struct Task *fprev, *fnext;  /* links among the waiters of 'fd' */
+} Task;
+
+
+typedef struct TaskQueue {
+    Task *head, *tail;
+} TaskQueue;
+
+
+typedef struct Sched {
+    TaskQueue runq;
+    Task *wheel[SCHED_WHEELSIZE];
+    lua_Integer now;  /* last time the timer wheel was advanced */
+    int ntasks;  /* number of live tasks */
+    int ntimers;  /* number of tasks in the timer wheel */
+    int nio;  /* number of tasks waiting on descriptors */
+    int running;  /* true while 'sched.run' is active */
+    int epfd;
+    int fdsize;  /* size of 'fdwait' */
+    Task **fdwait;  /* first task waiting on each descriptor */
+} Sched;
+
+
+typedef struct Channel {
+    TaskQueue sendq;  /* senders blocked with their value parked */
+    TaskQueue recvq;  /* receivers blocked on an empty channel */
+    int cap;  /* buffer capacity (0 for an unbuffered channel) */
+    int head;  /* first buffered value */
+    int count;  /* number of buffered values */
+    int closed;
+} Channel;
+
+
+#define getsched(L)    ((Sched *)lua_touserdata(L, lua_upvalueindex(1)))
+
+#define checkchan(L)    ((Channel *)luaL_checkudata(L, 1, SCHED_CHANNEL))
+
+
+static void qpush(TaskQueue *q, Task *t) {
+    t->next = NULL;
+    if (q->tail) q->tail->next = t;
+    else q->head = t;
+    q->tail = t;
+}
+
+
+static Task *qpop(TaskQueue *q) {
+    Task *t = q->head;
+    if (t != NULL) {
+        q->head = t->next;
+        if (q->head == NULL) q->tail = NULL;
+    }
+    return t;
+}
+
+
+/*
+** Make 't' runnable; 'nargs' values already pushed on its thread are
+** passed to its next resume.
+*/
+static void wake(Sched *s, Task *t, int nargs) {
+    t->state = TS_READY;
+    t->nargs = nargs;
+    qpush(&s->runq, t);
+}
+
+
+/*
+** Returns the task running in 'L', raising an error if 'L' is not a
+** task or cannot be suspended. Every blocking operation calls it before
+** touching any queue, so that a failed yield leaves nothing behind.
+*/
+static Task *checktask(lua_State *L) {
+    Task *t;
+    lua_getuservalue(L, lua_upvalueindex(1));
+    lua_pushthread(L);
+    lua_rawget(L, -2);
+    t = (Task *) lua_touserdata(L, -1);
+    lua_pop(L, 2);
+    if (t == NULL || t->state != TS_RUNNING)
+        luaL_error(L, "cannot block outside a sched task");
+    if (!lua_isyieldable(L))
+        luaL_error(L, "cannot block a sched task across a C-call boundary");
+    return t;
+}
+
+
+static lua_Integer tomillis(lua_Number secs) {
+    lua_Integer ms = (lua_Integer) (secs * 1000);
+    return (ms < secs * 1000) ? ms + 1 : ms;  /* round up */
+}
+
+
+/*
+** {======================================================
+** Timer wheel
+** =======================================================
+*/
+
+static void addtimer(Sched *s, Task *t, lua_Integer deadline) {
+    Task **slot = &s->wheel[wheelslot(deadline)];
+    t->deadline = deadline;
+    t->tprev = NULL;
+    t->tnext = *slot;
+    if (*slot) (*slot)->tprev = t;
+    *slot = t;
+    t->timed = 1;
+    s->ntimers++;
+}
+
+
+static void deltimer(Sched *s, Task *t) {
+    if (t->tprev) t->tprev->tnext = t->tnext;
+    else s->wheel[wheelslot(t->deadline)] = t->tnext;
+    if (t->tnext) t->tnext->tprev = t->tprev;
+    t->timed = 0;
+    s->ntimers--;
+}
+
+
+static void unwatch(Sched *s, Task *t);
+
+
+/*
+** Expire every timer whose deadline has passed. Each slot is visited at
+** most once, however long the scheduler was idle.
+*/
+static void advance(Sched *s) {
+    lua_Integer now = l_schedclock();
+    lua_Integer tick = s->now;
+    if (now - tick >= SCHED_WHEELSIZE)
+        tick = now - SCHED_WHEELSIZE + 1;
+    for (; tick <= now && s->ntimers > 0; tick++) {
+        Task *t = s->wheel[wheelslot(tick)];
+        while (t != NULL) {
+            Task *next = t->tnext;
+            if (t->deadline <= now) {
+                deltimer(s, t);
+                if (t->fd >= 0) {  /* 'sched.wait' timed out */
+                    unwatch(s, t);
+                    lua_pushboolean(t->co, 0);
+                    wake(s, t, 1);
+                } else
+                    wake(s, t, 0);
+            }
+            t = next;
+        }
+    }
+    s->now = now;
+}
+
+
+/*
+** Milliseconds until the next timer expires (-1 if there are none).
+*/
+static int nexttimeout(Sched *s) {
+    lua_Integer tick;
+    if (s->ntimers == 0)
+        return -1;
+    for (tick = s->now + 1; tick <= s->now + SCHED_WHEELSIZE; tick++) {
+        Task *t;
+        for (t = s->wheel[wheelslot(tick)]; t != NULL; t = t->tnext) {
+            if (t->deadline <= tick)
+                return (int) (tick - s->now);
+        }
+    }
+    return SCHED_WHEELSIZE;  /* all timers are farther away than one turn */
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Descriptor readiness
+** =======================================================
+*/
+
+#if defined(LUA_USE_EPOLL)    /* { */
+
+/*
+** epoll accepts a descriptor only once, so all tasks waiting on the same
+** descriptor share its registration: they form a list starting at
+** 'fdwait[fd]', and the registration asks for the union of their events.
+*/
+
+static unsigned fdevents(Sched *s, int fd) {
+    unsigned events = 0;
+    Task *t;
+    for (t = s->fdwait[fd]; t != NULL; t = t->fnext)
+        events |= t->events;
+    return events;
+}
+
+
+/* update the registration of 'fd' after waiters left its list */
+static void rearm(Sched *s, int fd) {
+    struct epoll_event ev;  /* kernels before 2.6.9 require non-NULL event */
+    memset(&ev, 0, sizeof(ev));
+    ev.events = fdevents(s, fd);
+    ev.data.fd = fd;
+    if (ev.events == 0)
+        epoll_ctl(s->epfd, EPOLL_CTL_DEL, fd, &ev);
+    else if (epoll_ctl(s->epfd, EPOLL_CTL_MOD, fd, &ev) < 0 && errno == ENOENT)
+        epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &ev);  /* closed and reopened */
+}
+
+
+static void fdunlink(Sched *s, Task *t) {
+    if (t->fprev) t->fprev->fnext = t->fnext;
+    else s->fdwait[t->fd] = t->fnext;
+    if (t->fnext) t->fnext->fprev = t->fprev;
+    t->fd = -1;
+    s->nio--;
+}
+
+
+static void growfdwait(lua_State *L, Sched *s, int fd) {
+    void *ud;
+    lua_Alloc allocf = lua_getallocf(L, &ud);
+    int newsize = (s->fdsize < 16) ? 16 : s->fdsize;
+    Task **newwait;
+    while (newsize <= fd)
+        newsize = (newsize <= INT_MAX / 2) ? newsize * 2 : INT_MAX;
+    newwait = (Task **) allocf(ud, s->fdwait, s->fdsize * sizeof(Task *),
+                               newsize * sizeof(Task *));
+    if (newwait == NULL)
+        luaL_error(L, "not enough memory");
+    memset(newwait + s->fdsize, 0, (newsize - s->fdsize) * sizeof(Task *));
+    s->fdwait = newwait;
+    s->fdsize = newsize;
+}
+
+
+static void watch(lua_State *L, Sched *s, Task *t, int fd, unsigned events) {
+    struct epoll_event ev;
+    Task *head;
+    if (s->epfd < 0 && (s->epfd = epoll_create(SCHED_MAXEVENTS)) < 0)
+        luaL_error(L, "cannot create epoll instance: %s", strerror(errno));
+    if (fd < 0)
+        luaL_error(L, "cannot wait on descriptor %d: %s", fd, strerror(EBADF));
+    if (fd >= s->fdsize)
+        growfdwait(L, s, fd);
+    head = s->fdwait[fd];
+    memset(&ev, 0, sizeof(ev));
+    ev.data.fd = fd;
+    if (head == NULL) {  /* first waiter registers the descriptor */
+        ev.events = events;
+        if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+            luaL_error(L, "cannot wait on descriptor %d: %s", fd, strerror(errno));
+    } else if ((fdevents(s, fd) | events) != fdevents(s, fd)) {
+        ev.events = fdevents(s, fd) | events;
+        if (epoll_ctl(s->epfd, EPOLL_CTL_MOD, fd, &ev) < 0)
+            luaL_error(L, "cannot wait on descriptor %d: %s", fd, strerror(errno));
+    }
+    t->fprev = NULL;
+    t->fnext = head;
+    if (head) head->fprev = t;
+    s->fdwait[fd] = t;
+    t->fd = fd;
+    t->events = events;
+    s->nio++;
+}
+
+
+static void unwatch(Sched *s, Task *t) {
+    int fd = t->fd;
+    fdunlink(s, t);
+    rearm(s, fd);
+}
+
+
+/* wake the waiters of each ready descriptor whose events happened */
+static void pollio(Sched *s, int timeout) {
+    struct epoll_event evs[SCHED_MAXEVENTS];
+    int i;
+    int n = epoll_wait(s->epfd, evs, SCHED_MAXEVENTS, timeout);
+    for (i = 0; i < n; i++) {
+        int fd = evs[i].data.fd;
+        unsigned events = evs[i].events;
+        Task *t = s->fdwait[fd];
+        if (events & (EPOLLERR | EPOLLHUP))  /* wakes every waiter */
+            events |= EPOLLIN | EPOLLOUT;
+        while (t != NULL) {
+            Task *next = t->fnext;
+            if (t->events & events) {
+                fdunlink(s, t);
+                if (t->timed)
+                    deltimer(s, t);
+                lua_pushboolean(t->co, 1);
+                wake(s, t, 1);
+            }
+            t = next;
+        }
+        rearm(s, fd);
+    }
+}
+
+
+static int getfd(lua_State *L, int arg) {
+    luaL_Stream *p = (luaL_Stream *) luaL_testudata(L, arg, LUA_FILEHANDLE);
+    if (p != NULL) {
+        luaL_argcheck(L, p->closef != NULL, arg, "attempt to use a closed file");
+        return fileno(p->f);
+    }
+    return (int) luaL_checkinteger(L, arg);
+}
+
+
+static int sched_wait(lua_State *L) {
+    static const char *const modes[] = {"r", "w", NULL};
+    Sched *s = getsched(L);
+    int fd = getfd(L, 1);
+    int mode = luaL_checkoption(L, 2, "r", modes);
+    lua_Number secs = luaL_optnumber(L, 3, -1);
+    Task *t = checktask(L);
+    watch(L, s, t, fd, (mode == 0) ? EPOLLIN : EPOLLOUT);
+    if (secs >= 0)
+        addtimer(s, t, l_schedclock() + tomillis(secs));
+    t->state = TS_BLOCKED;
+    return lua_yield(L, 0);
+}
+
+#else                /* }{ */
+
+static void unwatch(Sched *s, Task *t) {
+    (void) s;
+    (void) t;
+}
+
+#define pollio(s, timeout)    ((void)0)
+
+#endif                /* } */
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Tasks and the run loop
+** =======================================================
+*/
+
+static int sched_spawn(lua_State *L) {
+    Sched *s = getsched(L);
+    int n = lua_gettop(L);
+    int i;
+    lua_State *co;
+    Task *t;
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    co = lua_newthread(L);
+    t = (Task *) lua_newuserdata(L, sizeof(Task));
+    memset(t, 0, sizeof(Task));
+    t->co = co;
+    t->fd = -1;
+    if (!lua_checkstack(co, n))
+        return luaL_error(L, "too many arguments to spawn");
+    lua_getuservalue(L, lua_upvalueindex(1));  /* table of live tasks */
+    lua_pushvalue(L, -3);
+    lua_pushvalue(L, -3);
+    lua_rawset(L, -3);  /* tasks[co] = t */
+    lua_pop(L, 2);
+    for (i = 1; i <= n; i++)
+        lua_pushvalue(L, i);
+    lua_xmove(L, co, n);  /* function and its arguments */
+    s->ntasks++;
+    wake(s, t, n - 1);
+    return 1;  /* return the new thread */
+}
+
+
+static void finishtask(lua_State *L, Sched *s, Task *t) {
+    lua_getuservalue(L, lua_upvalueindex(1));
+    lua_pushthread(t->co);
+    lua_xmove(t->co, L, 1);
+    lua_pushnil(L);
+    lua_rawset(L, -3);  /* tasks[co] = nil */
+    lua_pop(L, 1);
+    s->ntasks--;
+}
+
+
+static void runtask(lua_State *L, Sched *s, Task *t) {
+    int status;
+    t->state = TS_RUNNING;
+    status = lua_resume(t->co, L, t->nargs);
+    t->nargs = 0;
+    if (status == LUA_YIELD) {
+        if (t->state == TS_RUNNING) {  /* plain 'coroutine.yield'? */
+            lua_settop(t->co, 0);  /* discard yielded values */
+            wake(s, t, 0);
+        }
+    } else {
+        if (status == LUA_OK)
+            lua_settop(t->co, 0);  /* discard results */
+        else
+            lua_xmove(t->co, L, 1);  /* move error object */
+        finishtask(L, s, t);
+        if (status != LUA_OK) {
+            s->running = 0;
+            lua_error(L);  /* propagate error */
+        }
+    }
+}
+
+
+/*
+** Resume the tasks that are ready now; tasks made ready meanwhile wait
+** for the next round, so timers and descriptors are polled regularly.
+*/
+static void runbatch(lua_State *L, Sched *s) {
+    Task *last = s->runq.tail;
+    Task *t;
+    while (last != NULL && (t = qpop(&s->runq)) != NULL) {
+        int done = (t == last);
+        runtask(L, s, t);
+        if (done) break;
+    }
+}
+
+
+static int sched_run(lua_State *L) {
+    Sched *s = getsched(L);
+    lua_getuservalue(L, lua_upvalueindex(1));
+    lua_pushthread(L);
+    if (s->running || lua_rawget(L, -2) != LUA_TNIL)
+        return luaL_error(L, "scheduler is already running");
+    lua_pop(L, 2);
+    s->running = 1;
+    while (s->ntasks > 0) {
+        int timeout;
+        advance(s);
+        if (s->runq.head != NULL)
+            timeout = 0;
+        else if (s->ntimers == 0 && s->nio == 0)
+            break;  /* remaining tasks wait on channels nobody will use */
+        else
+            timeout = nexttimeout(s);
+        if (s->nio > 0) {
+            pollio(s, timeout);
+            advance(s);
+        } else if (timeout > 0) {
+            l_schedsleep(timeout);
+            advance(s);
+        }
+        runbatch(L, s);
+    }
+    s->running = 0;
+    lua_pushinteger(L, s->ntasks);  /* number of tasks blocked forever */
+    return 1;
+}
+
+
+static int sched_sleep(lua_State *L) {
+    Sched *s = getsched(L);
+    lua_Integer ms = tomillis(luaL_optnumber(L, 1, 0));
+    Task *t = checktask(L);
+    if (ms <= 0)
+        wake(s, t, 0);  /* just go to the end of the run queue */
+    else {
+        addtimer(s, t, l_schedclock() + ms);
+        t->state = TS_BLOCKED;
+    }
+    return lua_yield(L, 0);
+}
+
+
+static int sched_now(lua_State *L) {
+    lua_pushnumber(L, (lua_Number) l_schedclock() / 1000);
+    return 1;
+}
+
+
+static int sched_gc(lua_State *L) {
+    Sched *s = (Sched *) lua_touserdata(L, 1);
+#if defined(LUA_USE_EPOLL)
+    if (s->epfd >= 0)
+        close(s->epfd);
+    if (s->fdwait != NULL) {
+        void *ud;
+        lua_Alloc allocf = lua_getallocf(L, &ud);
+        allocf(ud, s->fdwait, s->fdsize * sizeof(Task *), 0);
+    }
+#endif
+    s->epfd = -1;
+    s->fdwait = NULL;
+    s->fdsize = 0;
+    return 0;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Channels
+** =======================================================
+*/
+
+static int sched_channel(lua_State *L) {
+    lua_Integer cap = luaL_optinteger(L, 1, 0);
+    Channel *ch;
+    luaL_argcheck(L, 0 <= cap && cap <= 0x7fffffff, 1, "invalid capacity");
+    ch = (Channel *) lua_newuserdata(L, sizeof(Channel));
+    memset(ch, 0, sizeof(Channel));
+    ch->cap = (int) cap;
+    lua_createtable(L, ch->cap, 0);  /* buffer */
+    lua_setuservalue(L, -2);
+    luaL_setmetatable(L, SCHED_CHANNEL);
+    return 1;
+}
+
+
+/* append value on the top of the stack to the buffer of channel at 1 */
+static void bufpush(lua_State *L, Channel *ch) {
+    lua_getuservalue(L, 1);
+    lua_insert(L, -2);
+    lua_rawseti(L, -2, (ch->head + ch->count) % ch->cap + 1);
+    lua_pop(L, 1);
+    ch->count++;
+}
+
+
+/* push first buffered value of channel at 1, removing it */
+static void bufpop(lua_State *L, Channel *ch) {
+    lua_getuservalue(L, 1);
+    lua_rawgeti(L, -1, ch->head + 1);
+    lua_pushnil(L);
+    lua_rawseti(L, -3, ch->head + 1);
+    lua_remove(L, -2);
+    ch->head = (ch->head + 1) % ch->cap;
+    ch->count--;
+}
+
+
+/*
+** A task blocked on a channel is kept in the table of the channel at 1,
+** indexed by its thread, instead of in the table of live tasks. A channel
+** that only its blocked tasks can reach is then collected with them, and
+** its finalizer forgets them.
+*/
+static void chanpark(lua_State *L, TaskQueue *q, Task *t) {
+    lua_getuservalue(L, lua_upvalueindex(1));  /* live tasks */
+    lua_getuservalue(L, 1);
+    lua_pushthread(L);
+    lua_pushthread(L);
+    lua_rawget(L, -4);
+    lua_rawset(L, -3);  /* channel[co] = t */
+    lua_pushthread(L);
+    lua_pushnil(L);
+    lua_rawset(L, -4);  /* tasks[co] = nil */
+    lua_pop(L, 2);
+    qpush(q, t);
+    t->state = TS_BLOCKED;
+}
+
+
+/* remove the first task blocked in 'q', making it a live task again */
+static Task *chanunpark(lua_State *L, TaskQueue *q) {
+    Task *t = q->head;
+    lua_getuservalue(L, lua_upvalueindex(1));  /* live tasks */
+    lua_getuservalue(L, 1);
+    lua_pushthread(t->co);
+    lua_xmove(t->co, L, 1);
+    lua_pushvalue(L, -1);
+    lua_pushvalue(L, -1);
+    lua_rawget(L, -4);
+    lua_rawset(L, -5);  /* tasks[co] = t */
+    lua_pushnil(L);
+    lua_rawset(L, -3);  /* channel[co] = nil */
+    lua_pop(L, 2);
+    return qpop(q);
+}
+
+
+/* push on L the value parked by the first blocked sender and release it */
+static void takefrom(lua_State *L, Sched *s, Channel *ch) {
+    Task *w = chanunpark(L, &ch->sendq);
+    lua_xmove(w->co, L, 1);
+    lua_pushboolean(w->co, 1);
+    wake(s, w, 1);
+}
+
+
+static int chan_send(lua_State *L) {
+    Sched *s = getsched(L);
+    Channel *ch = checkchan(L);
+    luaL_checkany(L, 2);
+    lua_settop(L, 2);
+    if (ch->closed) {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+    if (ch->recvq.head != NULL) {  /* hand value straight to a receiver */
+        Task *r = chanunpark(L, &ch->recvq);
+        lua_xmove(L, r->co, 1);
+        lua_pushboolean(r->co, 1);
+        wake(s, r, 2);
+    } else if (ch->count < ch->cap)
+        bufpush(L, ch);
+    else {  /* block until a receiver takes the value */
+        chanpark(L, &ch->sendq, checktask(L));
+        return lua_yield(L, 1);  /* value stays parked on the task stack */
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+
+static int chan_recv(lua_State *L) {
+    Sched *s = getsched(L);
+    Channel *ch = checkchan(L);
+    lua_settop(L, 1);
+    if (ch->count > 0) {
+        bufpop(L, ch);
+        if (ch->sendq.head != NULL) {  /* room for a blocked sender */
+            takefrom(L, s, ch);
+            bufpush(L, ch);
+        }
+    } else if (ch->sendq.head != NULL)  /* unbuffered rendezvous */
+        takefrom(L, s, ch);
+    else if (ch->closed) {
+        lua_pushnil(L);
+        lua_pushboolean(L, 0);
+        return 2;
+    } else {  /* block until a sender arrives */
+        chanpark(L, &ch->recvq, checktask(L));
+        return lua_yield(L, 0);
+    }
+    lua_pushboolean(L, 1);
+    return 2;
+}
+
+
+static int chan_close(lua_State *L) {
+    Sched *s = getsched(L);
+    Channel *ch = checkchan(L);
+    ch->closed = 1;
+    while (ch->recvq.head != NULL) {
+        Task *t = chanunpark(L, &ch->recvq);
+        lua_pushnil(t->co);
+        lua_pushboolean(t->co, 0);
+        wake(s, t, 2);
+    }
+    while (ch->sendq.head != NULL) {
+        Task *t = chanunpark(L, &ch->sendq);
+        lua_pop(t->co, 1);  /* drop parked value */
+        lua_pushboolean(t->co, 0);
+        wake(s, t, 1);
+    }
+    return 0;
+}
+
+
+/* tasks still blocked on a collected channel can never run again */
+static int chan_gc(lua_State *L) {
+    Sched *s = getsched(L);
+    Channel *ch = (Channel *) lua_touserdata(L, 1);
+    while (qpop(&ch->recvq) != NULL)
+        s->ntasks--;
+    while (qpop(&ch->sendq) != NULL)
+        s->ntasks--;
+    return 0;
+}
+
+
+static int chan_len(lua_State *L) {
+    lua_pushinteger(L, checkchan(L)->count);
+    return 1;
+}
+
+/* }====================================================== */
+
+
+static const luaL_Reg sched_funcs[] = {
+        {"spawn",   sched_spawn},
+        {"run",     sched_run},
+        {"sleep",   sched_sleep},
+        {"now",     sched_now},
+        {"channel", sched_channel},
+#if defined(LUA_USE_EPOLL)
+        {"wait",    sched_wait},
+#endif
+        {NULL, NULL}
+};
+
+
+static const luaL_Reg chan_meth[] = {
+        {"send",  chan_send},
+        {"recv",  chan_recv},
+        {"close", chan_close},
+        {NULL, NULL}
+};
+
+
+LUAMOD_API int luaopen_sched(lua_State *L) {
+    Sched *s;
+    luaL_newlibtable(L, sched_funcs);
+    s = (Sched *) lua_newuserdata(L, sizeof(Sched));
+    memset(s, 0, sizeof(Sched));
+    s->epfd = -1;
+    s->now = l_schedclock();
+    lua_newtable(L);  /* live tasks, indexed by thread */
+    lua_setuservalue(L, -2);
+    lua_newtable(L);  /* metatable for the scheduler */
+    lua_pushcfunction(L, sched_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    luaL_newmetatable(L, SCHED_CHANNEL);  /* metatable for channels */
+    lua_newtable(L);  /* method table */
+    lua_pushvalue(L, -3);
+    luaL_setfuncs(L, chan_meth, 1);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, chan_len);
+    lua_setfield(L, -2, "__len");
+    lua_pushvalue(L, -2);
+    lua_pushcclosure(L, chan_gc, 1);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+    luaL_setfuncs(L, sched_funcs, 1);  /* scheduler is the upvalue */
+    return 1;
+}
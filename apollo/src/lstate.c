@@ -150,11 +150,12 @@ void luaE_shrinkCI(lua_State *L) {
 
 static void stack_init(lua_State *L1, lua_State *L) {
     int i;
+    int size = G(L)->compactstack ? COMPACT_STACK_SIZE : BASIC_STACK_SIZE;
     CallInfo *ci;
     /* initialize stack array */
-    L1->stack = luaM_newvector(L, BASIC_STACK_SIZE, TValue);
-    L1->stacksize = BASIC_STACK_SIZE;
-    for (i = 0; i < BASIC_STACK_SIZE; i++)
+    L1->stack = luaM_newvector(L, size, TValue);
+    L1->stacksize = size;
+    for (i = 0; i < size; i++)
         setnilvalue(L1->stack + i);  /* erase new stack */
     L1->top = L1->stack;
     L1->stack_last = L1->stack + L1->stacksize - EXTRA_STACK;
@@ -235,6 +236,8 @@ static void preinit_thread(lua_State *L, global_State *g) {
     resethookcount(L);
     L->openupval = NULL;
     L->nny = 1;
+    L->nnyrec = 0;
+    L->nCbase = 0;
     L->status = LUA_OK;
     L->errfunc = 0;
 }
@@ -311,6 +314,7 @@ LUA_API lua_State *lua_newstate(lua_Alloc f, void *ud) {
     g->mainthread = L;
     g->seed = makeseed(L);
     g->gcrunning = 0;  /* no GC while building state */
+    g->compactstack = 0;
     g->GCestimate = 0;
     g->strt.size = g->strt.nuse = 0;
     g->strt.hash = NULL;
@@ -323,6 +327,7 @@ LUA_API lua_State *lua_newstate(lua_Alloc f, void *ud) {
     g->sweepgc = NULL;
     g->gray = g->grayagain = NULL;
     g->weak = g->ephemeron = g->allweak = NULL;
+    g->slices = NULL;
     g->twups = NULL;
     g->totalbytes = sizeof(LG);
     g->GCdebt = 0;
@@ -69,6 +69,12 @@ struct lua_longjmp;  /* defined in ldo.c */
 
 #define BASIC_STACK_SIZE        (2*LUA_MINSTACK)
 
+/*
+** initial stack size for threads created in compact-stack mode: the
+** 'function' entry of 'base_ci' plus the LUA_MINSTACK slots promised to C
+*/
+#define COMPACT_STACK_SIZE      (1 + LUA_MINSTACK + EXTRA_STACK)
+
 
 /* kinds of Garbage Collection */
 #define KGC_NORMAL    0
@@ -150,6 +156,7 @@ typedef struct global_State {
     lu_byte gcstate;  /* state of garbage collector */
     lu_byte gckind;  /* kind of GC running */
     lu_byte gcrunning;  /* true if GC is running */
+    lu_byte compactstack;  /* true if threads use minimal stacks */
     GCObject *allgc;  /* list of all collectable objects */
     GCObject **sweepgc;  /* current position of sweep in list */
     GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -158,6 +165,7 @@ typedef struct global_State {
     GCObject *weak;  /* list of tables with weak values */
     GCObject *ephemeron;  /* list of ephemeron tables (weak keys) */
     GCObject *allweak;  /* list of all-weak tables */
+    struct LString *slices;  /* list of marked slices */
     GCObject *tobefnz;  /* list of userdata to be GC */
     GCObject *fixedgc;  /* list of objects not to be collected */
     struct lua_State *twups;  /* list of threads with open upvalues */
@@ -198,7 +206,9 @@ struct lua_State {
     int basehookcount;
     int hookcount;
     unsigned short nny;  /* number of non-yieldable calls in stack */
+    unsigned short nnyrec;  /* 'nny' where errors are recovered by unrolling */
     unsigned short nCcalls;  /* number of nested C calls */
+    unsigned short nCbase;  /* 'nCcalls' of the running 'lua_resume' */
     l_signalT hookmask;
     lu_byte allowhook;
 };
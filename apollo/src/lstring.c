@@ -127,26 +127,138 @@ void luaS_init(lua_State *L) {
 
 
 /*
-** creates a new string object
+** creates a new short string object
 */
-static TString *createstrobj(lua_State *L, size_t l, int tag, unsigned int h) {
+static TString *createstrobj(lua_State *L, size_t l, unsigned int h) {
     TString *ts;
     GCObject *o;
     size_t totalsize;  /* total size of TString object */
     totalsize = sizelstring(l);
-    o = luaC_newobj(L, tag, totalsize);
+    o = luaC_newobj(L, LUA_TSHRSTR, totalsize);
     ts = gco2ts(o);
     ts->hash = h;
     ts->extra = 0;
-    getstr(ts)[l] = '\0';  /* ending 0 */
+    getshrstr(ts)[l] = '\0';  /* ending 0 */
     return ts;
 }
 
 
+/*
+** creates a new long string object of kind 'kind' with 'size' bytes
+*/
+static LString *createlngstrobj(lua_State *L, size_t l, int kind,
+                                size_t size) {
+    LString *ls = cast(LString *, luaC_newobj(L, LUA_TLNGSTR, size));
+    ls->tsv.hash = G(L)->seed;
+    ls->tsv.extra = 0;
+    ls->tsv.shrlen = cast_byte(kind);
+    ls->tsv.u.lnglen = l;
+    return ls;
+}
+
+
 TString *luaS_createlngstrobj(lua_State *L, size_t l) {
-    TString *ts = createstrobj(L, l, LUA_TLNGSTR, G(L)->seed);
-    ts->u.lnglen = l;
-    return ts;
+    LString *ls = createlngstrobj(L, l, LSTRREG, sizelngstr(l));
+    ls->contents = cast(char *, ls) + offsetof(LString, parent);
+    ls->contents[l] = '\0';  /* ending 0 */
+    return &ls->tsv;
+}
+
+
+/*
+** Create a string with the 'l' bytes at 's', which must be followed by
+** a '\0', without copying them. Long strings keep pointing to 's' and
+** call 'falloc' (if not NULL) to release it when collected; short ones
+** are internalized copies, so 's' is released at once. Bytes released
+** by the collector count as its memory, so that holding them paces
+** collections as if they had been copied.
+*/
+TString *luaS_newextlstr(lua_State *L, const char *s, size_t l,
+                         lua_Alloc falloc, void *ud) {
+    if (l <= LUAI_MAXSHORTLEN) {
+        TString *ts = luaS_newlstr(L, s, l);
+        if (falloc != NULL)
+            (*falloc)(ud, cast(void *, s), l + 1, 0);
+        return ts;
+    } else {
+        LString *ls = createlngstrobj(L, l, LSTREXT, sizeof(LString));
+        ls->contents = cast(char *, s);
+        ls->falloc = falloc;
+        ls->ud = ud;
+        G(L)->GCdebt += cast(l_mem, extlstrmem(&ls->tsv));
+        return &ls->tsv;
+    }
+}
+
+
+/*
+** Create a string with the 'l' bytes of string 'ts' starting at 'i'.
+** Results with at least LUAI_MINSLICE bytes taken from a long string
+** are slices: they point to the bytes of that string (or of its parent,
+** if it is itself a slice) and copy nothing. Slices do not keep their
+** parents alive; when a parent is about to be collected, the collector
+** copies the bytes of its live slices (see 'checkslices' in lgc.c).
+** Slices also get their own copy when C code asks for a '\0'-terminated
+** string ('luaS_unslice').
+*/
+TString *luaS_newslice(lua_State *L, TString *ts, size_t i, size_t l) {
+    LString *ls;
+    lua_assert(i <= tsslen(ts) && l <= tsslen(ts) - i);
+    if (l < LUAI_MINSLICE || ts->tt != LUA_TLNGSTR)
+        return luaS_newlstr(L, getstr(ts) + i, l);
+    else if (l == ts->u.lnglen)  /* whole string? */
+        return ts;
+    if (ts->shrlen == LSTRSLICE) {  /* slice of a slice? */
+        TString *parent = lngstr(ts)->parent;
+        i += cast(size_t, getlngstr(ts) - getlngstr(parent));
+        ts = parent;  /* share bytes with the original string */
+    }
+    ls = createlngstrobj(L, l, LSTRSLICE, sizeslice);
+    ls->contents = getlngstr(ts) + i;
+    ls->parent = ts;
+    ls->gclist = NULL;
+    return &ls->tsv;
+}
+
+
+/*
+** Give slice 'ts' a '\0'-terminated copy of its bytes, so that it no
+** longer depends on its parent.
+*/
+void luaS_unslice(lua_State *L, TString *ts) {
+    LString *ls = lngstr(ts);
+    size_t l = ts->u.lnglen;
+    char *buff;
+    lua_assert(isslice(ts));
+    buff = luaM_newvector(L, l + 1, char);
+    memcpy(buff, ls->contents, l * sizeof(char));
+    buff[l] = '\0';
+    ls->contents = buff;
+    ls->parent = NULL;
+    ts->shrlen = LSTRMEM;
+}
+
+
+void luaS_freelngstr(lua_State *L, TString *ts) {
+    LString *ls = lngstr(ts);
+    switch (ts->shrlen) {
+        case LSTRREG:
+            luaM_freemem(L, ls, sizelngstr(ts->u.lnglen));
+            break;
+        case LSTREXT:
+            if (ls->falloc != NULL) {
+                (*ls->falloc)(ls->ud, ls->contents, ts->u.lnglen + 1, 0);
+                G(L)->GCdebt -= cast(l_mem, extlstrmem(ts));
+            }
+            luaM_freemem(L, ls, sizeof(LString));
+            break;
+        case LSTRMEM:
+            luaM_freearray(L, ls->contents, ts->u.lnglen + 1);
+            /* FALLTHROUGH */
+        default:
+            luaM_freemem(L, ls, sizeslice);
+            break;
+    }
 }
 
 
@@ -171,7 +283,7 @@ static TString *internshrstr(lua_State *L, const char *str, size_t l) {
     lua_assert(str != NULL);  /* otherwise 'memcmp'/'memcpy' are undefined */
     for (ts = *list; ts != NULL; ts = ts->u.hnext) {
         if (l == ts->shrlen &&
-            (memcmp(str, getstr(ts), l * sizeof(char)) == 0)) {
+            (memcmp(str, getshrstr(ts), l * sizeof(char)) == 0)) {
             /* found! */
             if (isdead(g, ts))  /* dead (but not collected yet)? */
                 changewhite(ts);  /* resurrect it */
@@ -182,8 +294,8 @@ static TString *internshrstr(lua_State *L, const char *str, size_t l) {
         luaS_resize(L, g->strt.size * 2);
         list = &g->strt.hash[lmod(h, g->strt.size)];  /* recompute with new size */
     }
-    ts = createstrobj(L, l, LUA_TSHRSTR, h);
-    memcpy(getstr(ts), str, l * sizeof(char));
+    ts = createstrobj(L, l, h);
+    memcpy(getshrstr(ts), str, l * sizeof(char));
     ts->shrlen = cast_byte(l);
     ts->u.hnext = *list;
     *list = ts;
@@ -200,10 +312,10 @@ TString *luaS_newlstr(lua_State *L, const char *str, size_t l) {
         return internshrstr(L, str, l);
     else {
         TString *ts;
-        if (l >= (MAX_SIZE - sizeof(TString)) / sizeof(char))
+        if (l >= (MAX_SIZE - sizeof(LString)) / sizeof(char))
             luaM_toobig(L);
         ts = luaS_createlngstrobj(L, l);
-        memcpy(getstr(ts), str, l * sizeof(char));
+        memcpy(getlngstr(ts), str, l * sizeof(char));
         return ts;
     }
 }
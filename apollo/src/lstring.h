@@ -14,6 +14,23 @@
 
 #define sizelstring(l)  (sizeof(union UTString) + ((l) + 1) * sizeof(char))
 
+/* size of a regular long string (see 'LString') */
+#define sizelngstr(l)  (offsetof(LString, parent) + ((l) + 1) * sizeof(char))
+
+/* size of the header of slices and LSTRMEM strings */
+#define sizeslice    offsetof(LString, falloc)
+
+/* bytes of external string 'ts' counted as collector memory */
+#define extlstrmem(ts)  \
+  (lngstr(ts)->falloc != NULL ? (ts)->u.lnglen + 1 : 0)
+
+/* memory used by long string 'ts' */
+#define lngstrmem(ts)  \
+  ((ts)->shrlen == LSTRREG ? sizelngstr((ts)->u.lnglen) : \
+   (ts)->shrlen == LSTRSLICE ? sizeslice : \
+   (ts)->shrlen == LSTRMEM ? sizeslice + (ts)->u.lnglen + 1 : \
+   sizeof(LString) + extlstrmem(ts))
+
 #define sizeludata(l)    (sizeof(union UUdata) + (l))
 #define sizeudata(u)    sizeludata((u)->len)
 
@@ -27,6 +44,13 @@
 #define isreserved(s)    ((s)->tt == LUA_TSHRSTR && (s)->extra > 0)
 
 
+/*
+** test whether a string is a slice (whose bytes are not followed by
+** a '\0')
+*/
+#define isslice(s)    ((s)->tt == LUA_TLNGSTR && (s)->shrlen == LSTRSLICE)
+
+
 /*
 ** equality for short strings, which are always internalized
 */
@@ -55,5 +79,15 @@ LUAI_FUNC TString *luaS_new(lua_State *L, const char *str);
 
 LUAI_FUNC TString *luaS_createlngstrobj(lua_State *L, size_t l);
 
+LUAI_FUNC TString *luaS_newextlstr(lua_State *L, const char *s, size_t l,
+                                   lua_Alloc falloc, void *ud);
+
+LUAI_FUNC TString *luaS_newslice(lua_State *L, TString *ts, size_t i,
+                                 size_t l);
+
+LUAI_FUNC void luaS_unslice(lua_State *L, TString *ts);
+
+LUAI_FUNC void luaS_freelngstr(lua_State *L, TString *ts);
+
 
 #endif
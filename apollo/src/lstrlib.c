@@ -49,10 +49,129 @@
     (sizeof(size_t) < sizeof(int) ? MAX_SIZET : (size_t)(INT_MAX))
 
 
-static int str_len(lua_State *L) {
+/*
+** {======================================================
+** VECTOR KERNELS
+** =======================================================
+*/
+
+/*
+** With SSE2 (part of every x86-64 target) and a GCC-compatible compiler,
+** plain substring search, case conversion and reversal work on 16 bytes
+** at a time; otherwise (or with LUA_NOVECTOR) they use plain loops.
+*/
+#if !defined(LUA_NOVECTOR) && defined(__SSE2__) && defined(__GNUC__)
+#define l_vector
+#include <emmintrin.h>
+#endif
+
+
+/* whether case conversion is plain ASCII, for a given LC_CTYPE locale */
+typedef struct CaseCache {
+    int ascii;
+    char locale[128];  /* LC_CTYPE it was worked out for */
+} CaseCache;
+
+
+#if defined(l_vector)
+
+/* strings shorter than this are converted one byte at a time */
+#define MINVECCASE    128
+
+
+/*
+** Check whether 'tolower' and 'toupper' only change ASCII letters, as
+** in the "C" locale; otherwise case conversion must go through them.
+** The answer is kept in the 'CaseCache' upvalue of the calling function
+** and only worked out again when the LC_CTYPE locale changes.
+*/
+static int asciicase(lua_State *L) {
+    CaseCache *cc = (CaseCache *) lua_touserdata(L, lua_upvalueindex(1));
+    const char *locale = setlocale(LC_CTYPE, NULL);
+    int c;
+    if (cc == NULL || locale == NULL)
+        return 0;
+    if (strncmp(locale, cc->locale, sizeof(cc->locale) - 1) == 0)
+        return cc->ascii;
+    strncpy(cc->locale, locale, sizeof(cc->locale) - 1);
+    cc->ascii = 1;
+    for (c = 0; c <= UCHAR_MAX; c++) {
+        int isup = ('A' <= c && c <= 'Z'), islow = ('a' <= c && c <= 'z');
+        if (tolower(c) != (isup ? c + ('a' - 'A') : c) ||
+            toupper(c) != (islow ? c - ('a' - 'A') : c)) {
+            cc->ascii = 0;
+            break;
+        }
+    }
+    return cc->ascii;
+}
+
+
+/*
+** Copy 'l' bytes from 's' to 'p' flipping the case of bytes between
+** 'first' and 'first' + 25 (ASCII letters of one case); return how many
+** bytes were done, leaving the rest for the caller.
+*/
+static size_t flipcase(char *p, const char *s, size_t l, char first) {
+    /* shift the range to [-128, -103], so one signed compare tests it */
+    const __m128i shift = _mm_set1_epi8((char) (0x80 - uchar(first)));
+    const __m128i limit = _mm_set1_epi8((char) (-128 + 26));
+    const __m128i bit = _mm_set1_epi8(0x20);
+    size_t i;
+    for (i = 0; i + 16 <= l; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        __m128i in = _mm_cmplt_epi8(_mm_add_epi8(v, shift), limit);
+        _mm_storeu_si128((__m128i *) (p + i),
+                         _mm_xor_si128(v, _mm_and_si128(in, bit)));
+    }
+    return i;
+}
+
+
+/*
+** Copy 'l' bytes from 's' to 'p' in reverse order; return how many bytes
+** were done (taken from the end of 's').
+*/
+static size_t revbytes(char *p, const char *s, size_t l) {
+    size_t i;
+    for (i = 0; i + 16 <= l; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + l - i - 16));
+        v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));  /* 32-bit lanes */
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));  /* 16-bit */
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i *) (p + i), v);
+    }
+    return i;
+}
+
+#else
+
+#define MINVECCASE    MAX_SIZET
+#define asciicase(L)    0
+#define flipcase(p, s, l, first)    0
+#define revbytes(p, s, l)    0
+
+#endif
+
+/* }====================================================== */
+
+
+/*
+** Get the length of string argument 'arg' without asking for its bytes
+** (which would give a slice its own copy of them).
+*/
+static size_t checkstrlen(lua_State *L, int arg) {
     size_t l;
-    luaL_checklstring(L, 1, &l);
-    lua_pushinteger(L, (lua_Integer) l);
+    if (lua_type(L, arg) == LUA_TSTRING)
+        return lua_rawlen(L, arg);
+    luaL_checklstring(L, arg, &l);  /* a number becomes a string */
+    return l;
+}
+
+
+static int str_len(lua_State *L) {
+    lua_pushinteger(L, (lua_Integer) checkstrlen(L, 1));
     return 1;
 }
 
@@ -66,14 +185,13 @@ static lua_Integer posrelat(lua_Integer pos, size_t len) {
 
 
 static int str_sub(lua_State *L) {
-    size_t l;
-    const char *s = luaL_checklstring(L, 1, &l);
+    size_t l = checkstrlen(L, 1);
     lua_Integer start = posrelat(luaL_checkinteger(L, 2), l);
     lua_Integer end = posrelat(luaL_optinteger(L, 3, -1), l);
     if (start < 1) start = 1;
     if (end > (lua_Integer) l) end = l;
     if (start <= end)
-        lua_pushlstring(L, s + start - 1, (size_t) (end - start) + 1);
+        lua_pushsubstring(L, 1, (size_t) start - 1, (size_t) (end - start) + 1);
     else
         lua_pushliteral(L, "");
     return 1;
@@ -85,7 +203,7 @@ static int str_reverse(lua_State *L) {
     luaL_Buffer b;
     const char *s = luaL_checklstring(L, 1, &l);
     char *p = luaL_buffinitsize(L, &b, l);
-    for (i = 0; i < l; i++)
+    for (i = revbytes(p, s, l); i < l; i++)
         p[i] = s[l - i - 1];
     luaL_pushresultsize(&b, l);
     return 1;
@@ -98,7 +216,8 @@ static int str_lower(lua_State *L) {
     luaL_Buffer b;
     const char *s = luaL_checklstring(L, 1, &l);
     char *p = luaL_buffinitsize(L, &b, l);
-    for (i = 0; i < l; i++)
+    i = (l >= MINVECCASE && asciicase(L)) ? flipcase(p, s, l, 'A') : 0;
+    for (; i < l; i++)
         p[i] = tolower(uchar(s[i]));
     luaL_pushresultsize(&b, l);
     return 1;
@@ -111,7 +230,8 @@ static int str_upper(lua_State *L) {
     luaL_Buffer b;
     const char *s = luaL_checklstring(L, 1, &l);
     char *p = luaL_buffinitsize(L, &b, l);
-    for (i = 0; i < l; i++)
+    i = (l >= MINVECCASE && asciicase(L)) ? flipcase(p, s, l, 'a') : 0;
+    for (; i < l; i++)
         p[i] = toupper(uchar(s[i]));
     luaL_pushresultsize(&b, l);
     return 1;
@@ -128,17 +248,18 @@ static int str_rep(lua_State *L) {
         return luaL_error(L, "resulting string too large");
     else {
         size_t totallen = (size_t) n * l + (size_t) (n - 1) * lsep;
+        size_t done = l + lsep;  /* bytes already in place */
         luaL_Buffer b;
         char *p = luaL_buffinitsize(L, &b, totallen);
-        while (n-- > 1) {  /* first n-1 copies (followed by separator) */
-            memcpy(p, s, l * sizeof(char));
-            p += l;
-            if (lsep > 0) {  /* empty 'memcpy' is not that cheap */
-                memcpy(p, sep, lsep * sizeof(char));
-                p += lsep;
-            }
+        memcpy(p, s, l * sizeof(char));  /* first copy */
+        if (lsep > 0 && n > 1)
+            memcpy(p + l, sep, lsep * sizeof(char));
+        /* double the copies already made until the result is complete */
+        while (done < totallen) {
+            size_t chunk = (done <= totallen - done) ? done : totallen - done;
+            memcpy(p + done, p, chunk * sizeof(char));
+            done += chunk;
         }
-        memcpy(p, s, l * sizeof(char));  /* last copy (not followed by separator) */
         luaL_pushresultsize(&b, totallen);
     }
     return 1;
@@ -216,6 +337,7 @@ typedef struct MatchState {
     const char *src_end;  /* end ('\0') of source string */
     const char *p_end;  /* end ('\0') of pattern */
     lua_State *L;
+    int src_idx;  /* stack index of source string */
     int matchdepth;  /* control for recursive depth (to avoid C stack overflow) */
     unsigned char level;  /* total number of captures (finished or unfinished) */
     struct {
@@ -363,14 +485,9 @@ static int singlematch(MatchState *ms, const char *s, const char *p,
 }
 
 
-static const char *matchbalance(MatchState *ms, const char *s,
-                                const char *p) {
-    if (p >= ms->p_end - 1)
-        luaL_error(ms->L, "malformed pattern (missing arguments to '%%b')");
-    if (*s != *p) return NULL;
+static const char *balance(MatchState *ms, const char *s, int b, int e) {
+    if (*s != b) return NULL;
     else {
-        int b = *p;
-        int e = *(p + 1);
         int cont = 1;
         while (++s < ms->src_end) {
             if (*s == e) {
@@ -382,6 +499,14 @@ static const char *matchbalance(MatchState *ms, const char *s,
 }
 
 
+static const char *matchbalance(MatchState *ms, const char *s,
+                                const char *p) {
+    if (p >= ms->p_end - 1)
+        luaL_error(ms->L, "malformed pattern (missing arguments to '%%b')");
+    return balance(ms, s, *p, *(p + 1));
+}
+
+
 static const char *max_expand(MatchState *ms, const char *s,
                               const char *p, const char *ep) {
     ptrdiff_t i = 0;  /* counts maximum expand for item */
@@ -564,12 +689,74 @@ static const char *match(MatchState *ms, const char *s, const char *p) {
 }
 
 
+#if defined(l_vector)
+
+/*
+** Find 's2' (at least 2 bytes) in the first positions of 's1' that can
+** hold 16 candidates each: compare its first and last bytes with 16
+** positions at once, and compare the middle only where both match.
+** After a few blocks without its first byte, skip ahead with 'memchr'.
+** Set '*done' to the number of positions checked.
+*/
+static const char *vecfind(const char *s1, size_t l1,
+                           const char *s2, size_t l2, size_t *done) {
+    const __m128i first = _mm_set1_epi8(s2[0]);
+    const __m128i last = _mm_set1_epi8(s2[l2 - 1]);
+    size_t n = l1 - l2 + 1;  /* number of possible starts */
+    size_t i = 0;
+    int misses = 0;  /* consecutive blocks without a start */
+    while (i + 16 <= n) {
+        __m128i a = _mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i *) (s1 + i)), first);
+        __m128i z = _mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i *) (s1 + i + l2 - 1)), last);
+        unsigned int mask;
+        if (_mm_movemask_epi8(a) == 0) {  /* no start in this block? */
+            const char *next;
+            i += 16;
+            if (++misses < 4 || i >= n)
+                continue;
+            misses = 0;
+            next = (const char *) memchr(s1 + i, s2[0], n - i);
+            if (next == NULL) {
+                i = n;  /* no start anywhere */
+                break;
+            }
+            i = next - s1;
+            continue;
+        }
+        misses = 0;
+        mask = (unsigned int) _mm_movemask_epi8(_mm_and_si128(a, z));
+        while (mask != 0) {
+            const char *init = s1 + i + __builtin_ctz(mask);
+            if (memcmp(init + 1, s2 + 1, l2 - 2) == 0)
+                return init;
+            mask &= mask - 1;  /* clear lowest candidate */
+        }
+        i += 16;
+    }
+    *done = i;
+    return NULL;
+}
+
+#endif
+
+
 static const char *lmemfind(const char *s1, size_t l1,
                             const char *s2, size_t l2) {
     if (l2 == 0) return s1;  /* empty strings are everywhere */
     else if (l2 > l1) return NULL;  /* avoids a negative 'l1' */
     else {
         const char *init;  /* to search for a '*s2' inside 's1' */
+#if defined(l_vector)
+        if (l2 > 1) {
+            size_t done = 0;
+            if ((init = vecfind(s1, l1, s2, l2, &done)) != NULL)
+                return init;
+            s1 += done;  /* check the remaining positions below */
+            l1 -= done;
+        }
+#endif
         l2--;  /* 1st char will be checked by 'memchr' */
         l1 = l1 - l2;  /* 's2' cannot be found after that */
         while (l1 > 0 && (init = (const char *) memchr(s1, *s2, l1)) != NULL) {
@@ -590,7 +777,8 @@ static void push_onecapture(MatchState *ms, int i, const char *s,
                             const char *e) {
     if (i >= ms->level) {
         if (i == 0)  /* ms->level == 0, too */
-            lua_pushlstring(ms->L, s, e - s);  /* add whole match */
+            lua_pushsubstring(ms->L, ms->src_idx, s - ms->src_init,
+                              e - s);  /* add whole match */
         else
             luaL_error(ms->L, "invalid capture index %%%d", i + 1);
     } else {
@@ -599,7 +787,8 @@ static void push_onecapture(MatchState *ms, int i, const char *s,
         if (l == CAP_POSITION)
             lua_pushinteger(ms->L, (ms->capture[i].init - ms->src_init) + 1);
         else
-            lua_pushlstring(ms->L, ms->capture[i].init, l);
+            lua_pushsubstring(ms->L, ms->src_idx,
+                              ms->capture[i].init - ms->src_init, l);
     }
 }
 
@@ -626,9 +815,10 @@ static int nospecials(const char *p, size_t l) {
 }
 
 
-static void prepstate(MatchState *ms, lua_State *L,
+static void prepstate(MatchState *ms, lua_State *L, int src_idx,
                       const char *s, size_t ls, const char *p, size_t lp) {
     ms->L = L;
+    ms->src_idx = src_idx;
     ms->matchdepth = MAXCCALLS;
     ms->src_init = s;
     ms->src_end = s + ls;
@@ -642,184 +832,690 @@ static void reprepstate(MatchState *ms) {
 }
 
 
-static int str_find_aux(lua_State *L, int find) {
-    size_t ls, lp;
-    const char *s = luaL_checklstring(L, 1, &ls);
-    const char *p = luaL_checklstring(L, 2, &lp);
-    lua_Integer init = posrelat(luaL_optinteger(L, 3, 1), ls);
-    if (init < 1) init = 1;
-    else if (init > (lua_Integer) ls + 1) {  /* start after string's end? */
-        lua_pushnil(L);  /* cannot find anything */
-        return 1;
+/*
+** {======================================================
+** COMPILED-STRING CACHES
+** =======================================================
+*/
+
+/*
+** Compiled patterns and formats live in a table indexed by their source
+** string, kept in the uservalue of a 'StrCache' that the functions using
+** them share as their first upvalue. The table is replaced when it gets
+** full and, for caches whose entries depend on it (pattern class maps),
+** when the LC_CTYPE locale changes.
+*/
+
+/* maximum number of entries in a cache */
+#if !defined(LUA_STRCACHESIZE)
+#define LUA_STRCACHESIZE    128
+#endif
+
+
+typedef struct StrCache {
+    int count;  /* number of cached entries */
+    int ctype;  /* do entries depend on LC_CTYPE? */
+    char locale[128];  /* LC_CTYPE used to compile them */
+} StrCache;
+
+
+/* compiles a string into a new userdata on the stack (NULL if invalid) */
+typedef void *(*Compiler)(lua_State *L, const char *s, size_t l);
+
+
+static void newcache(lua_State *L, int ctype) {
+    StrCache *sc = (StrCache *) lua_newuserdata(L, sizeof(StrCache));
+    sc->count = 0;
+    sc->ctype = ctype;
+    sc->locale[0] = '\0';  /* no locale yet */
+    lua_newtable(L);
+    lua_setuservalue(L, -2);
+}
+
+
+/*
+** Push the compiled form of string argument 'arg' and return it, calling
+** 'comp' if it is not cached yet; push nil and return NULL if it is longer
+** than 'maxlen' or cannot be compiled.
+*/
+static void *getcompiled(lua_State *L, int arg, size_t maxlen,
+                         Compiler comp) {
+    StrCache *sc = (StrCache *) lua_touserdata(L, lua_upvalueindex(1));
+    size_t l;
+    const char *s = lua_tolstring(L, arg, &l);
+    void *code;
+    if (sc == NULL || l > maxlen) {
+        lua_pushnil(L);
+        return NULL;
     }
-    /* explicit request or no special characters? */
-    if (find && (lua_toboolean(L, 4) || nospecials(p, lp))) {
-        /* do a plain search */
-        const char *s2 = lmemfind(s + init - 1, ls - (size_t) init + 1, p, lp);
-        if (s2) {
-            lua_pushinteger(L, (s2 - s) + 1);
-            lua_pushinteger(L, (s2 - s) + lp);
-            return 2;
+    if (sc->ctype) {
+        const char *locale = setlocale(LC_CTYPE, NULL);
+        if (locale == NULL) {
+            lua_pushnil(L);
+            return NULL;
         }
-    } else {
-        MatchState ms;
-        const char *s1 = s + init - 1;
-        int anchor = (*p == '^');
-        if (anchor) {
-            p++;
-            lp--;  /* skip anchor character */
+        if (strncmp(locale, sc->locale, sizeof(sc->locale) - 1) != 0) {
+            /* first use or compiled forms out of date; start a new cache */
+            strncpy(sc->locale, locale, sizeof(sc->locale) - 1);
+            lua_newtable(L);
+            lua_setuservalue(L, lua_upvalueindex(1));
+            sc->count = 0;
         }
-        prepstate(&ms, L, s, ls, p, lp);
-        do {
-            const char *res;
-            reprepstate(&ms);
-            if ((res = match(&ms, s1, p)) != NULL) {
-                if (find) {
-                    lua_pushinteger(L, (s1 - s) + 1);  /* start */
-                    lua_pushinteger(L, res - s);   /* end */
-                    return push_captures(&ms, NULL, 0) + 2;
-                } else
-                    return push_captures(&ms, s1, res);
-            }
-        } while (s1++ < ms.src_end && !anchor);
     }
-    lua_pushnil(L);  /* not found */
-    return 1;
+    lua_getuservalue(L, lua_upvalueindex(1));
+    lua_pushvalue(L, arg);
+    if (lua_rawget(L, -2) == LUA_TNIL) {  /* not compiled yet? */
+        int top;
+        lua_pop(L, 1);
+        if (sc->count >= LUA_STRCACHESIZE) {  /* cache is full? */
+            lua_pop(L, 1);
+            lua_newtable(L);  /* start a new one */
+            lua_pushvalue(L, -1);
+            lua_setuservalue(L, lua_upvalueindex(1));
+            sc->count = 0;
+        }
+        top = lua_gettop(L);
+        if (comp(L, s, l) == NULL) {
+            lua_settop(L, top);
+            lua_pushboolean(L, 0);  /* invalid; leave it to the caller */
+        }
+        lua_pushvalue(L, arg);
+        lua_pushvalue(L, -2);
+        lua_rawset(L, -4);
+        sc->count++;
+    }
+    lua_remove(L, -2);  /* remove cache table */
+    code = lua_touserdata(L, -1);
+    if (code == NULL) {
+        lua_pop(L, 1);
+        lua_pushnil(L);
+    }
+    return code;
 }
 
+/* }====================================================== */
 
-static int str_find(lua_State *L) {
-    return str_find_aux(L, 1);
-}
 
 
-static int str_match(lua_State *L) {
-    return str_find_aux(L, 0);
-}
+/*
+** {======================================================
+** COMPILED PATTERNS
+** =======================================================
+*/
 
+/*
+** 'find', 'match', 'gmatch' and 'gsub' compile their patterns into a
+** list of items, one per pattern element, where classes and sets become
+** 256-bit maps, and keep them in a 'StrCache'. 'pmatch' follows 'match'
+** step by step (including its recursion depth and run-time errors), so
+** results are the same. Malformed patterns are left to 'match', which
+** raises their errors if and when it reaches them. Unanchored searches
+** skip positions where a match cannot start: a literal prefix is looked
+** for with 'memchr' and 'memcmp', and a first item that must match at
+** least once filters the start positions.
+*/
 
-/* state for 'gmatch' */
-typedef struct GMatchState {
-    const char *src;  /* current position */
-    const char *p;  /* pattern */
-    const char *lastmatch;  /* end of last match */
-    MatchState ms;  /* match state */
-} GMatchState;
+/* longer patterns are not compiled */
+#define MAXPATLEN    256
 
 
-static int gmatch_aux(lua_State *L) {
-    GMatchState *gm = (GMatchState *) lua_touserdata(L, lua_upvalueindex(3));
-    const char *src;
-    gm->ms.L = L;
-    for (src = gm->src; src <= gm->ms.src_end; src++) {
-        const char *e;
-        reprepstate(&gm->ms);
-        if ((e = match(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
-            gm->src = gm->lastmatch = e;
-            return push_captures(&gm->ms, src, e);
-        }
-    }
-    return 0;  /* not found */
-}
+/* kinds of pattern items */
+enum {
+    PI_STOP, PI_CHAR, PI_ANY, PI_SET,  /* single-char items */
+    PI_OPEN, PI_POSITION, PI_CLOSE, PI_END,
+    PI_BALANCE, PI_FRONTIER, PI_BACKREF
+};
 
 
-static int gmatch(lua_State *L) {
-    size_t ls, lp;
-    const char *s = luaL_checklstring(L, 1, &ls);
-    const char *p = luaL_checklstring(L, 2, &lp);
-    GMatchState *gm;
-    lua_settop(L, 2);  /* keep them on closure to avoid being collected */
-    gm = (GMatchState *) lua_newuserdata(L, sizeof(GMatchState));
-    prepstate(&gm->ms, L, s, ls, p, lp);
-    gm->src = s;
-    gm->p = p;
-    gm->lastmatch = NULL;
-    lua_pushcclosure(L, gmatch_aux, 3);
-    return 1;
-}
+typedef struct PatItem {
+    unsigned char kind;
+    unsigned char rep;  /* suffix ('*', '+', '-' or '?'), or 0 */
+    unsigned char c1, c2;  /* character, '%b' delimiters or '%n' digit */
+    unsigned char set[32];  /* characters of a set or frontier */
+} PatItem;
 
 
-static void add_s(MatchState *ms, luaL_Buffer *b, const char *s,
-                  const char *e) {
-    size_t l, i;
-    lua_State *L = ms->L;
-    const char *news = lua_tolstring(L, 3, &l);
-    for (i = 0; i < l; i++) {
-        if (news[i] != L_ESC)
-            luaL_addchar(b, news[i]);
-        else {
-            i++;  /* skip ESC */
-            if (!isdigit(uchar(news[i]))) {
-                if (news[i] != L_ESC)
-                    luaL_error(L, "invalid use of '%c' in replacement string", L_ESC);
-                luaL_addchar(b, news[i]);
-            } else if (news[i] == '0')
-                luaL_addlstring(b, s, e - s);
-            else {
-                push_onecapture(ms, news[i] - '1', s, e);
-                luaL_tolstring(L, -1, NULL);  /* if number, convert it to string */
-                lua_remove(L, -2);  /* remove original value */
-                luaL_addvalue(b);  /* add capture to accumulated result */
-            }
-        }
-    }
+typedef struct Pattern {
+    int anchor;  /* pattern starts with '^'? */
+    size_t lprefix;  /* length of literal prefix */
+    const char *prefix;  /* literal prefix (after the items) */
+    const PatItem *first;  /* first item, if it must match; or NULL */
+    PatItem item[1];  /* items, ending with PI_STOP */
+} Pattern;
+
+
+#define inset(set, c)    ((set)[uchar(c) >> 3] & (1u << (uchar(c) & 7)))
+
+
+/* end of set starting at 'p' (after its '['), or NULL if malformed */
+static const char *setend(const char *p, const char *pe) {
+    if (*p == '^') p++;
+    do {  /* look for a ']' */
+        if (p == pe)
+            return NULL;
+        if (*(p++) == L_ESC && p < pe)
+            p++;  /* skip escapes (e.g. '%]') */
+    } while (*p != ']');
+    return p + 1;
 }
 
 
-static void add_value(MatchState *ms, luaL_Buffer *b, const char *s,
-                      const char *e, int tr) {
-    lua_State *L = ms->L;
-    switch (tr) {
-        case LUA_TFUNCTION: {
-            int n;
-            lua_pushvalue(L, 3);
-            n = push_captures(ms, s, e);
-            lua_call(L, n, 1);
-            break;
-        }
-        case LUA_TTABLE: {
-            push_onecapture(ms, 0, s, e);
-            lua_gettable(L, 3);
-            break;
-        }
-        default: {  /* LUA_TNUMBER or LUA_TSTRING */
-            add_s(ms, b, s, e);
-            return;
+/*
+** Fill the map of single-char item 'it' for class 'p' ('%x' or a set
+** ending at 'ep'); a map with one character becomes a plain character.
+*/
+static void makeset(PatItem *it, const char *p, const char *ep) {
+    int c, n = 0;
+    memset(it->set, 0, sizeof(it->set));
+    for (c = 0; c <= UCHAR_MAX; c++) {
+        if (*p == L_ESC ? match_class(c, uchar(*(p + 1)))
+                        : matchbracketclass(c, p, ep - 1)) {
+            it->set[c >> 3] |= 1u << (c & 7);
+            it->c1 = uchar(c);
+            n++;
         }
     }
-    if (!lua_toboolean(L, -1)) {  /* nil or false? */
-        lua_pop(L, 1);
-        lua_pushlstring(L, s, e - s);  /* keep original text */
-    } else if (!lua_isstring(L, -1))
-        luaL_error(L, "invalid replacement value (a %s)", luaL_typename(L, -1));
-    luaL_addvalue(b);  /* add result to accumulator */
+    it->kind = (n == 1) ? PI_CHAR : PI_SET;
 }
 
 
-static int str_gsub(lua_State *L) {
-    size_t srcl, lp;
-    const char *src = luaL_checklstring(L, 1, &srcl);  /* subject */
-    const char *p = luaL_checklstring(L, 2, &lp);  /* pattern */
-    const char *lastmatch = NULL;  /* end of last match */
-    int tr = lua_type(L, 3);  /* replacement type */
-    lua_Integer max_s = luaL_optinteger(L, 4, srcl + 1);  /* max replacements */
-    int anchor = (*p == '^');
+/*
+** Compile pattern 'p' into a new userdata on the stack; return NULL if
+** the pattern is malformed.
+*/
+static void *compilepattern(lua_State *L, const char *p, size_t lp) {
+    const char *pe = p + lp;
+    Pattern *pat = (Pattern *) lua_newuserdata(L, sizeof(Pattern) +
+                                               lp * sizeof(PatItem) + lp);
+    PatItem *it = pat->item;
+    char *prefix;
+    pat->anchor = (*p == '^');
+    if (pat->anchor) p++;
+    while (p < pe) {
+        it->rep = 0;
+        switch (*p) {
+            case '(': {
+                it->kind = (*(p + 1) == ')') ? PI_POSITION : PI_OPEN;
+                p += (it->kind == PI_POSITION) ? 2 : 1;
+                break;
+            }
+            case ')': {
+                it->kind = PI_CLOSE;
+                p++;
+                break;
+            }
+            case '$': {
+                if (p + 1 != pe)  /* not the last char? */
+                    goto dflt;
+                it->kind = PI_END;
+                p++;
+                break;
+            }
+            case L_ESC: {
+                switch (*(p + 1)) {
+                    case 'b': {
+                        if (p + 2 >= pe - 1)
+                            return NULL;  /* missing arguments */
+                        it->kind = PI_BALANCE;
+                        it->c1 = uchar(*(p + 2));
+                        it->c2 = uchar(*(p + 3));
+                        p += 4;
+                        break;
+                    }
+                    case 'f': {
+                        const char *ep;
+                        p += 2;
+                        if (*p != '[' || (ep = setend(p + 1, pe)) == NULL)
+                            return NULL;
+                        makeset(it, p, ep);
+                        it->kind = PI_FRONTIER;
+                        p = ep;
+                        break;
+                    }
+                    case '0': case '1': case '2': case '3': case '4':
+                    case '5': case '6': case '7': case '8': case '9': {
+                        it->kind = PI_BACKREF;
+                        it->c1 = uchar(*(p + 1));
+                        p += 2;
+                        break;
+                    }
+                    default:
+                        goto dflt;
+                }
+                break;
+            }
+            default:
+            dflt: {  /* single-char class plus optional suffix */
+                const char *ep;
+                if (*p == L_ESC) {
+                    if (p + 1 == pe)
+                        return NULL;  /* ends with '%' */
+                    ep = p + 2;
+                    makeset(it, p, ep);
+                } else if (*p == '[') {
+                    if ((ep = setend(p + 1, pe)) == NULL)
+                        return NULL;  /* missing ']' */
+                    makeset(it, p, ep);
+                } else {
+                    it->kind = (*p == '.') ? PI_ANY : PI_CHAR;
+                    it->c1 = uchar(*p);
+                    ep = p + 1;
+                }
+                if (ep < pe && (*ep == '*' || *ep == '+' || *ep == '-' || *ep == '?'))
+                    it->rep = uchar(*ep++);
+                p = ep;
+                break;
+            }
+        }
+        it++;
+    }
+    it->kind = PI_STOP;
+    /* collect literal prefix, after captures that start there */
+    prefix = (char *) (it + 1);
+    pat->prefix = prefix;
+    for (it = pat->item; it->kind == PI_OPEN || it->kind == PI_POSITION; it++) {}
+    pat->first = ((it->kind == PI_CHAR || it->kind == PI_SET) &&
+                  (it->rep == 0 || it->rep == '+')) ? it : NULL;
+    for (; it->kind == PI_CHAR && it->rep == 0; it++)
+        *prefix++ = (char) it->c1;
+    pat->lprefix = prefix - pat->prefix;
+    return pat;
+}
+
+
+/* push the compiled form of pattern argument 'arg' (see 'getcompiled') */
+static const Pattern *getpattern(lua_State *L, int arg) {
+    return (const Pattern *) getcompiled(L, arg, MAXPATLEN, compilepattern);
+}
+
+
+static const char *pmatch(MatchState *ms, const char *s, const PatItem *p);
+
+
+static int psinglematch(MatchState *ms, const char *s, const PatItem *p) {
+    if (s >= ms->src_end)
+        return 0;
+    switch (p->kind) {
+        case PI_CHAR:
+            return (uchar(*s) == p->c1);
+        case PI_ANY:
+            return 1;
+        default:
+            return inset(p->set, *s);
+    }
+}
+
+
+static const char *pmax_expand(MatchState *ms, const char *s,
+                               const PatItem *p) {
+    ptrdiff_t i = 0;  /* counts maximum expand for item */
+    while (psinglematch(ms, s + i, p))
+        i++;
+    /* keeps trying to match with the maximum repetitions */
+    while (i >= 0) {
+        const char *res = pmatch(ms, (s + i), p + 1);
+        if (res) return res;
+        i--;  /* else didn't match; reduce 1 repetition to try again */
+    }
+    return NULL;
+}
+
+
+static const char *pmin_expand(MatchState *ms, const char *s,
+                               const PatItem *p) {
+    for (;;) {
+        const char *res = pmatch(ms, s, p + 1);
+        if (res != NULL)
+            return res;
+        else if (psinglematch(ms, s, p))
+            s++;  /* try with one more repetition */
+        else return NULL;
+    }
+}
+
+
+static const char *pstart_capture(MatchState *ms, const char *s,
+                                  const PatItem *p, int what) {
+    const char *res;
+    int level = ms->level;
+    if (level >= LUA_MAXCAPTURES) luaL_error(ms->L, "too many captures");
+    ms->capture[level].init = s;
+    ms->capture[level].len = what;
+    ms->level = level + 1;
+    if ((res = pmatch(ms, s, p)) == NULL)  /* match failed? */
+        ms->level--;  /* undo capture */
+    return res;
+}
+
+
+static const char *pend_capture(MatchState *ms, const char *s,
+                                const PatItem *p) {
+    int l = capture_to_close(ms);
+    const char *res;
+    ms->capture[l].len = s - ms->capture[l].init;  /* close capture */
+    if ((res = pmatch(ms, s, p)) == NULL)  /* match failed? */
+        ms->capture[l].len = CAP_UNFINISHED;  /* undo capture */
+    return res;
+}
+
+
+/* 'match' for compiled patterns */
+static const char *pmatch(MatchState *ms, const char *s, const PatItem *p) {
+    if (ms->matchdepth-- == 0)
+        luaL_error(ms->L, "pattern too complex");
+    init: /* using goto's to optimize tail recursion */
+    switch (p->kind) {
+        case PI_STOP:  /* end of pattern */
+            break;
+        case PI_OPEN:
+            s = pstart_capture(ms, s, p + 1, CAP_UNFINISHED);
+            break;
+        case PI_POSITION:
+            s = pstart_capture(ms, s, p + 1, CAP_POSITION);
+            break;
+        case PI_CLOSE:
+            s = pend_capture(ms, s, p + 1);
+            break;
+        case PI_END:
+            s = (s == ms->src_end) ? s : NULL;  /* check end of string */
+            break;
+        case PI_BALANCE: {
+            s = balance(ms, s, p->c1, p->c2);
+            if (s != NULL) {
+                p++;
+                goto init;
+            }
+            break;
+        }
+        case PI_FRONTIER: {
+            char previous = (s == ms->src_init) ? '\0' : *(s - 1);
+            if (!inset(p->set, previous) && inset(p->set, *s)) {
+                p++;
+                goto init;
+            }
+            s = NULL;  /* match failed */
+            break;
+        }
+        case PI_BACKREF: {
+            s = match_capture(ms, s, p->c1);
+            if (s != NULL) {
+                p++;
+                goto init;
+            }
+            break;
+        }
+        default: {  /* single-char item plus optional suffix */
+            if (!psinglematch(ms, s, p)) {
+                if (p->rep == '*' || p->rep == '?' || p->rep == '-') {  /* accept empty? */
+                    p++;
+                    goto init;
+                } else  /* '+' or no suffix */
+                    s = NULL;  /* fail */
+            } else {  /* matched once */
+                switch (p->rep) {  /* handle optional suffix */
+                    case '?': {  /* optional */
+                        const char *res;
+                        if ((res = pmatch(ms, s + 1, p + 1)) != NULL)
+                            s = res;
+                        else {
+                            p++;
+                            goto init;
+                        }
+                        break;
+                    }
+                    case '+':  /* 1 or more repetitions */
+                        s++;  /* 1 match already done */
+                        /* FALLTHROUGH */
+                    case '*':  /* 0 or more repetitions */
+                        s = pmax_expand(ms, s, p);
+                        break;
+                    case '-':  /* 0 or more repetitions (minimum) */
+                        s = pmin_expand(ms, s, p);
+                        break;
+                    default:  /* no suffix */
+                        s++;
+                        p++;
+                        goto init;
+                }
+            }
+            break;
+        }
+    }
+    ms->matchdepth++;
+    return s;
+}
+
+
+/* match 'p' (or compiled 'pat', if not NULL) at 's' */
+static const char *domatch(MatchState *ms, const char *s, const char *p,
+                           const Pattern *pat) {
+    return (pat != NULL) ? pmatch(ms, s, pat->item) : match(ms, s, p);
+}
+
+
+/* first position from 's' where an unanchored match may start, or NULL */
+static const char *skipto(const Pattern *pat, const char *s, const char *e) {
+    if (pat == NULL)
+        return s;
+    else if (pat->lprefix > 0)
+        return lmemfind(s, e - s, pat->prefix, pat->lprefix);
+    else if (pat->first != NULL) {
+        const PatItem *f = pat->first;
+        if (f->kind == PI_CHAR)
+            return (const char *) memchr(s, f->c1, e - s);
+        while (s < e && !inset(f->set, *s))
+            s++;
+        return (s < e) ? s : NULL;
+    } else
+        return s;
+}
+
+/* }====================================================== */
+
+
+static int str_find_aux(lua_State *L, int find) {
+    size_t ls, lp;
+    const char *s = luaL_checklstring(L, 1, &ls);
+    const char *p = luaL_checklstring(L, 2, &lp);
+    lua_Integer init = posrelat(luaL_optinteger(L, 3, 1), ls);
+    if (init < 1) init = 1;
+    else if (init > (lua_Integer) ls + 1) {  /* start after string's end? */
+        lua_pushnil(L);  /* cannot find anything */
+        return 1;
+    }
+    /* explicit request or no special characters? */
+    if (find && (lua_toboolean(L, 4) || nospecials(p, lp))) {
+        /* do a plain search */
+        const char *s2 = lmemfind(s + init - 1, ls - (size_t) init + 1, p, lp);
+        if (s2) {
+            lua_pushinteger(L, (s2 - s) + 1);
+            lua_pushinteger(L, (s2 - s) + lp);
+            return 2;
+        }
+    } else {
+        MatchState ms;
+        const char *s1 = s + init - 1;
+        int anchor = (*p == '^');
+        const Pattern *pat = getpattern(L, 2);
+        if (anchor) {
+            p++;
+            lp--;  /* skip anchor character */
+        }
+        prepstate(&ms, L, 1, s, ls, p, lp);
+        do {
+            const char *res;
+            if (!anchor && (s1 = skipto(pat, s1, ms.src_end)) == NULL)
+                break;  /* no possible start */
+            reprepstate(&ms);
+            if ((res = domatch(&ms, s1, p, pat)) != NULL) {
+                if (find) {
+                    lua_pushinteger(L, (s1 - s) + 1);  /* start */
+                    lua_pushinteger(L, res - s);   /* end */
+                    return push_captures(&ms, NULL, 0) + 2;
+                } else
+                    return push_captures(&ms, s1, res);
+            }
+        } while (s1++ < ms.src_end && !anchor);
+    }
+    lua_pushnil(L);  /* not found */
+    return 1;
+}
+
+
+static int str_find(lua_State *L) {
+    return str_find_aux(L, 1);
+}
+
+
+static int str_match(lua_State *L) {
+    return str_find_aux(L, 0);
+}
+
+
+/* state for 'gmatch' */
+typedef struct GMatchState {
+    const char *src;  /* current position */
+    const char *p;  /* pattern */
+    const char *lastmatch;  /* end of last match */
+    const Pattern *pat;  /* compiled pattern (upvalue 4), or NULL */
+    MatchState ms;  /* match state */
+} GMatchState;
+
+
+static int gmatch_aux(lua_State *L) {
+    GMatchState *gm = (GMatchState *) lua_touserdata(L, lua_upvalueindex(3));
+    const char *src;
+    gm->ms.L = L;
+    for (src = gm->src; src <= gm->ms.src_end; src++) {
+        const char *e;
+        if ((src = skipto(gm->pat, src, gm->ms.src_end)) == NULL)
+            break;  /* no possible start */
+        reprepstate(&gm->ms);
+        if ((e = domatch(&gm->ms, src, gm->p, gm->pat)) != NULL &&
+            e != gm->lastmatch) {
+            gm->src = gm->lastmatch = e;
+            return push_captures(&gm->ms, src, e);
+        }
+    }
+    return 0;  /* not found */
+}
+
+
+static int gmatch(lua_State *L) {
+    size_t ls, lp;
+    const char *s = luaL_checklstring(L, 1, &ls);
+    const char *p = luaL_checklstring(L, 2, &lp);
+    const Pattern *pat;
+    GMatchState *gm;
+    lua_settop(L, 2);  /* keep them on closure to avoid being collected */
+    /* 'gmatch' does not anchor, so a '^' is matched by the interpreter */
+    if (*p == '^') {
+        lua_pushnil(L);
+        pat = NULL;
+    } else
+        pat = getpattern(L, 2);
+    gm = (GMatchState *) lua_newuserdata(L, sizeof(GMatchState));
+    lua_insert(L, 3);  /* upvalues: subject, pattern, state, program */
+    prepstate(&gm->ms, L, lua_upvalueindex(1), s, ls, p, lp);
+    gm->src = s;
+    gm->p = p;
+    gm->lastmatch = NULL;
+    gm->pat = pat;
+    lua_pushcclosure(L, gmatch_aux, 4);
+    return 1;
+}
+
+
+static void add_s(MatchState *ms, luaL_Buffer *b, const char *s,
+                  const char *e) {
+    size_t l, i;
+    lua_State *L = ms->L;
+    const char *news = lua_tolstring(L, 3, &l);
+    for (i = 0; i < l; i++) {
+        if (news[i] != L_ESC)
+            luaL_addchar(b, news[i]);
+        else {
+            i++;  /* skip ESC */
+            if (!isdigit(uchar(news[i]))) {
+                if (news[i] != L_ESC)
+                    luaL_error(L, "invalid use of '%c' in replacement string", L_ESC);
+                luaL_addchar(b, news[i]);
+            } else if (news[i] == '0')
+                luaL_addlstring(b, s, e - s);
+            else {
+                push_onecapture(ms, news[i] - '1', s, e);
+                luaL_tolstring(L, -1, NULL);  /* if number, convert it to string */
+                lua_remove(L, -2);  /* remove original value */
+                luaL_addvalue(b);  /* add capture to accumulated result */
+            }
+        }
+    }
+}
+
+
+static void add_value(MatchState *ms, luaL_Buffer *b, const char *s,
+                      const char *e, int tr) {
+    lua_State *L = ms->L;
+    switch (tr) {
+        case LUA_TFUNCTION: {
+            int n;
+            lua_pushvalue(L, 3);
+            n = push_captures(ms, s, e);
+            lua_call(L, n, 1);
+            break;
+        }
+        case LUA_TTABLE: {
+            push_onecapture(ms, 0, s, e);
+            lua_gettable(L, 3);
+            break;
+        }
+        default: {  /* LUA_TNUMBER or LUA_TSTRING */
+            add_s(ms, b, s, e);
+            return;
+        }
+    }
+    if (!lua_toboolean(L, -1)) {  /* nil or false? */
+        lua_pop(L, 1);
+        lua_pushlstring(L, s, e - s);  /* keep original text */
+    } else if (!lua_isstring(L, -1))
+        luaL_error(L, "invalid replacement value (a %s)", luaL_typename(L, -1));
+    luaL_addvalue(b);  /* add result to accumulator */
+}
+
+
+static int str_gsub(lua_State *L) {
+    size_t srcl, lp;
+    const char *src = luaL_checklstring(L, 1, &srcl);  /* subject */
+    const char *p = luaL_checklstring(L, 2, &lp);  /* pattern */
+    const char *lastmatch = NULL;  /* end of last match */
+    int tr = lua_type(L, 3);  /* replacement type */
+    lua_Integer max_s = luaL_optinteger(L, 4, srcl + 1);  /* max replacements */
+    int anchor = (*p == '^');
     lua_Integer n = 0;  /* replacement count */
+    const Pattern *pat;
     MatchState ms;
     luaL_Buffer b;
     luaL_argcheck(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
                      tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
                   "string/function/table expected");
+    pat = getpattern(L, 2);
     luaL_buffinit(L, &b);
     if (anchor) {
         p++;
         lp--;  /* skip anchor character */
     }
-    prepstate(&ms, L, src, srcl, p, lp);
+    prepstate(&ms, L, 1, src, srcl, p, lp);
     while (n < max_s) {
         const char *e;
+        if (!anchor && pat != NULL) {  /* copy text where no match starts */
+            const char *s1 = skipto(pat, src, ms.src_end);
+            if (s1 == NULL)
+                s1 = ms.src_end;
+            luaL_addlstring(&b, src, s1 - src);
+            src = s1;
+        }
         reprepstate(&ms);  /* (re)prepare state for new match */
-        if ((e = match(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
+        if ((e = domatch(&ms, src, p, pat)) != NULL && e != lastmatch) {  /* match? */
             n++;
             add_value(&ms, &b, src, e, tr);  /* add replacement to buffer */
             src = lastmatch = e;
@@ -1013,11 +1709,19 @@ static void addliteral(lua_State *L, luaL_Buffer *b, int arg) {
 }
 
 
-static const char *scanformat(lua_State *L, const char *strfrmt, char *form) {
+/*
+** Copy the format item at 'strfrmt' (after its '%') into 'form' and
+** return a pointer to its conversion; return NULL and set '*err' if it
+** is invalid.
+*/
+static const char *getformat(const char *strfrmt, char *form,
+                             const char **err) {
     const char *p = strfrmt;
     while (*p != '\0' && strchr(FLAGS, *p) != NULL) p++;  /* skip flags */
-    if ((size_t) (p - strfrmt) >= sizeof(FLAGS) / sizeof(char))
-        luaL_error(L, "invalid format (repeated flags)");
+    if ((size_t) (p - strfrmt) >= sizeof(FLAGS) / sizeof(char)) {
+        *err = "invalid format (repeated flags)";
+        return NULL;
+    }
     if (isdigit(uchar(*p))) p++;  /* skip width */
     if (isdigit(uchar(*p))) p++;  /* (2 digits at most) */
     if (*p == '.') {
@@ -1025,8 +1729,10 @@ static const char *scanformat(lua_State *L, const char *strfrmt, char *form) {
         if (isdigit(uchar(*p))) p++;  /* skip precision */
         if (isdigit(uchar(*p))) p++;  /* (2 digits at most) */
     }
-    if (isdigit(uchar(*p)))
-        luaL_error(L, "invalid format (width or precision too long)");
+    if (isdigit(uchar(*p))) {
+        *err = "invalid format (width or precision too long)";
+        return NULL;
+    }
     *(form++) = '%';
     memcpy(form, strfrmt, ((p - strfrmt) + 1) * sizeof(char));
     form += (p - strfrmt) + 1;
@@ -1035,16 +1741,326 @@ static const char *scanformat(lua_State *L, const char *strfrmt, char *form) {
 }
 
 
+static const char *scanformat(lua_State *L, const char *strfrmt, char *form) {
+    const char *err = NULL;
+    const char *p = getformat(strfrmt, form, &err);
+    if (p == NULL)
+        luaL_error(L, "%s", err);
+    return p;
+}
+
+
+/*
+** add length modifier into formats
+*/
+static void addlenmod(char *form, const char *lenmod) {
+    size_t l = strlen(form);
+    size_t lm = strlen(lenmod);
+    char spec = form[l - 1];
+    strcpy(form + l - 1, lenmod);
+    form[l + lm - 1] = spec;
+    form[l + lm] = '\0';
+}
+
+
+/*
+** Compiled formats: 'format' turns its format string into a list of
+** items (literal text or one conversion with its C format already
+** built) and keeps it in a 'StrCache'. The most common conversions
+** ('%d', '%x', '%s', '%q' and '%f'/'%.Nf' without flags or width) are
+** written straight into the buffer; the others go through 'l_sprintf'
+** as before. Invalid formats are left to the interpreter below, so
+** errors are raised in the same order.
+*/
+
+/* longer formats are not compiled */
+#define MAXFMTLEN    512
+
+
+/* kinds of format items */
+enum {
+    FI_TEXT,  /* literal text */
+    FI_INT,  /* '%d' or '%i' */
+    FI_HEX,  /* '%x' or '%X' */
+    FI_STR,  /* '%s' */
+    FI_QUOTE,  /* '%q' */
+    FI_FIXED,  /* '%f' or '%.Nf' */
+    FI_OTHER  /* anything else, through 'l_sprintf' */
+};
+
+
+typedef struct FmtItem {
+    unsigned char kind;
+    char conv;  /* conversion character */
+    unsigned char prec;  /* precision (FI_FIXED) */
+    size_t init, len;  /* literal text (position in the format) */
+    char form[MAX_FORMAT + 8];  /* C format, with length modifier */
+} FmtItem;
+
+
+typedef struct Format {
+    int n;  /* number of items */
+    FmtItem item[1];
+} Format;
+
+
+static void *compileformat(lua_State *L, const char *strfrmt, size_t sfl) {
+    const char *init = strfrmt;
+    const char *strfrmt_end = strfrmt + sfl;
+    const char *err;
+    const char *q;
+    Format *fmt;
+    FmtItem *it;
+    size_t n = 1;
+    for (q = strfrmt; (q = (const char *) memchr(q, L_ESC, strfrmt_end - q)) != NULL; q++)
+        n += 2;  /* each '%' adds at most a conversion and a text */
+    fmt = (Format *) lua_newuserdata(L, sizeof(Format) + n * sizeof(FmtItem));
+    it = fmt->item;
+    while (strfrmt < strfrmt_end) {
+        if (*strfrmt != L_ESC || *(strfrmt + 1) == L_ESC) {  /* text? */
+            const char *e = (*strfrmt == L_ESC) ? strfrmt + 1 : strfrmt;
+            it->kind = FI_TEXT;
+            it->init = e - init;  /* (skip first '%' of a '%%') */
+            e = (const char *) memchr(e + 1, L_ESC, strfrmt_end - e - 1);
+            if (e == NULL) e = strfrmt_end;
+            it->len = (e - init) - it->init;
+            strfrmt = e;
+        } else {  /* conversion */
+            const char *p = getformat(strfrmt + 1, it->form, &err);
+            int plain = (p == strfrmt + 1);  /* no flags, width or precision? */
+            if (p == NULL)
+                return NULL;
+            it->conv = *p;
+            switch (*p) {
+                case 'd': case 'i':
+                    it->kind = plain ? FI_INT : FI_OTHER;
+                    addlenmod(it->form, LUA_INTEGER_FRMLEN);
+                    break;
+                case 'x': case 'X':
+                    it->kind = plain ? FI_HEX : FI_OTHER;
+                    addlenmod(it->form, LUA_INTEGER_FRMLEN);
+                    break;
+                case 'o': case 'u':
+                    it->kind = FI_OTHER;
+                    addlenmod(it->form, LUA_INTEGER_FRMLEN);
+                    break;
+                case 'f': {
+                    it->kind = FI_OTHER;
+                    if (plain) {
+                        it->kind = FI_FIXED;
+                        it->prec = 6;
+                    } else if (*(strfrmt + 1) == '.') {  /* only a precision? */
+                        it->kind = FI_FIXED;
+                        it->prec = 0;
+                        for (q = strfrmt + 2; q < p; q++)
+                            it->prec = it->prec * 10 + (*q - '0');
+                    }
+                    addlenmod(it->form, LUA_NUMBER_FRMLEN);
+                    break;
+                }
+                case 'a': case 'A': case 'e': case 'E': case 'g': case 'G':
+                    it->kind = FI_OTHER;
+                    addlenmod(it->form, LUA_NUMBER_FRMLEN);
+                    break;
+                case 'c':
+                    it->kind = FI_OTHER;
+                    break;
+                case 'q':
+                    it->kind = FI_QUOTE;
+                    break;
+                case 's':
+                    it->kind = plain ? FI_STR : FI_OTHER;
+                    break;
+                default:  /* invalid conversion */
+                    return NULL;
+            }
+            strfrmt = p + 1;
+        }
+        it++;
+    }
+    fmt->n = (int) (it - fmt->item);
+    return fmt;
+}
+
+
+/* push the compiled form of format argument 'arg' (see 'getcompiled') */
+static const Format *getformatprog(lua_State *L, int arg) {
+    return (const Format *) getcompiled(L, arg, MAXFMTLEN, compileformat);
+}
+
+
+/* add integer 'n' in decimal ("%d") */
+static void adddecimal(luaL_Buffer *b, lua_Integer n) {
+    char buff[3 * sizeof(lua_Integer) + 2];
+    char *p = buff + sizeof(buff);
+    lua_Unsigned u = (n < 0) ? 0u - (lua_Unsigned) n : (lua_Unsigned) n;
+    do {
+        *--p = (char) ('0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+    if (n < 0) *--p = '-';
+    luaL_addlstring(b, p, buff + sizeof(buff) - p);
+}
+
+
+/* add integer 'n' in hexadecimal ("%x" or "%X") */
+static void addhex(luaL_Buffer *b, lua_Integer n, int upper) {
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char buff[2 * sizeof(lua_Integer)];
+    char *p = buff + sizeof(buff);
+    lua_Unsigned u = (lua_Unsigned) n;
+    do {
+        *--p = digits[u & 0xf];
+        u >>= 4;
+    } while (u != 0);
+    luaL_addlstring(b, p, buff + sizeof(buff) - p);
+}
+
+
+#if LUA_FLOAT_TYPE == LUA_FLOAT_DOUBLE && LUA_MAXINTEGER > 9007199254740992
+
+#include <math.h>
+
+/* write '%.Nf' with integer arithmetic when |n| * 10^N is below 2^53 */
+#define MAXFIXEDPREC    15
+
 /*
-** add length modifier into formats
+** Write 'n' with 'prec' decimals into 'buff', as '%.<prec>f' would, and
+** return its length; return 0 if that cannot be done exactly here. The
+** scaled value 'n * 10^prec' is rounded by the product (by at most half
+** an ulp), so the result is only used when that cannot move it across a
+** rounding boundary.
 */
-static void addlenmod(char *form, const char *lenmod) {
-    size_t l = strlen(form);
-    size_t lm = strlen(lenmod);
-    char spec = form[l - 1];
-    strcpy(form + l - 1, lenmod);
-    form[l + lm - 1] = spec;
-    form[l + lm] = '\0';
+static int fixedfloat(char *buff, lua_Number n, int prec) {
+    static const double pow10[MAXFIXEDPREC + 1] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+        1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+    };
+    double x = l_mathop(fabs)(n);
+    double scaled, r, frac;
+    char digits[20];
+    char *d = digits + sizeof(digits);
+    lua_Unsigned u;
+    int nd, nb = 0;
+    if (prec > MAXFIXEDPREC || !(x < 9007199254740992.0 / pow10[prec]))
+        return 0;  /* too precise, too large, inf or NaN */
+    scaled = x * pow10[prec];
+    r = l_mathop(floor)(scaled);
+    frac = scaled - r;  /* exact */
+    if (l_mathop(fabs)(frac - 0.5) <= scaled / 4503599627370496.0)  /* 2^52 */
+        return 0;  /* too close to a tie */
+    u = (lua_Unsigned) r + (frac > 0.5);
+    do {
+        *--d = (char) ('0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+    nd = (int) (digits + sizeof(digits) - d);
+    if (n < 0 || (n == 0 && 1 / n < 0))  /* negative (or -0.0)? */
+        buff[nb++] = '-';
+    if (nd <= prec) {  /* fraction only? */
+        buff[nb++] = '0';
+        buff[nb++] = lua_getlocaledecpoint();
+        memset(buff + nb, '0', prec - nd);
+        nb += prec - nd;
+        memcpy(buff + nb, d, nd);
+        return nb + nd;
+    }
+    memcpy(buff + nb, d, nd - prec);  /* integer part */
+    nb += nd - prec;
+    if (prec > 0) {
+        buff[nb++] = lua_getlocaledecpoint();
+        memcpy(buff + nb, d + nd - prec, prec);
+        nb += prec;
+    }
+    return nb;
+}
+
+#else
+
+#define fixedfloat(buff, n, prec)    0
+
+#endif
+
+
+static int formatcompiled(lua_State *L, const Format *fmt, int top) {
+    const char *strfrmt = lua_tostring(L, 1);
+    int arg = 1;
+    int i;
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    for (i = 0; i < fmt->n; i++) {
+        const FmtItem *it = &fmt->item[i];
+        char *buff;
+        int nb = 0;
+        if (it->kind == FI_TEXT) {
+            luaL_addlstring(&b, strfrmt + it->init, it->len);
+            continue;
+        }
+        if (++arg > top)
+            luaL_argerror(L, arg, "no value");
+        switch (it->kind) {
+            case FI_INT:
+                adddecimal(&b, luaL_checkinteger(L, arg));
+                break;
+            case FI_HEX:
+                addhex(&b, luaL_checkinteger(L, arg), it->conv == 'X');
+                break;
+            case FI_STR:
+                luaL_tolstring(L, arg, NULL);
+                luaL_addvalue(&b);
+                break;
+            case FI_QUOTE:
+                addliteral(L, &b, arg);
+                break;
+            case FI_FIXED: {
+                lua_Number n = luaL_checknumber(L, arg);
+                buff = luaL_prepbuffsize(&b, MAX_ITEM);
+                if ((nb = fixedfloat(buff, n, it->prec)) == 0)
+                    nb = l_sprintf(buff, MAX_ITEM, it->form, (LUAI_UACNUMBER) n);
+                luaL_addsize(&b, nb);
+                break;
+            }
+            default: {  /* FI_OTHER */
+                buff = luaL_prepbuffsize(&b, MAX_ITEM);
+                switch (it->conv) {
+                    case 'c':
+                        nb = l_sprintf(buff, MAX_ITEM, it->form,
+                                       (int) luaL_checkinteger(L, arg));
+                        break;
+                    case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+                        nb = l_sprintf(buff, MAX_ITEM, it->form,
+                                       (LUAI_UACINT) luaL_checkinteger(L, arg));
+                        break;
+                    case 'a': case 'A':
+                        nb = lua_number2strx(L, buff, MAX_ITEM, it->form,
+                                             luaL_checknumber(L, arg));
+                        break;
+                    case 's': {
+                        size_t l;
+                        const char *s = luaL_tolstring(L, arg, &l);
+                        luaL_argcheck(L, l == strlen(s), arg, "string contains zeros");
+                        if (!strchr(it->form, '.') && l >= 100) {
+                            /* no precision and string is too long to be formatted */
+                            luaL_addvalue(&b);  /* keep entire string */
+                        } else {  /* format the string into 'buff' */
+                            nb = l_sprintf(buff, MAX_ITEM, it->form, s);
+                            lua_pop(L, 1);  /* remove result from 'luaL_tolstring' */
+                        }
+                        break;
+                    }
+                    default:  /* 'e', 'E', 'f', 'g', 'G' */
+                        nb = l_sprintf(buff, MAX_ITEM, it->form,
+                                       (LUAI_UACNUMBER) luaL_checknumber(L, arg));
+                        break;
+                }
+                lua_assert(nb < MAX_ITEM);
+                luaL_addsize(&b, nb);
+                break;
+            }
+        }
+    }
+    luaL_pushresult(&b);
+    return 1;
 }
 
 
@@ -1054,7 +2070,10 @@ static int str_format(lua_State *L) {
     size_t sfl;
     const char *strfrmt = luaL_checklstring(L, arg, &sfl);
     const char *strfrmt_end = strfrmt + sfl;
+    const Format *fmt = getformatprog(L, arg);
     luaL_Buffer b;
+    if (fmt != NULL)
+        return formatcompiled(L, fmt, top);
     luaL_buffinit(L, &b);
     while (strfrmt < strfrmt_end) {
         if (*strfrmt != L_ESC)
@@ -1347,33 +2366,48 @@ static KOption getoption(Header *h, const char **fmt, int *size) {
 }
 
 
+/*
+** Details of one option: its kind, size, endianness and alignment (a
+** power of 2, 1 if the option needs no alignment).
+*/
+typedef struct PackItem {
+    unsigned char opt;  /* KOption */
+    unsigned char islittle;
+    unsigned char align;
+    int size;
+} PackItem;
+
+
+/* padding needed before item 'it' placed at offset 'pos' */
+#define itempad(it, pos)  \
+    ((int) (((it)->align - ((pos) & ((it)->align - 1))) & ((it)->align - 1)))
+
+
 /*
 ** Read, classify, and fill other details about the next option.
-** 'psize' is filled with option's size, 'notoalign' with its
-** alignment requirements.
-** Local variable 'size' gets the size to be aligned. (Kpadal option
+** Local variable 'align' gets the size to be aligned. (Kpadal option
 ** always gets its full alignment, other options are limited by
 ** the maximum alignment ('maxalign'). Kchar option needs no alignment
 ** despite its size.
 */
-static KOption getdetails(Header *h, size_t totalsize,
-                          const char **fmt, int *psize, int *ntoalign) {
-    KOption opt = getoption(h, fmt, psize);
-    int align = *psize;  /* usually, alignment follows size */
+static void getdetails(Header *h, const char **fmt, PackItem *it) {
+    KOption opt = getoption(h, fmt, &it->size);
+    int align = it->size;  /* usually, alignment follows size */
     if (opt == Kpaddalign) {  /* 'X' gets alignment from following option */
         if (**fmt == '\0' || getoption(h, fmt, &align) == Kchar || align == 0)
             luaL_argerror(h->L, 1, "invalid next option for option 'X'");
     }
     if (align <= 1 || opt == Kchar)  /* need no alignment? */
-        *ntoalign = 0;
+        align = 1;
     else {
         if (align > h->maxalign)  /* enforce maximum alignment */
             align = h->maxalign;
         if ((align & (align - 1)) != 0)  /* is 'align' not a power of 2? */
             luaL_argerror(h->L, 1, "format asks for alignment not power of 2");
-        *ntoalign = (align - (int) (totalsize & (align - 1))) & (align - 1);
     }
-    return opt;
+    it->opt = (unsigned char) opt;
+    it->islittle = (unsigned char) h->islittle;
+    it->align = (unsigned char) align;
 }
 
 
@@ -1417,89 +2451,169 @@ static void copywithendian(volatile char *dest, volatile const char *src,
 }
 
 
+/*
+** Where the values to pack come from: the arguments of the call or, for
+** 'packmany', the fields of record 'rec' (> 0), copied to the stack from
+** index 'base' on. Errors in records name the record and the field.
+*/
+typedef struct PackArgs {
+    lua_State *L;
+    int base;
+    lua_Integer rec;
+} PackArgs;
+
+
+static int packerror(PackArgs *pa, int arg, const char *msg) {
+    if (pa->rec == 0)
+        return luaL_argerror(pa->L, arg, msg);
+    return luaL_error(pa->L, "bad field #%d in record #%I (%s)",
+                      arg - pa->base + 1, pa->rec, msg);
+}
+
+
+static int packtypeerror(PackArgs *pa, int arg, const char *tname) {
+    return packerror(pa, arg, lua_pushfstring(pa->L, "%s expected, got %s",
+                                              tname, luaL_typename(pa->L, arg)));
+}
+
+
+static lua_Integer packinteger(PackArgs *pa, int arg) {
+    int isnum;
+    lua_Integer n = lua_tointegerx(pa->L, arg, &isnum);
+    if (!isnum) {
+        if (pa->rec == 0)
+            return luaL_checkinteger(pa->L, arg);  /* raise the usual error */
+        if (lua_isnumber(pa->L, arg))
+            packerror(pa, arg, "number has no integer representation");
+        packtypeerror(pa, arg, "number");
+    }
+    return n;
+}
+
+
+static lua_Number packnumber(PackArgs *pa, int arg) {
+    int isnum;
+    lua_Number n = lua_tonumberx(pa->L, arg, &isnum);
+    if (!isnum) {
+        if (pa->rec == 0)
+            return luaL_checknumber(pa->L, arg);  /* raise the usual error */
+        packtypeerror(pa, arg, "number");
+    }
+    return n;
+}
+
+
+static const char *packstring(PackArgs *pa, int arg, size_t *len) {
+    const char *s = lua_tolstring(pa->L, arg, len);
+    if (s == NULL) {
+        if (pa->rec == 0)
+            return luaL_checklstring(pa->L, arg, len);  /* raise the usual error */
+        packtypeerror(pa, arg, "string");
+    }
+    return s;
+}
+
+
+/*
+** Add item 'it' to 'b', after the padding that aligns it, taking its
+** value from stack index 'arg'. 'totalsize' is the size of the result
+** so far. Return whether the item took a value.
+*/
+static int packitem(PackArgs *pa, luaL_Buffer *b, const PackItem *it,
+                    int arg, size_t *totalsize) {
+    int size = it->size;
+    int ntoalign = itempad(it, *totalsize);
+    *totalsize += ntoalign + size;
+    while (ntoalign-- > 0)
+        luaL_addchar(b, LUAL_PACKPADBYTE);  /* fill alignment */
+    switch ((KOption) it->opt) {
+        case Kint: {  /* signed integers */
+            lua_Integer n = packinteger(pa, arg);
+            if (size < SZINT) {  /* need overflow check? */
+                lua_Integer lim = (lua_Integer) 1 << ((size * NB) - 1);
+                if (!(-lim <= n && n < lim))
+                    packerror(pa, arg, "integer overflow");
+            }
+            packint(b, (lua_Unsigned) n, it->islittle, size, (n < 0));
+            break;
+        }
+        case Kuint: {  /* unsigned integers */
+            lua_Integer n = packinteger(pa, arg);
+            if (size < SZINT &&  /* need overflow check? */
+                (lua_Unsigned) n >= ((lua_Unsigned) 1 << (size * NB)))
+                packerror(pa, arg, "unsigned overflow");
+            packint(b, (lua_Unsigned) n, it->islittle, size, 0);
+            break;
+        }
+        case Kfloat: {  /* floating-point options */
+            volatile Ftypes u;
+            char *buff = luaL_prepbuffsize(b, size);
+            lua_Number n = packnumber(pa, arg);  /* get argument */
+            if (size == sizeof(u.f)) u.f = (float) n;  /* copy it into 'u' */
+            else if (size == sizeof(u.d)) u.d = (double) n;
+            else u.n = n;
+            /* move 'u' to final result, correcting endianness if needed */
+            copywithendian(buff, u.buff, size, it->islittle);
+            luaL_addsize(b, size);
+            break;
+        }
+        case Kchar: {  /* fixed-size string */
+            size_t len;
+            const char *s = packstring(pa, arg, &len);
+            if (len > (size_t) size)
+                packerror(pa, arg, "string longer than given size");
+            luaL_addlstring(b, s, len);  /* add string */
+            while (len++ < (size_t) size)  /* pad extra space */
+                luaL_addchar(b, LUAL_PACKPADBYTE);
+            break;
+        }
+        case Kstring: {  /* strings with length count */
+            size_t len;
+            const char *s = packstring(pa, arg, &len);
+            if (size < (int) sizeof(size_t) && len >= ((size_t) 1 << (size * NB)))
+                packerror(pa, arg, "string length does not fit in given size");
+            packint(b, (lua_Unsigned) len, it->islittle, size, 0);  /* pack length */
+            luaL_addlstring(b, s, len);
+            *totalsize += len;
+            break;
+        }
+        case Kzstr: {  /* zero-terminated string */
+            size_t len;
+            const char *s = packstring(pa, arg, &len);
+            if (strlen(s) != len)
+                packerror(pa, arg, "string contains zeros");
+            luaL_addlstring(b, s, len);
+            luaL_addchar(b, '\0');  /* add zero at the end */
+            *totalsize += len + 1;
+            break;
+        }
+        case Kpadding:
+            luaL_addchar(b, LUAL_PACKPADBYTE);  /* FALLTHROUGH */
+        case Kpaddalign:
+        case Knop:
+            return 0;
+    }
+    return 1;
+}
+
+
 static int str_pack(lua_State *L) {
     luaL_Buffer b;
     Header h;
+    PackArgs pa;
     const char *fmt = luaL_checkstring(L, 1);  /* format string */
-    int arg = 1;  /* current argument to pack */
+    int arg = 2;  /* current argument to pack */
     size_t totalsize = 0;  /* accumulate total size of result */
     initheader(L, &h);
+    pa.L = L;
+    pa.base = 2;
+    pa.rec = 0;
     lua_pushnil(L);  /* mark to separate arguments from string buffer */
     luaL_buffinit(L, &b);
     while (*fmt != '\0') {
-        int size, ntoalign;
-        KOption opt = getdetails(&h, totalsize, &fmt, &size, &ntoalign);
-        totalsize += ntoalign + size;
-        while (ntoalign-- > 0)
-            luaL_addchar(&b, LUAL_PACKPADBYTE);  /* fill alignment */
-        arg++;
-        switch (opt) {
-            case Kint: {  /* signed integers */
-                lua_Integer n = luaL_checkinteger(L, arg);
-                if (size < SZINT) {  /* need overflow check? */
-                    lua_Integer lim = (lua_Integer) 1 << ((size * NB) - 1);
-                    luaL_argcheck(L, -lim <= n && n < lim, arg, "integer overflow");
-                }
-                packint(&b, (lua_Unsigned) n, h.islittle, size, (n < 0));
-                break;
-            }
-            case Kuint: {  /* unsigned integers */
-                lua_Integer n = luaL_checkinteger(L, arg);
-                if (size < SZINT)  /* need overflow check? */
-                    luaL_argcheck(L, (lua_Unsigned) n < ((lua_Unsigned) 1 << (size * NB)),
-                                  arg, "unsigned overflow");
-                packint(&b, (lua_Unsigned) n, h.islittle, size, 0);
-                break;
-            }
-            case Kfloat: {  /* floating-point options */
-                volatile Ftypes u;
-                char *buff = luaL_prepbuffsize(&b, size);
-                lua_Number n = luaL_checknumber(L, arg);  /* get argument */
-                if (size == sizeof(u.f)) u.f = (float) n;  /* copy it into 'u' */
-                else if (size == sizeof(u.d)) u.d = (double) n;
-                else u.n = n;
-                /* move 'u' to final result, correcting endianness if needed */
-                copywithendian(buff, u.buff, size, h.islittle);
-                luaL_addsize(&b, size);
-                break;
-            }
-            case Kchar: {  /* fixed-size string */
-                size_t len;
-                const char *s = luaL_checklstring(L, arg, &len);
-                luaL_argcheck(L, len <= (size_t) size, arg,
-                              "string longer than given size");
-                luaL_addlstring(&b, s, len);  /* add string */
-                while (len++ < (size_t) size)  /* pad extra space */
-                    luaL_addchar(&b, LUAL_PACKPADBYTE);
-                break;
-            }
-            case Kstring: {  /* strings with length count */
-                size_t len;
-                const char *s = luaL_checklstring(L, arg, &len);
-                luaL_argcheck(L, size >= (int) sizeof(size_t) ||
-                                 len < ((size_t) 1 << (size * NB)),
-                              arg, "string length does not fit in given size");
-                packint(&b, (lua_Unsigned) len, h.islittle, size, 0);  /* pack length */
-                luaL_addlstring(&b, s, len);
-                totalsize += len;
-                break;
-            }
-            case Kzstr: {  /* zero-terminated string */
-                size_t len;
-                const char *s = luaL_checklstring(L, arg, &len);
-                luaL_argcheck(L, strlen(s) == len, arg, "string contains zeros");
-                luaL_addlstring(&b, s, len);
-                luaL_addchar(&b, '\0');  /* add zero at the end */
-                totalsize += len + 1;
-                break;
-            }
-            case Kpadding:
-                luaL_addchar(&b, LUAL_PACKPADBYTE);  /* FALLTHROUGH */
-            case Kpaddalign:
-            case Knop:
-                arg--;  /* undo increment */
-                break;
-        }
+        PackItem it;
+        getdetails(&h, &fmt, &it);
+        arg += packitem(&pa, &b, &it, arg, &totalsize);
     }
     luaL_pushresult(&b);
     return 1;
@@ -1512,13 +2626,14 @@ static int str_packsize(lua_State *L) {
     size_t totalsize = 0;  /* accumulate total size of result */
     initheader(L, &h);
     while (*fmt != '\0') {
-        int size, ntoalign;
-        KOption opt = getdetails(&h, totalsize, &fmt, &size, &ntoalign);
-        size += ntoalign;  /* total space used by option */
+        PackItem it;
+        int size;
+        getdetails(&h, &fmt, &it);
+        size = itempad(&it, totalsize) + it.size;  /* total space used by option */
         luaL_argcheck(L, totalsize <= MAXSIZE - size, 1,
                       "format result too large");
         totalsize += size;
-        switch (opt) {
+        switch (it.opt) {
             case Kstring:  /* strings with length count */
             case Kzstr:    /* zero-terminated string */
                 luaL_argerror(L, 1, "variable-length format");
@@ -1565,6 +2680,66 @@ static lua_Integer unpackint(lua_State *L, const char *str,
 }
 
 
+/*
+** Unpack item 'it' at offset '*ppos' of 'data', the string with 'ld'
+** bytes at stack index 'arg', and move '*ppos' past it. Push the value
+** of the item, if it has one, and return the number of values pushed.
+*/
+static int unpackitem(lua_State *L, const PackItem *it, int arg,
+                      const char *data, size_t ld, size_t *ppos) {
+    size_t pos = *ppos;
+    int size = it->size;
+    int ntoalign = itempad(it, pos);
+    int n = 1;
+    if ((size_t) ntoalign + size > ~pos || pos + ntoalign + size > ld)
+        luaL_argerror(L, arg, "data string too short");
+    pos += ntoalign;  /* skip alignment */
+    switch ((KOption) it->opt) {
+        case Kint:
+        case Kuint: {
+            lua_Integer res = unpackint(L, data + pos, it->islittle, size,
+                                        (it->opt == Kint));
+            lua_pushinteger(L, res);
+            break;
+        }
+        case Kfloat: {
+            volatile Ftypes u;
+            lua_Number num;
+            copywithendian(u.buff, data + pos, size, it->islittle);
+            if (size == sizeof(u.f)) num = (lua_Number) u.f;
+            else if (size == sizeof(u.d)) num = (lua_Number) u.d;
+            else num = u.n;
+            lua_pushnumber(L, num);
+            break;
+        }
+        case Kchar: {
+            lua_pushsubstring(L, arg, pos, size);
+            break;
+        }
+        case Kstring: {
+            size_t len = (size_t) unpackint(L, data + pos, it->islittle, size, 0);
+            luaL_argcheck(L, pos + len + size <= ld, arg, "data string too short");
+            lua_pushsubstring(L, arg, pos + size, len);
+            pos += len;  /* skip string */
+            break;
+        }
+        case Kzstr: {
+            size_t len = (int) strlen(data + pos);
+            lua_pushsubstring(L, arg, pos, len);
+            pos += len + 1;  /* skip string plus final '\0' */
+            break;
+        }
+        case Kpaddalign:
+        case Kpadding:
+        case Knop:
+            n = 0;
+            break;
+    }
+    *ppos = pos + size;
+    return n;
+}
+
+
 static int str_unpack(lua_State *L) {
     Header h;
     const char *fmt = luaL_checkstring(L, 1);
@@ -1575,59 +2750,242 @@ static int str_unpack(lua_State *L) {
     luaL_argcheck(L, pos <= ld, 3, "initial position out of string");
     initheader(L, &h);
     while (*fmt != '\0') {
-        int size, ntoalign;
-        KOption opt = getdetails(&h, pos, &fmt, &size, &ntoalign);
-        if ((size_t) ntoalign + size > ~pos || pos + ntoalign + size > ld)
-            luaL_argerror(L, 2, "data string too short");
-        pos += ntoalign;  /* skip alignment */
+        PackItem it;
+        getdetails(&h, &fmt, &it);
         /* stack space for item + next position */
         luaL_checkstack(L, 2, "too many results");
-        n++;
-        switch (opt) {
-            case Kint:
-            case Kuint: {
-                lua_Integer res = unpackint(L, data + pos, h.islittle, size,
-                                            (opt == Kint));
-                lua_pushinteger(L, res);
-                break;
-            }
-            case Kfloat: {
-                volatile Ftypes u;
-                lua_Number num;
-                copywithendian(u.buff, data + pos, size, h.islittle);
-                if (size == sizeof(u.f)) num = (lua_Number) u.f;
-                else if (size == sizeof(u.d)) num = (lua_Number) u.d;
-                else num = u.n;
-                lua_pushnumber(L, num);
-                break;
-            }
-            case Kchar: {
-                lua_pushlstring(L, data + pos, size);
+        n += unpackitem(L, &it, 2, data, ld, &pos);
+    }
+    lua_pushinteger(L, pos + 1);  /* next position */
+    return n + 1;
+}
+
+
+/*
+** Compiled layouts: 'string.compilepack' parses a format once into a
+** list of items, dropping the options that only change settings, and
+** the methods of the layout pack and unpack with that list. 'packmany'
+** and 'unpackmany' handle a whole array of records in one call; a record
+** is a table with the values of the layout in order or, for layouts with
+** exactly one value, the value itself.
+*/
+
+#define LAYOUT_HANDLE    "string.layout"
+
+
+typedef struct Layout {
+    int n;  /* number of items */
+    int nvalues;  /* number of values in a record */
+    size_t minsize;  /* smallest number of bytes of a record */
+    int varsize;  /* true if records can be longer than 'minsize' */
+    PackItem item[1];
+} Layout;
+
+
+#define checklayout(L)    ((Layout *)luaL_checkudata(L, 1, LAYOUT_HANDLE))
+
+
+static int str_compilepack(lua_State *L) {
+    Header h;
+    size_t l;
+    const char *fmt = luaL_checklstring(L, 1, &l);
+    Layout *lay = (Layout *) lua_newuserdata(L, sizeof(Layout) +
+                                                l * sizeof(PackItem));
+    lay->n = lay->nvalues = 0;
+    lay->minsize = 0;
+    lay->varsize = 0;
+    initheader(L, &h);
+    while (*fmt != '\0') {  /* each option uses at least one character */
+        PackItem *it = &lay->item[lay->n];
+        getdetails(&h, &fmt, it);
+        switch (it->opt) {
+            case Knop:
+                continue;  /* settings are kept in the items */
+            case Kzstr:
+                lay->minsize++;  /* final '\0' */
+                /* FALLTHROUGH */
+            case Kstring:
+                lay->varsize = 1;
+                lay->nvalues++;
                 break;
-            }
-            case Kstring: {
-                size_t len = (size_t) unpackint(L, data + pos, h.islittle, size, 0);
-                luaL_argcheck(L, pos + len + size <= ld, 2, "data string too short");
-                lua_pushlstring(L, data + pos + size, len);
-                pos += len;  /* skip string */
+            case Kint: case Kuint: case Kfloat: case Kchar:
+                lay->nvalues++;
                 break;
-            }
-            case Kzstr: {
-                size_t len = (int) strlen(data + pos);
-                lua_pushlstring(L, data + pos, len);
-                pos += len + 1;  /* skip string plus final '\0' */
+            default:
                 break;
+        }
+        lay->minsize += it->size;
+        lay->n++;
+    }
+    luaL_setmetatable(L, LAYOUT_HANDLE);
+    return 1;
+}
+
+
+static int lay_pack(lua_State *L) {
+    Layout *lay = checklayout(L);
+    luaL_Buffer b;
+    PackArgs pa;
+    int arg = 2;  /* current argument to pack */
+    size_t totalsize = 0;
+    int i;
+    pa.L = L;
+    pa.base = 2;
+    pa.rec = 0;
+    lua_pushnil(L);  /* mark to separate arguments from string buffer */
+    luaL_buffinit(L, &b);
+    for (i = 0; i < lay->n; i++)
+        arg += packitem(&pa, &b, &lay->item[i], arg, &totalsize);
+    luaL_pushresult(&b);
+    return 1;
+}
+
+
+static int lay_unpack(lua_State *L) {
+    Layout *lay = checklayout(L);
+    size_t ld;
+    const char *data = luaL_checklstring(L, 2, &ld);
+    size_t pos = (size_t) posrelat(luaL_optinteger(L, 3, 1), ld) - 1;
+    int i;
+    luaL_argcheck(L, pos <= ld, 3, "initial position out of string");
+    luaL_checkstack(L, lay->nvalues + 1, "too many results");
+    for (i = 0; i < lay->n; i++)
+        unpackitem(L, &lay->item[i], 2, data, ld, &pos);
+    lua_pushinteger(L, pos + 1);  /* next position */
+    return lay->nvalues + 1;
+}
+
+
+/*
+** Pack records 't[i]' to 't[j]' (by default, all of them) one after the
+** other into a single string. Alignment counts from the start of the
+** result. The values of a record are copied to a fixed block of stack
+** slots below the string buffer, which must stay at the top.
+*/
+static int lay_packmany(lua_State *L) {
+    Layout *lay = checklayout(L);
+    lua_Integer i = luaL_optinteger(L, 3, 1);
+    lua_Integer last;
+    luaL_Buffer b;
+    PackArgs pa;
+    size_t totalsize = 0;
+    int base, k;
+    luaL_checktype(L, 2, LUA_TTABLE);
+    last = luaL_opt(L, luaL_checkinteger, 4, luaL_len(L, 2));
+    lua_settop(L, 4);
+    luaL_checkstack(L, lay->nvalues + 4, "too many values");
+    base = lua_gettop(L) + 1;  /* slot for the record */
+    for (k = 0; k <= lay->nvalues; k++)
+        lua_pushnil(L);
+    pa.L = L;
+    pa.base = base + 1;
+    luaL_buffinit(L, &b);
+    for (; i <= last; i++) {
+        int arg = pa.base;
+        pa.rec = i;
+        lua_geti(L, 2, i);
+        if (lay->nvalues == 1)  /* record is the value itself? */
+            lua_replace(L, arg);
+        else {
+            if (!lua_istable(L, -1))
+                luaL_error(L, "bad record #%I (table expected, got %s)",
+                           i, luaL_typename(L, -1));
+            lua_replace(L, base);
+            for (k = 1; k <= lay->nvalues; k++) {
+                lua_geti(L, base, k);
+                lua_replace(L, base + k);
             }
-            case Kpaddalign:
-            case Kpadding:
-            case Knop:
-                n--;  /* undo increment */
-                break;
         }
-        pos += size;
+        for (k = 0; k < lay->n; k++)
+            arg += packitem(&pa, &b, &lay->item[k], arg, &totalsize);
+        if (i == last)  /* avoid overflow in 'i++' */
+            break;
+    }
+    luaL_pushresult(&b);
+    return 1;
+}
+
+
+/* initial size of result tables for records of variable length */
+#define LAYOUT_PREALLOC    16
+
+
+/*
+** Unpack 'count' records (by default, until the end of the data) into
+** a new table and return it with the position after the last record.
+** The table is preallocated for all records when their number is known
+** (a fixed-size layout or an explicit count); otherwise, as a record may
+** be much longer than 'minsize', it starts small and grows as needed.
+*/
+static int lay_unpackmany(lua_State *L) {
+    Layout *lay = checklayout(L);
+    size_t ld;
+    const char *data = luaL_checklstring(L, 2, &ld);
+    size_t pos = (size_t) posrelat(luaL_optinteger(L, 3, 1), ld) - 1;
+    lua_Integer count = luaL_optinteger(L, 4, -1);
+    size_t prealloc;
+    lua_Integer i;
+    luaL_argcheck(L, pos <= ld, 3, "initial position out of string");
+    luaL_argcheck(L, count >= 0 || lua_isnoneornil(L, 4), 4, "negative count");
+    prealloc = (lay->minsize > 0) ? (ld - pos) / lay->minsize : 0;
+    if (count >= 0 && (lua_Unsigned) count < prealloc)
+        prealloc = (size_t) count;
+    else if (count < 0 && lay->varsize && prealloc > LAYOUT_PREALLOC)
+        prealloc = LAYOUT_PREALLOC;
+    lua_createtable(L, (prealloc < INT_MAX) ? (int) prealloc : INT_MAX, 0);
+    for (i = 1; (count < 0) ? pos < ld : i <= count; i++) {
+        size_t start = pos;
+        int k, j = 0;
+        if (lay->nvalues != 1)
+            lua_createtable(L, lay->nvalues, 0);
+        for (k = 0; k < lay->n; k++) {
+            if (unpackitem(L, &lay->item[k], 2, data, ld, &pos) &&
+                lay->nvalues != 1)
+                lua_rawseti(L, -2, ++j);
+        }
+        lua_rawseti(L, -2, i);
+        if (count < 0 && pos == start)  /* would never reach the end? */
+            luaL_argerror(L, 4, "count needed for records with no data");
     }
     lua_pushinteger(L, pos + 1);  /* next position */
-    return n + 1;
+    return 2;
+}
+
+
+/* size of a record, as 'string.packsize' */
+static int lay_size(lua_State *L) {
+    Layout *lay = checklayout(L);
+    size_t totalsize = 0;
+    int i;
+    for (i = 0; i < lay->n; i++) {
+        const PackItem *it = &lay->item[i];
+        int size = itempad(it, totalsize) + it->size;
+        if (it->opt == Kstring || it->opt == Kzstr)
+            luaL_error(L, "variable-length layout");
+        if (totalsize > MAXSIZE - size)
+            luaL_error(L, "layout size too large");
+        totalsize += size;
+    }
+    lua_pushinteger(L, (lua_Integer) totalsize);
+    return 1;
+}
+
+
+static const luaL_Reg lay_meth[] = {
+        {"pack",       lay_pack},
+        {"unpack",     lay_unpack},
+        {"packmany",   lay_packmany},
+        {"unpackmany", lay_unpackmany},
+        {"size",       lay_size},
+        {NULL, NULL}
+};
+
+
+static void createlayoutmeta(lua_State *L) {
+    luaL_newmetatable(L, LAYOUT_HANDLE);
+    luaL_newlib(L, lay_meth);
+    lua_setfield(L, -2, "__index");
+    lua_pop(L, 1);
 }
 
 /* }====================================================== */
@@ -1637,20 +2995,39 @@ static const luaL_Reg strlib[] = {
         {"byte",     str_byte},
         {"char",     str_char},
         {"dump",     str_dump},
-        {"find",     str_find},
-        {"format",   str_format},
-        {"gmatch",   gmatch},
-        {"gsub",     str_gsub},
         {"len",      str_len},
-        {"lower",    str_lower},
-        {"match",    str_match},
         {"rep",      str_rep},
         {"reverse",  str_reverse},
         {"sub",      str_sub},
-        {"upper",    str_upper},
         {"pack",     str_pack},
         {"packsize", str_packsize},
         {"unpack",   str_unpack},
+        {"compilepack", str_compilepack},
+        {NULL, NULL}
+};
+
+
+/* functions sharing the case cache */
+static const luaL_Reg caselib[] = {
+        {"lower",    str_lower},
+        {"upper",    str_upper},
+        {NULL, NULL}
+};
+
+
+/* functions sharing the format cache */
+static const luaL_Reg fmtlib[] = {
+        {"format",   str_format},
+        {NULL, NULL}
+};
+
+
+/* functions sharing the pattern cache */
+static const luaL_Reg patlib[] = {
+        {"find",     str_find},
+        {"gmatch",   gmatch},
+        {"gsub",     str_gsub},
+        {"match",    str_match},
         {NULL, NULL}
 };
 
@@ -1672,7 +3049,14 @@ static void createmetatable(lua_State *L) {
 */
 LUAMOD_API int luaopen_string(lua_State *L) {
     luaL_newlib(L, strlib);
+    memset(lua_newuserdata(L, sizeof(CaseCache)), 0, sizeof(CaseCache));
+    luaL_setfuncs(L, caselib, 1);
+    newcache(L, 1);
+    luaL_setfuncs(L, patlib, 1);  /* share cache among pattern functions */
+    newcache(L, 0);  /* (formats do not depend on the locale) */
+    luaL_setfuncs(L, fmtlib, 1);
     createmetatable(L);
+    createlayoutmeta(L);
     return 1;
 }
 
@@ -24,7 +24,15 @@
 */
 #define wgkey(n)        (&(n)->i_key.nk)
 
-#define invalidateTMcache(t)    ((t)->flags = 0)
+/*
+** The high bit of 'flags' marks a frozen (read-only) table. The other
+** bits cache absent metamethods and are cleared on every change.
+*/
+#define FROZENFLAG    (1u << 7)
+
+#define isfrozen(t)    ((t)->flags & FROZENFLAG)
+
+#define invalidateTMcache(t)    ((t)->flags &= FROZENFLAG)
 
 
 /* true when 't' is using 'dummynode' as its hash part */
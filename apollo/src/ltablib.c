@@ -220,6 +220,66 @@ static int unpack(lua_State *L) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Freezing
+** =======================================================
+*/
+
+/*
+** Freeze the value at 'idx' if it is a table not yet frozen, adding it
+** to the list of tables to be scanned (at index 2); 'n' is the length
+** of that list.
+*/
+static int addfrozen(lua_State *L, int idx, int n) {
+    if (lua_type(L, idx) == LUA_TTABLE && !lua_isfrozen(L, idx)) {
+        lua_freezetable(L, idx);
+        lua_pushvalue(L, idx);
+        lua_rawseti(L, 2, ++n);
+    }
+    return n;
+}
+
+
+/*
+** Freeze a table and every table reachable from it through keys, values
+** and metatables. Uses an explicit list instead of recursion, so deep
+** structures cannot overflow the C stack.
+*/
+static int tfreeze(lua_State *L) {
+    int n;
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_settop(L, 1);
+    lua_newtable(L);  /* list of tables to scan */
+    n = addfrozen(L, 1, 0);
+    while (n > 0) {
+        lua_rawgeti(L, 2, n--);  /* table to scan at 3 */
+        if (lua_getmetatable(L, 3)) {
+            n = addfrozen(L, 4, n);
+            lua_pop(L, 1);
+        }
+        lua_pushnil(L);
+        while (lua_next(L, 3)) {
+            n = addfrozen(L, 4, n);  /* key */
+            n = addfrozen(L, 5, n);  /* value */
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+    }
+    lua_settop(L, 1);
+    return 1;
+}
+
+
+static int isfrozen(lua_State *L) {
+    luaL_checkany(L, 1);
+    lua_pushboolean(L, lua_isfrozen(L, 1));
+    return 1;
+}
+
+/* }====================================================== */
+
+
 
 /*
 ** {======================================================
@@ -431,6 +491,8 @@ static const luaL_Reg tab_funcs[] = {
         {"remove", tremove},
         {"move", tmove},
         {"sort", sort},
+        {"freeze", tfreeze},
+        {"isfrozen", isfrozen},
         {NULL, NULL}
 };
 
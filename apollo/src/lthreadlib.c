@@ -0,0 +1,965 @@
+/*
+** Threads Library
+** See Copyright Notice in lua.h
+*/
+
+#define lthreadlib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** LUA_USE_PTHREADS enables the library; it needs POSIX threads. Without
+** it, 'threads.spawn', 'threads.channel' and 'threads.share' raise an
+** error.
+*/
+#if !defined(LUA_USE_PTHREADS) && defined(LUA_USE_POSIX)
+#define LUA_USE_PTHREADS
+#endif
+
+
+#if defined(LUA_USE_PTHREADS)    /* { */
+
+#include <pthread.h>
+#include <unistd.h>
+
+
+#define THREADS_HANDLE    "threads.thread"
+#define THREADS_CHANNEL    "threads.channel"
+#define THREADS_BOX    "threads.box"
+#define THREADS_SHARED    "threads.shared"
+
+/* maximum nesting of tables inside a message */
+#define THREADS_MAXDEPTH    200
+
+/* strings at least this long are received without copying them */
+#define THREADS_MINEXTERNAL    1024
+
+
+/*
+** {======================================================
+** Messages
+** =======================================================
+*/
+
+/*
+** A message is a sequence of Lua values serialized into memory that
+** belongs to no state, so that it can move between threads. Each value
+** is a one-byte tag followed by its payload; tables are their key-value
+** pairs enclosed between MT_TABLE (or MT_FROZEN, for a table that will
+** be frozen on arrival) and MT_END. Strings (and functions, which travel
+** as bytecode) are a length, their bytes and a '\0'; channels and shared
+** chunks are a counted reference.
+*/
+#define MT_NIL      0
+#define MT_FALSE    1
+#define MT_TRUE     2
+#define MT_INT      3
+#define MT_FLT      4
+#define MT_STR      5
+#define MT_FUNC     6
+#define MT_TABLE    7
+#define MT_END      8
+#define MT_CHAN     9
+#define MT_SHARED   10
+#define MT_FROZEN   11
+
+
+typedef struct Msg {
+    struct Msg *next;  /* link in a channel queue */
+    size_t n;  /* number of bytes used */
+    size_t size;  /* number of bytes allocated after the header */
+    int nrefs;  /* number of channel and shared-chunk references */
+    int users;  /* owner plus external strings using its bytes */
+} Msg;
+
+#define msgdata(m)    ((char *)((m) + 1))
+
+
+typedef struct Channel {
+    pthread_mutex_t lock;
+    pthread_cond_t cansend;  /* signaled when a message is taken */
+    pthread_cond_t canrecv;  /* signaled when a message is queued */
+    Msg *head, *tail;  /* queued messages */
+    lua_Integer sent;  /* total number of messages queued */
+    lua_Integer taken;  /* total number of messages received */
+    int refs;  /* number of handles and messages referring to it */
+    int cap;  /* capacity (0 for an unbuffered channel) */
+    int count;  /* number of queued messages */
+    int closed;
+} Channel;
+
+
+static void chanrelease(Channel *ch);
+
+
+static void msgfree(Msg *m) {
+    if (m == NULL)
+        return;
+    if (m->nrefs > 0) {  /* drop references */
+        const char *p = msgdata(m);
+        const char *end = p + m->n;
+        while (p < end) {
+            switch (*p++) {
+                case MT_INT:
+                    p += sizeof(lua_Integer);
+                    break;
+                case MT_FLT:
+                    p += sizeof(lua_Number);
+                    break;
+                case MT_STR:
+                case MT_FUNC: {
+                    size_t l;
+                    memcpy(&l, p, sizeof(l));
+                    p += sizeof(l) + l + 1;
+                    break;
+                }
+                case MT_CHAN: {
+                    Channel *ch;
+                    memcpy(&ch, p, sizeof(ch));
+                    p += sizeof(ch);
+                    chanrelease(ch);
+                    break;
+                }
+                case MT_SHARED: {
+                    lua_Shared *s;
+                    memcpy(&s, p, sizeof(s));
+                    p += sizeof(s);
+                    lua_releaseshared(s);
+                    break;
+                }
+                default:  /* tag without payload */
+                    break;
+            }
+        }
+        m->nrefs = 0;
+    }
+    if (--m->users == 0)
+        free(m);
+}
+
+
+/*
+** Release function of strings received without copying (see 'decode'):
+** the message is freed when neither its owner nor any of those strings
+** use it. All of them belong to the state that decoded the message.
+*/
+static void *msgunref(void *ud, void *ptr, size_t osize, size_t nsize) {
+    Msg *m = (Msg *) ud;
+    (void) ptr; (void) osize; (void) nsize;
+    if (--m->users == 0)
+        free(m);
+    return NULL;
+}
+
+
+/*
+** Messages under construction live in a "box" userdata, so that an
+** error while encoding or decoding does not leak them.
+*/
+static int box_gc(lua_State *L) {
+    Msg **box = (Msg **) lua_touserdata(L, 1);
+    msgfree(*box);
+    *box = NULL;
+    return 0;
+}
+
+
+static Msg **newbox(lua_State *L, Msg *m) {
+    Msg **box = (Msg **) lua_newuserdata(L, sizeof(Msg *));
+    *box = m;
+    luaL_setmetatable(L, THREADS_BOX);
+    return box;
+}
+
+
+/*
+** Reserve 'sz' bytes at the end of the message in 'box'. Each value is
+** written with a single reservation, so a message is always well
+** formed up to 'n' even after an error.
+*/
+static char *reserve(lua_State *L, Msg **box, size_t sz) {
+    Msg *m = *box;
+    if (m == NULL || m->size - m->n < sz) {
+        size_t n = (m == NULL) ? 0 : m->n;
+        size_t newsize = (m == NULL) ? 64 : m->size * 2;
+        if (newsize - n < sz)
+            newsize = n + sz;
+        m = (Msg *) realloc(m, sizeof(Msg) + newsize);
+        if (m == NULL)
+            luaL_error(L, "not enough memory");
+        if (*box == NULL) {
+            m->next = NULL;
+            m->n = 0;
+            m->nrefs = 0;
+            m->users = 1;
+        }
+        m->size = newsize;
+        *box = m;
+    }
+    return msgdata(m) + m->n;
+}
+
+
+typedef struct Encoder {
+    lua_State *L;
+    Msg **box;
+    Channel *target;  /* channel the message is sent through (if any) */
+    int depth;
+    const void *path[THREADS_MAXDEPTH];  /* tables being encoded */
+} Encoder;
+
+
+static void puttag(Encoder *e, int tag) {
+    *reserve(e->L, e->box, 1) = (char) tag;
+    (*e->box)->n++;
+}
+
+
+static void putbytes(Encoder *e, int tag, const void *p, size_t l) {
+    char *b = reserve(e->L, e->box, 1 + l);
+    b[0] = (char) tag;
+    memcpy(b + 1, p, l);
+    (*e->box)->n += 1 + l;
+}
+
+
+static void putstring(Encoder *e, int tag, const char *s, size_t l) {
+    char *b = reserve(e->L, e->box, 1 + sizeof(l) + l + 1);
+    b[0] = (char) tag;
+    memcpy(b + 1, &l, sizeof(l));
+    memcpy(b + 1 + sizeof(l), s, l);
+    b[1 + sizeof(l) + l] = '\0';
+    (*e->box)->n += 1 + sizeof(l) + l + 1;
+}
+
+
+static int dumpwriter(lua_State *L, const void *p, size_t sz, void *ud) {
+    (void) L;
+    luaL_addlstring((luaL_Buffer *) ud, (const char *) p, sz);
+    return 0;
+}
+
+
+/*
+** Check that the function at 'idx' can be moved to another state: a Lua
+** function whose only upvalue, if any, is '_ENV', which becomes the
+** globals of the state that loads it.
+*/
+static void checkfunction(lua_State *L, int idx) {
+    const char *name;
+    if (lua_iscfunction(L, idx))
+        luaL_error(L, "cannot send a C function");
+    name = lua_getupvalue(L, idx, 1);
+    if (name != NULL) {
+        lua_pop(L, 1);
+        if (strcmp(name, "_ENV") != 0 || lua_getupvalue(L, idx, 2) != NULL)
+            luaL_error(L, "cannot send a function with upvalues");
+    }
+}
+
+
+static void encodefunc(Encoder *e, int idx) {
+    lua_State *L = e->L;
+    luaL_Buffer b;
+    size_t l;
+    const char *s;
+    checkfunction(L, idx);
+    lua_pushvalue(L, idx);
+    luaL_buffinit(L, &b);
+    lua_dump(L, dumpwriter, &b, 0);
+    luaL_pushresult(&b);
+    s = lua_tolstring(L, -1, &l);
+    putstring(e, MT_FUNC, s, l);
+    lua_pop(L, 2);
+}
+
+
+static void chanretain(Channel *ch);
+
+static void encode(Encoder *e, int idx);
+
+
+static void encodetable(Encoder *e, int idx) {
+    lua_State *L = e->L;
+    const void *t = lua_topointer(L, idx);
+    int i;
+    for (i = 0; i < e->depth; i++) {
+        if (e->path[i] == t)
+            luaL_error(L, "cannot send a table with cycles");
+    }
+    if (e->depth >= THREADS_MAXDEPTH)
+        luaL_error(L, "table nesting too deep");
+    luaL_checkstack(L, 3, "table nesting too deep");
+    e->path[e->depth++] = t;
+    puttag(e, lua_isfrozen(L, idx) ? MT_FROZEN : MT_TABLE);
+    lua_pushnil(L);
+    while (lua_next(L, idx)) {
+        encode(e, lua_gettop(L) - 1);
+        encode(e, lua_gettop(L));
+        lua_pop(L, 1);
+    }
+    puttag(e, MT_END);
+    e->depth--;
+}
+
+
+static void encode(Encoder *e, int idx) {
+    lua_State *L = e->L;
+    switch (lua_type(L, idx)) {
+        case LUA_TNIL:
+            puttag(e, MT_NIL);
+            break;
+        case LUA_TBOOLEAN:
+            puttag(e, lua_toboolean(L, idx) ? MT_TRUE : MT_FALSE);
+            break;
+        case LUA_TNUMBER:
+            if (lua_isinteger(L, idx)) {
+                lua_Integer i = lua_tointeger(L, idx);
+                putbytes(e, MT_INT, &i, sizeof(i));
+            } else {
+                lua_Number n = lua_tonumber(L, idx);
+                putbytes(e, MT_FLT, &n, sizeof(n));
+            }
+            break;
+        case LUA_TSTRING: {
+            size_t l;
+            const char *s = lua_tolstring(L, idx, &l);
+            putstring(e, MT_STR, s, l);
+            break;
+        }
+        case LUA_TFUNCTION:
+            encodefunc(e, idx);
+            break;
+        case LUA_TTABLE:
+            encodetable(e, idx);
+            break;
+        default: {
+            void *h;
+            if ((h = luaL_testudata(L, idx, THREADS_CHANNEL)) != NULL) {
+                /* its own queue would keep it alive forever */
+                if (*(Channel **) h == e->target)
+                    luaL_error(L, "cannot send a channel through itself");
+                putbytes(e, MT_CHAN, h, sizeof(Channel *));
+                chanretain(*(Channel **) h);
+            } else if ((h = luaL_testudata(L, idx, THREADS_SHARED)) != NULL) {
+                putbytes(e, MT_SHARED, h, sizeof(lua_Shared *));
+                lua_retainshared(*(lua_Shared **) h);
+            } else
+                luaL_error(L, "cannot send a %s value", luaL_typename(L, idx));
+            (*e->box)->nrefs++;
+            break;
+        }
+    }
+}
+
+
+/*
+** Serialize the values at indices [first, last] into a new message to be
+** queued in 'target' (NULL if it is not going through a channel).
+*/
+static Msg *encodemsg(lua_State *L, int first, int last, Channel *target) {
+    Encoder e;
+    Msg *m;
+    int i;
+    e.L = L;
+    e.box = newbox(L, NULL);
+    e.target = target;
+    e.depth = 0;
+    reserve(L, e.box, 0);  /* an empty sequence still needs a message */
+    for (i = first; i <= last; i++)
+        encode(&e, i);
+    m = *e.box;
+    *e.box = NULL;
+    lua_pop(L, 1);
+    return m;
+}
+
+
+typedef struct Decoder {
+    Msg *m;  /* message being decoded */
+    const char *p;
+    const char *end;
+} Decoder;
+
+
+static void pushchannel(lua_State *L, Channel *ch);
+
+static void pushshared(lua_State *L, lua_Shared *s);
+
+
+static void decode(lua_State *L, Decoder *d) {
+    luaL_checkstack(L, 3, "table nesting too deep");
+    switch (*d->p++) {
+        case MT_NIL:
+            lua_pushnil(L);
+            break;
+        case MT_FALSE:
+            lua_pushboolean(L, 0);
+            break;
+        case MT_TRUE:
+            lua_pushboolean(L, 1);
+            break;
+        case MT_INT: {
+            lua_Integer i;
+            memcpy(&i, d->p, sizeof(i));
+            d->p += sizeof(i);
+            lua_pushinteger(L, i);
+            break;
+        }
+        case MT_FLT: {
+            lua_Number n;
+            memcpy(&n, d->p, sizeof(n));
+            d->p += sizeof(n);
+            lua_pushnumber(L, n);
+            break;
+        }
+        case MT_STR:
+        case MT_FUNC: {
+            int func = (d->p[-1] == MT_FUNC);
+            size_t l;
+            memcpy(&l, d->p, sizeof(l));
+            d->p += sizeof(l);
+            if (func) {
+                if (luaL_loadbufferx(L, d->p, l, "=(thread)", "b") != LUA_OK)
+                    lua_error(L);
+            } else if (l >= THREADS_MINEXTERNAL) {  /* borrow message bytes */
+                lua_pushexternalstring(L, d->p, l, msgunref, d->m);
+                d->m->users++;  /* only once the string exists */
+            } else
+                lua_pushlstring(L, d->p, l);
+            d->p += l + 1;
+            break;
+        }
+        case MT_TABLE:
+        case MT_FROZEN: {
+            int frozen = (d->p[-1] == MT_FROZEN);
+            lua_newtable(L);
+            while (*d->p != MT_END) {
+                decode(L, d);
+                decode(L, d);
+                lua_rawset(L, -3);
+            }
+            d->p++;  /* skip MT_END */
+            if (frozen)
+                lua_freezetable(L, -1);
+            break;
+        }
+        case MT_CHAN: {
+            Channel *ch;
+            memcpy(&ch, d->p, sizeof(ch));
+            d->p += sizeof(ch);
+            pushchannel(L, ch);
+            break;
+        }
+        case MT_SHARED: {
+            lua_Shared *s;
+            memcpy(&s, d->p, sizeof(s));
+            d->p += sizeof(s);
+            pushshared(L, s);
+            break;
+        }
+        default:
+            lua_assert(0);
+            break;
+    }
+}
+
+
+/* push the values in message 'm', freeing it; return how many */
+static int decodemsg(lua_State *L, Msg *m) {
+    Decoder d;
+    int top = lua_gettop(L);
+    Msg **box = newbox(L, m);
+    d.m = m;
+    d.p = msgdata(m);
+    d.end = d.p + m->n;
+    while (d.p < d.end)
+        decode(L, &d);
+    *box = NULL;
+    lua_remove(L, top + 1);
+    msgfree(m);
+    return lua_gettop(L) - top;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Channels
+** =======================================================
+*/
+
+#define checkchan(L)    (*(Channel **)luaL_checkudata(L, 1, THREADS_CHANNEL))
+
+
+static void chanretain(Channel *ch) {
+    pthread_mutex_lock(&ch->lock);
+    ch->refs++;
+    pthread_mutex_unlock(&ch->lock);
+}
+
+
+static void chanrelease(Channel *ch) {
+    int refs;
+    pthread_mutex_lock(&ch->lock);
+    refs = --ch->refs;
+    pthread_mutex_unlock(&ch->lock);
+    if (refs == 0) {
+        while (ch->head != NULL) {
+            Msg *m = ch->head;
+            ch->head = m->next;
+            msgfree(m);
+        }
+        pthread_cond_destroy(&ch->canrecv);
+        pthread_cond_destroy(&ch->cansend);
+        pthread_mutex_destroy(&ch->lock);
+        free(ch);
+    }
+}
+
+
+/* push a new handle for channel 'ch' */
+static void pushchannel(lua_State *L, Channel *ch) {
+    Channel **h = (Channel **) lua_newuserdata(L, sizeof(Channel *));
+    *h = NULL;
+    luaL_setmetatable(L, THREADS_CHANNEL);
+    chanretain(ch);
+    *h = ch;
+}
+
+
+static int threads_channel(lua_State *L) {
+    lua_Integer cap = luaL_optinteger(L, 1, 0);
+    Channel *ch;
+    luaL_argcheck(L, 0 <= cap && cap <= 0x7fffffff, 1, "invalid capacity");
+    ch = (Channel *) malloc(sizeof(Channel));
+    if (ch == NULL)
+        return luaL_error(L, "not enough memory");
+    memset(ch, 0, sizeof(Channel));
+    ch->cap = (int) cap;
+    pthread_mutex_init(&ch->lock, NULL);
+    pthread_cond_init(&ch->cansend, NULL);
+    pthread_cond_init(&ch->canrecv, NULL);
+    ch->refs = 1;  /* released below, once the handle owns it */
+    pushchannel(L, ch);
+    chanrelease(ch);
+    return 1;
+}
+
+
+static int chan_gc(lua_State *L) {
+    Channel **h = (Channel **) lua_touserdata(L, 1);
+    if (*h != NULL)
+        chanrelease(*h);
+    *h = NULL;
+    return 0;
+}
+
+
+static int chan_send(lua_State *L) {
+    Channel *ch = checkchan(L);
+    Msg *m;
+    int full;
+    luaL_checkany(L, 2);
+    lua_settop(L, 2);
+    m = encodemsg(L, 2, 2, ch);  /* serialize outside the lock */
+    pthread_mutex_lock(&ch->lock);
+    /* an unbuffered channel holds the message while its sender waits */
+    full = (ch->cap > 0) ? ch->cap : 1;
+    while (!ch->closed && ch->count >= full)
+        pthread_cond_wait(&ch->cansend, &ch->lock);
+    if (ch->closed) {
+        pthread_mutex_unlock(&ch->lock);
+        msgfree(m);
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+    if (ch->tail != NULL)
+        ch->tail->next = m;
+    else
+        ch->head = m;
+    ch->tail = m;
+    ch->count++;
+    ch->sent++;
+    pthread_cond_signal(&ch->canrecv);
+    if (ch->cap == 0) {  /* wait for a receiver to take it */
+        lua_Integer seq = ch->sent;
+        while (!ch->closed && ch->taken < seq)
+            pthread_cond_wait(&ch->cansend, &ch->lock);
+    }
+    pthread_mutex_unlock(&ch->lock);
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+
+static int chan_recv(lua_State *L) {
+    Channel *ch = checkchan(L);
+    Msg *m;
+    pthread_mutex_lock(&ch->lock);
+    while (!ch->closed && ch->count == 0)
+        pthread_cond_wait(&ch->canrecv, &ch->lock);
+    if (ch->count == 0) {  /* closed and drained */
+        pthread_mutex_unlock(&ch->lock);
+        lua_pushnil(L);
+        lua_pushboolean(L, 0);
+        return 2;
+    }
+    m = ch->head;
+    ch->head = m->next;
+    if (ch->head == NULL)
+        ch->tail = NULL;
+    m->next = NULL;
+    ch->count--;
+    ch->taken++;
+    if (ch->cap == 0)  /* wake the sender waiting for this message */
+        pthread_cond_broadcast(&ch->cansend);
+    else
+        pthread_cond_signal(&ch->cansend);
+    pthread_mutex_unlock(&ch->lock);
+    decodemsg(L, m);
+    lua_pushboolean(L, 1);
+    return 2;
+}
+
+
+static int chan_close(lua_State *L) {
+    Channel *ch = checkchan(L);
+    pthread_mutex_lock(&ch->lock);
+    ch->closed = 1;
+    pthread_cond_broadcast(&ch->canrecv);
+    pthread_cond_broadcast(&ch->cansend);
+    pthread_mutex_unlock(&ch->lock);
+    return 0;
+}
+
+
+static int chan_len(lua_State *L) {
+    Channel *ch = checkchan(L);
+    int count;
+    pthread_mutex_lock(&ch->lock);
+    count = ch->count;
+    pthread_mutex_unlock(&ch->lock);
+    lua_pushinteger(L, count);
+    return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Shared chunks
+** =======================================================
+*/
+
+#define checkshared(L)    (*(lua_Shared **)luaL_checkudata(L, 1, THREADS_SHARED))
+
+
+/* push a new handle for shared chunk 's' */
+static void pushshared(lua_State *L, lua_Shared *s) {
+    lua_Shared **h = (lua_Shared **) lua_newuserdata(L, sizeof(lua_Shared *));
+    *h = NULL;
+    luaL_setmetatable(L, THREADS_SHARED);
+    lua_retainshared(s);
+    *h = s;
+}
+
+
+static int threads_share(lua_State *L) {
+    lua_Shared **h;
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    checkfunction(L, 1);
+    lua_settop(L, 1);
+    h = (lua_Shared **) lua_newuserdata(L, sizeof(lua_Shared *));
+    *h = NULL;
+    luaL_setmetatable(L, THREADS_SHARED);
+    lua_pushvalue(L, 1);
+    *h = lua_newshared(L);
+    return 1;
+}
+
+
+static int shared_load(lua_State *L) {
+    lua_Shared *s = checkshared(L);
+    if (lua_loadshared(L, s) != LUA_OK)
+        return lua_error(L);
+    return 1;
+}
+
+
+static int shared_gc(lua_State *L) {
+    lua_Shared **h = (lua_Shared **) lua_touserdata(L, 1);
+    if (*h != NULL)
+        lua_releaseshared(*h);
+    *h = NULL;
+    return 0;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Worker threads
+** =======================================================
+*/
+
+typedef struct Worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    Msg *msg;  /* function and arguments; then results or error message */
+    int status;  /* status of the call, once the thread has finished */
+    int refs;  /* the handle and the running thread */
+    int started;  /* true once the thread exists */
+} Worker;
+
+
+#define checkworker(L)    ((Worker **)luaL_checkudata(L, 1, THREADS_HANDLE))
+
+
+static void workerrelease(Worker *w) {
+    int refs;
+    pthread_mutex_lock(&w->lock);
+    refs = --w->refs;
+    pthread_mutex_unlock(&w->lock);
+    if (refs == 0) {
+        msgfree(w->msg);
+        pthread_mutex_destroy(&w->lock);
+        free(w);
+    }
+}
+
+
+/* open the libraries, then call the function sent to the thread */
+static int workercall(lua_State *L) {
+    Worker *w = (Worker *) lua_touserdata(L, 1);
+    Msg *m = w->msg;
+    int n;
+    w->msg = NULL;
+    luaL_openlibs(L);
+    n = decodemsg(L, m);
+    lua_call(L, n - 1, LUA_MULTRET);
+    w->msg = encodemsg(L, 2, lua_gettop(L), NULL);
+    return 0;
+}
+
+
+/* turn the error object at 2 into the message of worker at 1 */
+static int workerfail(lua_State *L) {
+    Worker *w = (Worker *) lua_touserdata(L, 1);
+    if (!lua_isstring(L, 2))
+        lua_pushfstring(L, "(error object is a %s value)", luaL_typename(L, 2));
+    w->msg = encodemsg(L, lua_gettop(L), lua_gettop(L), NULL);
+    return 0;
+}
+
+
+static int msghandler(lua_State *L) {
+    const char *msg = lua_tostring(L, 1);
+    if (msg == NULL)  /* keep non-string error objects for 'workerfail' */
+        return 1;
+    luaL_traceback(L, L, msg, 1);
+    return 1;
+}
+
+
+static void *workermain(void *ud) {
+    Worker *w = (Worker *) ud;
+    lua_State *L = luaL_newstate();
+    if (L == NULL) {
+        msgfree(w->msg);
+        w->msg = NULL;
+        w->status = LUA_ERRMEM;
+    } else {
+        lua_pushcfunction(L, msghandler);
+        lua_pushcfunction(L, workercall);
+        lua_pushlightuserdata(L, w);
+        w->status = lua_pcall(L, 1, 0, 1);
+        if (w->status != LUA_OK) {
+            msgfree(w->msg);
+            w->msg = NULL;
+            lua_pushcfunction(L, workerfail);
+            lua_insert(L, -2);
+            lua_pushlightuserdata(L, w);
+            lua_insert(L, -2);
+            lua_pcall(L, 2, 0, 0);  /* on failure, 'msg' stays NULL */
+        }
+        lua_close(L);
+    }
+    workerrelease(w);
+    return NULL;
+}
+
+
+static int threads_spawn(lua_State *L) {
+    int n = lua_gettop(L);
+    Worker **h;
+    Worker *w;
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    h = (Worker **) lua_newuserdata(L, sizeof(Worker *));
+    *h = NULL;
+    luaL_setmetatable(L, THREADS_HANDLE);
+    w = (Worker *) malloc(sizeof(Worker));
+    if (w == NULL)
+        return luaL_error(L, "not enough memory");
+    w->msg = NULL;
+    w->status = LUA_OK;
+    w->refs = 1;
+    w->started = 0;
+    pthread_mutex_init(&w->lock, NULL);
+    *h = w;  /* from now on the handle frees it */
+    w->msg = encodemsg(L, 1, n, NULL);
+    w->refs = 2;
+    if (pthread_create(&w->thread, NULL, workermain, w) != 0) {
+        w->refs = 1;
+        return luaL_error(L, "cannot create thread");
+    }
+    w->started = 1;
+    return 1;
+}
+
+
+static int thread_join(lua_State *L) {
+    Worker **h = checkworker(L);
+    Worker *w = *h;
+    Msg *m;
+    int status;
+    int n;
+    luaL_argcheck(L, w != NULL && w->started, 1, "thread already joined");
+    pthread_join(w->thread, NULL);
+    *h = NULL;
+    status = w->status;
+    m = w->msg;
+    w->msg = NULL;
+    workerrelease(w);
+    if (m == NULL)
+        return luaL_error(L, "not enough memory");
+    n = decodemsg(L, m);
+    if (status != LUA_OK)
+        return lua_error(L);
+    return n;
+}
+
+
+static int thread_gc(lua_State *L) {
+    Worker **h = (Worker **) lua_touserdata(L, 1);
+    Worker *w = *h;
+    if (w != NULL) {
+        if (w->started)  /* never joined; let it finish on its own */
+            pthread_detach(w->thread);
+        workerrelease(w);
+    }
+    *h = NULL;
+    return 0;
+}
+
+
+static int threads_cores(lua_State *L) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    lua_pushinteger(L, n > 0 ? (lua_Integer) n : 1);
+    return 1;
+}
+
+/* }====================================================== */
+
+
+static const luaL_Reg threads_funcs[] = {
+        {"spawn",   threads_spawn},
+        {"channel", threads_channel},
+        {"share",   threads_share},
+        {"cores",   threads_cores},
+        {NULL, NULL}
+};
+
+
+static const luaL_Reg shared_meth[] = {
+        {"load", shared_load},
+        {NULL, NULL}
+};
+
+
+static const luaL_Reg chan_meth[] = {
+        {"send",  chan_send},
+        {"recv",  chan_recv},
+        {"close", chan_close},
+        {NULL, NULL}
+};
+
+
+static const luaL_Reg thread_meth[] = {
+        {"join", thread_join},
+        {NULL, NULL}
+};
+
+
+static void createmeta(lua_State *L, const char *name,
+                       const luaL_Reg *meth, lua_CFunction gc) {
+    luaL_newmetatable(L, name);
+    if (meth != NULL) {
+        lua_newtable(L);
+        luaL_setfuncs(L, meth, 0);
+        lua_setfield(L, -2, "__index");
+    }
+    lua_pushcfunction(L, gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+}
+
+
+LUAMOD_API int luaopen_threads(lua_State *L) {
+    luaL_newlib(L, threads_funcs);
+    createmeta(L, THREADS_BOX, NULL, box_gc);
+    createmeta(L, THREADS_HANDLE, thread_meth, thread_gc);
+    createmeta(L, THREADS_CHANNEL, chan_meth, chan_gc);
+    createmeta(L, THREADS_SHARED, shared_meth, shared_gc);
+    luaL_getmetatable(L, THREADS_CHANNEL);
+    lua_pushcfunction(L, chan_len);
+    lua_setfield(L, -2, "__len");
+    lua_pop(L, 1);
+    return 1;
+}
+
+
+#else                /* }{ */
+
+
+static int threads_unsupported(lua_State *L) {
+    return luaL_error(L, "threads not supported on this platform");
+}
+
+
+static int threads_cores(lua_State *L) {
+    lua_pushinteger(L, 1);
+    return 1;
+}
+
+
+static const luaL_Reg threads_funcs[] = {
+        {"spawn",   threads_unsupported},
+        {"channel", threads_unsupported},
+        {"share",   threads_unsupported},
+        {"cores",   threads_cores},
+        {NULL, NULL}
+};
+
+
+LUAMOD_API int luaopen_threads(lua_State *L) {
+    luaL_newlib(L, threads_funcs);
+    return 1;
+}
+
+
+#endif                /* } */
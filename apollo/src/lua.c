@@ -40,6 +40,11 @@
 #define LUA_INITVARVERSION    LUA_INIT_VAR LUA_VERSUFFIX
 
 
+#if !defined(LUA_CACHEDIR_VAR)
+#define LUA_CACHEDIR_VAR    "LUA_CACHEDIR"
+#endif
+
+
 /*
 ** lua_stdin_is_tty detects whether the standard input is a 'tty' (that
 ** is, whether we're running lua interactively).
@@ -740,6 +745,19 @@ static int runargs(lua_State *L, char **argv, int n) {
 }
 
 
+/*
+** Enable the compiled-chunk cache of 'luaL_loadfilex' when LUA_CACHEDIR
+** names a directory for it
+*/
+static void handle_cachedir(lua_State *L) {
+    const char *dir = getenv(LUA_CACHEDIR_VAR);
+    if (dir != NULL && *dir != '\0') {
+        lua_pushstring(L, dir);
+        lua_setfield(L, LUA_REGISTRYINDEX, LUA_CACHEDIR_KEY);
+    }
+}
+
+
 static int handle_luainit(lua_State *L) {
     const char *name = "=" LUA_INITVARVERSION;
     const char *init = getenv(name + 1);
@@ -779,6 +797,7 @@ static int pmain(lua_State *L) {
     luaL_openlibs(L);  /* open standard libraries */
     createargtable(L, argv, argc, script);  /* create table 'arg' */
     if (!(args & has_E)) {  /* no option '-E'? */
+        handle_cachedir(L);
         if (handle_luainit(L) != LUA_OK)  /* run LUA_INIT */
             return 0;  /* error running LUA_INIT */
     }
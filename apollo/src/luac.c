@@ -18,10 +18,24 @@
 #include "lua.h"
 #include "lauxlib.h"
 
+#include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
 #include "lundump.h"
 
+/*
+** LUA_USE_PTHREADS lets luac compile its input files in parallel; it
+** needs POSIX threads.
+*/
+#if !defined(LUA_USE_PTHREADS) && defined(LUA_USE_POSIX)
+#define LUA_USE_PTHREADS
+#endif
+
+#if defined(LUA_USE_PTHREADS)
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
 static void PrintFunction(const Proto *f, int full);
 
 #define luaU_print    PrintFunction
@@ -32,6 +46,10 @@ static void PrintFunction(const Proto *f, int full);
 static int listing = 0;            /* list bytecodes? */
 static int dumping = 1;            /* dump bytecodes? */
 static int stripping = 0;            /* strip debug information? */
+static int imaging = 0;            /* dump a bytecode image? */
+static int bundling = 0;            /* dump a bundle of modules? */
+static int njobs = 0;            /* compiling threads (0 = one per core) */
+static const char *loadmode = NULL;    /* load mode (optimization level) */
 static char Output[] = {OUTPUT};    /* default output file name */
 static const char *output = Output;    /* actual output file name */
 static const char *progname = PROGNAME;    /* actual program name */
@@ -54,11 +72,15 @@ static void usage(const char *message) {
     fprintf(stderr,
             "usage: %s [options] [filenames]\n"
             "Available options are:\n"
+            "  -j n     compile with 'n' threads (default is one per core)\n"
             "  -l       list (use -l -l for full listing)\n"
+            "  -m       output a memory-mappable bytecode image\n"
+            "  -O1 -O2  optimize (-O2 also removes moves and unused constants)\n"
             "  -o name  output to file 'name' (default is \"%s\")\n"
             "  -p       parse only\n"
             "  -s       strip debug information\n"
             "  -v       show version information\n"
+            "  --bundle build a module bundle; inputs are 'file' or 'modname=file'\n"
             "  --       stop handling options\n"
             "  -        stop handling options and process stdin\n", progname, Output);
     exit(EXIT_FAILURE);
@@ -82,6 +104,19 @@ static int doargs(int argc, char *argv[]) {
             break;
         else if (IS("-l"))            /* list */
             ++listing;
+        else if (IS("-j"))            /* compiling threads */
+        {
+            const char *n = argv[++i];
+            if (n == NULL || (njobs = atoi(n)) <= 0)
+                usage("'-j' needs a positive number");
+        } else if (IS("-m"))            /* bytecode image */
+            imaging = 1;
+        else if (IS("-O0"))            /* no optimization */
+            loadmode = NULL;
+        else if (IS("-O1"))            /* optimization level 1 */
+            loadmode = "bto";
+        else if (IS("-O2"))            /* optimization level 2 */
+            loadmode = "btO";
         else if (IS("-o"))            /* output file */
         {
             output = argv[++i];
@@ -94,9 +129,13 @@ static int doargs(int argc, char *argv[]) {
             stripping = 1;
         else if (IS("-v"))            /* show version */
             ++version;
+        else if (IS("--bundle"))        /* module bundle */
+            bundling = 1;
         else                    /* unknown option */
             usage(argv[i]);
     }
+    if (bundling && imaging)
+        usage("'-m' cannot be used with '--bundle'");
     if (i == argc && (listing || !dumping)) {
         dumping = 0;
         argv[--i] = Output;
@@ -135,6 +174,8 @@ static const Proto *combine(lua_State *L, int n) {
             f->p[i] = toproto(L, i - n - 1);
             if (f->p[i]->sizeupvalues > 0) f->p[i]->upvalues[0].instack = 0;
         }
+        luaM_freearray(L, f->lineinfo, f->sizelineinfo);  /* no line info */
+        f->lineinfo = NULL;
         f->sizelineinfo = 0;
         return f;
     }
@@ -145,23 +186,292 @@ static int writer(lua_State *L, const void *p, size_t size, void *u) {
     return (fwrite(p, size, 1, (FILE *) u) != 1) && (size != 0);
 }
 
+/*
+** {======================================================
+** Module bundles
+** =======================================================
+*/
+
+typedef struct Buffer {
+    char *b;
+    size_t n;
+    size_t size;
+} Buffer;
+
+static int bufwriter(lua_State *L, const void *p, size_t size, void *u) {
+    Buffer *B = (Buffer *) u;
+    UNUSED(L);
+    if (B->n + size > B->size) {
+        size_t newsize = (B->size == 0) ? 1024 : B->size;
+        char *b;
+        while (newsize < B->n + size) newsize *= 2;
+        b = (char *) realloc(B->b, newsize);
+        if (b == NULL) return 1;
+        B->b = b;
+        B->size = newsize;
+    }
+    memcpy(B->b + B->n, p, size);
+    B->n += size;
+    return 0;
+}
+
+/*
+** module name of input 'arg': either given as 'modname=file' or
+** derived from the file name ("a/b/c.lua" -> "a.b.c", "a/init.lua" -> "a")
+*/
+static const char *modname(lua_State *L, const char *arg, const char **filename) {
+    const char *eq = strchr(arg, '=');
+    const char *p, *dot = NULL;
+    luaL_Buffer b;
+    size_t l;
+    if (eq != NULL) {
+        *filename = eq + 1;
+        return lua_pushlstring(L, arg, eq - arg);
+    }
+    *filename = arg;
+    while (arg[0] == '.' && (arg[1] == '/' || arg[1] == '\\')) arg += 2;
+    for (p = arg; *p; p++) {
+        if (*p == '.') dot = p;
+        else if (*p == '/' || *p == '\\') dot = NULL;
+    }
+    if (dot == NULL) dot = p;
+    luaL_buffinit(L, &b);
+    for (p = arg; p < dot; p++)
+        luaL_addchar(&b, (*p == '/' || *p == '\\') ? '.' : *p);
+    luaL_pushresult(&b);
+    l = lua_rawlen(L, -1);
+    p = lua_tostring(L, -1);
+    if (l > 5 && strcmp(p + l - 5, ".init") == 0) {
+        lua_pushlstring(L, p, l - 5);
+        lua_remove(L, -2);
+    } else if (strcmp(p, "init") == 0) fatal("cannot derive module name of 'init'");
+    return lua_tostring(L, -1);
+}
+
+static void writesize(size_t x, FILE *D) {
+    fwrite(&x, sizeof(x), 1, D);
+}
+
+/*
+** Write a bundle: signature, size of 'size_t', number of modules, the
+** index (name length, name, offset and size of the binary chunk of
+** each module) and then the chunks themselves.
+*/
+static void dumpbundle(lua_State *L, int names, int n, Buffer *chunks, FILE *D) {
+    size_t offset = sizeof(LUA_BUNDLESIGNATURE) - 1 + 1 + sizeof(size_t);
+    int i;
+    for (i = 0; i < n; i++)
+        offset += 3 * sizeof(size_t) + lua_rawlen(L, names + i);
+    fwrite(LUA_BUNDLESIGNATURE, sizeof(LUA_BUNDLESIGNATURE) - 1, 1, D);
+    fputc((int) sizeof(size_t), D);
+    writesize((size_t) n, D);
+    for (i = 0; i < n; i++) {
+        size_t l;
+        const char *name = lua_tolstring(L, names + i, &l);
+        writesize(l, D);
+        fwrite(name, 1, l, D);
+        writesize(offset, D);
+        writesize(chunks[i].n, D);
+        offset += chunks[i].n;
+    }
+    for (i = 0; i < n; i++)
+        fwrite(chunks[i].b, 1, chunks[i].n, D);
+}
+
+/* module names are at stack index 'names' on, followed by the functions */
+static void bundle(lua_State *L, int names, int n, FILE *D) {
+    Buffer *chunks;
+    int i;
+    lua_createtable(L, 0, n);  /* set of module names, to catch duplicates */
+    for (i = 0; i < n; i++) {
+        lua_pushvalue(L, names + i);
+        if (lua_rawget(L, -2) != LUA_TNIL)
+            fatal(lua_pushfstring(L, "duplicate module '%s'", lua_tostring(L, names + i)));
+        lua_pop(L, 1);
+        lua_pushvalue(L, names + i);
+        lua_pushboolean(L, 1);
+        lua_rawset(L, -3);
+    }
+    lua_pop(L, 1);
+    chunks = (Buffer *) lua_newuserdata(L, n * sizeof(Buffer));
+    memset(chunks, 0, n * sizeof(Buffer));
+    for (i = 0; i < n; i++) {
+        const Proto *f = getproto(L->ci->func + names + n + i);
+        lua_lock(L);
+        if (luaU_dump(L, f, bufwriter, &chunks[i], stripping) != 0)
+            fatal("not enough memory");
+        lua_unlock(L);
+    }
+    dumpbundle(L, names, n, chunks, D);
+    for (i = 0; i < n; i++)
+        free(chunks[i].b);
+    lua_pop(L, 1);
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Parallel compilation
+** =======================================================
+*/
+
+/*
+** Each worker thread has its own state, takes the next input file from
+** a shared queue and compiles it to a binary chunk (or an error
+** message). The main state then loads the chunks in input order, so the
+** output does not depend on the number of threads.
+*/
+
+typedef struct Job {
+    const char *filename;  /* NULL for standard input */
+    Buffer chunk;  /* binary chunk or error message */
+    int status;
+} Job;
+
+typedef struct Queue {
+    Job *jobs;
+    int n;
+    int next;  /* next job to be taken */
+#if defined(LUA_USE_PTHREADS)
+    pthread_mutex_t lock;
+#endif
+} Queue;
+
+static int takejob(Queue *q) {
+    int i;
+#if defined(LUA_USE_PTHREADS)
+    pthread_mutex_lock(&q->lock);
+#endif
+    i = (q->next < q->n) ? q->next++ : -1;
+#if defined(LUA_USE_PTHREADS)
+    pthread_mutex_unlock(&q->lock);
+#endif
+    return i;
+}
+
+static void joberror(Job *j, const char *msg) {
+    j->status = LUA_ERRERR;
+    j->chunk.n = 0;
+    if (bufwriter(NULL, msg, strlen(msg) + 1, &j->chunk) != 0)
+        j->chunk.n = 0;  /* no message; 'loadjobs' reports it */
+}
+
+static void compilejob(lua_State *L, Job *j) {
+    if (L == NULL)
+        joberror(j, "cannot create state: not enough memory");
+    else if (luaL_loadfilex(L, j->filename, loadmode) != LUA_OK)
+        joberror(j, lua_tostring(L, -1));
+    else {
+        lua_lock(L);
+        if (luaU_dump(L, getproto(L->top - 1), bufwriter, &j->chunk, 0) != 0)
+            joberror(j, "not enough memory");
+        lua_unlock(L);
+    }
+    if (L != NULL) lua_settop(L, 0);
+}
+
+static void *worker(void *ud) {
+    Queue *q = (Queue *) ud;
+    lua_State *L = luaL_newstate();
+    int i;
+    while ((i = takejob(q)) >= 0)
+        compilejob(L, &q->jobs[i]);
+    if (L != NULL) lua_close(L);
+    return NULL;
+}
+
+static int cores(void) {
+#if defined(LUA_USE_PTHREADS)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int) n : 1;
+#else
+    return 1;
+#endif
+}
+
+/* push the functions compiled from the 'n' files in 'argv' */
+static void loadfiles(lua_State *L, int n, char **argv) {
+    int nthreads = (njobs > 0) ? njobs : cores();
+    Queue q;
+    int i;
+    if (nthreads > n) nthreads = n;
+    if (nthreads <= 1) {  /* compile in this state */
+        for (i = 0; i < n; i++) {
+            const char *filename = IS("-") ? NULL : argv[i];
+            if (luaL_loadfilex(L, filename, loadmode) != LUA_OK)
+                fatal(lua_tostring(L, -1));
+        }
+        return;
+    }
+    q.jobs = (Job *) calloc(n, sizeof(Job));
+    if (q.jobs == NULL) fatal("not enough memory");
+    q.n = n;
+    q.next = 0;
+    for (i = 0; i < n; i++)
+        q.jobs[i].filename = IS("-") ? NULL : argv[i];
+#if defined(LUA_USE_PTHREADS)
+    {
+        pthread_t *threads = (pthread_t *) calloc(nthreads - 1, sizeof(pthread_t));
+        int started = 0;
+        pthread_mutex_init(&q.lock, NULL);
+        while (threads != NULL && started < nthreads - 1 &&
+               pthread_create(&threads[started], NULL, worker, &q) == 0)
+            started++;
+        worker(&q);  /* this thread works too */
+        for (i = 0; i < started; i++)
+            pthread_join(threads[i], NULL);
+        pthread_mutex_destroy(&q.lock);
+        free(threads);
+    }
+#else
+    worker(&q);
+#endif
+    for (i = 0; i < n; i++) {
+        Job *j = &q.jobs[i];
+        if (j->status != LUA_OK)
+            fatal((j->chunk.n > 0) ? j->chunk.b : "not enough memory");
+        if (luaL_loadbufferx(L, j->chunk.b, j->chunk.n, argv[i], "b") != LUA_OK)
+            fatal(lua_tostring(L, -1));
+        free(j->chunk.b);
+    }
+    free(q.jobs);
+}
+
+/* }====================================================== */
+
 static int pmain(lua_State *L) {
     int argc = (int) lua_tointeger(L, 1);
     char **argv = (char **) lua_touserdata(L, 2);
-    const Proto *f;
+    const Proto *f = NULL;
     int i;
-    if (!lua_checkstack(L, argc)) fatal("too many input files");
-    for (i = 0; i < argc; i++) {
-        const char *filename = IS("-") ? NULL : argv[i];
-        if (luaL_loadfile(L, filename) != LUA_OK) fatal(lua_tostring(L, -1));
+    if (!lua_checkstack(L, 2 * argc + 4))  /* names, functions and work space */
+        fatal("too many input files");
+    if (bundling) {  /* push module names, below the functions */
+        for (i = 0; i < argc; i++) {
+            const char *filename;
+            if (IS("-")) fatal("cannot bundle standard input");
+            modname(L, argv[i], &filename);
+            argv[i] = (char *) filename;
+        }
     }
-    f = combine(L, argc);
-    if (listing) luaU_print(f, listing > 1);
+    loadfiles(L, argc, argv);
+    if (bundling) {
+        if (listing) {
+            for (i = 0; i < argc; i++) luaU_print(toproto(L, i - argc), listing > 1);
+        }
+    } else f = combine(L, argc);
+    if (listing && !bundling) luaU_print(f, listing > 1);
     if (dumping) {
         FILE *D = (output == NULL) ? stdout : fopen(output, "wb");
         if (D == NULL) cannot("open");
         lua_lock(L);
-        luaU_dump(L, f, writer, D, stripping);
+        if (bundling)
+            bundle(L, 3, argc, D);
+        else if (imaging)
+            luaU_dumpimage(L, f, writer, D, stripping);
+        else
+            luaU_dump(L, f, writer, D, stripping);
         lua_unlock(L);
         if (ferror(D)) cannot("write");
         if (fclose(D)) cannot("close");
@@ -33,6 +33,9 @@ typedef struct {
     lua_State *L;
     ZIO *Z;
     const char *name;
+    lua_Shared *shared;  /* shared chunk being loaded (or NULL) */
+    int building;  /* true when loading 'shared' for the first time */
+    int nproto;  /* number of prototypes loaded so far */
 } LoadState;
 
 
@@ -109,8 +112,59 @@ static TString *LoadString(LoadState *S, Proto *p) {
 }
 
 
-static void LoadCode(LoadState *S, Proto *f) {
+/*
+** Allocate a block for a shared chunk, which lives outside any state.
+*/
+static void *SharedAlloc(LoadState *S, void *b, size_t osize, size_t nsize) {
+    lua_Shared *s = S->shared;
+    void *nb = (*s->frealloc)(s->ud, b, osize, nsize);
+    if (nb == NULL && nsize > 0)
+        luaD_throw(S->L, LUA_ERRMEM);
+    return nb;
+}
+
+
+/*
+** Return the arrays in the shared chunk for the prototype being loaded.
+** While building the chunk, add a new empty entry for it.
+*/
+static SharedProto *SharedSlot(LoadState *S, int idx) {
+    lua_Shared *s = S->shared;
+    if (S->building) {
+        if (idx >= s->sizeprotos) {
+            int n = 2 * s->sizeprotos + 4;
+            s->protos = cast(SharedProto *,
+                             SharedAlloc(S, s->protos, s->sizeprotos * sizeof(SharedProto),
+                                         n * sizeof(SharedProto)));
+            memset(s->protos + s->sizeprotos, 0,
+                   (n - s->sizeprotos) * sizeof(SharedProto));
+            s->sizeprotos = n;
+        }
+    } else if (idx >= s->nprotos)
+        error(S, "corrupted");
+    return &s->protos[idx];
+}
+
+
+static void LoadCode(LoadState *S, Proto *f, int idx) {
     int n = LoadInt(S);
+    if (S->shared != NULL) {
+        SharedProto *sp = SharedSlot(S, idx);
+        if (S->building) {
+            sp->code = cast(Instruction *,
+                            SharedAlloc(S, NULL, 0, n * sizeof(Instruction)));
+            sp->sizecode = n;
+            LoadVector(S, sp->code, n);
+        } else {
+            if (n != sp->sizecode)
+                error(S, "corrupted");
+            if (S->shared->image == NULL)  /* code is in the chunk? */
+                LoadBlock(S, NULL, n * sizeof(Instruction));  /* skip it */
+        }
+        f->code = sp->code;
+        f->sizecode = n;
+        return;
+    }
     f->code = luaM_newvector(S->L, n, Instruction);
     f->sizecode = n;
     LoadVector(S, f->code, n);
@@ -180,12 +234,33 @@ static void LoadUpvalues(LoadState *S, Proto *f) {
 }
 
 
-static void LoadDebug(LoadState *S, Proto *f) {
-    int i, n;
-    n = LoadInt(S);
+static void LoadLineInfo(LoadState *S, Proto *f, int idx) {
+    int n = LoadInt(S);
+    if (S->shared != NULL) {
+        SharedProto *sp = SharedSlot(S, idx);
+        if (S->building) {
+            sp->lineinfo = cast(int *, SharedAlloc(S, NULL, 0, n * sizeof(int)));
+            sp->sizelineinfo = n;
+            LoadVector(S, sp->lineinfo, n);
+        } else {
+            if (n != sp->sizelineinfo)
+                error(S, "corrupted");
+            if (S->shared->image == NULL)  /* line information is in the chunk? */
+                LoadBlock(S, NULL, n * sizeof(int));  /* skip it */
+        }
+        f->lineinfo = sp->lineinfo;
+        f->sizelineinfo = n;
+        return;
+    }
     f->lineinfo = luaM_newvector(S->L, n, int);
     f->sizelineinfo = n;
     LoadVector(S, f->lineinfo, n);
+}
+
+
+static void LoadDebug(LoadState *S, Proto *f, int idx) {
+    int i, n;
+    LoadLineInfo(S, f, idx);
     n = LoadInt(S);
     f->locvars = luaM_newvector(S->L, n, LocVar);
     f->sizelocvars = n;
@@ -203,6 +278,11 @@ static void LoadDebug(LoadState *S, Proto *f) {
 
 
 static void LoadFunction(LoadState *S, Proto *f, TString *psource) {
+    int idx = S->nproto++;
+    if (S->shared != NULL) {  /* 'f' will use arrays from the shared chunk */
+        f->shared = S->shared;
+        luai_atomicinc(f->shared->refs);
+    }
     f->source = LoadString(S, f);
     if (f->source == NULL)  /* no source in dump? */
         f->source = psource;  /* reuse parent's source */
@@ -211,11 +291,11 @@ static void LoadFunction(LoadState *S, Proto *f, TString *psource) {
     f->numparams = LoadByte(S);
     f->is_vararg = LoadByte(S);
     f->maxstacksize = LoadByte(S);
-    LoadCode(S, f);
+    LoadCode(S, f, idx);
     LoadConstants(S, f);
     LoadUpvalues(S, f);
     LoadProtos(S, f);
-    LoadDebug(S, f);
+    LoadDebug(S, f, idx);
 }
 
 
@@ -256,9 +336,88 @@ static void checkHeader(LoadState *S) {
 
 
 /*
-** load precompiled chunk
+** {======================================================
+** Bytecode images
+** =======================================================
+*/
+
+static l_noret badimage(lua_State *L, const char *name) {
+    if (*name == '@' || *name == '=')
+        name++;
+    luaO_pushfstring(L, "%s: bad bytecode image", name);
+    luaD_throw(L, LUA_ERRSYNTAX);
+}
+
+
+static size_t getsize(const char *p) {
+    size_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+
+/* check that an array of 'n' elements of size 'sz' at 'offset' fits */
+static int checkarray(size_t offset, int n, size_t sz, size_t size) {
+    return (n >= 0 && offset % sz == 0 && offset <= size &&
+            (size_t) n <= (size - offset) / sz);
+}
+
+
+/*
+** Read the header and directory of the image in 's', pointing the
+** shared chunk to the binary chunk and arrays inside it. The image is
+** not copied; it must stay valid until the chunk is released.
+*/
+void luaU_openimage(lua_State *L, lua_Shared *s, const char *name) {
+    const char *image = cast(const char *, s->image);
+    size_t size = s->sizeimage;
+    size_t nprotos, chunkoffset, chunksize, i;
+    const char *entry;
+    if (size < LUAI_IMAGEHEADER ||
+        memcmp(image, LUA_IMAGESIGNATURE, sizeof(LUA_IMAGESIGNATURE) - 1) != 0 ||
+        cast_byte(image[sizeof(LUA_IMAGESIGNATURE) - 1]) != LUAC_VERSION)
+        badimage(L, name);
+    nprotos = getsize(image + 8);
+    chunkoffset = getsize(image + 8 + sizeof(size_t));
+    chunksize = getsize(image + 8 + 2 * sizeof(size_t));
+    if (nprotos == 0 || nprotos > (size - LUAI_IMAGEHEADER) / LUAI_IMAGEENTRY ||
+        chunkoffset != LUAI_IMAGEHEADER + nprotos * LUAI_IMAGEENTRY ||
+        chunksize > size - chunkoffset || cast_int(nprotos) < 0)
+        badimage(L, name);
+    s->protos = cast(SharedProto *, (*s->frealloc)(s->ud, NULL, 0,
+                                                   nprotos * sizeof(SharedProto)));
+    if (s->protos == NULL)
+        luaD_throw(L, LUA_ERRMEM);
+    s->sizeprotos = cast_int(nprotos);
+    entry = image + LUAI_IMAGEHEADER;
+    for (i = 0; i < nprotos; i++, entry += LUAI_IMAGEENTRY) {
+        SharedProto *sp = &s->protos[i];
+        size_t codeoffset = getsize(entry);
+        size_t lineoffset = getsize(entry + sizeof(size_t));
+        memcpy(&sp->sizecode, entry + 2 * sizeof(size_t), sizeof(int));
+        memcpy(&sp->sizelineinfo, entry + 2 * sizeof(size_t) + sizeof(int),
+               sizeof(int));
+        if (!checkarray(codeoffset, sp->sizecode, sizeof(Instruction), size) ||
+            !checkarray(lineoffset, sp->sizelineinfo, sizeof(int), size))
+            badimage(L, name);
+        sp->code = cast(Instruction *, image + codeoffset);
+        sp->lineinfo = (sp->sizelineinfo == 0) ? NULL  /* stripped */
+                       : cast(int *, image + lineoffset);
+    }
+    s->chunk = cast(char *, image + chunkoffset);
+    s->size = chunksize;
+    s->nprotos = cast_int(nprotos);
+}
+
+/* }====================================================== */
+
+
+/*
+** load precompiled chunk; with 'shared', the chunk is the binary of that
+** shared chunk, and the first load builds its arrays
 */
-LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
+LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name,
+                      lua_Shared *shared) {
     LoadState S;
     LClosure *cl;
     if (*name == '@' || *name == '=')
@@ -269,6 +428,9 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
         S.name = name;
     S.L = L;
     S.Z = Z;
+    S.shared = shared;
+    S.building = (shared != NULL && shared->nprotos == 0);
+    S.nproto = 0;
     checkHeader(&S);
     cl = luaF_newLclosure(L, LoadByte(&S));
     setclLvalue(L, L->top, cl);
@@ -276,6 +438,8 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
     cl->p = luaF_newproto(L);
     luaC_objbarrier(L, cl, cl->p);
     LoadFunction(&S, cl->p, NULL);
+    if (S.building)
+        shared->nprotos = S.nproto;
     lua_assert(cl->nupvalues == cl->p->sizeupvalues);
     luai_verifycode(L, buff, cl->p);
     return cl;
@@ -15,18 +15,45 @@
 /* data to catch conversion errors */
 #define LUAC_DATA    "\x19\x93\r\n\x1a\n"
 
+/*
+** A bytecode image is a binary chunk laid out to be used in place, for
+** instance from a memory-mapped file:
+**   header: LUA_IMAGESIGNATURE, LUAC_VERSION, then 'size_t' fields
+**           'nprotos', 'chunkoffset' and 'chunksize';
+**   directory: for each prototype, in load order, the offsets ('size_t')
+**           of its code and line information and their sizes ('int');
+**   chunk: a binary chunk without code and line information;
+**   arrays: the code and line information of each prototype, starting
+**           at a LUAI_IMAGEALIGN boundary.
+** All offsets are relative to the start of the image.
+*/
+#define LUAI_IMAGEHEADER    (8 + 3 * sizeof(size_t))
+#define LUAI_IMAGEENTRY    (2 * sizeof(size_t) + 2 * sizeof(int))
+
+#if !defined(LUAI_IMAGEALIGN)
+#define LUAI_IMAGEALIGN    4096
+#endif
+
 #define LUAC_INT    0x5678
 #define LUAC_NUM    cast_num(370.5)
 
 #define MYINT(s)    (s[0]-'0')
 #define LUAC_VERSION    (MYINT(LUA_VERSION_MAJOR)*16+MYINT(LUA_VERSION_MINOR))
-#define LUAC_FORMAT    1    /* this is not the official format */
+#define LUAC_FORMAT    LUA_BYTECODE_FORMAT
 
 /* load one chunk; from lundump.c */
-LUAI_FUNC LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name);
+LUAI_FUNC LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name,
+                                lua_Shared *shared);
 
 /* dump one chunk; from ldump.c */
 LUAI_FUNC int luaU_dump(lua_State *L, const Proto *f, lua_Writer w,
                         void *data, int strip);
 
+/* dump one chunk as a bytecode image; from ldump.c */
+LUAI_FUNC int luaU_dumpimage(lua_State *L, const Proto *f, lua_Writer w,
+                             void *data, int strip);
+
+/* prepare shared chunk 's' to load from its image; from lundump.c */
+LUAI_FUNC void luaU_openimage(lua_State *L, lua_Shared *s, const char *name);
+
 #endif
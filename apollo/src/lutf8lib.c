@@ -12,6 +12,7 @@
 
 #include <assert.h>
 #include <limits.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -24,6 +25,154 @@
 
 #define iscont(p)    ((*(p) & 0xC0) == 0x80)
 
+#define uchar(c)    ((unsigned char)(c))
+
+
+/*
+** {======================================================
+** VECTOR KERNELS
+** =======================================================
+*/
+
+/*
+** With SSE2 and a GCC-compatible compiler (as in lstrlib.c), runs of
+** ASCII bytes are skipped and character starts counted 16 bytes at a
+** time; otherwise (or with LUA_NOVECTOR) plain loops do all the work.
+*/
+#if !defined(LUA_NOVECTOR) && defined(__SSE2__) && defined(__GNUC__)
+#define l_vector
+#include <emmintrin.h>
+#endif
+
+
+#if defined(l_vector)
+
+/* number of bytes that start a character (not 10xxxxxx) in 'v' */
+static int vstarts(__m128i v) {
+    /* continuation bytes are the signed values in [-128, -65] */
+    __m128i start = _mm_cmpgt_epi8(v, _mm_set1_epi8(-65));
+    return __builtin_popcount((unsigned) _mm_movemask_epi8(start));
+}
+
+
+/*
+** Return the length of the prefix of 's' made of whole 16-byte blocks
+** of ASCII bytes (at most 'l').
+*/
+static size_t asciiprefix(const char *s, size_t l) {
+    size_t i;
+    for (i = 0; i + 16 <= l; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        if (_mm_movemask_epi8(v) != 0)  /* some byte >= 0x80? */
+            break;
+    }
+    return i;
+}
+
+
+/*
+** Add to '*n' the number of character starts in the whole 16-byte
+** blocks of 's' (at most 'l' bytes); return how many bytes were done.
+*/
+static size_t vcountstarts(const char *s, size_t l, size_t *n) {
+    size_t i;
+    for (i = 0; i + 16 <= l; i += 16)
+        *n += vstarts(_mm_loadu_si128((const __m128i *) (s + i)));
+    return i;
+}
+
+
+/*
+** Skip forward from 's' over whole 16-byte blocks (at most 'l' bytes)
+** while they hold fewer than '*n' character starts, discounting those
+** from '*n'; return how many bytes were skipped.
+*/
+static size_t vforward(const char *s, size_t l, lua_Integer *n) {
+    size_t i;
+    for (i = 0; i + 16 <= l; i += 16) {
+        int c = vstarts(_mm_loadu_si128((const __m128i *) (s + i)));
+        if (c >= *n)
+            break;
+        *n -= c;
+    }
+    return i;
+}
+
+
+/*
+** Skip backward from position 'p' over whole 16-byte blocks (never
+** including the first byte of 's') while they hold fewer than '*n'
+** character starts, discounting those from '*n'; return how many bytes
+** were skipped.
+*/
+static size_t vbackward(const char *s, size_t p, lua_Integer *n) {
+    size_t i;
+    for (i = 0; p - i >= 17; i += 16) {
+        int c = vstarts(_mm_loadu_si128((const __m128i *) (s + p - i - 16)));
+        if (c >= *n)
+            break;
+        *n -= c;
+    }
+    return i;
+}
+
+#else
+
+#define asciiprefix(s, l)    0
+#define vcountstarts(s, l, n)    0
+#define vforward(s, l, n)    0
+#define vbackward(s, p, n)    0
+
+#endif
+
+
+/* number of bytes that start a character in the 'l' bytes at 's' */
+static size_t countstarts(const char *s, size_t l) {
+    size_t n = 0;
+    size_t i = vcountstarts(s, l, &n);
+    for (; i < l; i++)
+        n += !iscont(s + i);
+    return n;
+}
+
+
+/*
+** Move forward from position 'p' over '*n' characters, taking the end
+** of the string as the start of a last one; return the new position
+** and leave in '*n' how many characters were missing.
+*/
+static size_t forward(const char *s, size_t len, size_t p, lua_Integer *n) {
+    size_t q;
+    if (*n == 0 || p >= len)
+        return p;
+    q = p + 1;
+    for (q += vforward(s + q, len - q, n); q < len; q++) {
+        if (!iscont(s + q) && --*n == 0)
+            return q;
+    }
+    (*n)--;  /* end of string */
+    return len;
+}
+
+
+/*
+** Move backward from position 'p' over '*n' characters, taking the
+** first byte as the start of one; return the new position and leave
+** in '*n' how many characters were missing.
+*/
+static size_t backward(const char *s, size_t p, lua_Integer *n) {
+    p -= vbackward(s, p, n);
+    while (*n > 0 && p > 0) {
+        do {  /* find beginning of previous character */
+            p--;
+        } while (p > 0 && iscont(s + p));
+        (*n)--;
+    }
+    return p;
+}
+
+/* }====================================================== */
+
 
 /* from strlib */
 /* translate a relative string position: negative means back from end */
@@ -63,13 +212,29 @@ static const char *utf8_decode(const char *o, int *val) {
 }
 
 
+/*
+** Skip the sequence at 'o' like 'utf8_decode', checking the common
+** two- and three-byte sequences (which cannot be overlong or too large
+** with these first bytes) without decoding them.
+*/
+static const char *utf8_skip(const char *o) {
+    unsigned int c = uchar(o[0]);
+    if (0xE1 <= c && c <= 0xEF && iscont(o + 1) && iscont(o + 2))
+        return o + 3;
+    else if (0xC2 <= c && c <= 0xDF && iscont(o + 1))
+        return o + 2;
+    else
+        return utf8_decode(o, NULL);
+}
+
+
 /*
 ** utf8len(s [, i [, j]]) --> number of characters that start in the
 ** range [i,j], or nil + current position if 's' is not well formed in
 ** that interval
 */
 static int utflen(lua_State *L) {
-    int n = 0;
+    lua_Integer n = 0;
     size_t len;
     const char *s = luaL_checklstring(L, 1, &len);
     lua_Integer posi = u_posrelat(luaL_optinteger(L, 2, 1), len);
@@ -79,7 +244,18 @@ static int utflen(lua_State *L) {
     luaL_argcheck(L, --posj < (lua_Integer) len, 3,
                   "final position out of string");
     while (posi <= posj) {
-        const char *s1 = utf8_decode(s + posi, NULL);
+        const char *s1;
+        if (uchar(s[posi]) < 0x80) {  /* ASCII run? */
+            lua_Integer p0 = posi;
+            lua_Integer e = (posj - posi >= 16) ? posi + 16 : posj + 1;
+            while (posi < e && uchar(s[posi]) < 0x80)
+                posi++;
+            if (posi - p0 == 16)  /* long run? skip the rest in blocks */
+                posi += asciiprefix(s + posi, (size_t) (posj - posi + 1));
+            n += posi - p0;
+            continue;
+        }
+        s1 = utf8_skip(s + posi);
         if (s1 == NULL) {  /* conversion error? */
             lua_pushnil(L);  /* return nil ... */
             lua_pushinteger(L, posi + 1);  /* ... and current position */
@@ -153,6 +329,123 @@ static int utfchar(lua_State *L) {
 }
 
 
+/*
+** {======================================================
+** CHARACTER INDEX
+** =======================================================
+*/
+
+/*
+** 'utf8.offset' over a long string keeps, for the strings it walks more
+** than once, an index with the position of every UTF8_INDEXSTEP-th
+** character. With it, any offset is a binary search plus a walk over
+** less than UTF8_INDEXSTEP characters. Indices live in a table keyed by
+** the strings, kept in the uservalue of the first upvalue of 'offset';
+** the table is replaced when it has UTF8_CACHESIZE entries, which
+** bounds how many strings it keeps alive.
+*/
+
+/* strings shorter than this are never indexed */
+#if !defined(UTF8_MININDEX)
+#define UTF8_MININDEX    4096
+#endif
+
+/* characters between indexed positions */
+#define UTF8_INDEXSTEP    128
+
+/* maximum number of strings in the cache */
+#if !defined(UTF8_CACHESIZE)
+#define UTF8_CACHESIZE    16
+#endif
+
+
+typedef struct UIndex {
+    size_t nchars;  /* number of characters (bytes that start one) */
+    size_t n;  /* number of entries in 'pos' */
+    size_t pos[1];  /* position of characters 0, STEP, 2 * STEP, ... */
+} UIndex;
+
+
+static UIndex *buildindex(lua_State *L, const char *s, size_t len) {
+    size_t nchars = countstarts(s, len);
+    size_t n = nchars / UTF8_INDEXSTEP + 1;
+    UIndex *ix = (UIndex *) lua_newuserdata(L,
+                              offsetof(UIndex, pos) + n * sizeof(size_t));
+    size_t k;
+    ix->nchars = nchars;
+    ix->n = n;
+    ix->pos[0] = 0;
+    for (k = 1; k < n; k++) {
+        lua_Integer step = UTF8_INDEXSTEP;
+        ix->pos[k] = forward(s, len, ix->pos[k - 1], &step);
+    }
+    return ix;
+}
+
+
+/*
+** Return the index of string 'arg', or NULL the first time the string
+** is seen (an index only pays off for strings walked again).
+*/
+static UIndex *getindex(lua_State *L, int arg, const char *s, size_t len) {
+    int *count = (int *) lua_touserdata(L, lua_upvalueindex(1));
+    UIndex *ix = NULL;
+    lua_getuservalue(L, lua_upvalueindex(1));
+    lua_pushvalue(L, arg);
+    if (lua_rawget(L, -2) != LUA_TNIL)  /* seen before? */
+        ix = (UIndex *) lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    if (ix == NULL) {
+        if (*count >= UTF8_CACHESIZE) {  /* cache is full? */
+            lua_pop(L, 1);
+            lua_newtable(L);  /* start a new one */
+            lua_pushvalue(L, -1);
+            lua_setuservalue(L, lua_upvalueindex(1));
+            *count = 0;
+        }
+        lua_pushvalue(L, arg);
+        lua_pushvalue(L, arg);
+        if (lua_rawget(L, -3) == LUA_TNIL) {  /* first time? */
+            lua_pop(L, 1);
+            lua_pushboolean(L, 1);  /* just mark it */
+            (*count)++;
+        } else {
+            lua_pop(L, 1);
+            ix = buildindex(L, s, len);
+        }
+        lua_rawset(L, -3);
+    }
+    lua_pop(L, 1);  /* cache table */
+    return ix;
+}
+
+
+/* number of characters before position 'p', which starts one */
+static size_t charnumber(const UIndex *ix, const char *s, size_t p) {
+    size_t lo = 0, hi = ix->n;  /* last 'pos' <= p is in [lo, hi) */
+    while (hi - lo > 1) {
+        size_t m = lo + (hi - lo) / 2;
+        if (ix->pos[m] <= p)
+            lo = m;
+        else
+            hi = m;
+    }
+    return lo * UTF8_INDEXSTEP + countstarts(s + ix->pos[lo], p - ix->pos[lo]);
+}
+
+
+/* position of character 'c' ('nchars' is the end of the string) */
+static size_t charpos(const UIndex *ix, const char *s, size_t len,
+                      size_t c) {
+    lua_Integer rest = (lua_Integer) (c % UTF8_INDEXSTEP);
+    if (c >= ix->nchars)
+        return len;
+    return forward(s, len, ix->pos[c / UTF8_INDEXSTEP], &rest);
+}
+
+/* }====================================================== */
+
+
 /*
 ** offset(s, n, [i])  -> index where n-th character counting from
 **   position 'i' starts; 0 means character at 'i'.
@@ -169,23 +462,28 @@ static int byteoffset(lua_State *L) {
         /* find beginning of current byte sequence */
         while (posi > 0 && iscont(s + posi)) posi--;
     } else {
+        UIndex *ix = NULL;
         if (iscont(s + posi))
             return luaL_error(L, "initial position is a continuation byte");
+        if (len >= UTF8_MININDEX && !iscont(s) &&
+            (n > UTF8_INDEXSTEP || n < -UTF8_INDEXSTEP))  /* long walk? */
+            ix = getindex(L, 1, s, len);
+        if (ix != NULL) {
+            size_t c = charnumber(ix, s, (size_t) posi);
+            size_t d = (n > 0) ? (size_t) (n - 1) : 0u - (size_t) n;
+            if (n > 0 ? d > ix->nchars - c : d > c)  /* out of string? */
+                lua_pushnil(L);
+            else
+                lua_pushinteger(L, (lua_Integer) charpos(ix, s, len,
+                                                   n > 0 ? c + d : c - d) + 1);
+            return 1;
+        }
         if (n < 0) {
-            while (n < 0 && posi > 0) {  /* move back */
-                do {  /* find beginning of previous character */
-                    posi--;
-                } while (posi > 0 && iscont(s + posi));
-                n++;
-            }
+            n = -n;
+            posi = (lua_Integer) backward(s, (size_t) posi, &n);
         } else {
             n--;  /* do not move for 1st character */
-            while (n > 0 && posi < (lua_Integer) len) {
-                do {  /* find beginning of next character */
-                    posi++;
-                } while (iscont(s + posi));  /* (cannot pass final '\0') */
-                n--;
-            }
+            posi = (lua_Integer) forward(s, len, (size_t) posi, &n);
         }
     }
     if (n == 0)  /* did it find given character? */
@@ -246,7 +544,13 @@ static const luaL_Reg funcs[] = {
 
 
 LUAMOD_API int luaopen_utf8(lua_State *L) {
-    luaL_newlib(L, funcs);
+    int *count;
+    luaL_newlibtable(L, funcs);
+    count = (int *) lua_newuserdata(L, sizeof(int));  /* index cache */
+    *count = 0;
+    lua_newtable(L);
+    lua_setuservalue(L, -2);
+    luaL_setfuncs(L, funcs, 1);
     lua_pushlstring(L, UTF8PATT, sizeof(UTF8PATT) / sizeof(char) - 1);
     lua_setfield(L, -2, "charpattern");
     return 1;
@@ -64,6 +64,32 @@
 #endif
 
 
+/*
+** Longest slice that is converted to a number. Slices are not followed
+** by a '\0', so their bytes must be copied to a buffer for the
+** conversion; longer slices are not taken as numerals.
+*/
+#define MAXNUMSLICE    200
+
+
+/*
+** Try to convert string 'obj' to a number, storing it in 'result'.
+*/
+static int l_strton(const TValue *obj, TValue *result) {
+    TString *ts = tsvalue(obj);
+    size_t l = tsslen(ts);
+    if (isslice(ts)) {
+        char buff[MAXNUMSLICE + 1];
+        if (l > MAXNUMSLICE)
+            return 0;
+        memcpy(buff, getlngstr(ts), l * sizeof(char));
+        buff[l] = '\0';
+        return (luaO_str2num(buff, result) == l + 1);
+    }
+    return (luaO_str2num(getstr(ts), result) == l + 1);
+}
+
+
 /*
 ** Try to convert a value to a float. The float case is already handled
 ** by the macro 'tonumber'.
@@ -73,8 +99,7 @@ int luaV_tonumber_(const TValue *obj, lua_Number *n) {
     if (ttisinteger(obj)) {
         *n = cast_num(ivalue(obj));
         return 1;
-    } else if (cvt2num(obj) &&  /* string convertible to number? */
-               luaO_str2num(svalue(obj), &v) == vslen(obj) + 1) {
+    } else if (cvt2num(obj) && l_strton(obj, &v)) {  /* convertible string? */
         *n = nvalue(&v);  /* convert result of 'luaO_str2num' to a float */
         return 1;
     } else
@@ -103,8 +128,7 @@ int luaV_tointeger(const TValue *obj, lua_Integer *p, int mode) {
     } else if (ttisinteger(obj)) {
         *p = ivalue(obj);
         return 1;
-    } else if (cvt2num(obj) &&
-               luaO_str2num(svalue(obj), &v) == vslen(obj) + 1) {
+    } else if (cvt2num(obj) && l_strton(obj, &v)) {
         obj = &v;
         goto again;  /* convert result from 'luaO_str2num' to an integer */
     }
@@ -200,6 +224,8 @@ void luaV_finishset(lua_State *L, const TValue *t, TValue *key,
         const TValue *tm;  /* '__newindex' metamethod */
         if (slot != NULL) {  /* is 't' a table? */
             Table *h = hvalue(t);  /* save 't' table */
+            if (isfrozen(h))
+                luaG_frozenerror(L, t);
             lua_assert(ttisnil(slot));  /* old value must be nil */
             tm = fasttm(L, h->metatable, TM_NEWINDEX);  /* get metamethod */
             if (tm == NULL) {  /* no metamethod? */
@@ -235,13 +261,17 @@ void luaV_finishset(lua_State *L, const TValue *t, TValue *key,
 ** -larger than zero if 'ls' is smaller-equal-larger than 'rs'.
 ** The code is a little tricky because it allows '\0' in the strings
 ** and it uses 'strcoll' (to respect locales) for each segments
-** of the strings.
+** of the strings. (So, slices need their own '\0'-terminated copies.)
 */
-static int l_strcmp(const TString *ls, const TString *rs) {
-    const char *l = getstr(ls);
-    size_t ll = tsslen(ls);
-    const char *r = getstr(rs);
-    size_t lr = tsslen(rs);
+static int l_strcmp(lua_State *L, TString *ls, TString *rs) {
+    const char *l, *r;
+    size_t ll, lr;
+    if (isslice(ls)) luaS_unslice(L, ls);
+    if (isslice(rs)) luaS_unslice(L, rs);
+    l = getstr(ls);
+    ll = tsslen(ls);
+    r = getstr(rs);
+    lr = tsslen(rs);
     for (;;) {  /* for each segment */
         int temp = strcoll(l, r);
         if (temp != 0)  /* not equal? */
@@ -359,7 +389,7 @@ int luaV_lessthan(lua_State *L, const TValue *l, const TValue *r) {
     if (ttisnumber(l) && ttisnumber(r))  /* both operands are numbers? */
         return LTnum(l, r);
     else if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-        return l_strcmp(tsvalue(l), tsvalue(r)) < 0;
+        return l_strcmp(L, tsvalue(l), tsvalue(r)) < 0;
     else if ((res = luaT_callorderTM(L, l, r, TM_LT)) < 0)  /* no metamethod? */
         luaG_ordererror(L, l, r);  /* error */
     return res;
@@ -379,7 +409,7 @@ int luaV_lessequal(lua_State *L, const TValue *l, const TValue *r) {
     if (ttisnumber(l) && ttisnumber(r))  /* both operands are numbers? */
         return LEnum(l, r);
     else if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-        return l_strcmp(tsvalue(l), tsvalue(r)) <= 0;
+        return l_strcmp(L, tsvalue(l), tsvalue(r)) <= 0;
     else if ((res = luaT_callorderTM(L, l, r, TM_LE)) >= 0)  /* try 'le' */
         return res;
     else {  /* try 'lt': */
@@ -1148,6 +1178,8 @@ void luaV_execute(lua_State *L) {
                 int nresults = GETARG_C(i) - 1;
                 if (b != 0) L->top = ra + b;  /* else previous instruction set top */
                 if (luaD_precall(L, ra, nresults)) {  /* C function? */
+                    if (L->status == LUA_YIELD)  /* it yielded? */
+                        return;  /* back to 'lua_resume' */
                     if (nresults >= 0)
                         L->top = ci->top;  /* adjust results */
                     Protect((void) 0);  /* update 'base' */
@@ -1162,6 +1194,8 @@ void luaV_execute(lua_State *L) {
                 if (b != 0) L->top = ra + b;  /* else previous instruction set top */
                 lua_assert(GETARG_C(i) - 1 == LUA_MULTRET);
                 if (luaD_precall(L, ra, LUA_MULTRET)) {  /* C function? */
+                    if (L->status == LUA_YIELD)  /* it yielded? */
+                        return;  /* back to 'lua_resume' */
                     Protect((void) 0);  /* update 'base' */
                 } else {
                     /* tail call: put called frame (n) in place of caller one (o) */
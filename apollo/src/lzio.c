@@ -57,10 +57,12 @@ size_t luaZ_read(ZIO *z, void *b, size_t n) {
             }
         }
         m = (n <= z->n) ? n : z->n;  /* min. between n and z->n */
-        memcpy(b, z->p, m);
+        if (b != NULL) {
+            memcpy(b, z->p, m);
+            b = (char *) b + m;
+        }
         z->n -= m;
         z->p += m;
-        b = (char *) b + m;
         n -= m;
     }
     return 0;